@@ -200,4 +200,20 @@ static __inline__ void atomic_dec(atomic_t *v)
 
 #endif
 
+/*! \brief
+ * membar_full - full memory barrier
+ *
+ * Orders the loads and stores before it against the ones after it, e.g.
+ * before handing a buffer to another process or to the kernel through a
+ * status word.
+ */
+#if defined(__CPU_x86_64)
+#define membar_full() __asm__ __volatile__ ("mfence" : : : "memory")
+#elif defined(__CPU_i386)
+#define membar_full() \
+	__asm__ __volatile__ ("lock ; addl $0,0(%%esp)" : : : "memory")
+#else
+#define membar_full() __sync_synchronize()
+#endif
+
 #endif
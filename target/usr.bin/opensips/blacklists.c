@@ -695,6 +695,17 @@ static inline int check_against_rule_list(struct ip_addr *ip, str *text,
 
 
 
+int blacklists_in_use(void)
+{
+	unsigned int bl_marker;
+
+	if (get_bl_marker(&bl_marker) != 0)
+		return 0;
+
+	return used_heads && bl_marker;
+}
+
+
 int check_against_blacklist(struct ip_addr *ip, str *text,
 			unsigned short port, unsigned short proto)
 {
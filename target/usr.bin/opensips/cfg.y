@@ -289,6 +289,7 @@ extern char *finame;
 %token XLOG
 %token XLOG_BUF_SIZE
 %token XLOG_FORCE_COLOR
+%token XLOG_ASYNC_BUF_SIZE
 %token RAISE_EVENT
 %token SUBSCRIBE_EVENT
 %token CONSTRUCT_URI
@@ -871,7 +872,9 @@ assign_stm: DEBUG EQUAL snumber {
 		| XLOG_BUF_SIZE EQUAL NUMBER { xlog_buf_size = $3; }
 		| XLOG_FORCE_COLOR EQUAL NUMBER { xlog_force_color = $3; }
 		| XLOG_BUF_SIZE EQUAL error { yyerror("number expected"); }
+		| XLOG_ASYNC_BUF_SIZE EQUAL NUMBER { xlog_async_buf_size = $3; }
 		| XLOG_FORCE_COLOR EQUAL error { yyerror("boolean value expected"); }
+		| XLOG_ASYNC_BUF_SIZE EQUAL error { yyerror("number expected"); }
 		| LISTEN EQUAL listen_def {
 							if (add_listener($3, 0)!=0){
 								LM_CRIT("cfg. parser: failed"
@@ -0,0 +1,499 @@
+/*
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "db_bulkq.h"
+#include "db_insertq.h"
+#include "../dprint.h"
+#include "../mem/mem.h"
+#include "../mem/shm_mem.h"
+
+/* A queued row is a record of the ring: its length (unsigned int) followed
+ * by a header (number of values, tag and queuing time), by the table name
+ * (length + chars) and by the values - type and null flag (one byte each)
+ * and the data, if not null. A record may wrap around the end of the ring.
+ * Without the length, the same record is what db_bulkq_pop_raw() returns. */
+
+struct bq_hdr {
+	int n;
+	int tag;
+	utime_t queued;
+};
+
+struct bq_scratch {
+	char *s;
+	unsigned int size;
+};
+
+/* per process buffers for serializing / unserializing the rows */
+static struct bq_scratch push_buf = {NULL, 0};
+static struct bq_scratch pop_buf = {NULL, 0};
+
+
+db_bulkq_t *db_bulkq_new(unsigned int size, int col_no, int drop_oldest)
+{
+	db_bulkq_t *q;
+
+	q = shm_malloc(sizeof(db_bulkq_t) + size);
+	if (q == NULL) {
+		LM_ERR("no more shm memory for a %u bytes queue\n", size);
+		return NULL;
+	}
+	memset(q, 0, sizeof(db_bulkq_t));
+
+	if (lock_init(&q->lock) == 0) {
+		LM_ERR("failed to init lock\n");
+		shm_free(q);
+		return NULL;
+	}
+
+	q->size = size;
+	q->col_no = col_no;
+	q->drop_oldest = drop_oldest;
+	q->buf = (char *)(q + 1);
+
+	return q;
+}
+
+
+void db_bulkq_destroy(db_bulkq_t *q)
+{
+	if (q == NULL)
+		return;
+
+	if (q->used)
+		LM_WARN("%u bytes of queued rows lost at shutdown\n", q->used);
+
+	lock_destroy(&q->lock);
+	shm_free(q);
+}
+
+
+static inline int bq_scratch_grow(struct bq_scratch *b, unsigned int len)
+{
+	char *p;
+
+	if (len <= b->size)
+		return 0;
+
+	len = (len + 1023) & ~1023;
+	p = pkg_realloc(b->s, len);
+	if (p == NULL) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+
+	b->s = p;
+	b->size = len;
+	return 0;
+}
+
+
+static inline void bq_write(db_bulkq_t *q, unsigned int pos,
+		const void *p, unsigned int len)
+{
+	unsigned int n = q->size - pos;
+
+	if (len <= n) {
+		memcpy(q->buf + pos, p, len);
+	} else {
+		memcpy(q->buf + pos, p, n);
+		memcpy(q->buf, (const char *)p + n, len - n);
+	}
+}
+
+
+static inline void bq_read(db_bulkq_t *q, unsigned int pos,
+		void *p, unsigned int len)
+{
+	unsigned int n = q->size - pos;
+
+	if (len <= n) {
+		memcpy(p, q->buf + pos, len);
+	} else {
+		memcpy(p, q->buf + pos, n);
+		memcpy((char *)p + n, q->buf, len - n);
+	}
+}
+
+
+static unsigned int bq_row_size(const str *table, const db_val_t *row,
+		int n)
+{
+	unsigned int len;
+	int i;
+
+	len = sizeof(struct bq_hdr) + sizeof(int) + table->len;
+
+	for (i = 0; i < n; i++) {
+		len += 2;
+		if (VAL_NULL(row + i))
+			continue;
+
+		switch (VAL_TYPE(row + i)) {
+			case DB_INT:
+			case DB_BITMAP:
+				len += sizeof(int);
+				break;
+			case DB_BIGINT:
+				len += sizeof(long long);
+				break;
+			case DB_DOUBLE:
+				len += sizeof(double);
+				break;
+			case DB_DATETIME:
+				len += sizeof(time_t);
+				break;
+			case DB_STRING:
+				len += sizeof(int) + strlen(VAL_STRING(row + i)) + 1;
+				break;
+			case DB_STR:
+			case DB_BLOB:
+				len += sizeof(int) + VAL_STR(row + i).len;
+				break;
+		}
+	}
+
+	return len;
+}
+
+
+#define bq_put(_p, _v, _l) \
+	do { \
+		memcpy(_p, _v, _l); \
+		(_p) += (_l); \
+	} while (0)
+
+#define bq_get(_p, _v, _l) \
+	do { \
+		memcpy(_v, _p, _l); \
+		(_p) += (_l); \
+	} while (0)
+
+/* the records may come from outside the queue (e.g. a spool file), so
+ * the unpacking checks each field against the end of the record */
+#define bq_need(_p, _end, _l) \
+	do { \
+		if ((_l) < 0 || (_end) - (_p) < (_l)) \
+			goto error; \
+	} while (0)
+
+#define bq_get_chk(_p, _end, _v, _l) \
+	do { \
+		bq_need(_p, _end, (int)(_l)); \
+		bq_get(_p, _v, _l); \
+	} while (0)
+
+static void bq_row_pack(char *p, const str *table, const db_val_t *row, int n,
+		int tag)
+{
+	struct bq_hdr hdr;
+	struct timeval tv;
+	int i, l;
+
+	gettimeofday(&tv, NULL);
+	hdr.n = n;
+	hdr.tag = tag;
+	hdr.queued = (utime_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	bq_put(p, &hdr, sizeof(struct bq_hdr));
+
+	bq_put(p, &table->len, sizeof(int));
+	bq_put(p, table->s, table->len);
+
+	for (i = 0; i < n; i++) {
+		*(p++) = (char)VAL_TYPE(row + i);
+		*(p++) = VAL_NULL(row + i) ? 1 : 0;
+		if (VAL_NULL(row + i))
+			continue;
+
+		switch (VAL_TYPE(row + i)) {
+			case DB_INT:
+				bq_put(p, &VAL_INT(row + i), sizeof(int));
+				break;
+			case DB_BITMAP:
+				bq_put(p, &VAL_BITMAP(row + i), sizeof(int));
+				break;
+			case DB_BIGINT:
+				bq_put(p, &VAL_BIGINT(row + i), sizeof(long long));
+				break;
+			case DB_DOUBLE:
+				bq_put(p, &VAL_DOUBLE(row + i), sizeof(double));
+				break;
+			case DB_DATETIME:
+				bq_put(p, &VAL_TIME(row + i), sizeof(time_t));
+				break;
+			case DB_STRING:
+				l = strlen(VAL_STRING(row + i)) + 1;
+				bq_put(p, &l, sizeof(int));
+				bq_put(p, VAL_STRING(row + i), l);
+				break;
+			case DB_STR:
+			case DB_BLOB:
+				bq_put(p, &VAL_STR(row + i).len, sizeof(int));
+				bq_put(p, VAL_STR(row + i).s, VAL_STR(row + i).len);
+				break;
+		}
+	}
+}
+
+
+int db_bulkq_unpack(char *p, unsigned int len, str *table, db_val_t *row,
+		int max, int *n, int *tag, utime_t *queued)
+{
+	struct bq_hdr hdr;
+	char *end = p + len;
+	int i, l;
+
+	bq_get_chk(p, end, &hdr, sizeof(struct bq_hdr));
+	if (hdr.n < 0 || hdr.n > max)
+		goto error;
+	*n = hdr.n;
+	if (tag)
+		*tag = hdr.tag;
+	if (queued)
+		*queued = hdr.queued;
+
+	bq_get_chk(p, end, &table->len, sizeof(int));
+	bq_need(p, end, table->len);
+	table->s = p;
+	p += table->len;
+
+	for (i = 0; i < hdr.n; i++) {
+		bq_need(p, end, 2);
+
+		memset(row + i, 0, sizeof(db_val_t));
+		VAL_TYPE(row + i) = (db_type_t)*(p++);
+		VAL_NULL(row + i) = *(p++);
+		if (VAL_NULL(row + i))
+			continue;
+
+		switch (VAL_TYPE(row + i)) {
+			case DB_INT:
+				bq_get_chk(p, end, &VAL_INT(row + i), sizeof(int));
+				break;
+			case DB_BITMAP:
+				bq_get_chk(p, end, &VAL_BITMAP(row + i), sizeof(int));
+				break;
+			case DB_BIGINT:
+				bq_get_chk(p, end, &VAL_BIGINT(row + i), sizeof(long long));
+				break;
+			case DB_DOUBLE:
+				bq_get_chk(p, end, &VAL_DOUBLE(row + i), sizeof(double));
+				break;
+			case DB_DATETIME:
+				bq_get_chk(p, end, &VAL_TIME(row + i), sizeof(time_t));
+				break;
+			case DB_STRING:
+				bq_get_chk(p, end, &l, sizeof(int));
+				/* packed with its terminating 0 */
+				bq_need(p, end, l);
+				if (l == 0 || p[l - 1] != '\0')
+					goto error;
+				VAL_STRING(row + i) = p;
+				p += l;
+				break;
+			case DB_STR:
+			case DB_BLOB:
+				bq_get_chk(p, end, &l, sizeof(int));
+				bq_need(p, end, l);
+				VAL_STR(row + i).s = p;
+				VAL_STR(row + i).len = l;
+				p += l;
+				break;
+			default:
+				goto error;
+		}
+	}
+
+	if (p != end)
+		goto error;
+
+	return 0;
+error:
+	LM_ERR("corrupted bulk queue record\n");
+	return -1;
+}
+
+
+int db_bulkq_push_row(db_bulkq_t *q, const str *table, const db_val_t *row,
+		int n, int tag)
+{
+	unsigned int len, need, rlen;
+
+	len = bq_row_size(table, row, n);
+	need = sizeof(unsigned int) + len;
+
+	if (need > q->size) {
+		LM_ERR("row of %u bytes does not fit in the queue\n", len);
+		lock_get(&q->lock);
+		q->dropped++;
+		lock_release(&q->lock);
+		return 1;
+	}
+
+	/* serialize outside the lock */
+	if (bq_scratch_grow(&push_buf, len) < 0)
+		return -1;
+	bq_row_pack(push_buf.s, table, row, n, tag);
+
+	lock_get(&q->lock);
+
+	if (q->size - q->used < need) {
+		if (!q->drop_oldest) {
+			q->dropped++;
+			lock_release(&q->lock);
+			return 1;
+		}
+
+		/* make room for the new row */
+		while (q->size - q->used < need) {
+			bq_read(q, q->tail, &rlen, sizeof(unsigned int));
+			rlen += sizeof(unsigned int);
+			q->tail = (q->tail + rlen) % q->size;
+			q->used -= rlen;
+			q->rows--;
+			q->dropped++;
+		}
+	}
+
+	bq_write(q, q->head, &len, sizeof(unsigned int));
+	bq_write(q, (q->head + sizeof(unsigned int)) % q->size, push_buf.s, len);
+	q->head = (q->head + need) % q->size;
+	q->used += need;
+	q->rows++;
+	q->queued++;
+
+	lock_release(&q->lock);
+	return 0;
+}
+
+
+int db_bulkq_push(db_bulkq_t *q, const str *table, const db_val_t *row)
+{
+	return db_bulkq_push_row(q, table, row, q->col_no, 0);
+}
+
+
+int db_bulkq_pop_raw(db_bulkq_t *q, char **rec, unsigned int *rec_len)
+{
+	unsigned int len;
+	int ret;
+
+	lock_get(&q->lock);
+
+	if (q->used == 0) {
+		lock_release(&q->lock);
+		return 0;
+	}
+
+	bq_read(q, q->tail, &len, sizeof(unsigned int));
+
+	ret = bq_scratch_grow(&pop_buf, len);
+	if (ret == 0)
+		bq_read(q, (q->tail + sizeof(unsigned int)) % q->size, pop_buf.s, len);
+	else
+		q->dropped++;
+
+	q->tail = (q->tail + sizeof(unsigned int) + len) % q->size;
+	q->used -= sizeof(unsigned int) + len;
+	q->rows--;
+
+	lock_release(&q->lock);
+
+	if (ret < 0)
+		return -1;
+
+	*rec = pop_buf.s;
+	*rec_len = len;
+	return 1;
+}
+
+
+int db_bulkq_pop(db_bulkq_t *q, str *table, db_val_t *row)
+{
+	unsigned int len;
+	char *rec;
+	int ret, n;
+
+	ret = db_bulkq_pop_raw(q, &rec, &len);
+	if (ret <= 0)
+		return ret;
+
+	if (db_bulkq_unpack(rec, len, table, row, q->col_no, &n, NULL, NULL) < 0)
+		return -1;
+
+	return 1;
+}
+
+
+unsigned long db_bulkq_load(db_bulkq_t *q)
+{
+	return q->size ? (unsigned long)q->used * 100 / q->size : 0;
+}
+
+
+void db_bulkq_writer(db_bulkq_t *q, db_bulkq_insert_f insert,
+		db_bulkq_flush_f flush)
+{
+	unsigned long reported = 0;
+	db_val_t *row;
+	str table;
+	int batch, n, ret;
+
+	row = pkg_malloc(q->col_no * sizeof(db_val_t));
+	if (row == NULL) {
+		LM_ERR("no more pkg memory\n");
+		return;
+	}
+
+	/* with insert buffering, a full batch goes out as one (multi row)
+	 * insert query */
+	batch = query_buffer_size > 1 ? query_buffer_size : DB_BULKQ_BATCH;
+
+	for ( ;; ) {
+		for (n = 0; n < batch; n++) {
+			ret = db_bulkq_pop(q, &table, row);
+			if (ret == 0)
+				break;
+			if (ret < 0)
+				continue;
+
+			if (insert(&table, row) < 0)
+				q->failed++;
+			else
+				q->written++;
+		}
+
+		if (n && flush)
+			flush();
+
+		if (q->dropped != reported) {
+			LM_WARN("%lu rows dropped so far (queue full), the database "
+				"is not keeping up\n", q->dropped);
+			reported = q->dropped;
+		}
+
+		if (n < batch)
+			usleep(DB_BULKQ_IDLE);
+	}
+}
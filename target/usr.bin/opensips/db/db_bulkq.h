@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Bulk insert queue - the SIP workers serialize the rows to be inserted
+ * into a ring buffer in shared memory and a dedicated writer process
+ * pushes them to the database, in batches. The workers never wait for the
+ * database: if the ring is full, the row is dropped (or the oldest rows
+ * are, depending on the queue policy) and counted.
+ */
+
+#ifndef _DB_BULKQ_H
+#define _DB_BULKQ_H
+
+#include "db_val.h"
+#include "../str.h"
+#include "../locking.h"
+#include "../timer.h"
+
+/* rows taken from the queue at once when the insert buffering of the core
+ * (query_buffer_size) is not used */
+#define DB_BULKQ_BATCH   64
+/* how long the writer sleeps when the queue is empty (us) */
+#define DB_BULKQ_IDLE    10000
+
+typedef struct db_bulkq {
+	gen_lock_t lock;
+	unsigned int size;      /* size of the ring */
+	unsigned int head;      /* where the next row is written */
+	unsigned int tail;      /* oldest queued row */
+	unsigned int used;      /* bytes in use */
+	unsigned int rows;      /* rows in the queue */
+	int col_no;             /* (maximum) number of values in a row */
+	int drop_oldest;        /* on overflow, drop the oldest rows
+	                           instead of the new one */
+	/* counters */
+	unsigned long queued;   /* rows accepted in the queue */
+	unsigned long dropped;  /* rows lost because the queue was full */
+	unsigned long written;  /* rows handed to the database */
+	unsigned long failed;   /* rows the database refused */
+	char *buf;
+} db_bulkq_t;
+
+/* inserts a row popped from the queue; to be provided by the user */
+typedef int (*db_bulkq_insert_f)(str *table, db_val_t *row);
+/* called after each batch of rows, to flush the insert buffers (if any) */
+typedef void (*db_bulkq_flush_f)(void);
+
+/*
+ * Creates (in shm memory) a queue of "size" bytes for rows of "col_no"
+ * values. To be called before forking.
+ */
+db_bulkq_t *db_bulkq_new(unsigned int size, int col_no, int drop_oldest);
+
+void db_bulkq_destroy(db_bulkq_t *q);
+
+/*
+ * Queues a row for the "table" table. The values are copied.
+ * Returns 0 on success, 1 if the row was dropped, -1 on error.
+ */
+int db_bulkq_push(db_bulkq_t *q, const str *table, const db_val_t *row);
+
+/*
+ * Queues a row of "n" values (at most col_no) with an opaque "tag" for the
+ * consumer. Same return codes as db_bulkq_push().
+ */
+int db_bulkq_push_row(db_bulkq_t *q, const str *table, const db_val_t *row,
+		int n, int tag);
+
+/*
+ * Takes the oldest row out of the queue. The table name and the string
+ * values point in a per process buffer, valid up to the next pop.
+ * Returns 1 if a row was returned, 0 if the queue is empty, -1 on error.
+ */
+int db_bulkq_pop(db_bulkq_t *q, str *table, db_val_t *row);
+
+/*
+ * Takes the oldest row out of the queue, as an opaque record (in a per
+ * process buffer, valid up to the next pop) which may be kept elsewhere
+ * (e.g. on disk) and unpacked later with db_bulkq_unpack().
+ * Returns 1 if a record was returned, 0 if the queue is empty, -1 on error.
+ */
+int db_bulkq_pop_raw(db_bulkq_t *q, char **rec, unsigned int *len);
+
+/*
+ * Unpacks a record returned by db_bulkq_pop_raw() into the table name and
+ * (at most "max") values, which point inside the record. The number of
+ * values, the tag and the time the row was queued at (us) are returned in
+ * "n", "tag" and "queued" (the last two are optional). Returns 0 or -1 if
+ * the record is corrupted.
+ */
+int db_bulkq_unpack(char *rec, unsigned int len, str *table, db_val_t *row,
+		int max, int *n, int *tag, utime_t *queued);
+
+/* percentage of the queue in use */
+unsigned long db_bulkq_load(db_bulkq_t *q);
+
+/*
+ * Main loop of the writer process - never returns.
+ */
+void db_bulkq_writer(db_bulkq_t *q, db_bulkq_insert_f insert,
+		db_bulkq_flush_f flush);
+
+#endif
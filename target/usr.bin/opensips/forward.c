@@ -357,10 +357,21 @@ int forward_request( struct sip_msg* msg, struct proxy_l * p)
 	union sockaddr_union to;
 	unsigned int len;
 	char* buf;
+	struct msg_iov iov;
+	int use_iov;
 	struct socket_info* send_sock;
 	struct socket_info* last_sock;
 
 	buf=0;
+	msg_iov_init(&iov);
+	/* the outgoing message is not copied into a new buffer (but sent
+	 * directly from the original buffer and from the lumps), unless
+	 * someone needs to look at it as a whole */
+#ifdef NO_SEND_IOV
+	use_iov = 0;
+#else
+	use_iov = (fwdcb_hl==0 && !blacklists_in_use());
+#endif
 
 	/* calculate branch for outbound request - if the branch buffer is already
 	 * set (maybe by an upper level as TM), used it; otherwise computes
@@ -393,36 +404,58 @@ int forward_request( struct sip_msg* msg, struct proxy_l * p)
 
 		if ( last_sock!=send_sock ) {
 
-			if (buf)
+			if (buf) {
 				pkg_free(buf);
-
-			buf = build_req_buf_from_sip_req(msg, &len, send_sock, p->proto, 0);
-			if (!buf){
-				LM_ERR("building req buf failed\n");
-				tcp_no_new_conn = 0;
-				goto error;
+				buf = 0;
+			}
+			msg_iov_destroy(&iov);
+
+			if (use_iov) {
+				if (build_req_iov_from_sip_req(msg, &iov, send_sock,
+				p->proto, 0) < 0) {
+					LM_ERR("building req iovec failed\n");
+					tcp_no_new_conn = 0;
+					goto error;
+				}
+				len = iov.len;
+			} else {
+				buf = build_req_buf_from_sip_req(msg, &len, send_sock,
+					p->proto, 0);
+				if (!buf){
+					LM_ERR("building req buf failed\n");
+					tcp_no_new_conn = 0;
+					goto error;
+				}
 			}
 
 			last_sock = send_sock;
 		}
 
-		if (check_blacklists( p->proto, &to, buf, len)) {
+		if (!use_iov && check_blacklists( p->proto, &to, buf, len)) {
 			LM_DBG("blocked by blacklists\n");
 			ser_error=E_IP_BLOCKED;
 			continue;
 		}
 
 		/* send it! */
-		LM_DBG("sending:\n%.*s.\n", (int)len, buf);
-		LM_DBG("orig. len=%d, new_len=%d, proto=%d\n",
-			msg->len, len, p->proto );
+		LM_DBG("orig. len=%d, new_len=%d, chunks=%d, proto=%d\n",
+			msg->len, len, use_iov ? iov.cnt : 1, p->proto );
 
-		if (msg_send(send_sock, p->proto, &to, 0, buf, len, msg)<0){
-			ser_error=E_SEND;
-			continue;
-		}
+		if (use_iov) {
+			if (msg_send_iov(send_sock, p->proto, &to, 0, &iov, msg)<0){
+				ser_error=E_SEND;
+				continue;
+			}
+		} else {
+			LM_DBG("sending:\n%.*s.\n", (int)len, buf);
 
-		run_fwd_callbacks( msg, buf, len, send_sock, p->proto, &to);
+			if (msg_send(send_sock, p->proto, &to, 0, buf, len, msg)<0){
+				ser_error=E_SEND;
+				continue;
+			}
+
+			run_fwd_callbacks( msg, buf, len, send_sock, p->proto, &to);
+		}
 
 		ser_error = 0;
 		break;
@@ -439,12 +472,14 @@ int forward_request( struct sip_msg* msg, struct proxy_l * p)
 	/* sent requests stats */
 	update_stat( fwd_reqs, 1);
 
-	pkg_free(buf);
+	if (buf) pkg_free(buf);
+	msg_iov_destroy(&iov);
 	/* received_buf & line_buf will be freed in receive_msg by free_lump_list*/
 	return 0;
 
 error:
 	if (buf) pkg_free(buf);
+	msg_iov_destroy(&iov);
 	return -1;
 }
 
@@ -515,9 +550,8 @@ int update_sock_struct_from_via( union sockaddr_union* to,
 /*! \brief removes first via & sends msg to the second */
 int forward_reply(struct sip_msg* msg)
 {
-	char* new_buf;
+	struct msg_iov iov;
 	union sockaddr_union* to;
-	unsigned int new_len;
 	struct sr_module *mod;
 	int proto;
 	int id; /* used only by tcp*/
@@ -527,7 +561,7 @@ int forward_reply(struct sip_msg* msg)
 
 	to=0;
 	id=0;
-	new_buf=0;
+	msg_iov_init(&iov);
 	/*check if first via host = us */
 	if (check_via){
 		if (check_self(&msg->via1->host,
@@ -581,13 +615,12 @@ int forward_reply(struct sip_msg* msg)
 
 	send_sock = get_send_socket(msg, to, proto);
 
-	new_buf = build_res_buf_from_sip_res( msg, &new_len, send_sock,0);
-	if (!new_buf){
+	if (build_res_iov_from_sip_res( msg, &iov, send_sock, 0) < 0) {
 		LM_ERR("failed to build rpl from req failed\n");
 		goto error;
 	}
 
-	if (msg_send(send_sock, proto, to, id, new_buf, new_len, msg)<0) {
+	if (msg_send_iov(send_sock, proto, to, id, &iov, msg)<0) {
 		update_stat( drp_rpls, 1);
 		goto error0;
 	}
@@ -601,14 +634,14 @@ int forward_reply(struct sip_msg* msg)
 	LM_DBG("reply forwarded to %.*s:%d\n", msg->via2->host.len,
 		msg->via2->host.s, (unsigned short) msg->via2->port);
 
-	pkg_free(new_buf);
+	msg_iov_destroy(&iov);
 	pkg_free(to);
 skip:
 	return 0;
 error:
 	update_stat( err_rpls, 1);
 error0:
-	if (new_buf) pkg_free(new_buf);
+	msg_iov_destroy(&iov);
 	if (to) pkg_free(to);
 	return -1;
 }
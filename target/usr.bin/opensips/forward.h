@@ -36,6 +36,8 @@
 #ifndef forward_h
 #define forward_h
 
+#include <limits.h>
+
 #include "globals.h"
 #include "mem/mem.h"
 #include "parser/msg_parser.h"
@@ -43,6 +45,7 @@
 #include "proxy.h"
 #include "ip_addr.h"
 #include "script_cb.h"
+#include "msg_translator.h"
 #include "net/trans.h"
 
 struct socket_info* get_send_socket(struct sip_msg* msg,
@@ -130,6 +133,64 @@ error:
 }
 
 
+/*! \brief
+ *
+ *  Same as msg_send(), but the message is given as a list of chunks (see
+ *  build_req_iov_from_sip_req()), which is sent as it is (with no extra
+ *  copying) if the protocol supports it. Otherwise, or if the message has to
+ *  be seen as a whole by the raw processing callbacks, the chunks are first
+ *  copied into a buffer.
+ * \return 0 if ok, -1 on error
+ */
+static inline int msg_send_iov( struct socket_info* send_sock, int proto,
+							union sockaddr_union* to, int id,
+							struct msg_iov* iov, struct sip_msg* msg)
+{
+	unsigned int len;
+	char *buf;
+	int ret;
+
+	if (proto<=PROTO_NONE || proto>=PROTO_OTHER) {
+		LM_BUG("bogus proto %d received!\n",proto);
+		return -1;
+	}
+	if (protos[proto].id==PROTO_NONE) {
+		LM_BUG("using proto %d which is not init!\n",proto);
+		return -1;
+	}
+
+	if (protos[proto].tran.sendv==NULL ||
+#ifdef IOV_MAX
+	/* on some systems this limit is very low (16 on Solaris) */
+	iov->cnt>IOV_MAX ||
+#endif
+	has_post_raw_processing_cb()) {
+		buf = msg_iov_flatten(iov, &len, 0);
+		if (buf==NULL)
+			return -1;
+		ret = msg_send(send_sock, proto, to, id, buf, len, msg);
+		pkg_free(buf);
+		return ret;
+	}
+
+	/* determin the send socket */
+	if (send_sock==0)
+		send_sock=get_send_socket(0, to, proto);
+	if (send_sock==0){
+		LM_ERR("no sending socket found for proto %d\n", proto);
+		return -1;
+	}
+
+	if (protos[proto].tran.sendv(send_sock, iov->v, iov->cnt, iov->len,
+	to, id)<0){
+		LM_ERR("sendv() for proto %d failed\n",proto);
+		return -1;
+	}
+
+	return 0;
+}
+
+
 /***** forward callbacks *****/
 
 /* callback function prototype */
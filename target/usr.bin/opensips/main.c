@@ -126,6 +126,7 @@
 #include "statistics.h"
 #include "core_stats.h"
 #include "pvar.h"
+#include "xlog.h"
 #include "poll_types.h"
 #include "net/net_tcp.h"
 #include "net/net_udp.h"
@@ -647,6 +648,11 @@ static int main_loop(void)
 		goto error;
 	}
 
+	if (init_xlog_async() != 0) {
+		LM_ERR("failed to init the asynchronous xlog buffers\n");
+		goto error;
+	}
+
 	if (dont_fork){
 
 		if (create_status_pipe() < 0) {
@@ -674,6 +680,11 @@ static int main_loop(void)
 			goto error;
 		}
 
+		if (start_xlog_writer()!=0) {
+			LM_CRIT("cannot start the log writer process\n");
+			goto error;
+		}
+
 		is_main=1;
 
 		udp_start_nofork();
@@ -727,6 +738,12 @@ static int main_loop(void)
 			goto error;
 		}
 
+		/* fork the asynchronous log writer */
+		if (start_xlog_writer()!=0) {
+			LM_CRIT("cannot start the log writer process\n");
+			goto error;
+		}
+
 		/* fork all processes required by UDP network layer */
 		if (udp_start_processes( &chd_rank, startup_done)<0) {
 			LM_CRIT("cannot start TCP processes\n");
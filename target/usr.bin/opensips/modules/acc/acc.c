@@ -60,6 +60,7 @@
 #include "acc_mod.h"
 #include "acc_extra.h"
 #include "acc_logic.h"
+#include "acc_async.h"
 
 #define TABLE_VERSION 6
 
@@ -233,6 +234,16 @@ static str log_attrs[ACC_CORE_LEN+ACC_DLG_LEN+MAX_ACC_EXTRA+MAX_ACC_LEG];
 	} while(0)
 
 
+/* with async_queue_size, the lines are logged by the acc writer process */
+#define ACC_LOG(_fmt, _args...) \
+	do { \
+		if (acc_async_on()) \
+			acc_async_log(_fmt, ##_args); \
+		else \
+			LM_GEN2(acc_log_facility, log_level, _fmt, ##_args); \
+	} while (0)
+
+
 void acc_log_init(void)
 {
 	struct acc_extra *extra;
@@ -363,8 +374,7 @@ int acc_log_cdrs(struct dlg_cell *dlg, struct sip_msg *msg)
 	*(p++) = '\n';
 	*(p++) = 0;
 
-	LM_GEN2(acc_log_facility, log_level,
-		"%.*screated=%lu;call_start_time=%lu;duration=%lu;setuptime=%lu%s",
+	ACC_LOG("%.*screated=%lu;call_start_time=%lu;duration=%lu;setuptime=%lu%s",
 		acc_env.text.len, acc_env.text.s,(unsigned long)created,
 		(unsigned long)start_time,
 		(unsigned long)(time(NULL)-start_time),
@@ -444,7 +454,7 @@ int acc_log_request( struct sip_msg *rq, struct sip_msg *rpl, int cdr_flag)
 
 
 	if (cdr_flag) {
-		LM_GEN2(acc_log_facility, log_level, "%.*stimestamp=%lu;created=%lu;setuptime=%lu%s",
+		ACC_LOG("%.*stimestamp=%lu;created=%lu;setuptime=%lu%s",
 			acc_env.text.len, acc_env.text.s,
 			(unsigned long) acc_env.ts,
 			(unsigned long) _created,
@@ -452,7 +462,7 @@ int acc_log_request( struct sip_msg *rq, struct sip_msg *rpl, int cdr_flag)
 		return 1;
 	}
 
-	LM_GEN2(acc_log_facility, log_level, "%.*stimestamp=%lu%s",
+	ACC_LOG("%.*stimestamp=%lu%s",
 		acc_env.text.len, acc_env.text.s,(unsigned long) acc_env.ts, log_msg);
 
 	return 1;
@@ -465,6 +475,13 @@ int store_log_extra_values(struct dlg_cell *dlg, struct sip_msg *req,
 }
 
 
+/* logs a line queued by a SIP worker - in the acc writer */
+void acc_log_write(str *line)
+{
+	LM_GEN2(acc_log_facility, log_level, "%.*s", line->len, line->s);
+}
+
+
 /********************************************
  *        SQL  ACCOUNTING
  ********************************************/
@@ -591,6 +608,54 @@ void acc_db_close(void)
 }
 
 
+/* inserts a row, or hands it to the acc writer */
+static inline int acc_db_insert(query_list_t **ins_list, db_key_t *keys,
+		db_val_t *vals, int n, str *table, int kind)
+{
+	if (acc_async_on())
+		return acc_async_push(kind, table, vals, n);
+
+	if (con_set_inslist(&acc_dbf,db_handle,ins_list,keys,n) < 0 )
+		CON_RESET_INSLIST(db_handle);
+	return acc_dbf.insert(db_handle, keys, vals, n);
+}
+
+
+/* inserts a row queued by a SIP worker - in the acc writer; returns the
+ * insert queue the row was buffered in, if any */
+int acc_db_write(int kind, str *table, db_val_t *vals, int n,
+		query_list_t **ql)
+{
+	db_key_t *keys;
+
+	keys = (kind == ACC_Q_DB_CDRS) ? db_keys_cdrs : db_keys;
+
+	acc_dbf.use_table(db_handle, table);
+	/* tables and columns vary from row to row */
+	CON_RESET_CURR_PS(db_handle);
+
+	*ql = NULL;
+	if (con_set_inslist(&acc_dbf, db_handle, ql, keys, n) < 0) {
+		CON_RESET_INSLIST(db_handle);
+		*ql = NULL;
+	}
+
+	if (acc_dbf.insert(db_handle, keys, vals, n) < 0) {
+		LM_ERR("failed to insert into database\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* writes the rows buffered in an insert queue - in the acc writer */
+int acc_db_flush(query_list_t *ql)
+{
+	return ql_flush_rows(&acc_dbf, db_handle, ql);
+}
+
+
 int acc_db_request( struct sip_msg *rq, struct sip_msg *rpl,
 		query_list_t **ins_list, int cdr_flag)
 {
@@ -635,15 +700,16 @@ int acc_db_request( struct sip_msg *rq, struct sip_msg *rpl,
 		VAL_TIME(db_vals+(m+n+1)) = _created;
 	}
 
-	acc_dbf.use_table(db_handle, &acc_env.text/*table*/);
-	CON_PS_REFERENCE(db_handle) = cdr_flag ?
-		(ins_list? &my_ps_ins2:&my_ps2) : (ins_list? &my_ps_ins:&my_ps);
+	if (!acc_async_on()) {
+		acc_dbf.use_table(db_handle, &acc_env.text/*table*/);
+		CON_PS_REFERENCE(db_handle) = cdr_flag ?
+			(ins_list? &my_ps_ins2:&my_ps2) : (ins_list? &my_ps_ins:&my_ps);
+	}
 
 	/* multi-leg columns */
 	if ( !leg_info ) {
-		if (con_set_inslist(&acc_dbf,db_handle,ins_list,db_keys,m+(cdr_flag?2:0)) < 0 )
-			CON_RESET_INSLIST(db_handle);
-		if (acc_dbf.insert(db_handle, db_keys, db_vals, m+(cdr_flag?2:0)) < 0) {
+		if (acc_db_insert(ins_list, db_keys, db_vals, m+(cdr_flag?2:0),
+		&acc_env.text, ACC_Q_DB) < 0) {
 			LM_ERR("failed to insert into database\n");
 			return -1;
 		}
@@ -651,9 +717,8 @@ int acc_db_request( struct sip_msg *rq, struct sip_msg *rpl,
 		do {
 			for ( i = m; i < m + n; i++)
 				VAL_STR(db_vals+i)=val_arr[i];
-			if (con_set_inslist(&acc_dbf,db_handle,ins_list,db_keys,m+n+(cdr_flag?2:0)) < 0 )
-				CON_RESET_INSLIST(db_handle);
-			if (acc_dbf.insert(db_handle, db_keys, db_vals, m+n+(cdr_flag?2:0)) < 0) {
+			if (acc_db_insert(ins_list, db_keys, db_vals,
+			m+n+(cdr_flag?2:0), &acc_env.text, ACC_Q_DB) < 0) {
 				LM_ERR("failed to insert into database\n");
 				return -1;
 			}
@@ -725,13 +790,14 @@ int acc_db_cdrs(struct dlg_cell *dlg, struct sip_msg *msg)
 	VAL_INT(db_vals_cdrs+ret+nr_vals+nr_bye_vals+3) = time(NULL) - start_time;
 
 	total = ret + 4;
-	acc_dbf.use_table(db_handle, &table);
-	CON_PS_REFERENCE(db_handle) = &my_ps;
+	if (!acc_async_on()) {
+		acc_dbf.use_table(db_handle, &table);
+		CON_PS_REFERENCE(db_handle) = &my_ps;
+	}
 
 	if (!leg_info && !leg_bye_info) {
-		if (con_set_inslist(&acc_dbf,db_handle,&ins_list,db_keys_cdrs,total) < 0 )
-			CON_RESET_INSLIST(db_handle);
-		if (acc_dbf.insert(db_handle, db_keys_cdrs, db_vals_cdrs, total) < 0) {
+		if (acc_db_insert(&ins_list, db_keys_cdrs, db_vals_cdrs, total,
+		&table, ACC_Q_DB_CDRS) < 0) {
 			LM_ERR("failed to insert into database\n");
 			goto end;
 		}
@@ -742,9 +808,8 @@ int acc_db_cdrs(struct dlg_cell *dlg, struct sip_msg *msg)
 			complete_dlg_values(&leg_s,val_arr+ret,nr_vals);
 			 for (j = 0; j<nr_vals+nr_bye_vals; j++)
 				VAL_STR(db_vals_cdrs+ret+j+1) = val_arr[ret+j];
-			if (con_set_inslist(&acc_dbf,db_handle,&ins_list,db_keys_cdrs,total+nr_bye_vals) < 0 )
-				CON_RESET_INSLIST(db_handle);
-			if (acc_dbf.insert(db_handle,db_keys_cdrs,db_vals_cdrs,total+nr_bye_vals) < 0) {
+			if (acc_db_insert(&ins_list, db_keys_cdrs, db_vals_cdrs,
+			total+nr_bye_vals, &table, ACC_Q_DB_CDRS) < 0) {
 				LM_ERR("failed inserting into database\n");
 				goto end;
 			}
@@ -755,9 +820,8 @@ int acc_db_cdrs(struct dlg_cell *dlg, struct sip_msg *msg)
 			/* drain all the values */
 			for (j = ret+nr_vals; j<ret+nr_bye_vals+nr_vals; j++)
 				VAL_STR(db_vals_cdrs+j+1) = val_arr[j];
-			if (con_set_inslist(&acc_dbf,db_handle,&ins_list,db_keys_cdrs,total+nr_bye_vals) < 0 )
-				CON_RESET_INSLIST(db_handle);
-			if (acc_dbf.insert(db_handle,db_keys_cdrs,db_vals_cdrs,total+nr_bye_vals) < 0) {
+			if (acc_db_insert(&ins_list, db_keys_cdrs, db_vals_cdrs,
+			total+nr_bye_vals, &table, ACC_Q_DB_CDRS) < 0) {
 				LM_ERR("failed inserting into database\n");
 				goto end;
 			}
@@ -0,0 +1,695 @@
+/*
+ * Asynchronous accounting - the records are written by the acc writer
+ * process
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * The SIP workers serialize the finished records (syslog lines and
+ * database rows) into a shared memory queue (db/db_bulkq) and the acc
+ * writer process takes them out, in batches. With insert buffering
+ * (query_buffer_size), a batch of rows goes out as one multi-row insert.
+ *
+ * If the database fails, the rows of the failed batch and all the rows
+ * coming after them are appended to the spool file, as raw queue records
+ * framed by a magic, their length and a crc32, and the database is retried
+ * every acc_spool_retry seconds. While there are spooled rows, the new rows
+ * go to the spool too, so the order is kept; the spool is replayed one batch
+ * at a time, interleaved with the draining of the queue. The rows are
+ * written at least once - a row may be written twice if the database failed
+ * in the middle of a batch. A record not matching its frame (e.g. a tail cut
+ * by a crash) is taken as the end of the spool - the file is truncated
+ * there.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "../../dprint.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "../../crc.h"
+#include "../../db/db_bulkq.h"
+#include "../../aaa/aaa.h"
+#include "acc_mod.h"
+#include "acc_async.h"
+
+unsigned int acc_async_queue_size = 0;
+char *acc_spool_file = NULL;
+int acc_spool_retry = ACC_SPOOL_RETRY;
+
+/* counters kept by the writer, besides the ones of the queue */
+struct acc_async_stats {
+	unsigned long latency;      /* queue to database / syslog (ms) */
+	unsigned long latency_max;
+	unsigned long spooled;      /* rows written to the spool */
+	unsigned long replayed;     /* rows taken from the spool into the db */
+};
+
+static db_bulkq_t *acc_q = NULL;
+static struct acc_async_stats *acc_st = NULL;
+
+/* set in the writer, which does not queue anything */
+static int is_writer = 0;
+
+/* largest queue record: a syslog line and its formatting */
+#define ACC_LOG_LINE_MAX  (MAX_SYSLOG_SIZE + 512)
+
+/* distinct insert queues flushed at the end of a batch */
+#define ACC_BATCH_QL      8
+
+
+int acc_async_init(void)
+{
+	if (!acc_async_queue_size)
+		return 0;
+
+	acc_q = db_bulkq_new(acc_async_queue_size, ACC_Q_MAX_COLS, 0);
+	if (acc_q == NULL) {
+		LM_ERR("failed to create the acc queue\n");
+		return -1;
+	}
+
+	acc_st = shm_malloc(sizeof *acc_st);
+	if (acc_st == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(acc_st, 0, sizeof *acc_st);
+
+	if (acc_spool_retry <= 0)
+		acc_spool_retry = ACC_SPOOL_RETRY;
+
+	return 0;
+}
+
+
+void acc_async_destroy(void)
+{
+	if (acc_q)
+		db_bulkq_destroy(acc_q);
+	acc_q = NULL;
+	if (acc_st)
+		shm_free(acc_st);
+	acc_st = NULL;
+}
+
+
+int acc_async_on(void)
+{
+	return acc_q != NULL && !is_writer;
+}
+
+
+int acc_async_push(int kind, str *table, db_val_t *vals, int n)
+{
+	return db_bulkq_push_row(acc_q, table, vals, n, kind) < 0 ? -1 : 0;
+}
+
+
+void acc_async_log(char *fmt, ...)
+{
+	static char *line = NULL;
+	static str empty = {"", 0};
+	db_val_t val;
+	va_list ap;
+	int len;
+
+	if (!is_printable(log_level))
+		return;
+
+	if (line == NULL) {
+		line = pkg_malloc(ACC_LOG_LINE_MAX);
+		if (line == NULL) {
+			LM_ERR("no more pkg memory\n");
+			return;
+		}
+	}
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, ACC_LOG_LINE_MAX, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len >= ACC_LOG_LINE_MAX)
+		len = ACC_LOG_LINE_MAX - 1;
+
+	memset(&val, 0, sizeof val);
+	VAL_TYPE(&val) = DB_STR;
+	VAL_STR(&val).s = line;
+	VAL_STR(&val).len = len;
+
+	db_bulkq_push_row(acc_q, &empty, &val, 1, ACC_Q_LOG);
+}
+
+
+static inline utime_t acc_now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (utime_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+/* accounts the queue to database / syslog latency of "n" records, given the
+ * sum and the oldest of their queuing times */
+static void acc_async_latency(int n, utime_t sum, utime_t oldest)
+{
+	utime_t now;
+	unsigned long avg, max;
+
+	if (n == 0)
+		return;
+
+	now = acc_now_us();
+	avg = (unsigned long)((now * n - sum) / n / 1000);
+	max = (unsigned long)((now - oldest) / 1000);
+
+	/* moving average, 1/8 weight for the new batch */
+	acc_st->latency = acc_st->latency - acc_st->latency / 8 + avg / 8;
+	if (max > acc_st->latency_max)
+		acc_st->latency_max = max;
+}
+
+
+/*
+ * Spool file
+ */
+
+/* frame of a spooled record */
+struct acc_spool_hdr {
+	unsigned int magic;
+	unsigned int len;
+	unsigned int crc;           /* crc32 of the record */
+};
+
+#define ACC_SPOOL_MAGIC   0x41434331  /* "ACC1" */
+
+static int spool_fd = -1;
+/* replay position and size of the spool */
+static off_t spool_off = 0;
+static off_t spool_size = 0;
+/* the database failed, wait up to retry_at before trying it again */
+static int db_down = 0;
+static time_t retry_at = 0;
+
+static int acc_spool_open(void)
+{
+	struct stat st;
+
+	if (spool_fd >= 0)
+		return 0;
+
+	spool_fd = open(acc_spool_file, O_RDWR | O_CREAT, 0600);
+	if (spool_fd < 0) {
+		LM_ERR("cannot open spool file %s: %s\n", acc_spool_file,
+			strerror(errno));
+		return -1;
+	}
+
+	if (fstat(spool_fd, &st) == 0)
+		spool_size = st.st_size;
+	spool_off = 0;
+
+	return 0;
+}
+
+
+static inline unsigned int acc_spool_crc(char *rec, unsigned int len)
+{
+	str s;
+	unsigned int crc;
+
+	s.s = rec;
+	s.len = len;
+	crc32_uint(&s, &crc);
+	return crc;
+}
+
+
+static int acc_spool_append(char *rec, unsigned int len)
+{
+	struct acc_spool_hdr hdr;
+	struct iovec iov[2];
+	int ret;
+
+	if (!acc_spool_file || acc_spool_open() < 0) {
+		acc_q->failed++;
+		return -1;
+	}
+
+	hdr.magic = ACC_SPOOL_MAGIC;
+	hdr.len = len;
+	hdr.crc = acc_spool_crc(rec, len);
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof hdr;
+	iov[1].iov_base = rec;
+	iov[1].iov_len = len;
+
+	do {
+		ret = pwritev(spool_fd, iov, 2, spool_size);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret != (int)(sizeof hdr + len)) {
+		LM_ERR("failed to write to the spool file: %s\n",
+			ret < 0 ? strerror(errno) : "short write");
+		acc_q->failed++;
+		return -1;
+	}
+
+	spool_size += ret;
+	acc_st->spooled++;
+	return 0;
+}
+
+
+/* moves the rows not replayed yet to the beginning of the spool */
+static void acc_spool_compact(void)
+{
+	char buf[16384];
+	off_t r, w;
+	int n;
+
+	if (spool_fd < 0 || spool_off == 0)
+		return;
+
+	for (r = spool_off, w = 0; r < spool_size; r += n, w += n) {
+		n = pread(spool_fd, buf, sizeof buf, r);
+		if (n <= 0 || pwrite(spool_fd, buf, n, w) != n) {
+			LM_ERR("failed to compact the spool file\n");
+			return;
+		}
+	}
+
+	if (ftruncate(spool_fd, w) < 0)
+		LM_ERR("failed to truncate the spool file: %s\n", strerror(errno));
+	spool_size = w;
+	spool_off = 0;
+}
+
+
+static void acc_spool_atexit(void)
+{
+	acc_spool_compact();
+}
+
+
+/*
+ * Batches of records - the raw records are kept until the rows get to the
+ * database, to be spooled if they do not
+ */
+
+struct acc_batch {
+	char *buf;
+	unsigned int len;
+	unsigned int size;
+	unsigned int done;          /* rows up to here are in the database */
+	int rows;
+	query_list_t *ql[ACC_BATCH_QL];
+	int ql_no;
+	utime_t sum;                /* sum of the queuing times */
+	utime_t oldest;
+	int failed;
+};
+
+static struct acc_batch batch;
+
+static int acc_batch_add(char *rec, unsigned int len)
+{
+	char *p;
+	unsigned int size;
+
+	if (batch.len + sizeof len + len > batch.size) {
+		size = (batch.len + sizeof len + len) * 2;
+		p = pkg_realloc(batch.buf, size);
+		if (p == NULL) {
+			LM_ERR("no more pkg memory\n");
+			return -1;
+		}
+		batch.buf = p;
+		batch.size = size;
+	}
+
+	memcpy(batch.buf + batch.len, &len, sizeof len);
+	memcpy(batch.buf + batch.len + sizeof len, rec, len);
+	batch.len += sizeof len + len;
+	batch.rows++;
+
+	return 0;
+}
+
+
+static void acc_batch_reset(void)
+{
+	batch.len = batch.done = 0;
+	batch.rows = batch.ql_no = batch.failed = 0;
+	batch.sum = batch.oldest = 0;
+}
+
+
+/* flushes the insert queues used by the batch */
+static int acc_batch_flush(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < batch.ql_no; i++)
+		if (acc_db_flush(batch.ql[i]) < 0)
+			ret = -1;
+	batch.ql_no = 0;
+
+	return ret;
+}
+
+
+/* writes a row to the database, as part of the current batch */
+static void acc_batch_write(int kind, str *table, db_val_t *vals, int n,
+		utime_t queued)
+{
+	query_list_t *ql = NULL;
+	int i;
+
+	if (batch.failed)
+		return;
+
+	if (acc_db_write(kind, table, vals, n, &ql) < 0) {
+		batch.failed = 1;
+		return;
+	}
+
+	if (ql == NULL) {
+		/* not buffered - it is in the database already */
+		if (!batch.ql_no)
+			batch.done = batch.len;
+	} else {
+		for (i = 0; i < batch.ql_no; i++)
+			if (batch.ql[i] == ql)
+				break;
+		if (i == batch.ql_no) {
+			if (batch.ql_no == ACC_BATCH_QL && acc_batch_flush() < 0) {
+				batch.failed = 1;
+				return;
+			}
+			batch.ql[batch.ql_no++] = ql;
+		}
+	}
+
+	batch.sum += queued;
+	if (!batch.oldest || queued < batch.oldest)
+		batch.oldest = queued;
+}
+
+
+/*
+ * Ends the current batch. If the database failed, the rows which did not
+ * get there are spooled (if "spool" is set) and the database is marked down.
+ * Returns 0 or -1 if the database failed; the number of rows written is
+ * returned in "rows".
+ */
+static int acc_batch_end(int spool, int *rows)
+{
+	unsigned int off, len;
+
+	if (!batch.failed && acc_batch_flush() < 0)
+		batch.failed = 1;
+
+	if (!batch.failed) {
+		acc_async_latency(batch.rows, batch.sum, batch.oldest);
+		*rows = batch.rows;
+		acc_q->written += *rows;
+		acc_batch_reset();
+		if (db_down)
+			LM_INFO("database writes resumed\n");
+		db_down = 0;
+		return 0;
+	}
+
+	if (!db_down)
+		LM_ERR("database write failed, %s for %d seconds\n",
+			acc_spool_file ? "spooling the rows" : "dropping the rows",
+			acc_spool_retry);
+	db_down = 1;
+	retry_at = time(NULL) + acc_spool_retry;
+
+	*rows = 0;
+	for (off = 0; off < batch.len; off += sizeof len + len) {
+		memcpy(&len, batch.buf + off, sizeof len);
+		if (off < batch.done) {
+			(*rows)++;
+			continue;
+		}
+		if (spool)
+			acc_spool_append(batch.buf + off + sizeof len, len);
+	}
+	acc_q->written += *rows;
+
+	acc_batch_reset();
+	return -1;
+}
+
+
+/* cuts the spool at "off", where a record does not match its frame */
+static void acc_spool_truncate(off_t off)
+{
+	LM_ERR("corrupted spool record at %ld - discarding the tail of %ld bytes\n",
+		(long)off, (long)(spool_size - off));
+	if (ftruncate(spool_fd, off) < 0)
+		LM_ERR("failed to truncate the spool file: %s\n", strerror(errno));
+	spool_size = off;
+}
+
+
+/* replays (at most) a batch of rows from the spool */
+static void acc_spool_replay(int max)
+{
+	static char *rec = NULL;
+	static unsigned int rec_size = 0;
+	db_val_t vals[ACC_Q_MAX_COLS];
+	struct acc_spool_hdr hdr;
+	off_t off, start;
+	str table;
+	utime_t queued;
+	int n, kind, rows;
+	char *p;
+
+	start = off = spool_off;
+	while (batch.rows < max && off < spool_size) {
+		if (pread(spool_fd, &hdr, sizeof hdr, off) != sizeof hdr ||
+		hdr.magic != ACC_SPOOL_MAGIC ||
+		off + (off_t)(sizeof hdr + hdr.len) > spool_size) {
+			acc_spool_truncate(off);
+			break;
+		}
+
+		if (hdr.len > rec_size) {
+			p = pkg_realloc(rec, hdr.len);
+			if (p == NULL) {
+				LM_ERR("no more pkg memory\n");
+				break;
+			}
+			rec = p;
+			rec_size = hdr.len;
+		}
+
+		if (pread(spool_fd, rec, hdr.len, off + sizeof hdr) != (int)hdr.len) {
+			LM_ERR("failed to read the spool file: %s\n", strerror(errno));
+			break;
+		}
+
+		if (acc_spool_crc(rec, hdr.len) != hdr.crc) {
+			acc_spool_truncate(off);
+			break;
+		}
+		off += sizeof hdr + hdr.len;
+
+		if (db_bulkq_unpack(rec, hdr.len, &table, vals, ACC_Q_MAX_COLS, &n,
+		&kind, &queued) < 0 || kind == ACC_Q_LOG) {
+			acc_q->failed++;
+			continue;
+		}
+
+		if (acc_batch_add(rec, hdr.len) < 0)
+			break;
+		acc_batch_write(kind, &table, vals, n, queued);
+	}
+
+	/* the rows are still in the spool, nothing to spool again */
+	if (acc_batch_end(0, &rows) == 0) {
+		spool_off = off;
+		acc_st->replayed += rows;
+	} else {
+		/* skip what got to the database - rows are whole records */
+		for (n = 0; n < rows; n++) {
+			if (pread(spool_fd, &hdr, sizeof hdr, start) != sizeof hdr)
+				break;
+			start += sizeof hdr + hdr.len;
+		}
+		spool_off = start;
+		acc_st->replayed += rows;
+		acc_spool_compact();
+		return;
+	}
+
+	if (spool_off >= spool_size) {
+		/* all replayed */
+		if (ftruncate(spool_fd, 0) < 0)
+			LM_ERR("failed to truncate the spool file: %s\n",
+				strerror(errno));
+		spool_off = spool_size = 0;
+		LM_INFO("all the spooled rows were written to the database\n");
+	}
+}
+
+
+void acc_async_writer(void)
+{
+	db_val_t vals[ACC_Q_MAX_COLS];
+	unsigned long reported = 0;
+	unsigned int len;
+	utime_t queued, log_sum, log_oldest;
+	str table;
+	char *rec;
+	int max, n, i, ret, kind, logs;
+
+	is_writer = 1;
+
+	/* rows left in the spool by a previous run are replayed first */
+	if (acc_spool_file) {
+		if (acc_spool_open() < 0)
+			LM_WARN("running without spool file\n");
+		atexit(acc_spool_atexit);
+	}
+
+	max = query_buffer_size > 1 ? query_buffer_size : DB_BULKQ_BATCH;
+
+	for ( ;; ) {
+		logs = 0;
+		log_sum = log_oldest = 0;
+
+		for (i = 0; i < max; i++) {
+			ret = db_bulkq_pop_raw(acc_q, &rec, &len);
+			if (ret == 0)
+				break;
+			if (ret < 0 || db_bulkq_unpack(rec, len, &table, vals,
+			ACC_Q_MAX_COLS, &n, &kind, &queued) < 0) {
+				acc_q->failed++;
+				continue;
+			}
+
+			if (kind == ACC_Q_LOG) {
+				acc_log_write(&VAL_STR(vals));
+				acc_q->written++;
+				logs++;
+				log_sum += queued;
+				if (!log_oldest || queued < log_oldest)
+					log_oldest = queued;
+				continue;
+			}
+
+			/* keep the order - nothing goes before the spooled rows; while
+			 * the database is down, the rows are spooled (or dropped) */
+			if (spool_size > spool_off || (db_down && time(NULL) < retry_at)) {
+				acc_spool_append(rec, len);
+				continue;
+			}
+
+			if (acc_batch_add(rec, len) < 0) {
+				acc_q->failed++;
+				continue;
+			}
+			acc_batch_write(kind, &table, vals, n, queued);
+		}
+
+		if (batch.rows)
+			acc_batch_end(1, &n);
+		acc_async_latency(logs, log_sum, log_oldest);
+
+		if (spool_size > spool_off && time(NULL) >= retry_at)
+			acc_spool_replay(max);
+
+		if (acc_q->dropped != reported) {
+			LM_WARN("%lu records dropped so far (queue full), the acc "
+				"writer is not keeping up\n", acc_q->dropped);
+			reported = acc_q->dropped;
+		}
+
+		if (i < max && (spool_size <= spool_off || db_down))
+			usleep(DB_BULKQ_IDLE);
+	}
+}
+
+
+#ifdef STATISTICS
+unsigned long acc_async_get_queued(void *foo)
+{
+	return acc_q ? acc_q->queued : 0;
+}
+
+unsigned long acc_async_get_dropped(void *foo)
+{
+	return acc_q ? acc_q->dropped : 0;
+}
+
+unsigned long acc_async_get_written(void *foo)
+{
+	return acc_q ? acc_q->written : 0;
+}
+
+unsigned long acc_async_get_failed(void *foo)
+{
+	return acc_q ? acc_q->failed : 0;
+}
+
+unsigned long acc_async_get_depth(void *foo)
+{
+	return acc_q ? acc_q->rows : 0;
+}
+
+unsigned long acc_async_get_load(void *foo)
+{
+	return acc_q ? db_bulkq_load(acc_q) : 0;
+}
+
+unsigned long acc_async_get_latency(void *foo)
+{
+	return acc_st ? acc_st->latency : 0;
+}
+
+unsigned long acc_async_get_latency_max(void *foo)
+{
+	return acc_st ? acc_st->latency_max : 0;
+}
+
+unsigned long acc_async_get_spooled(void *foo)
+{
+	return acc_st ? acc_st->spooled : 0;
+}
+
+unsigned long acc_async_get_replayed(void *foo)
+{
+	return acc_st ? acc_st->replayed : 0;
+}
+#endif
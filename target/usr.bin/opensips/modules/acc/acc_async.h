@@ -0,0 +1,87 @@
+/*
+ * Asynchronous accounting - the records are written by the acc writer
+ * process
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#ifndef _ACC_ASYNC_H_
+#define _ACC_ASYNC_H_
+
+#include "../../str.h"
+#include "../../db/db_val.h"
+#include "../../db/db_insertq.h"
+#include "acc.h"
+#include "acc_extra.h"
+
+/* kinds of queued records */
+#define ACC_Q_LOG       0  /* a syslog line */
+#define ACC_Q_DB        1  /* an acc / missed calls row */
+#define ACC_Q_DB_CDRS   2  /* a CDR row (dialog based accounting) */
+
+#define ACC_Q_MAX_COLS  (ACC_CORE_LEN+1+ACC_DLG_LEN+MAX_ACC_EXTRA+MAX_ACC_LEG)
+
+/* how often the backend is retried when down and rows are spooled (s) */
+#define ACC_SPOOL_RETRY 10
+
+/* size of the shared memory queue; 0 writes from the SIP workers */
+extern unsigned int acc_async_queue_size;
+/* file the rows are kept in while the database is down */
+extern char *acc_spool_file;
+extern int acc_spool_retry;
+
+/* creates the queue - before forking */
+int acc_async_init(void);
+
+void acc_async_destroy(void);
+
+/* are the records handed to the acc writer ? */
+int acc_async_on(void);
+
+/* queues a database row of "n" values, of the given ACC_Q_DB* kind */
+int acc_async_push(int kind, str *table, db_val_t *vals, int n);
+
+/* queues a syslog line, formatted as for LM_GEN2() */
+void acc_async_log(char *fmt, ...);
+
+/* main loop of the acc writer process - never returns */
+void acc_async_writer(void);
+
+/* exported by acc.c - write a popped record in the writer process */
+int acc_db_write(int kind, str *table, db_val_t *vals, int n,
+		query_list_t **ql);
+int acc_db_flush(query_list_t *ql);
+void acc_log_write(str *line);
+
+#ifdef STATISTICS
+#include "../../statistics.h"
+
+unsigned long acc_async_get_queued(void *foo);
+unsigned long acc_async_get_dropped(void *foo);
+unsigned long acc_async_get_written(void *foo);
+unsigned long acc_async_get_failed(void *foo);
+unsigned long acc_async_get_depth(void *foo);
+unsigned long acc_async_get_load(void *foo);
+unsigned long acc_async_get_latency(void *foo);
+unsigned long acc_async_get_latency_max(void *foo);
+unsigned long acc_async_get_spooled(void *foo);
+unsigned long acc_async_get_replayed(void *foo);
+#endif
+
+#endif
@@ -63,6 +63,7 @@
 #include "acc_mod.h"
 #include "acc_extra.h"
 #include "acc_logic.h"
+#include "acc_async.h"
 
 struct dlg_binds dlg_api;
 struct tm_binds tmb;
@@ -71,6 +72,7 @@ struct rr_binds rrb;
 static int mod_init(void);
 static void destroy(void);
 static int child_init(int rank);
+static void acc_writer_process(int rank);
 
 
 /* ----- General purpose variables ----------- */
@@ -289,9 +291,34 @@ static param_export_t params[] = {
 	{"acc_sip_reason_column",STR_PARAM, &acc_sipreason_col.s  },
 	{"acc_time_column",      STR_PARAM, &acc_time_col.s       },
 	{"acc_created_avp_name", STR_PARAM, &acc_created_avp_name.s},
+	/* asynchronous writing */
+	{"async_queue_size",     INT_PARAM, &acc_async_queue_size },
+	{"async_spool_file",     STR_PARAM, &acc_spool_file       },
+	{"async_spool_retry",    INT_PARAM, &acc_spool_retry      },
 	{0,0,0}
 };
 
+static proc_export_t procs[] = {
+	{"acc writer",  0,  0, acc_writer_process, 1, 0},
+	{0,0,0,0,0,0}
+};
+
+#ifdef STATISTICS
+static stat_export_t acc_stats[] = {
+	{"async_queued",      STAT_IS_FUNC, (stat_var**)acc_async_get_queued      },
+	{"async_dropped",     STAT_IS_FUNC, (stat_var**)acc_async_get_dropped     },
+	{"async_written",     STAT_IS_FUNC, (stat_var**)acc_async_get_written     },
+	{"async_failed",      STAT_IS_FUNC, (stat_var**)acc_async_get_failed      },
+	{"async_queue_depth", STAT_IS_FUNC, (stat_var**)acc_async_get_depth       },
+	{"async_queue_load",  STAT_IS_FUNC, (stat_var**)acc_async_get_load        },
+	{"async_latency",     STAT_IS_FUNC, (stat_var**)acc_async_get_latency     },
+	{"async_latency_max", STAT_IS_FUNC, (stat_var**)acc_async_get_latency_max },
+	{"async_spooled",     STAT_IS_FUNC, (stat_var**)acc_async_get_spooled     },
+	{"async_replayed",    STAT_IS_FUNC, (stat_var**)acc_async_get_replayed    },
+	{0,0,0}
+};
+#endif
+
 static module_dependency_t *get_deps_aaa_url(param_export_t *param)
 {
 	char *aaa_url = *(char **)param->param_pointer;
@@ -345,10 +372,14 @@ struct module_exports exports= {
 	cmds,       /* exported functions */
 	0,          /* exported async functions */
 	params,     /* exported params */
+#ifdef STATISTICS
+	acc_stats,  /* exported statistics */
+#else
 	0,          /* exported statistics */
+#endif
 	0,          /* exported MI functions */
 	0,          /* exported pseudo-variables */
-	0,          /* extra processes */
+	procs,      /* extra processes */
 	mod_init,   /* initialization module */
 	0,          /* response function */
 	destroy,    /* destroy function */
@@ -697,13 +728,22 @@ static int mod_init( void )
 					"for ongoing calls will be lost after restart\n");
 	}
 
+	/* ------------ ASYNC INIT SECTION ----------- */
+
+	if (acc_async_init() < 0) {
+		LM_ERR("failed to init the asynchronous writing\n");
+		return -1;
+	}
+	procs[0].no = acc_async_on() ? 1 : 0;
+
 	return 0;
 }
 
 
 static int child_init(int rank)
 {
-	if(db_url.s && acc_db_init_child(&db_url)<0) {
+	/* the rows are written by the acc writer */
+	if(db_url.s && !acc_async_on() && acc_db_init_child(&db_url)<0) {
 		LM_ERR("could not open database connection");
 		return -1;
 	}
@@ -736,6 +776,19 @@ static int child_init(int rank)
 }
 
 
+static void acc_writer_process(int rank)
+{
+	if (db_url.s && acc_db_init_child(&db_url) < 0) {
+		LM_ERR("could not open database connection\n");
+		return;
+	}
+
+	acc_async_writer();
+
+	acc_db_close();
+}
+
+
 static void destroy(void)
 {
 	if (log_extra)
@@ -743,6 +796,7 @@ static void destroy(void)
 	if (log_extra_bye)
 		destroy_extras( log_extra_bye);
 	acc_db_close();
+	acc_async_destroy();
 	if (db_extra)
 		destroy_extras( db_extra);
 	if (db_extra_bye)
@@ -215,6 +215,7 @@ auth_result_t pre_auth(struct sip_msg* _m, str* _realm, hdr_types_t _hftype,
 
 	if (is_nonce_stale(&c->digest.nonce)) {
 		LM_DBG("stale nonce value received\n");
+		update_stat(stale_nonces, 1);
 		c->stale = 1;
 		return STALE_NONCE;
 	}
@@ -229,6 +230,32 @@ auth_result_t pre_auth(struct sip_msg* _m, str* _realm, hdr_types_t _hftype,
 }
 
 
+/*
+ * Converts the 8 hex digits of the nonce-count; 0 if missing or invalid
+ */
+static inline unsigned int nc2int(str *nc)
+{
+	unsigned int i, res = 0;
+
+	if (nc->s == NULL || nc->len != 8)
+		return 0;
+
+	for (i = 0; i < 8; i++) {
+		res <<= 4;
+		if (nc->s[i] >= '0' && nc->s[i] <= '9')
+			res += nc->s[i] - '0';
+		else if (nc->s[i] >= 'a' && nc->s[i] <= 'f')
+			res += nc->s[i] - 'a' + 10;
+		else if (nc->s[i] >= 'A' && nc->s[i] <= 'F')
+			res += nc->s[i] - 'A' + 10;
+		else
+			return 0;
+	}
+
+	return res;
+}
+
+
 /*
  * Purpose of this function is to do post authentication steps like
  * marking authorized credentials and so on.
@@ -253,7 +280,7 @@ auth_result_t post_auth(struct sip_msg* _m, struct hdr_field* _h)
 		}
 		LM_DBG("nonce index= %d\n", index);
 
-		if(!is_nonce_index_valid(index)) {
+		if(!is_nonce_index_valid(index, nc2int(&c->digest.nc))) {
 			LM_DBG("nonce index not valid\n");
 			c->stale = 1;
 			return STALE_NONCE;
@@ -28,6 +28,7 @@
  * 2003-04-28 rpid contributed by Juha Heinanen added (janakj)
  * 2005-05-31 general avp specification added for rpid (bogdan)
  * 2006-03-01 pseudo variables support for domain name (bogdan)
+ * 2016-10-19 nonce reuse with nonce-count tracking, nonce statistics
  */
 
 
@@ -113,6 +114,14 @@ int* sec_monit= NULL;
 int* second= NULL;
 int* next_index= NULL;
 int disable_nonce_check = 0;
+int max_nonce_index = DEF_MAX_NONCE_INDEX;
+/* if set, a nonce may be reused with higher nonce-counts */
+unsigned int nonce_nc_window = 0;
+unsigned long long* nonce_nc= NULL;
+
+stat_var *stale_nonces;
+stat_var *replayed_nonces;
+stat_var *reused_nonces;
 
 /*
  * Exported functions
@@ -155,6 +164,15 @@ static param_export_t params[] = {
 	{"password_spec",       STR_PARAM, &passwd_spec_param  },
 	{"calculate_ha1",       INT_PARAM, &auth_calc_ha1      },
 	{"disable_nonce_check", INT_PARAM, &disable_nonce_check},
+	{"max_nonce_index",     INT_PARAM, &max_nonce_index    },
+	{"nonce_nc_window",     INT_PARAM, &nonce_nc_window    },
+	{0, 0, 0}
+};
+
+static stat_export_t auth_stats[] = {
+	{"stale_nonces",    0, &stale_nonces    },
+	{"replayed_nonces", 0, &replayed_nonces },
+	{"reused_nonces",   0, &reused_nonces   },
 	{0, 0, 0}
 };
 
@@ -180,7 +198,7 @@ struct module_exports exports = {
 	cmds,
 	0,
 	params,
-	0,          /* exported statistics */
+	auth_stats, /* exported statistics */
 	0,          /* exported MI functions */
 	0,          /* exported pseudo-variables */
 	0,          /* extra processes */
@@ -294,6 +312,12 @@ static int mod_init(void)
 
 	if(!disable_nonce_check)
 	{
+		if(max_nonce_index <= 0)
+		{
+			LM_ERR("invalid max_nonce_index %d\n", max_nonce_index);
+			return -9;
+		}
+
 		nonce_lock = (gen_lock_t*)lock_alloc();
 		if(nonce_lock== NULL)
 		{
@@ -331,6 +355,29 @@ static int mod_init(void)
 			return -10;
 		}
 		*next_index= -1;
+
+		if(nonce_nc_window)
+		{
+			if(nonce_nc_window > MAX_NC_WINDOW)
+			{
+				LM_WARN("nonce_nc_window %u too large, using %d\n",
+					nonce_nc_window, MAX_NC_WINDOW);
+				nonce_nc_window = MAX_NC_WINDOW;
+			}
+			nonce_nc= (unsigned long long*)shm_malloc(
+				max_nonce_index* sizeof(unsigned long long));
+			if(nonce_nc== NULL)
+			{
+				LM_ERR("no more share memory\n");
+				return -10;
+			}
+			memset(nonce_nc, 0, max_nonce_index* sizeof(unsigned long long));
+		}
+	}
+	else if(nonce_nc_window)
+	{
+		LM_WARN("nonce_nc_window needs the nonce check, ignoring it\n");
+		nonce_nc_window = 0;
 	}
 
 	return 0;
@@ -358,6 +405,8 @@ static void destroy(void)
 			shm_free(sec_monit);
 		if(next_index)
 			shm_free(next_index);
+		if(nonce_nc)
+			shm_free(nonce_nc);
 	}
 }
 
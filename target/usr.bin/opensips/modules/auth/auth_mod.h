@@ -31,9 +31,13 @@
 #include "../../parser/msg_parser.h"    /* struct sip_msg */
 #include "../signaling/signaling.h"
 #include "../../lock_ops.h"
+#include "../../statistics.h"
 
-#define MAX_NONCE_INDEX     100000
-#define NBUF_LEN            (MAX_NONCE_INDEX>>3)
+#define DEF_MAX_NONCE_INDEX 100000
+#define NBUF_LEN            ((max_nonce_index>>3)+1)
+
+/* nonce-count values accepted below the highest one received */
+#define MAX_NC_WINDOW       32
 
 /*
  * Module parameters variables
@@ -54,5 +58,12 @@ extern int* sec_monit;
 extern int* second;
 extern int* next_index;
 extern int disable_nonce_check;
+extern int max_nonce_index;
+extern unsigned int nonce_nc_window;
+extern unsigned long long* nonce_nc;
+
+extern stat_var *stale_nonces;
+extern stat_var *replayed_nonces;
+extern stat_var *reused_nonces;
 
 #endif /* AUTH_MOD_H */
@@ -22,6 +22,7 @@
  * History:
  * --------
  *  2008-05-29  initial version (anca)
+ *  2016-10-19  nonce-count window for reusing nonces
  */
 
 #include <stdio.h>
@@ -42,6 +43,13 @@
 
 #define check_buf_bit(index)  ( nonce_buf[index>>3] & (1<<(index%8)) )
 
+/* nonce-count state of an index: the highest nc received (high word) and
+ * the bitmap of the nc values received below it (low word, bit k stands
+ * for highest-1-k) */
+#define NC_MAX(_w)     ((unsigned int)((_w)>>32))
+#define NC_BITS(_w)    ((unsigned int)(_w))
+#define NC_WORD(_m,_b) ((((unsigned long long)(_m))<<32) | (_b))
+
 /*
  *  Get a valid index for the new nonce
  */
@@ -66,7 +74,7 @@ int reserve_nonce_index(void)
         if(*second!= curr_sec)
         {
             /* get the index for the next nonce */
-			index= (*next_index==MAX_NONCE_INDEX)?MAX_NONCE_INDEX-1:*next_index -1;
+			index= (*next_index==max_nonce_index)?max_nonce_index-1:*next_index -1;
 
 			/* set the interval in sec_monit vector */
             if(curr_sec> *second)
@@ -88,7 +96,7 @@ int reserve_nonce_index(void)
 
     if(sec_monit[curr_sec]== -1) /* if in the first second*/
     {
-        if(*next_index == MAX_NONCE_INDEX)
+        if(*next_index == max_nonce_index)
         {
             lock_release(nonce_lock);
             return -1;
@@ -100,7 +108,7 @@ int reserve_nonce_index(void)
     if(*next_index> sec_monit[curr_sec]) /* if at the end of the buffer */
     {
         /* if at the end of the buffer */
-        if(*next_index == MAX_NONCE_INDEX)
+        if(*next_index == max_nonce_index)
         {
             *next_index = 0;
             goto index_smaller;
@@ -118,6 +126,8 @@ index_smaller:
 
 done:
 	unset_buf_bit(*next_index);
+	if(nonce_nc)
+		nonce_nc[*next_index] = 0;
     index= *next_index;
     *next_index = *next_index + 1;
     LM_DBG("second= %d, sec_monit= %d,  index= %d\n", *second, sec_monit[curr_sec], index);
@@ -126,15 +136,57 @@ done:
 }
 
 /*
- *  Check if the nonce has been used before
+ *  Accepts a nonce-count if higher than all the previous ones, or if not
+ *  yet received and inside the window below the highest one; called with
+ *  the nonce lock held
  */
+static int use_nonce_count(int index, unsigned int nc)
+{
+    unsigned long long w;
+    unsigned int max, bits, shift;
+
+    w = nonce_nc[index];
+    max = NC_MAX(w);
+    bits = NC_BITS(w);
+
+    if(nc > max)
+    {
+        /* slide the window up to the new nc */
+        shift = nc - max;
+        if(max == 0 || shift > 32)
+            bits = 0;
+        else
+            bits = (shift==32 ? 0 : bits<<shift) | (1U<<(shift-1));
+        nonce_nc[index] = NC_WORD(nc, bits);
+    }
+    else if(nc == max || max - nc > nonce_nc_window)
+    {
+        return 0;
+    }
+    else
+    {
+        if(bits & (1U<<(max-nc-1)))
+            return 0;
+        nonce_nc[index] = NC_WORD(max, bits | (1U<<(max-nc-1)));
+    }
+
+    if(max)
+        update_stat(reused_nonces, 1);
+    return 1;
+}
+
 
+/*
+ *  Check if the nonce has been used before; with a nonce-count window,
+ *  checks the "nc" of the request instead (0 if none was received)
+ */
 
-int is_nonce_index_valid(int index)
+
+int is_nonce_index_valid(int index, unsigned int nc)
 {
-    /* if greater than MAX_NONCE_INDEX ->error */
+    /* if greater than max_nonce_index ->error */
 
-    if(index>= MAX_NONCE_INDEX )
+    if(index < 0 || index>= max_nonce_index )
     {
         LM_ERR("index greater than buffer length\n");
         return 0;
@@ -148,15 +200,9 @@ int is_nonce_index_valid(int index)
         if(index>= *next_index)
         {
             LM_DBG("index out of range\n");
-            lock_release(nonce_lock);
-            return 0;
-        }
-        else
-        {
-            set_buf_bit(index);
-            lock_release(nonce_lock);
-            return 1;
+            goto error;
         }
+        goto check_use;
     }
 
     /* check if right interval */
@@ -177,11 +223,28 @@ int is_nonce_index_valid(int index)
         }
     }
 
+check_use:
+    if(nonce_nc)
+    {
+        /* requests without qop have no nonce-count - one use only */
+        if(!use_nonce_count(index, nc ? nc : 1))
+        {
+            lock_release(nonce_lock);
+            LM_DBG("nonce-count %u already used or too old\n", nc);
+            update_stat(replayed_nonces, 1);
+            return 0;
+        }
+        lock_release(nonce_lock);
+        return 1;
+    }
+
     /* check if the first time used */
     if(check_buf_bit(index))
     {
+        lock_release(nonce_lock);
         LM_DBG("nonce already used\n");
-        goto error;
+        update_stat(replayed_nonces, 1);
+        return 0;
     }
 
     set_buf_bit(index);
@@ -193,4 +256,3 @@ error:
     return 0;
 
 }
-
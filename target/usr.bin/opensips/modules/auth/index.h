@@ -33,8 +33,8 @@
 int reserve_nonce_index(void);
 
 /*
- * Check index validity
+ * Check index validity; "nc" is the nonce-count of the request, 0 if none
  */
-int is_nonce_index_valid(int index);
+int is_nonce_index_valid(int index, unsigned int nc);
 
 #endif
@@ -0,0 +1,552 @@
+/*
+ * Digest Authentication - shared memory credential cache
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  created - username+realm -> ha1/ha1b + credentials cache,
+ *               with negative caching
+ */
+
+#include <string.h>
+#include <sys/time.h>
+#include "../../dprint.h"
+#include "../../ut.h"
+#include "../../locking.h"
+#include "../../hash_func.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "../../statistics.h"
+#include "authdb_mod.h"
+#include "authdb_cache.h"
+
+#define AUTH_CENTRY_UNKNOWN  (1<<0)   /* negative entry */
+#define AUTH_CENTRY_HA1B     (1<<1)   /* secret read from password_column_2 */
+
+#define AUTH_ALIGN(_n) \
+	(((_n) + sizeof(long) - 1) & ~(sizeof(long) - 1))
+
+struct auth_centry {
+	struct auth_centry *next;
+	unsigned int flags;
+	unsigned int expires;          /* in ticks */
+	str table;
+	str user;
+	str domain;
+	struct auth_creds *creds;      /* NULL for the negative entries */
+};
+
+struct auth_cbucket {
+	struct auth_centry *first;
+	unsigned int no;
+	gen_lock_t lock;
+};
+
+struct auth_cache_stats {
+	unsigned long db_latency;      /* moving average (us) */
+	unsigned long db_latency_max;
+};
+
+int auth_cache_size    = 0;    /* buckets; 0 disables the cache */
+int auth_cache_ttl     = 300;
+int auth_cache_neg_ttl = 30;
+
+static struct auth_cbucket *auth_cache = NULL;
+static struct auth_cache_stats *auth_st = NULL;
+
+stat_var *auth_cache_hits;
+stat_var *auth_cache_neg_hits;
+stat_var *auth_cache_misses;
+stat_var *auth_cache_entries;
+stat_var *auth_db_queries;
+stat_var *auth_db_failed;
+
+
+int init_auth_cache(void)
+{
+	unsigned int size;
+	int i;
+
+	auth_st = shm_malloc(sizeof *auth_st);
+	if (auth_st == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(auth_st, 0, sizeof *auth_st);
+
+	if (auth_cache_size <= 0)
+		return 0;
+
+	/* the hash needs a power of 2 */
+	for (size = 1; size < (unsigned int)auth_cache_size; size <<= 1);
+	if (size != (unsigned int)auth_cache_size)
+		LM_INFO("cache_size rounded up to %u\n", size);
+	auth_cache_size = size;
+
+	if (auth_cache_ttl <= 0) {
+		LM_ERR("invalid cache_ttl %d\n", auth_cache_ttl);
+		return -1;
+	}
+
+	auth_cache = shm_malloc(size * sizeof *auth_cache);
+	if (auth_cache == NULL) {
+		LM_ERR("no more shm memory for %u buckets\n", size);
+		return -1;
+	}
+	memset(auth_cache, 0, size * sizeof *auth_cache);
+
+	for (i = 0; i < size; i++) {
+		if (lock_init(&auth_cache[i].lock) == NULL) {
+			LM_ERR("failed to init lock\n");
+			for (i--; i >= 0; i--)
+				lock_destroy(&auth_cache[i].lock);
+			shm_free(auth_cache);
+			auth_cache = NULL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+void destroy_auth_cache(void)
+{
+	struct auth_centry *e, *next;
+	int i;
+
+	if (auth_cache) {
+		for (i = 0; i < auth_cache_size; i++) {
+			for (e = auth_cache[i].first; e; e = next) {
+				next = e->next;
+				shm_free(e);
+			}
+			lock_destroy(&auth_cache[i].lock);
+		}
+		shm_free(auth_cache);
+		auth_cache = NULL;
+	}
+
+	if (auth_st) {
+		shm_free(auth_st);
+		auth_st = NULL;
+	}
+}
+
+
+int auth_cache_on(void)
+{
+	return auth_cache != NULL;
+}
+
+
+int auth_creds_size(struct auth_creds *creds)
+{
+	int i, size;
+
+	size = sizeof *creds + creds->n * sizeof *creds->vals + creds->secret.len;
+	for (i = 0; i < creds->n; i++)
+		if (creds->vals[i].type == AUTH_CVAL_STR)
+			size += creds->vals[i].s.len;
+
+	return size;
+}
+
+
+struct auth_creds *auth_creds_pack(struct auth_creds *creds, char *buf,
+		int size)
+{
+	struct auth_creds *c;
+	char *p;
+	int i;
+
+	if (size < auth_creds_size(creds)) {
+		LM_BUG("%d bytes are too few for the credentials\n", size);
+		return NULL;
+	}
+
+	c = (struct auth_creds *)buf;
+	c->n = creds->n;
+	c->vals = (struct auth_cval *)(c + 1);
+	p = (char *)(c->vals + c->n);
+
+	c->secret.s = p;
+	c->secret.len = creds->secret.len;
+	memcpy(p, creds->secret.s, creds->secret.len);
+	p += creds->secret.len;
+
+	for (i = 0; i < creds->n; i++) {
+		c->vals[i] = creds->vals[i];
+		if (creds->vals[i].type == AUTH_CVAL_STR) {
+			c->vals[i].s.s = p;
+			memcpy(p, creds->vals[i].s.s, creds->vals[i].s.len);
+			p += creds->vals[i].s.len;
+		}
+	}
+
+	return c;
+}
+
+
+static inline str *auth_cache_domain(str *domain)
+{
+	static str no_domain = {NULL, 0};
+
+	/* without "use_domain", the realm does not select the row */
+	return (use_domain && domain) ? domain : &no_domain;
+}
+
+
+static inline int auth_centry_match(struct auth_centry *e, str *table,
+		str *user, str *domain, int ha1b)
+{
+	return ((e->flags & AUTH_CENTRY_HA1B) ? 1 : 0) == (ha1b ? 1 : 0) &&
+		e->user.len == user->len && e->domain.len == domain->len &&
+		e->table.len == table->len &&
+		memcmp(e->user.s, user->s, user->len) == 0 &&
+		memcmp(e->domain.s, domain->s, domain->len) == 0 &&
+		memcmp(e->table.s, table->s, table->len) == 0;
+}
+
+
+static inline void auth_centry_unlink(struct auth_cbucket *b,
+		struct auth_centry *e, struct auth_centry *prev)
+{
+	if (prev)
+		prev->next = e->next;
+	else
+		b->first = e->next;
+	b->no--;
+	update_stat(auth_cache_entries, -1);
+	shm_free(e);
+}
+
+
+int auth_cache_fetch(str *table, str *user, str *domain, int ha1b,
+		struct auth_creds **creds)
+{
+	struct auth_cbucket *b;
+	struct auth_centry *e, *prev;
+	unsigned int now;
+	char *buf;
+	int size, ret;
+
+	*creds = NULL;
+	if (auth_cache == NULL)
+		return -1;
+
+	domain = auth_cache_domain(domain);
+	b = &auth_cache[core_hash(user, domain, auth_cache_size)];
+	now = get_ticks();
+	ret = -1;
+
+	lock_get(&b->lock);
+
+	for (prev = NULL, e = b->first; e; prev = e, e = e->next) {
+		if (!auth_centry_match(e, table, user, domain, ha1b))
+			continue;
+
+		if (e->expires <= now) {
+			auth_centry_unlink(b, e, prev);
+			break;
+		}
+
+		if (e->creds == NULL) {
+			ret = 1;
+			break;
+		}
+
+		size = auth_creds_size(e->creds);
+		buf = pkg_malloc(size);
+		if (buf == NULL) {
+			LM_ERR("no more pkg memory\n");
+			break;
+		}
+		*creds = auth_creds_pack(e->creds, buf, size);
+		ret = 0;
+		break;
+	}
+
+	lock_release(&b->lock);
+
+	if (ret == 0)
+		update_stat(auth_cache_hits, 1);
+	else if (ret == 1)
+		update_stat(auth_cache_neg_hits, 1);
+	else
+		update_stat(auth_cache_misses, 1);
+
+	return ret;
+}
+
+
+int auth_cache_store(str *table, str *user, str *domain, int ha1b,
+		struct auth_creds *creds)
+{
+	struct auth_cbucket *b;
+	struct auth_centry *e, *it, *prev, *old, *old_prev;
+	int size, csize;
+	char *p;
+
+	if (auth_cache == NULL)
+		return 0;
+
+	if (creds == NULL && auth_cache_neg_ttl <= 0)
+		return 0;
+
+	domain = auth_cache_domain(domain);
+
+	size = AUTH_ALIGN(sizeof *e + table->len + user->len + domain->len);
+	csize = creds ? auth_creds_size(creds) : 0;
+
+	e = shm_malloc(size + csize);
+	if (e == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(e, 0, sizeof *e);
+
+	p = (char *)(e + 1);
+	e->table.s = p;
+	e->table.len = table->len;
+	memcpy(p, table->s, table->len);
+	p += table->len;
+	e->user.s = p;
+	e->user.len = user->len;
+	memcpy(p, user->s, user->len);
+	p += user->len;
+	e->domain.s = p;
+	e->domain.len = domain->len;
+	memcpy(p, domain->s, domain->len);
+
+	if (ha1b)
+		e->flags |= AUTH_CENTRY_HA1B;
+	if (creds) {
+		e->creds = auth_creds_pack(creds, (char *)e + size, csize);
+		e->expires = get_ticks() + auth_cache_ttl;
+	} else {
+		e->flags |= AUTH_CENTRY_UNKNOWN;
+		e->expires = get_ticks() + auth_cache_neg_ttl;
+	}
+
+	b = &auth_cache[core_hash(user, domain, auth_cache_size)];
+
+	lock_get(&b->lock);
+
+	/* replace a previous version, keeping an eye on the oldest entry */
+	old = old_prev = prev = NULL;
+	it = b->first;
+	while (it) {
+		if (auth_centry_match(it, table, user, domain, ha1b)) {
+			auth_centry_unlink(b, it, prev);
+			it = prev ? prev->next : b->first;
+			continue;
+		}
+		if (old == NULL || it->expires < old->expires) {
+			old = it;
+			old_prev = prev;
+		}
+		prev = it;
+		it = it->next;
+	}
+
+	if (b->no >= AUTH_CACHE_BUCKET_MAX && old)
+		auth_centry_unlink(b, old, old_prev);
+
+	e->next = b->first;
+	b->first = e;
+	b->no++;
+	update_stat(auth_cache_entries, 1);
+
+	lock_release(&b->lock);
+
+	return 0;
+}
+
+
+static int auth_cache_purge_bucket(struct auth_cbucket *b, str *user,
+		str *domain, unsigned int now)
+{
+	struct auth_centry *e, *prev;
+	int n = 0;
+
+	lock_get(&b->lock);
+
+	prev = NULL;
+	e = b->first;
+	while (e) {
+		if ((now && e->expires <= now) || (!now && (user == NULL ||
+		(e->user.len == user->len &&
+			memcmp(e->user.s, user->s, user->len) == 0 &&
+			(domain == NULL || (e->domain.len == domain->len &&
+				memcmp(e->domain.s, domain->s, domain->len) == 0)))))) {
+			auth_centry_unlink(b, e, prev);
+			e = prev ? prev->next : b->first;
+			n++;
+			continue;
+		}
+		prev = e;
+		e = e->next;
+	}
+
+	lock_release(&b->lock);
+
+	return n;
+}
+
+
+int auth_cache_invalidate(str *user, str *domain)
+{
+	int i, n;
+
+	if (auth_cache == NULL)
+		return 0;
+
+	/* a given user and domain live in a single bucket */
+	if (user && (domain || !use_domain)) {
+		domain = auth_cache_domain(domain);
+		return auth_cache_purge_bucket(
+			&auth_cache[core_hash(user, domain, auth_cache_size)],
+			user, domain, 0);
+	}
+
+	for (i = 0, n = 0; i < auth_cache_size; i++)
+		n += auth_cache_purge_bucket(&auth_cache[i], user, NULL, 0);
+
+	return n;
+}
+
+
+void auth_cache_timer(unsigned int ticks, void *param)
+{
+	int i, n;
+
+	if (auth_cache == NULL)
+		return;
+
+	for (i = 0, n = 0; i < auth_cache_size; i++)
+		if (auth_cache[i].first)
+			n += auth_cache_purge_bucket(&auth_cache[i], NULL, NULL, ticks);
+
+	if (n)
+		LM_DBG("%d expired credentials dropped\n", n);
+}
+
+
+utime_t auth_cache_now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (utime_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+void auth_cache_db_latency(utime_t us, int failed)
+{
+	unsigned long lat = (unsigned long)us;
+
+	if (auth_st == NULL)
+		return;
+
+	update_stat(auth_db_queries, 1);
+	if (failed) {
+		update_stat(auth_db_failed, 1);
+		return;
+	}
+
+	/* moving average, 1/8 weight for the new query; lossy under
+	 * contention, but that is fine for a statistic */
+	auth_st->db_latency = auth_st->db_latency - auth_st->db_latency / 8 +
+		lat / 8;
+	if (lat > auth_st->db_latency_max)
+		auth_st->db_latency_max = lat;
+}
+
+
+/*
+ * MI function - drops the cached credentials
+ * Params: [user [domain]]
+ */
+struct mi_root *mi_auth_cache_flush(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *node;
+	str *user, *domain;
+	int n, len;
+	char *p;
+
+	if (auth_cache == NULL)
+		return init_mi_tree(400, MI_SSTR("Cache disabled"));
+
+	user = domain = NULL;
+	node = cmd->node.kids;
+	if (node) {
+		if (node->value.s == NULL || node->value.len == 0)
+			return init_mi_tree(400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
+		user = &node->value;
+		node = node->next;
+		if (node) {
+			if (node->value.s == NULL || node->next)
+				return init_mi_tree(400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
+			domain = &node->value;
+		}
+	}
+
+	n = auth_cache_invalidate(user, domain);
+
+	rpl_tree = init_mi_tree(200, MI_OK_S, MI_OK_LEN);
+	if (rpl_tree == NULL)
+		return NULL;
+
+	p = int2str((unsigned long)n, &len);
+	if (add_mi_node_child(&rpl_tree->node, MI_DUP_VALUE, MI_SSTR("removed"),
+	p, len) == NULL) {
+		free_mi_tree(rpl_tree);
+		return NULL;
+	}
+
+	return rpl_tree;
+}
+
+
+#ifdef STATISTICS
+
+/* percentage of the lookups answered by the cache */
+unsigned long auth_cache_get_hit_ratio(void *foo)
+{
+	unsigned long hits, total;
+
+	hits = get_stat_val(auth_cache_hits) + get_stat_val(auth_cache_neg_hits);
+	total = hits + get_stat_val(auth_cache_misses);
+	return total ? hits * 100 / total : 0;
+}
+
+unsigned long auth_cache_get_db_latency(void *foo)
+{
+	return auth_st ? auth_st->db_latency : 0;
+}
+
+unsigned long auth_cache_get_db_latency_max(void *foo)
+{
+	return auth_st ? auth_st->db_latency_max : 0;
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * Digest Authentication - shared memory credential cache
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  created - username+realm -> ha1/ha1b + credentials cache,
+ *               with negative caching
+ */
+
+#ifndef _AUTHDB_CACHE_H_
+#define _AUTHDB_CACHE_H_
+
+#include "../../str.h"
+#include "../../timer.h"
+#include "../../mi/mi.h"
+
+/* entries kept per bucket; the oldest one is dropped when full */
+#define AUTH_CACHE_BUCKET_MAX  8
+
+#define AUTH_CVAL_NULL  0
+#define AUTH_CVAL_INT   1
+#define AUTH_CVAL_STR   2
+
+/* value of a "load_credentials" column */
+struct auth_cval {
+	int type;
+	int n;
+	str s;
+};
+
+/* the columns fetched for a subscriber, as read from the database or
+ * copied out of the cache (one pkg chunk, free with pkg_free) */
+struct auth_creds {
+	str secret;                /* ha1, ha1b or the plain text password */
+	int n;
+	struct auth_cval *vals;    /* "n" values, in "credentials" order */
+};
+
+extern int auth_cache_size;
+extern int auth_cache_ttl;
+extern int auth_cache_neg_ttl;
+
+/* creates the cache - before forking; does nothing if disabled */
+int init_auth_cache(void);
+
+void destroy_auth_cache(void);
+
+int auth_cache_on(void);
+
+/* bytes needed by auth_creds_pack() */
+int auth_creds_size(struct auth_creds *creds);
+
+/* copies the credentials into the "size" bytes of "buf" */
+struct auth_creds *auth_creds_pack(struct auth_creds *creds, char *buf,
+		int size);
+
+/* looks up a subscriber; "ha1b" tells which password column is wanted.
+ * Returns 0 if found (creds allocated in pkg), 1 if cached as unknown
+ * or -1 if not in the cache */
+int auth_cache_fetch(str *table, str *user, str *domain, int ha1b,
+		struct auth_creds **creds);
+
+/* caches the credentials of a subscriber, or its absence if NULL */
+int auth_cache_store(str *table, str *user, str *domain, int ha1b,
+		struct auth_creds *creds);
+
+/* drops the entries of a user (of any domain if NULL) or all the entries
+ * if the user is NULL; returns the number of removed entries */
+int auth_cache_invalidate(str *user, str *domain);
+
+/* accounts a database lookup which took "us" microseconds */
+void auth_cache_db_latency(utime_t us, int failed);
+
+utime_t auth_cache_now_us(void);
+
+void auth_cache_timer(unsigned int ticks, void *param);
+
+struct mi_root *mi_auth_cache_flush(struct mi_root *cmd, void *param);
+
+#ifdef STATISTICS
+#include "../../statistics.h"
+
+extern stat_var *auth_cache_hits;
+extern stat_var *auth_cache_neg_hits;
+extern stat_var *auth_cache_misses;
+extern stat_var *auth_cache_entries;
+extern stat_var *auth_db_queries;
+extern stat_var *auth_db_failed;
+
+unsigned long auth_cache_get_hit_ratio(void *foo);
+unsigned long auth_cache_get_db_latency(void *foo);
+unsigned long auth_cache_get_db_latency_max(void *foo);
+#endif
+
+#endif
@@ -30,6 +30,7 @@
  * 2005-05-31  general definition of AVPs in credentials now accepted - ID AVP,
  *             STRING AVP, AVP aliases (bogdan)
  * 2006-03-01 pseudo variables support for domain name (bogdan)
+ * 2016-10-19 credentials cache, async www/proxy_authorize
  */
 
 #include <stdio.h>
@@ -40,10 +41,14 @@
 #include "../../error.h"
 #include "../../mod_fix.h"
 #include "../../mem/mem.h"
+#include "../../timer.h"
+#include "../../route.h"
+#include "../../mi/mi.h"
 #include "../auth/api.h"
 #include "../signaling/signaling.h"
 #include "aaa_avps.h"
 #include "authorize.h"
+#include "authdb_cache.h"
 
 
 
@@ -69,6 +74,8 @@ static int mod_init(void);
 
 static int auth_fixup(void** param, int param_no);
 
+static int w_cache_invalidate(struct sip_msg* msg, char* user, char* domain);
+
 /** SIGNALING binds */
 struct sig_binds sigb;
 
@@ -114,9 +121,24 @@ int skip_version_check      = 0; /* skips version check for custom db */
 static cmd_export_t cmds[] = {
 	{"www_authorize",   (cmd_function)www_authorize,   2, auth_fixup, 0, REQUEST_ROUTE},
 	{"proxy_authorize", (cmd_function)proxy_authorize, 2, auth_fixup, 0, REQUEST_ROUTE},
+	{"auth_db_cache_invalidate", (cmd_function)w_cache_invalidate, 1,
+		fixup_spve_null, 0, REQUEST_ROUTE|FAILURE_ROUTE|ONREPLY_ROUTE|
+		BRANCH_ROUTE|LOCAL_ROUTE|STARTUP_ROUTE|TIMER_ROUTE|EVENT_ROUTE},
+	{"auth_db_cache_invalidate", (cmd_function)w_cache_invalidate, 2,
+		fixup_spve_spve, 0, REQUEST_ROUTE|FAILURE_ROUTE|ONREPLY_ROUTE|
+		BRANCH_ROUTE|LOCAL_ROUTE|STARTUP_ROUTE|TIMER_ROUTE|EVENT_ROUTE},
 	{0, 0, 0, 0, 0, 0}
 };
 
+/*
+ * Exported async functions
+ */
+static acmd_export_t acmds[] = {
+	{"www_authorize",   (acmd_function)w_async_www_authorize,   2, auth_fixup},
+	{"proxy_authorize", (acmd_function)w_async_proxy_authorize, 2, auth_fixup},
+	{0, 0, 0, 0}
+};
+
 
 /*
  * Exported parameters
@@ -131,9 +153,36 @@ static param_export_t params[] = {
 	{"use_domain",        INT_PARAM, &use_domain         },
 	{"load_credentials",  STR_PARAM, &credentials_list   },
 	{"skip_version_check",INT_PARAM, &skip_version_check },
+	{"cache_size",        INT_PARAM, &auth_cache_size    },
+	{"cache_ttl",         INT_PARAM, &auth_cache_ttl     },
+	{"cache_negative_ttl",INT_PARAM, &auth_cache_neg_ttl },
 	{0, 0, 0}
 };
 
+#ifdef STATISTICS
+static stat_export_t auth_db_stats[] = {
+	{"cache_hits",        0,             &auth_cache_hits                      },
+	{"cache_neg_hits",    0,             &auth_cache_neg_hits                  },
+	{"cache_misses",      0,             &auth_cache_misses                    },
+	{"cache_hit_ratio",   STAT_IS_FUNC, (stat_var**)auth_cache_get_hit_ratio   },
+	{"cache_entries",     STAT_NO_RESET, &auth_cache_entries                   },
+	{"db_queries",        0,             &auth_db_queries                      },
+	{"db_failed",         0,             &auth_db_failed                       },
+	{"db_latency",        STAT_IS_FUNC, (stat_var**)auth_cache_get_db_latency  },
+	{"db_latency_max",    STAT_IS_FUNC, (stat_var**)auth_cache_get_db_latency_max },
+	{0, 0, 0}
+};
+#endif
+
+/*
+ * Exported MI functions
+ */
+static mi_export_t mi_cmds[] = {
+	{"auth_db_cache_flush", "drops the cached credentials of a user, or all",
+		mi_auth_cache_flush, 0, 0, 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
 static dep_export_t deps = {
 	{ /* OpenSIPS module dependencies */
 		{ MOD_TYPE_DEFAULT, "auth", DEP_ABORT },
@@ -155,10 +204,14 @@ struct module_exports exports = {
 	DEFAULT_DLFLAGS, /* dlopen flags */
 	&deps,           /* OpenSIPS module dependencies */
 	cmds,       /* Exported functions */
-	0,          /* Exported async functions */
+	acmds,      /* Exported async functions */
 	params,     /* Exported parameters */
+#ifdef STATISTICS
+	auth_db_stats, /* exported statistics */
+#else
 	0,          /* exported statistics */
-	0,          /* exported MI functions */
+#endif
+	mi_cmds,    /* exported MI functions */
 	0,          /* exported pseudo-variables */
 	0,          /* extra processes */
 	mod_init,   /* module initialization function */
@@ -222,6 +275,25 @@ static int mod_init(void)
 		return -5;
 	}
 
+	if ((is_script_async_func_used("www_authorize", 2) ||
+	is_script_async_func_used("proxy_authorize", 2)) &&
+	!DB_CAPABILITY(auth_dbf, DB_CAP_ASYNC_RAW_QUERY))
+		LM_WARN("async() calls will work in normal mode due to "
+			"driver limitations\n");
+
+	if (init_auth_cache() < 0) {
+		LM_ERR("failed to create the credentials cache\n");
+		return -1;
+	}
+
+	if (auth_cache_on() &&
+	register_timer("auth_db-cache", auth_cache_timer, 0,
+	auth_cache_neg_ttl > 0 && auth_cache_neg_ttl < 10 ? auth_cache_neg_ttl : 10,
+	TIMER_FLAG_DELAY_ON_DELAY) < 0) {
+		LM_ERR("failed to register the cache timer\n");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -237,6 +309,37 @@ static void destroy(void)
 		credentials = 0;
 		credentials_n = 0;
 	}
+	destroy_auth_cache();
+}
+
+
+/*
+ * Drops the cached credentials of a user, e.g. from the event_route
+ * triggered by the provisioning side when a password changes
+ */
+static int w_cache_invalidate(struct sip_msg* msg, char* user, char* domain)
+{
+	str u, d;
+
+	if (!auth_cache_on()) {
+		LM_DBG("credentials cache disabled\n");
+		return -1;
+	}
+
+	if (fixup_get_svalue(msg, (gparam_p)user, &u) != 0 || u.len == 0) {
+		LM_ERR("invalid user parameter\n");
+		return -1;
+	}
+
+	if (domain) {
+		if (fixup_get_svalue(msg, (gparam_p)domain, &d) != 0) {
+			LM_ERR("invalid domain parameter\n");
+			return -1;
+		}
+		return auth_cache_invalidate(&u, &d) > 0 ? 1 : -1;
+	}
+
+	return auth_cache_invalidate(&u, NULL) > 0 ? 1 : -1;
 }
 
 
@@ -30,10 +30,12 @@
  * 2006-03-01 pseudo variables support for domain name (bogdan)
  * 2009-01-25 added prepared statements support in running the DB queries
  *             (bogdan)
+ * 2016-10-19 credentials cache and async DB lookups
  */
 
 
 #include <string.h>
+#include "../../async.h"
 #include "../../ut.h"
 #include "../../str.h"
 #include "../../db/db.h"
@@ -46,23 +48,152 @@
 #include "../../mem/mem.h"
 #include "aaa_avps.h"
 #include "authdb_mod.h"
+#include "authdb_cache.h"
+#include "authorize.h"
 
 
 static str auth_500_err = str_init("Server Internal Error");
 
+/* longest query sent over the async connections */
+#define AUTH_ASYNC_QUERY_MAX 1024
 
-static inline int get_ha1(struct username* _username, str* _domain,
-			  const str* _table, char* _ha1, db_res_t** res)
+/* an async lookup in progress */
+struct auth_async_param {
+	gparam_p realm;
+	char *table;
+	hdr_types_t hftype;
+	int ha1b;
+	str user;          /* the key the result is cached under */
+	str domain;
+	utime_t start;
+	void *db_priv;
+};
+
+
+/*
+ * Reads a string column; NULL values give an empty string
+ */
+static inline int db_val2str(db_val_t *v, str *s)
+{
+	s->s = NULL;
+	s->len = 0;
+
+	if (VAL_NULL(v))
+		return 0;
+
+	switch (VAL_TYPE(v)) {
+	case DB_STR:
+		*s = VAL_STR(v);
+		break;
+	case DB_STRING:
+		s->s = (char *)VAL_STRING(v);
+		s->len = s->s ? strlen(s->s) : 0;
+		break;
+	case DB_BLOB:
+		*s = VAL_BLOB(v);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Copies the password and the "load_credentials" columns of the first
+ * row of a result into pkg memory
+ */
+static struct auth_creds *result2creds(db_res_t *res)
+{
+	struct auth_creds tmp, *creds;
+	struct auth_cval *cv;
+	db_val_t *v;
+	char *buf;
+	int i, size;
+
+	v = ROW_VALUES(RES_ROWS(res));
+
+	if (db_val2str(v, &tmp.secret) < 0) {
+		LM_ERR("password column `%.*s' is not a string\n",
+			RES_NAMES(res)[0]->len, RES_NAMES(res)[0]->s);
+		return NULL;
+	}
+
+	tmp.n = credentials_n;
+	tmp.vals = NULL;
+	if (tmp.n) {
+		tmp.vals = pkg_malloc(tmp.n * sizeof *tmp.vals);
+		if (tmp.vals == NULL) {
+			LM_ERR("no more pkg memory\n");
+			return NULL;
+		}
+		memset(tmp.vals, 0, tmp.n * sizeof *tmp.vals);
+	}
+
+	for (i = 1; i <= tmp.n && i < RES_COL_N(res); i++) {
+		cv = &tmp.vals[i - 1];
+		if (VAL_NULL(v + i))
+			continue;
+
+		switch (VAL_TYPE(v + i)) {
+		case DB_STR:
+		case DB_STRING:
+		case DB_BLOB:
+			db_val2str(v + i, &cv->s);
+			if (cv->s.s && cv->s.len)
+				cv->type = AUTH_CVAL_STR;
+			break;
+		case DB_INT:
+			cv->n = (int)VAL_INT(v + i);
+			cv->type = AUTH_CVAL_INT;
+			break;
+		case DB_BIGINT:
+			cv->n = (int)VAL_BIGINT(v + i);
+			cv->type = AUTH_CVAL_INT;
+			break;
+		default:
+			LM_ERR("subscriber table column %d `%.*s' has unsupported type. "
+				"Only string/str or int columns are supported by"
+				"load_credentials.\n", i,
+				RES_NAMES(res)[i]->len, RES_NAMES(res)[i]->s);
+			break;
+		}
+	}
+
+	size = auth_creds_size(&tmp);
+	buf = pkg_malloc(size);
+	if (buf == NULL) {
+		LM_ERR("no more pkg memory\n");
+		creds = NULL;
+	} else {
+		creds = auth_creds_pack(&tmp, buf, size);
+	}
+
+	if (tmp.vals)
+		pkg_free(tmp.vals);
+	return creds;
+}
+
+
+/*
+ * Queries the subscriber table; returns 0 if found, 1 if the user is
+ * unknown or -1 on error
+ */
+static int db_get_creds(str *user, str *domain, str *_table, int ha1b,
+													struct auth_creds **creds)
 {
 	struct aaa_avp *cred;
 	db_key_t keys[2];
 	db_val_t vals[2];
 	db_key_t *col;
-	str result;
+	db_res_t *res = NULL;
 	static db_ps_t auth_ha1_ps = NULL;
 	static db_ps_t auth_ha1b_ps = NULL;
+	utime_t start;
+	int n, nc, ret;
 
-	int n, nc;
+	*creds = NULL;
 
 	col = pkg_malloc(sizeof(*col) * (credentials_n + 1));
 	if (col == NULL) {
@@ -74,7 +205,7 @@ static inline int get_ha1(struct username* _username, str* _domain,
 	keys[1] = &domain_column;
 
 	/* should we calculate the HA1, and is it calculated with domain? */
-	if (_username->domain.len && !calc_ha1) {
+	if (ha1b) {
 		col[0] = &pass_column_2 ;
 		CON_PS_REFERENCE(auth_db_handle) = &auth_ha1b_ps;
 	} else {
@@ -89,14 +220,8 @@ static inline int get_ha1(struct username* _username, str* _domain,
 	VAL_TYPE(vals) = VAL_TYPE(vals + 1) = DB_STR;
 	VAL_NULL(vals) = VAL_NULL(vals + 1) = 0;
 
-	VAL_STR(vals).s = _username->user.s;
-	VAL_STR(vals).len = _username->user.len;
-
-	if (_username->domain.len) {
-		VAL_STR(vals + 1) = _username->domain;
-	} else {
-		VAL_STR(vals + 1) = *_domain;
-	}
+	VAL_STR(vals) = *user;
+	VAL_STR(vals + 1) = *domain;
 
 	if (auth_dbf.use_table(auth_db_handle, _table) < 0) {
 		LM_ERR("failed to use_table\n");
@@ -106,32 +231,77 @@ static inline int get_ha1(struct username* _username, str* _domain,
 
 	n = (use_domain ? 2 : 1);
 	nc = 1 + credentials_n;
-	if (auth_dbf.query(auth_db_handle, keys, 0, vals, col, n, nc, 0, res) < 0) {
+	start = auth_cache_now_us();
+	if (auth_dbf.query(auth_db_handle, keys, 0, vals, col, n, nc, 0, &res) < 0) {
 		LM_ERR("failed to query database\n");
+		auth_cache_db_latency(auth_cache_now_us() - start, 1);
 		pkg_free(col);
 		return -1;
 	}
+	auth_cache_db_latency(auth_cache_now_us() - start, 0);
 	pkg_free(col);
 
-	if (RES_ROW_N(*res) == 0) {
+	if (RES_ROW_N(res) == 0) {
 		LM_DBG("no result for user \'%.*s@%.*s\'\n",
-				_username->user.len, ZSW(_username->user.s),
-			(use_domain ? (_domain->len) : 0), ZSW(_domain->s));
-		return 1;
+				user->len, ZSW(user->s),
+			(use_domain ? (domain->len) : 0), ZSW(domain->s));
+		ret = 1;
+	} else {
+		*creds = result2creds(res);
+		ret = *creds ? 0 : -1;
 	}
 
-	result.s = (char*)ROW_VALUES(RES_ROWS(*res))[0].val.string_val;
-	result.len = strlen(result.s);
+	auth_dbf.free_result(auth_db_handle, res);
+	return ret;
+}
+
 
+/*
+ * Looks up the credentials of a user, in the cache first
+ */
+static int get_creds(struct username* _username, str* _domain,
+						const str* _table, struct auth_creds **creds)
+{
+	str *domain;
+	int ha1b, ret;
+
+	ha1b = (_username->domain.len && !calc_ha1);
+	domain = _username->domain.len ? &_username->domain : _domain;
+
+	ret = auth_cache_fetch((str *)_table, &_username->user, domain, ha1b,
+		creds);
+	if (ret >= 0)
+		return ret;
+
+	ret = db_get_creds(&_username->user, domain, (str *)_table, ha1b, creds);
+	if (ret >= 0)
+		auth_cache_store((str *)_table, &_username->user, domain, ha1b,
+			ret == 0 ? *creds : NULL);
+
+	return ret;
+}
+
+
+/*
+ * Builds the HA1 string out of the stored password
+ */
+static inline int get_ha1(struct username* _username, str* _domain,
+					struct auth_creds *creds, char* _ha1, int ha1_size)
+{
 	if (calc_ha1) {
 		/* Only plaintext passwords are stored in database,
 		 * we have to calculate HA1 */
-		auth_api.calc_HA1(HA_MD5, &_username->whole, _domain, &result,
+		auth_api.calc_HA1(HA_MD5, &_username->whole, _domain, &creds->secret,
 				0, 0, _ha1);
 		LM_DBG("HA1 string calculated: %s\n", _ha1);
 	} else {
-		memcpy(_ha1, result.s, result.len);
-		_ha1[result.len] = '\0';
+		if (creds->secret.len >= ha1_size) {
+			LM_ERR("HA1 of user \'%.*s\' is too long (%d)\n",
+				_username->user.len, _username->user.s, creds->secret.len);
+			return -1;
+		}
+		memcpy(_ha1, creds->secret.s, creds->secret.len);
+		_ha1[creds->secret.len] = '\0';
 	}
 
 	return 0;
@@ -139,37 +309,20 @@ static inline int get_ha1(struct username* _username, str* _domain,
 
 
 /*
- * Generate AVPs from the database result
+ * Generate AVPs from the loaded credentials
  */
-static int generate_avps(db_res_t* result)
+static int generate_avps(struct auth_creds *creds)
 {
 	struct aaa_avp *cred;
+	struct auth_cval *cv;
 	int_str ivalue;
 	int i;
 
-	for (cred=credentials, i=1; cred; cred=cred->next, i++) {
-		switch (result->col.types[i]) {
-		case DB_STR:
-			ivalue.s = VAL_STR(&(result->rows[0].values[i]));
-
-			if (VAL_NULL(&(result->rows[0].values[i])) ||
-			ivalue.s.s == NULL || ivalue.s.len==0)
-				continue;
-
-			if (add_avp(cred->avp_type|AVP_VAL_STR,cred->avp_name,ivalue)!=0){
-				LM_ERR("failed to add AVP\n");
-				return -1;
-			}
-
-			LM_DBG("set string AVP %d = \"%.*s\"\n",
-					cred->avp_name, ivalue.s.len, ZSW(ivalue.s.s));
-			break;
-		case DB_STRING:
-			ivalue.s.s = (char*)VAL_STRING(&(result->rows[0].values[i]));
-
-			if (VAL_NULL(&(result->rows[0].values[i])) ||
-			ivalue.s.s == NULL || (ivalue.s.len=strlen(ivalue.s.s))==0 )
-				continue;
+	for (cred=credentials, i=0; cred && i<creds->n; cred=cred->next, i++) {
+		cv = &creds->vals[i];
+		switch (cv->type) {
+		case AUTH_CVAL_STR:
+			ivalue.s = cv->s;
 
 			if (add_avp(cred->avp_type|AVP_VAL_STR,cred->avp_name,ivalue)!=0){
 				LM_ERR("failed to add AVP\n");
@@ -179,11 +332,8 @@ static int generate_avps(db_res_t* result)
 			LM_DBG("set string AVP %d = \"%.*s\"\n",
 					cred->avp_name, ivalue.s.len, ZSW(ivalue.s.s));
 			break;
-		case DB_INT:
-			if (VAL_NULL(&(result->rows[0].values[i])))
-				continue;
-
-			ivalue.n = (int)VAL_INT(&(result->rows[0].values[i]));
+		case AUTH_CVAL_INT:
+			ivalue.n = cv->n;
 
 			if (add_avp(cred->avp_type, cred->avp_name, ivalue)!=0) {
 				LM_ERR("failed to add AVP\n");
@@ -193,10 +343,6 @@ static int generate_avps(db_res_t* result)
 			LM_DBG("set int AVP %d = %d\n",cred->avp_name, ivalue.n);
 			break;
 		default:
-			LM_ERR("subscriber table column %d `%.*s' has unsupported type. "
-				"Only string/str or int columns are supported by"
-				"load_credentials.\n", i,
-				result->col.names[i]->len, result->col.names[i]->s);
 			break;
 		}
 	}
@@ -206,44 +352,45 @@ static int generate_avps(db_res_t* result)
 
 
 /*
- * Authorize digest credentials
+ * Evaluates the parameters and checks the credentials of the request;
+ * returns DO_AUTHORIZATION if they have to be verified
  */
-static inline int authorize(struct sip_msg* _m, gparam_p _realm,
-									char* _table, hdr_types_t _hftype)
+static inline int auth_pre(struct sip_msg* _m, gparam_p _realm,
+		char* _table, hdr_types_t _hftype, str *table, str *domain,
+		struct hdr_field** h)
 {
-	char ha1[256];
-	int res;
-	struct hdr_field* h;
-	auth_body_t* cred;
-	auth_result_t ret;
-	str domain, table;
-	db_res_t* result = NULL;
-
 	if(!_table) {
 		LM_ERR("invalid table parameter\n");
 		return -1;
 	}
 
-	table.s = _table;
-	table.len = strlen(_table);
+	table->s = _table;
+	table->len = strlen(_table);
 
-	if(fixup_get_svalue(_m, _realm, &domain)!=0)
+	if(fixup_get_svalue(_m, _realm, domain)!=0)
 	{
 		LM_ERR("invalid realm parameter\n");
 		return AUTH_ERROR;
 	}
 
-	if (domain.len==0)
-		domain.s = 0;
+	if (domain->len==0)
+		domain->s = 0;
 
-	ret = auth_api.pre_auth(_m, &domain, _hftype, &h);
+	return auth_api.pre_auth(_m, domain, _hftype, h);
+}
 
-	if (ret != DO_AUTHORIZATION)
-		return ret;
 
-	cred = (auth_body_t*)h->parsed;
+/*
+ * Verifies the response against the credentials looked up with result
+ * "res" (see get_creds()); the credentials are freed
+ */
+static int auth_finish(struct sip_msg* _m, struct hdr_field* h, str *domain,
+										int res, struct auth_creds *creds)
+{
+	char ha1[256];
+	auth_body_t* cred;
+	auth_result_t ret;
 
-	res = get_ha1(&cred->digest.username, &domain, &table, ha1, &result);
 	if (res < 0) {
 		/* Error while accessing the database */
 		if (sigb.reply(_m, 500, &auth_500_err, NULL) == -1) {
@@ -253,25 +400,56 @@ static inline int authorize(struct sip_msg* _m, gparam_p _realm,
 	}
 	if (res > 0) {
 		/* Username not found in the database */
-		auth_dbf.free_result(auth_db_handle, result);
 		return USER_UNKNOWN;
 	}
 
+	cred = (auth_body_t*)h->parsed;
+
+	if (get_ha1(&cred->digest.username, domain, creds, ha1, sizeof ha1) < 0) {
+		pkg_free(creds);
+		return INVALID_PASSWORD;
+	}
+
 	/* Recalculate response, it must be same to authorize successfully */
 	if (!auth_api.check_response(&(cred->digest),
 				&_m->first_line.u.request.method, ha1)) {
 		ret = auth_api.post_auth(_m, h);
 		if (ret == AUTHORIZED)
-			generate_avps(result);
-		auth_dbf.free_result(auth_db_handle, result);
+			generate_avps(creds);
+		pkg_free(creds);
 		return ret;
 	}
 
-	auth_dbf.free_result(auth_db_handle, result);
+	pkg_free(creds);
 	return INVALID_PASSWORD;
 }
 
 
+/*
+ * Authorize digest credentials
+ */
+static inline int authorize(struct sip_msg* _m, gparam_p _realm,
+									char* _table, hdr_types_t _hftype)
+{
+	int res;
+	struct hdr_field* h;
+	auth_body_t* cred;
+	auth_result_t ret;
+	str domain, table;
+	struct auth_creds *creds;
+
+	ret = auth_pre(_m, _realm, _table, _hftype, &table, &domain, &h);
+	if (ret != DO_AUTHORIZATION)
+		return ret;
+
+	cred = (auth_body_t*)h->parsed;
+
+	res = get_creds(&cred->digest.username, &domain, &table, &creds);
+
+	return auth_finish(_m, h, &domain, res, creds);
+}
+
+
 /*
  * Authorize using Proxy-Authorize header field
  */
@@ -288,3 +466,240 @@ int www_authorize(struct sip_msg* _m, char* _realm, char* _table)
 {
 	return authorize(_m, (gparam_p)_realm, _table, HDR_AUTHORIZATION_T);
 }
+
+
+/*
+ * Appends a quoted value to the query; the values which would need
+ * escaping are refused, the caller falls back to a blocking query
+ */
+static inline char *auth_query_value(char *p, char *end, str *val)
+{
+	int i;
+
+	if (p + val->len + 2 >= end)
+		return NULL;
+
+	*p++ = '\'';
+	for (i = 0; i < val->len; i++) {
+		if (val->s[i] == '\'' || val->s[i] == '\\' ||
+		(unsigned char)val->s[i] < 0x20)
+			return NULL;
+		*p++ = val->s[i];
+	}
+	*p++ = '\'';
+
+	return p;
+}
+
+
+static inline char *auth_query_str(char *p, char *end, char *s, int len)
+{
+	if (p + len >= end)
+		return NULL;
+	memcpy(p, s, len);
+	return p + len;
+}
+
+
+/*
+ * Prints the SELECT run by db_get_creds(), for the raw query interface
+ */
+static int auth_build_query(str *user, str *domain, str *table, int ha1b,
+														str *query)
+{
+	static char buf[AUTH_ASYNC_QUERY_MAX];
+	char *p, *end;
+	struct aaa_avp *cred;
+	str *col;
+
+	p = buf;
+	end = buf + AUTH_ASYNC_QUERY_MAX;
+	col = ha1b ? &pass_column_2 : &pass_column;
+
+	if (!(p = auth_query_str(p, end, "SELECT ", 7)) ||
+	!(p = auth_query_str(p, end, col->s, col->len)))
+		return -1;
+
+	for (cred = credentials; cred; cred = cred->next)
+		if (!(p = auth_query_str(p, end, ",", 1)) ||
+		!(p = auth_query_str(p, end, cred->attr_name.s, cred->attr_name.len)))
+			return -1;
+
+	if (!(p = auth_query_str(p, end, " FROM ", 6)) ||
+	!(p = auth_query_str(p, end, table->s, table->len)) ||
+	!(p = auth_query_str(p, end, " WHERE ", 7)) ||
+	!(p = auth_query_str(p, end, user_column.s, user_column.len)) ||
+	!(p = auth_query_str(p, end, "=", 1)) ||
+	!(p = auth_query_value(p, end, user)))
+		return -1;
+
+	if (use_domain &&
+	(!(p = auth_query_str(p, end, " AND ", 5)) ||
+	!(p = auth_query_str(p, end, domain_column.s, domain_column.len)) ||
+	!(p = auth_query_str(p, end, "=", 1)) ||
+	!(p = auth_query_value(p, end, domain))))
+		return -1;
+
+	query->s = buf;
+	query->len = p - buf;
+	return 0;
+}
+
+
+static int resume_async_authorize(int fd, struct sip_msg *msg, void *_param)
+{
+	struct auth_async_param *param = (struct auth_async_param *)_param;
+	struct auth_creds *creds = NULL;
+	struct hdr_field* h;
+	db_res_t *res = NULL;
+	str domain, table;
+	int rc, ret;
+
+	rc = auth_dbf.async_resume(auth_db_handle, fd, &res, param->db_priv);
+	if (async_status == ASYNC_CONTINUE)
+		return rc;
+
+	if (rc != 0) {
+		LM_ERR("async query for user \'%.*s\' failed\n",
+			param->user.len, param->user.s);
+		auth_cache_db_latency(auth_cache_now_us() - param->start, 1);
+		rc = -1;
+	} else {
+		auth_cache_db_latency(auth_cache_now_us() - param->start, 0);
+		if (!res || RES_ROW_N(res) <= 0) {
+			LM_DBG("no result for user \'%.*s@%.*s\'\n",
+				param->user.len, param->user.s,
+				param->domain.len, param->domain.s);
+			rc = 1;
+		} else if (RES_COL_N(res) < 1 + credentials_n) {
+			LM_ERR("the query returned %d columns, %d expected\n",
+				RES_COL_N(res), 1 + credentials_n);
+			rc = -1;
+		} else {
+			creds = result2creds(res);
+			rc = creds ? 0 : -1;
+		}
+	}
+
+	auth_dbf.async_free_result(auth_db_handle, res, param->db_priv);
+	async_status = ASYNC_DONE;
+
+	if (rc >= 0) {
+		table.s = param->table;
+		table.len = strlen(param->table);
+		auth_cache_store(&table, &param->user, &param->domain,
+			param->ha1b, creds);
+	}
+
+	/* the credentials are parsed again, on the message we resume with */
+	ret = auth_pre(msg, param->realm, param->table, param->hftype,
+		&table, &domain, &h);
+	if (ret != DO_AUTHORIZATION) {
+		if (creds)
+			pkg_free(creds);
+	} else {
+		ret = auth_finish(msg, h, &domain, rc, creds);
+	}
+
+	pkg_free(param);
+	return ret;
+}
+
+
+/*
+ * Authorize digest credentials, without blocking on the database: cache
+ * misses are looked up over an async DB connection
+ */
+static int async_authorize(struct sip_msg* _m, async_resume_module **resume_f,
+		void **resume_param, gparam_p _realm, char* _table,
+		hdr_types_t _hftype)
+{
+	struct auth_async_param *param;
+	struct hdr_field* h;
+	auth_body_t* cred;
+	auth_result_t ret;
+	struct auth_creds *creds;
+	str domain, table, query, *qdomain;
+	struct username *user;
+	void *priv;
+	int res, ha1b, fd;
+
+	*resume_f = NULL;
+	*resume_param = NULL;
+	async_status = ASYNC_NO_IO;
+
+	ret = auth_pre(_m, _realm, _table, _hftype, &table, &domain, &h);
+	if (ret != DO_AUTHORIZATION)
+		return ret;
+
+	cred = (auth_body_t*)h->parsed;
+	user = &cred->digest.username;
+
+	ha1b = (user->domain.len && !calc_ha1);
+	qdomain = user->domain.len ? &user->domain : &domain;
+
+	res = auth_cache_fetch(&table, &user->user, qdomain, ha1b, &creds);
+	if (res >= 0)
+		return auth_finish(_m, h, &domain, res, creds);
+
+	if (!DB_CAPABILITY(auth_dbf, DB_CAP_ASYNC_RAW_QUERY) ||
+	auth_build_query(&user->user, qdomain, &table, ha1b, &query) < 0) {
+		/* no async support, or a username we would have to escape */
+		res = db_get_creds(&user->user, qdomain, &table, ha1b, &creds);
+		if (res >= 0)
+			auth_cache_store(&table, &user->user, qdomain, ha1b,
+				res == 0 ? creds : NULL);
+		return auth_finish(_m, h, &domain, res, creds);
+	}
+
+	param = pkg_malloc(sizeof *param + user->user.len + qdomain->len);
+	if (param == NULL) {
+		LM_ERR("no more pkg memory\n");
+		return auth_finish(_m, h, &domain, -1, NULL);
+	}
+	memset(param, 0, sizeof *param);
+
+	param->realm = _realm;
+	param->table = _table;
+	param->hftype = _hftype;
+	param->ha1b = ha1b;
+	param->user.s = (char *)(param + 1);
+	param->user.len = user->user.len;
+	memcpy(param->user.s, user->user.s, user->user.len);
+	param->domain.s = param->user.s + param->user.len;
+	param->domain.len = qdomain->len;
+	memcpy(param->domain.s, qdomain->s, qdomain->len);
+	param->start = auth_cache_now_us();
+
+	fd = auth_dbf.async_raw_query(auth_db_handle, &query, &priv);
+	if (fd < 0) {
+		LM_ERR("failed to start the query for user \'%.*s\'\n",
+			user->user.len, user->user.s);
+		auth_cache_db_latency(0, 1);
+		pkg_free(param);
+		return auth_finish(_m, h, &domain, -1, NULL);
+	}
+	param->db_priv = priv;
+
+	*resume_f = resume_async_authorize;
+	*resume_param = param;
+	async_status = fd;
+
+	return 1;
+}
+
+
+int w_async_proxy_authorize(struct sip_msg* _m, async_resume_module **rf,
+							void **rp, char* _realm, char* _table)
+{
+	return async_authorize(_m, rf, rp, (gparam_p)_realm, _table,
+		HDR_PROXYAUTH_T);
+}
+
+
+int w_async_www_authorize(struct sip_msg* _m, async_resume_module **rf,
+							void **rp, char* _realm, char* _table)
+{
+	return async_authorize(_m, rf, rp, (gparam_p)_realm, _table,
+		HDR_AUTHORIZATION_T);
+}
@@ -26,6 +26,7 @@
 
 
 #include "../../parser/msg_parser.h"
+#include "../../async.h"
 
 int auth_db_init(const str* db_url);
 int auth_db_bind(const str* db_url);
@@ -43,4 +44,15 @@ int proxy_authorize(struct sip_msg* _msg, char* _realm, char* _table);
 int www_authorize(struct sip_msg* _msg, char* _realm, char* _table);
 
 
+/*
+ * Async versions - the credentials missing from the cache are looked up
+ * without blocking the process
+ */
+int w_async_proxy_authorize(struct sip_msg* _m, async_resume_module **rf,
+							void **rp, char* _realm, char* _table);
+
+int w_async_www_authorize(struct sip_msg* _m, async_resume_module **rf,
+							void **rp, char* _realm, char* _table);
+
+
 #endif /* AUTHORIZE_H */
@@ -52,6 +52,14 @@ lcache_t* cache_htable = NULL;
 int cache_htable_size = 9;
 int cache_clean_period = 600;
 int local_exec_threshold = 0;
+lcache_shard_t* cache_shards = NULL;
+int cache_shards_no = 32;
+int cache_max_memory = 0;
+
+stat_var *lcache_hits = 0;
+stat_var *lcache_misses = 0;
+stat_var *lcache_evictions = 0;
+stat_var *lcache_expired = 0;
 
 
 static int remove_chunk_f(struct sip_msg* msg, char* glob);
@@ -62,6 +70,8 @@ static param_export_t params[]={
 	{ "cache_table_size",   INT_PARAM, &cache_htable_size },
 	{ "cache_clean_period", INT_PARAM, &cache_clean_period },
 	{ "exec_threshold",     INT_PARAM, &local_exec_threshold },
+	{ "cache_shards",       INT_PARAM, &cache_shards_no },
+	{ "cache_max_memory",   INT_PARAM, &cache_max_memory },
 	{0,0,0}
 };
 
@@ -72,6 +82,18 @@ static cmd_export_t cmds[]= {
 	{0,0,0,0,0,0}
 };
 
+static stat_export_t mod_stats[] = {
+	{"hits",         0,                           &lcache_hits      },
+	{"misses",       0,                           &lcache_misses    },
+	{"evictions",    0,                           &lcache_evictions },
+	{"expired",      0,                           &lcache_expired   },
+	{"entries",      STAT_IS_FUNC|STAT_NO_RESET,
+		(stat_var**)lcache_get_entries },
+	{"used_memory",  STAT_IS_FUNC|STAT_NO_RESET,
+		(stat_var**)lcache_get_used_memory },
+	{0,0,0}
+};
+
 static mi_export_t mi_cmds[] = {
 	{ "cache_remove_chunk",           0, mi_cache_remove_chunk,         0,  0,  0},
 	{ 0, 0, 0, 0, 0, 0}
@@ -87,7 +109,7 @@ struct module_exports exports= {
 	cmds,                       /* exported functions */
 	0,                          /* exported async functions */
 	params,                     /* exported parameters */
-	0,                          /* exported statistics */
+	mod_stats,                  /* exported statistics */
 	mi_cmds,                    /* exported MI functions */
 	0,                          /* exported pseudo-variables */
 	0,                          /* extra processes */
@@ -105,7 +127,8 @@ static int remove_chunk_f(struct sip_msg* msg, char* glob)
 {
 	int i;
 	str *pat = (str *)glob;
-	lcache_entry_t* me1, *me2;
+	lcache_shard_t *sh;
+	lcache_entry_t* me1, **link;
 	struct timeval start;
 
 	if (pat->len+1 > pat_buff_size) {
@@ -126,17 +149,17 @@ static int remove_chunk_f(struct sip_msg* msg, char* glob)
 	start_expire_timer(start,local_exec_threshold);
 
 	for(i = 0; i< cache_htable_size; i++) {
-		lock_get(&cache_htable[i].lock);
-		me1 = cache_htable[i].entries;
-		me2 = NULL;
+		sh = lcache_shard(i);
+		lock_get(&sh->lock);
+		link = &cache_htable[i].entries;
 
-		while(me1) {
+		while((me1 = *link) != NULL) {
 			if (me1->attr.len + 1 > key_buff_size) {
 				key_buff = pkg_realloc(key_buff,me1->attr.len+1);
 				if (key_buff == NULL) {
 					LM_ERR("No more pkg mem\n");
 					key_buff_size = 0;
-					lock_release(&cache_htable[i].lock);
+					lock_release(&sh->lock);
 					stop_expire_timer(start,local_exec_threshold,
 					"cachedb_local remove_chunk",pat->s,pat->len,0);
 					return -1;
@@ -152,21 +175,12 @@ static int remove_chunk_f(struct sip_msg* msg, char* glob)
 				LM_DBG("[%.*s] matches glob [%.*s] - removing from bucket %d\n",
 						me1->attr.len, me1->attr.s,pat_buff_size,pat_buff,i);
 
-				if(me2) {
-					me2->next = me1->next;
-					shm_free(me1);
-					me1 = me2->next;
-				} else{
-					cache_htable[i].entries = me1->next;
-					shm_free(me1);
-					me1 = cache_htable[i].entries;
-				}
+				lcache_free_entry(sh, link, me1);
 			} else {
-				me2 = me1;
-				me1 = me1->next;
+				link = &me1->next;
 			}
 		}
-		lock_release(&cache_htable[i].lock);
+		lock_release(&sh->lock);
 	}
 
 	stop_expire_timer(start,local_exec_threshold,
@@ -252,12 +266,29 @@ static int mod_init(void)
 	cachedb_con *con;
 	str url=str_init("local://");
 	str name=str_init("local");
+	int i;
 
 	if(cache_htable_size< 1)
 		cache_htable_size= 512;
 	else
 		cache_htable_size= 1<< cache_htable_size;
 
+	/* each shard holds every cache_shards-th bucket */
+	if (cache_shards_no < 1)
+		cache_shards_no = 1;
+	else if (cache_shards_no > cache_htable_size)
+		cache_shards_no = cache_htable_size;
+	else if (cache_shards_no & (cache_shards_no - 1)) {
+		for (i = 1; i < cache_shards_no; i <<= 1);
+		LM_NOTICE("rounding cache_shards up to %d\n", i);
+		cache_shards_no = i;
+	}
+
+	if (cache_max_memory < 0) {
+		LM_ERR("Wrong parameter cache_max_memory - need a positive value\n");
+		return -1;
+	}
+
 	if(lcache_htable_init(cache_htable_size) < 0)
 	{
 		LM_ERR("failed to initialize cache hash table\n");
@@ -327,43 +358,6 @@ static void destroy(void)
 
 void localcache_clean(unsigned int ticks,void *param)
 {
-	int i;
-	lcache_entry_t* me1, *me2;
-
 	LM_DBG("start\n");
-	for(i = 0; i< cache_htable_size; i++)
-	{
-		lock_get(&cache_htable[i].lock);
-		me1 = cache_htable[i].entries;
-		me2 = NULL;
-
-		while(me1)
-		{
-			if((me1->expires > 0) && (me1->expires < get_ticks()))
-			{
-				LM_DBG("deleted entry attr= [%.*s]\n",
-						me1->attr.len, me1->attr.s);
-
-				if(me2)
-				{
-					me2->next = me1->next;
-					shm_free(me1);
-					me1 = me2->next;
-				}
-				else
-				{
-					cache_htable[i].entries = me1->next;
-					shm_free(me1);
-					me1 = cache_htable[i].entries;
-				}
-			}
-			else
-			{
-				me2 = me1;
-				me1 = me1->next;
-			}
-		}
-
-		lock_release(&cache_htable[i].lock);
-	}
+	lcache_htable_expire(get_ticks());
 }
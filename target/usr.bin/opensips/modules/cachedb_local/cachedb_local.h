@@ -29,11 +29,20 @@
 
 #include "../../cachedb/cachedb.h"
 #include "../../cachedb/cachedb_cap.h"
+#include "../../statistics.h"
 #include "hash.h"
 
 extern lcache_t* cache_htable;
 extern int cache_htable_size;
+extern lcache_shard_t* cache_shards;
+extern int cache_shards_no;
 extern int local_exec_threshold;
+extern int cache_max_memory;
+
+extern stat_var *lcache_hits;
+extern stat_var *lcache_misses;
+extern stat_var *lcache_evictions;
+extern stat_var *lcache_expired;
 
 typedef struct {
 	struct cachedb_id *id;
@@ -35,11 +35,215 @@
 #include "cachedb_local.h"
 #include "hash.h"
 
-void lcache_htable_remove_safe(str attr, lcache_entry_t** it);
+#define lcache_expired(_e, _now) \
+	((_e)->expires != 0 && (_e)->expires < (_now))
+
+static inline void lru_unlink(lcache_shard_t *sh, lcache_entry_t *e)
+{
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		sh->lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		sh->lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static inline void lru_push(lcache_shard_t *sh, lcache_entry_t *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = sh->lru_head;
+	if (sh->lru_head)
+		sh->lru_head->lru_prev = e;
+	else
+		sh->lru_tail = e;
+	sh->lru_head = e;
+}
+
+/* marks the entry as the most recently used one of its shard */
+static inline void lru_touch(lcache_shard_t *sh, lcache_entry_t *e)
+{
+	if (sh->lru_head != e) {
+		lru_unlink(sh, e);
+		lru_push(sh, e);
+	}
+}
+
+static inline void wheel_link(lcache_shard_t *sh, lcache_entry_t *e)
+{
+	lcache_entry_t **slot;
+
+	if (e->expires == 0)
+		return;
+
+	slot = &sh->wheel[e->expires & (LCACHE_WHEEL_SIZE-1)];
+	e->exp_prev = NULL;
+	e->exp_next = *slot;
+	if (*slot)
+		(*slot)->exp_prev = e;
+	*slot = e;
+}
+
+static inline void wheel_unlink(lcache_shard_t *sh, lcache_entry_t *e)
+{
+	if (e->expires == 0)
+		return;
+
+	if (e->exp_prev)
+		e->exp_prev->exp_next = e->exp_next;
+	else
+		sh->wheel[e->expires & (LCACHE_WHEEL_SIZE-1)] = e->exp_next;
+	if (e->exp_next)
+		e->exp_next->exp_prev = e->exp_prev;
+}
+
+void lcache_free_entry(lcache_shard_t *sh, lcache_entry_t **link,
+		lcache_entry_t *e)
+{
+	*link = e->next;
+	lru_unlink(sh, e);
+	wheel_unlink(sh, e);
+	sh->used -= e->size;
+	sh->entries_no--;
+	shm_free(e);
+}
+
+/* the bucket pointer referring to a linked entry */
+static lcache_entry_t **lcache_bucket_link(lcache_entry_t *e)
+{
+	lcache_entry_t **link;
+
+	for (link = &cache_htable[e->hash].entries; *link != e;
+			link = &(*link)->next);
+	return link;
+}
+
+static lcache_entry_t **lcache_lookup(str *attr, unsigned int hash)
+{
+	lcache_entry_t **link;
+
+	for (link = &cache_htable[hash].entries; *link; link = &(*link)->next)
+		if ((*link)->attr.len == attr->len &&
+				memcmp((*link)->attr.s, attr->s, attr->len) == 0)
+			return link;
+
+	return NULL;
+}
+
+/* looks up a valid entry, deleting it if found expired */
+static lcache_entry_t *lcache_find(lcache_shard_t *sh, str *attr,
+		unsigned int hash)
+{
+	lcache_entry_t **link;
+
+	link = lcache_lookup(attr, hash);
+	if (link == NULL)
+		return NULL;
+
+	if (lcache_expired(*link, get_ticks())) {
+		/* found an expired entry  -> delete it */
+		lcache_free_entry(sh, link, *link);
+		update_stat(lcache_expired, 1);
+		return NULL;
+	}
+
+	return *link;
+}
+
+/* builds an entry - a counter one if no value is given */
+static lcache_entry_t *lcache_new_entry(str *attr, str *value, int expires,
+		unsigned int hash)
+{
+	lcache_entry_t *me;
+	int size;
+
+	size = sizeof(lcache_entry_t) + attr->len + (value ? value->len : 0);
+
+	me = (lcache_entry_t*)shm_malloc(size);
+	if (me == NULL) {
+		LM_ERR("no more shared memory\n");
+		return NULL;
+	}
+	memset(me, 0, size);
+
+	me->size = size;
+	me->hash = hash;
+
+	me->attr.s = (char*)me + (sizeof(lcache_entry_t));
+	memcpy(me->attr.s, attr->s, attr->len);
+	me->attr.len = attr->len;
+
+	me->value.s = (char*)me + (sizeof(lcache_entry_t)) + attr->len;
+	if (value) {
+		memcpy(me->value.s, value->s, value->len);
+		me->value.len = value->len;
+	} else {
+		me->flags |= LCACHE_COUNTER;
+	}
+
+	if (expires != 0)
+		me->expires = get_ticks() + expires;
+
+	return me;
+}
+
+/* links a new entry in its bucket, replacing any previous record for
+ * the same attr and evicting the least recently used entries of the
+ * shard if over its memory limit - the shard lock must be held */
+static int lcache_link_entry(lcache_shard_t *sh, lcache_entry_t *me)
+{
+	lcache_entry_t **link, *e;
+
+	link = lcache_lookup(&me->attr, me->hash);
+	if (link)
+		lcache_free_entry(sh, link, *link);
+
+	if (sh->max_used) {
+		if (me->size > sh->max_used) {
+			LM_ERR("entry [%.*s] of %u bytes is over the %lu bytes limit "
+				"of a shard\n", me->attr.len, me->attr.s, me->size,
+				sh->max_used);
+			return -1;
+		}
+
+		while (sh->used + me->size > sh->max_used) {
+			e = sh->lru_tail;
+			LM_DBG("evicting entry attr= [%.*s]\n", e->attr.len, e->attr.s);
+			lcache_free_entry(sh, lcache_bucket_link(e), e);
+			update_stat(lcache_evictions, 1);
+		}
+	}
+
+	me->next = cache_htable[me->hash].entries;
+	cache_htable[me->hash].entries = me;
+	lru_push(sh, me);
+	wheel_link(sh, me);
+	sh->used += me->size;
+	sh->entries_no++;
+
+	return 0;
+}
+
+/* counters are kept as native integers, so the string value of an entry
+ * is only parsed the first time it is used as a counter */
+static int lcache_to_counter(lcache_entry_t *e)
+{
+	if (e->flags & LCACHE_COUNTER)
+		return 0;
+
+	if (str2sint(&e->value, &e->counter) != 0)
+		return -1;
+
+	e->flags |= LCACHE_COUNTER;
+	return 0;
+}
 
 int lcache_htable_init(int size)
 {
 	int i = 0, j;
+	lcache_entry_t **wheel;
 
 	cache_htable = (lcache_t*)shm_malloc(size * sizeof(lcache_t));
 	if(cache_htable == NULL)
@@ -49,13 +253,31 @@ int lcache_htable_init(int size)
 	}
 	memset(cache_htable, 0, size * sizeof(lcache_t));
 
-	for(i= 0; i< size; i++)
+	cache_shards = (lcache_shard_t*)shm_malloc(cache_shards_no *
+		(sizeof(lcache_shard_t) +
+		LCACHE_WHEEL_SIZE * sizeof(lcache_entry_t*)));
+	if(cache_shards == NULL)
+	{
+		LM_ERR("no more shared memory\n");
+		shm_free(cache_htable);
+		cache_htable = NULL;
+		return -1;
+	}
+	memset(cache_shards, 0, cache_shards_no *
+		(sizeof(lcache_shard_t) + LCACHE_WHEEL_SIZE * sizeof(lcache_entry_t*)));
+	wheel = (lcache_entry_t**)(cache_shards + cache_shards_no);
+
+	for(i= 0; i< cache_shards_no; i++)
 	{
-		if(lock_init(&cache_htable[i].lock)== 0)
+		if(lock_init(&cache_shards[i].lock)== 0)
 		{
 			LM_ERR("failed to initialize lock [%d]\n", i);
 			goto error;
 		}
+		cache_shards[i].wheel = wheel + i * LCACHE_WHEEL_SIZE;
+		cache_shards[i].wheel_last = get_ticks();
+		cache_shards[i].max_used =
+			(unsigned long)cache_max_memory * 1024 / cache_shards_no;
 	}
 
 	return 0;
@@ -63,8 +285,10 @@ int lcache_htable_init(int size)
 error:
 	for(j = 0; j< i; j++)
 	{
-		lock_destroy(&cache_htable[j].lock);
+		lock_destroy(&cache_shards[j].lock);
 	}
+	shm_free(cache_shards);
+	cache_shards = NULL;
 	shm_free(cache_htable);
 	cache_htable = NULL;
 	return -1;
@@ -80,7 +304,6 @@ void lcache_htable_destroy(void)
 
 	for(i = 0; i< cache_htable_size; i++)
 	{
-		lock_destroy(&cache_htable[i].lock);
 		me1 = cache_htable[i].entries;
 		while(me1)
 		{
@@ -89,95 +312,66 @@ void lcache_htable_destroy(void)
 			me1 = me2;
 		}
 	}
+	for(i = 0; i< cache_shards_no; i++)
+		lock_destroy(&cache_shards[i].lock);
+
+	shm_free(cache_shards);
+	cache_shards = NULL;
 	shm_free(cache_htable);
 	cache_htable = NULL;
 }
 
 int lcache_htable_insert(cachedb_con *con,str* attr, str* value, int expires)
 {
-	lcache_entry_t* me, *it;
-	int hash_code;
-	int size;
+	lcache_entry_t* me;
+	lcache_shard_t *sh;
 	struct timeval start;
 
-	size= sizeof(lcache_entry_t) + attr->len + value->len;
-
-	me = (lcache_entry_t*)shm_malloc(size);
+	me = lcache_new_entry(attr, value, expires,
+		core_hash(attr, 0, cache_htable_size));
 	if(me == NULL)
-	{
-		LM_ERR("no more shared memory\n");
 		return -1;
-	}
-	memset(me, 0, size);
 
 	start_expire_timer(start,local_exec_threshold);
 
-	me->attr.s = (char*)me + (sizeof(lcache_entry_t));
-	memcpy(me->attr.s, attr->s, attr->len);
-	me->attr.len = attr->len;
-
-	me->value.s = (char*)me + (sizeof(lcache_entry_t)) + attr->len;
-	memcpy(me->value.s, value->s, value->len);
-	me->value.len = value->len;
-	if( expires != 0)
-		me->expires = get_ticks() + expires;
-
-	hash_code= core_hash( attr, 0, cache_htable_size);
-	lock_get(&cache_htable[hash_code].lock);
-
-	it = cache_htable[hash_code].entries;
-
-	/* if a previous record for the same attr delete it */
-	lcache_htable_remove_safe( *attr, &it);
+	sh = lcache_shard(me->hash);
+	lock_get(&sh->lock);
 
-	me->next = it;
-	cache_htable[hash_code].entries = me;
+	if (lcache_link_entry(sh, me) < 0) {
+		lock_release(&sh->lock);
+		shm_free(me);
+		stop_expire_timer(start,local_exec_threshold,
+		"cachedb_local insert",attr->s,attr->len,0);
+		return -1;
+	}
 
-	lock_release(&cache_htable[hash_code].lock);
+	lock_release(&sh->lock);
 
 	stop_expire_timer(start,local_exec_threshold,
 	"cachedb_local insert",attr->s,attr->len,0);
 	return 1;
 }
 
-void lcache_htable_remove_safe(str attr, lcache_entry_t** it_p)
-{
-	lcache_entry_t* me = NULL, *it= *it_p;
-
-	while(it)
-	{
-		if(it->attr.len == attr.len &&
-				(strncmp(it->attr.s, attr.s, attr.len) == 0))
-		{
-
-			if(me)
-				me->next = it->next;
-			else
-				*it_p = it->next;
-
-			shm_free(it);
-
-			return;
-		}
-		me = it;
-		it = it->next;
-	}
-	LM_DBG("entry not found\n");
-}
-
 int lcache_htable_remove(cachedb_con *con,str* attr)
 {
-	int hash_code;
+	unsigned int hash_code;
+	lcache_shard_t *sh;
+	lcache_entry_t **link;
 	struct timeval start;
 
 	start_expire_timer(start,local_exec_threshold);
 
 	hash_code= core_hash( attr, 0, cache_htable_size);
-	lock_get(&cache_htable[hash_code].lock);
+	sh = lcache_shard(hash_code);
+	lock_get(&sh->lock);
 
-	lcache_htable_remove_safe( *attr, &cache_htable[hash_code].entries);
+	link = lcache_lookup(attr, hash_code);
+	if (link)
+		lcache_free_entry(sh, link, *link);
+	else
+		LM_DBG("entry not found\n");
 
-	lock_release(&cache_htable[hash_code].lock);
+	lock_release(&sh->lock);
 
 	stop_expire_timer(start,local_exec_threshold,
 	"cachedb_local remove",attr->s,attr->len,0);
@@ -187,103 +381,54 @@ int lcache_htable_remove(cachedb_con *con,str* attr)
 
 int lcache_htable_add(cachedb_con *con,str *attr,int val,int expires,int *new_val)
 {
-	int hash_code;
-	lcache_entry_t *it=NULL,*it_prev=NULL;
-	int old_value;
-	char *new_value;
-	int new_len;
-	str ins_val;
+	unsigned int hash_code;
+	lcache_shard_t *sh;
+	lcache_entry_t *it;
 	struct timeval start;
 
 	start_expire_timer(start,local_exec_threshold);
 
 	hash_code = core_hash(attr,0,cache_htable_size);
-	lock_get(&cache_htable[hash_code].lock);
-
-	it = cache_htable[hash_code].entries;
-	while (it) {
-		if (it->attr.len == attr->len &&
-				memcmp(it->attr.s,attr->s,attr->len) == 0) {
-			if (it->expires !=0 && it->expires < get_ticks()) {
-				/* found an expired entry  -> delete it */
-				if(it_prev)
-					it_prev->next = it->next;
-				else
-					cache_htable[hash_code].entries = it->next;
-
-				shm_free(it);
-				lock_release(&cache_htable[hash_code].lock);
-
-				ins_val.s = sint2str(val,&ins_val.len);
-				if (lcache_htable_insert(con,attr,&ins_val,expires) < 0) {
-					LM_ERR("failed to insert value\n");
-					stop_expire_timer(start,local_exec_threshold,
-					"cachedb_local add",attr->s,attr->len,0);
-					return -1;
-				}
-
-				if (new_val)
-					*new_val = val;
-
-				stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local add",attr->s,attr->len,0);
-				return 0;
-			}
-
-			/* found our valid entry */
-			if (str2sint(&it->value,&old_value) < 0) {
-				LM_ERR("not an integer\n");
-				lock_release(&cache_htable[hash_code].lock);
-				stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local add",attr->s,attr->len,0);
-				return -1;
-			}
-
-			old_value+=val;
-			expires = it->expires;
-			new_value = sint2str(old_value,&new_len);
-			it = shm_realloc(it,sizeof(lcache_entry_t) + attr->len +new_len);
-			if (it == NULL) {
-				LM_ERR("failed to realloc struct\n");
-				lock_release(&cache_htable[hash_code].lock);
-				stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local add",attr->s,attr->len,0);
-				return -1;
-			}
-
-			if (it_prev)
-				it_prev->next = it;
-			else
-				cache_htable[hash_code].entries = it;
-
-			it->attr.s = (char*)(it + 1);
-			it->value.s =(char *)(it + 1) + attr->len;
-			it->expires = expires;
-
-			memcpy(it->value.s,new_value,new_len);
-			it->value.len = new_len;
-			lock_release(&cache_htable[hash_code].lock);
-			if (new_val)
-				*new_val = old_value;
+	sh = lcache_shard(hash_code);
+	lock_get(&sh->lock);
+
+	it = lcache_find(sh, attr, hash_code);
+	if (it) {
+		/* found our valid entry */
+		if (lcache_to_counter(it) < 0) {
+			LM_ERR("not an integer\n");
+			lock_release(&sh->lock);
 			stop_expire_timer(start,local_exec_threshold,
 			"cachedb_local add",attr->s,attr->len,0);
-			return 0;
+			return -1;
 		}
 
-		it_prev = it;
-		it = it->next;
-	}
+		it->counter += val;
+		lru_touch(sh, it);
+		if (new_val)
+			*new_val = it->counter;
 
-	lock_release(&cache_htable[hash_code].lock);
+		lock_release(&sh->lock);
+		stop_expire_timer(start,local_exec_threshold,
+		"cachedb_local add",attr->s,attr->len,0);
+		return 0;
+	}
 
-	/* not found */
-	ins_val.s = sint2str(val,&ins_val.len);
-	if (lcache_htable_insert(con,attr,&ins_val,expires) < 0) {
+	/* not found - create the counter without releasing the lock, so
+	 * concurrent adds are not lost */
+	it = lcache_new_entry(attr, NULL, expires, hash_code);
+	if (it == NULL || lcache_link_entry(sh, it) < 0) {
 		LM_ERR("failed to insert value\n");
+		lock_release(&sh->lock);
+		if (it)
+			shm_free(it);
 		stop_expire_timer(start,local_exec_threshold,
 		"cachedb_local add",attr->s,attr->len,0);
 		return -1;
 	}
+	it->counter = val;
+
+	lock_release(&sh->lock);
 
 	if (new_val)
 		*new_val = val;
@@ -305,121 +450,155 @@ int lcache_htable_sub(cachedb_con *con,str *attr,int val,int expires,int *new_va
  * */
 int lcache_htable_fetch(cachedb_con *con,str* attr, str* res)
 {
-	int hash_code;
-	lcache_entry_t* it = NULL, *it_aux = NULL;
-	char* value;
+	unsigned int hash_code;
+	lcache_shard_t *sh;
+	lcache_entry_t* it;
+	str value;
 	struct timeval start;
 
 	start_expire_timer(start,local_exec_threshold);
 
 	hash_code= core_hash( attr, 0, cache_htable_size);
-	lock_get(&cache_htable[hash_code].lock);
+	sh = lcache_shard(hash_code);
+	lock_get(&sh->lock);
 
-	it = cache_htable[hash_code].entries;
+	it = lcache_find(sh, attr, hash_code);
+	if (it == NULL) {
+		lock_release(&sh->lock);
+		update_stat(lcache_misses, 1);
+		stop_expire_timer(start,local_exec_threshold,
+		"cachedb_local fetch",attr->s,attr->len,0);
+		return -2;
+	}
 
-	while(it)
-	{
-		if(it->attr.len == attr->len &&
-				(strncmp(it->attr.s, attr->s, attr->len) == 0))
-		{
-			if( it->expires != 0 && it->expires < get_ticks())
-			{
-				/* found an expired entry  -> delete it */
-				if(it_aux)
-					it_aux->next = it->next;
-				else
-					cache_htable[hash_code].entries = it->next;
-
-				shm_free(it);
-
-				lock_release(&cache_htable[hash_code].lock);
-				stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local fetch",attr->s,attr->len,0);
-				return -2;
-			}
-			value = (char*)pkg_malloc(it->value.len);
-			if(value == NULL)
-			{
-				LM_ERR("no more memory\n");
-				lock_release(&cache_htable[hash_code].lock);
-				stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local fetch",attr->s,attr->len,0);
-				return -1;
-			}
-			memcpy(value, it->value.s, it->value.len);
-			res->len = it->value.len;
-			res->s = value;
-			lock_release(&cache_htable[hash_code].lock);
-			stop_expire_timer(start,local_exec_threshold,
-			"cachedb_local fetch",attr->s,attr->len,0);
-			return 1;
-		}
+	if (it->flags & LCACHE_COUNTER)
+		value.s = sint2str(it->counter, &value.len);
+	else
+		value = it->value;
 
-		it_aux = it;
-		it = it->next;
+	res->s = (char*)pkg_malloc(value.len);
+	if(res->s == NULL)
+	{
+		LM_ERR("no more memory\n");
+		lock_release(&sh->lock);
+		stop_expire_timer(start,local_exec_threshold,
+		"cachedb_local fetch",attr->s,attr->len,0);
+		return -1;
 	}
+	memcpy(res->s, value.s, value.len);
+	res->len = value.len;
+	lru_touch(sh, it);
 
-	lock_release(&cache_htable[hash_code].lock);
+	lock_release(&sh->lock);
+	update_stat(lcache_hits, 1);
 	stop_expire_timer(start,local_exec_threshold,
 	"cachedb_local fetch",attr->s,attr->len,0);
-	return -2;
+	return 1;
 }
 
 int lcache_htable_fetch_counter(cachedb_con* con,str* attr,int *val)
 {
-	int hash_code;
-	lcache_entry_t* it = NULL, *it_aux = NULL;
-	int ret;
+	unsigned int hash_code;
+	lcache_shard_t *sh;
+	lcache_entry_t* it;
 	struct timeval start;
 
 	start_expire_timer(start,local_exec_threshold);
 
 	hash_code= core_hash( attr, 0, cache_htable_size);
-	lock_get(&cache_htable[hash_code].lock);
+	sh = lcache_shard(hash_code);
+	lock_get(&sh->lock);
 
-	it = cache_htable[hash_code].entries;
+	it = lcache_find(sh, attr, hash_code);
+	if (it == NULL) {
+		lock_release(&sh->lock);
+		update_stat(lcache_misses, 1);
+		stop_expire_timer(start,local_exec_threshold,
+		"cachedb_local fetch_counter",attr->s,attr->len,0);
+		return -2;
+	}
 
-	while(it)
-	{
-		if(it->attr.len == attr->len &&
-				(strncmp(it->attr.s, attr->s, attr->len) == 0))
-		{
-			if( it->expires != 0 && it->expires < get_ticks())
-			{
-				/* found an expired entry  -> delete it */
-				if(it_aux)
-					it_aux->next = it->next;
-				else
-					cache_htable[hash_code].entries = it->next;
-
-				shm_free(it);
-
-				lock_release(&cache_htable[hash_code].lock);
-				stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local fetch_counter",attr->s,attr->len,0);
-				return -2;
-			}
-			if (str2sint(&it->value,&ret) != 0) {
-				LM_ERR("Not a counter key\n");
-				lock_release(&cache_htable[hash_code].lock);
-				stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local fetch_counter",attr->s,attr->len,0);
-				return -3;
+	if (lcache_to_counter(it) < 0) {
+		LM_ERR("Not a counter key\n");
+		lock_release(&sh->lock);
+		stop_expire_timer(start,local_exec_threshold,
+		"cachedb_local fetch_counter",attr->s,attr->len,0);
+		return -3;
+	}
+
+	if (val)
+		*val = it->counter;
+	lru_touch(sh, it);
+
+	lock_release(&sh->lock);
+	update_stat(lcache_hits, 1);
+	stop_expire_timer(start,local_exec_threshold,
+	"cachedb_local fetch_counter",attr->s,attr->len,0);
+	return 1;
+}
+
+static void lcache_expire_shard(lcache_shard_t *sh, unsigned int ticks)
+{
+	lcache_entry_t *e, *next;
+	unsigned int t, from, to;
+
+	/* the entries expiring before the current tick are due */
+	if (ticks == 0 || ticks - 1 <= sh->wheel_last)
+		return;
+
+	to = ticks - 1;
+	from = sh->wheel_last + 1;
+	/* once around the wheel covers all the due slots */
+	if (to - from >= LCACHE_WHEEL_SIZE)
+		from = to - LCACHE_WHEEL_SIZE + 1;
+
+	for (t = from; ; t++) {
+		for (e = sh->wheel[t & (LCACHE_WHEEL_SIZE-1)]; e; e = next) {
+			next = e->exp_next;
+			/* entries of the later turns of the wheel stay */
+			if (e->expires < ticks) {
+				LM_DBG("deleted entry attr= [%.*s]\n",
+					e->attr.len, e->attr.s);
+				lcache_free_entry(sh, lcache_bucket_link(e), e);
+				update_stat(lcache_expired, 1);
 			}
-			if (val)
-				*val = ret;
-			lock_release(&cache_htable[hash_code].lock);
-			stop_expire_timer(start,local_exec_threshold,
-			"cachedb_local fetch_counter",attr->s,attr->len,0);
-			return 1;
 		}
+		if (t == to)
+			break;
+	}
+
+	sh->wheel_last = to;
+}
 
-		it_aux = it;
-		it = it->next;
+void lcache_htable_expire(unsigned int ticks)
+{
+	int i;
+
+	for (i = 0; i < cache_shards_no; i++) {
+		lock_get(&cache_shards[i].lock);
+		lcache_expire_shard(&cache_shards[i], ticks);
+		lock_release(&cache_shards[i].lock);
 	}
+}
 
-	lock_release(&cache_htable[hash_code].lock);
-	stop_expire_timer(start,local_exec_threshold,
-	"cachedb_local fetch_counter",attr->s,attr->len,0);
-	return -2;
+unsigned long lcache_get_used_memory(void *foo)
+{
+	unsigned long used = 0;
+	int i;
+
+	for (i = 0; i < cache_shards_no; i++)
+		used += cache_shards[i].used;
+
+	return used;
+}
+
+unsigned long lcache_get_entries(void *foo)
+{
+	unsigned long n = 0;
+	int i;
+
+	for (i = 0; i < cache_shards_no; i++)
+		n += cache_shards[i].entries_no;
+
+	return n;
 }
@@ -32,21 +32,49 @@
 #include "../../lock_ops.h"
 #include "../../cachedb/cachedb.h"
 
+/* the entry holds a native integer (see lcache_htable_add()) */
+#define LCACHE_COUNTER  (1<<0)
+
+/* slots of the expiry wheel of each shard - power of 2 */
+#define LCACHE_WHEEL_SIZE  1024
+
 typedef struct lcache_entry
 {
 	str attr;
 	str value;
 	unsigned int expires;
+	unsigned int hash;      /* bucket of the entry */
+	unsigned int size;      /* shm memory accounted to the entry */
+	unsigned int flags;
+	int counter;            /* value of LCACHE_COUNTER entries */
 	struct lcache_entry* next;
+	/* LRU list of the shard, most recently used first */
+	struct lcache_entry *lru_prev, *lru_next;
+	/* slot of the expiry wheel, for the entries with an expire */
+	struct lcache_entry *exp_prev, *exp_next;
 }lcache_entry_t;
 
 
 typedef struct lcache
 {
 	lcache_entry_t* entries;
-	gen_lock_t lock;
 }lcache_t;
 
+/* a shard owns every cache_shards_no-th bucket of the table, with the
+ * lock, LRU list and expiry wheel covering all of them */
+typedef struct lcache_shard
+{
+	gen_lock_t lock;
+	lcache_entry_t *lru_head, *lru_tail;
+	unsigned long used;          /* shm memory of the entries */
+	unsigned long max_used;      /* 0 - unlimited */
+	unsigned int entries_no;
+	lcache_entry_t **wheel;
+	unsigned int wheel_last;     /* last tick expired from the wheel */
+}lcache_shard_t;
+
+#define lcache_shard(_hash) (&cache_shards[(_hash) & (cache_shards_no-1)])
+
 
 int lcache_htable_init(int size);
 void lcache_htable_destroy();
@@ -57,4 +85,15 @@ int lcache_htable_add(cachedb_con *con,str *attr,int val,int expires,int *new_va
 int lcache_htable_sub(cachedb_con *con,str *attr,int val,int expires,int *new_val);
 int lcache_htable_fetch_counter(cachedb_con* con,str* attr,int *val);
 
+/* unlinks and frees an entry - the shard lock must be held and "link"
+ * must point to the bucket pointer referring to it */
+void lcache_free_entry(lcache_shard_t *sh, lcache_entry_t **link,
+		lcache_entry_t *e);
+/* deletes the entries due until "ticks", only going through the slots
+ * of the expiry wheel which are not yet processed */
+void lcache_htable_expire(unsigned int ticks);
+
+unsigned long lcache_get_used_memory(void *foo);
+unsigned long lcache_get_entries(void *foo);
+
 #endif
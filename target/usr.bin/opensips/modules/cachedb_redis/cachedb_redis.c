@@ -21,6 +21,7 @@
  * history:
  * ---------
  *  2011-09-xx  created (vlad-paiu)
+ *  2016-10-19  async redis_fetch(), redis_nodes MI command
  */
 
 #include <stdio.h>
@@ -36,17 +37,34 @@
 #include "../../dprint.h"
 #include "../../error.h"
 #include "../../pt.h"
+#include "../../async.h"
+#include "../../mod_fix.h"
+#include "../../pvar.h"
+#include "../../mi/mi.h"
 #include "../../cachedb/cachedb.h"
 
 #include "cachedb_redis_dbase.h"
+#include "cachedb_redis_utils.h"
 
 static int mod_init(void);
 static int child_init(int);
 static void destroy(void);
 
+static int fixup_redis_fetch(void** param, int param_no);
+static int w_async_redis_fetch(struct sip_msg *msg,
+		async_resume_module **resume_f, void **resume_param,
+		char *grp, char *key, char *var);
+
 static str cache_mod_name = str_init("redis");
 struct cachedb_url *redis_script_urls = NULL;
 
+/* the connections opened for the script, by group */
+struct redis_script_con {
+	cachedb_con *con;
+	struct redis_script_con *next;
+};
+static struct redis_script_con *redis_script_cons = NULL;
+
 int set_connection(unsigned int type, void *val)
 {
 	return cachedb_store_url(&redis_script_urls,(char *)val);
@@ -59,6 +77,17 @@ static param_export_t params[]={
 	{0,0,0}
 };
 
+static acmd_export_t acmds[] = {
+	{"redis_fetch", (acmd_function)w_async_redis_fetch, 3, fixup_redis_fetch},
+	{0, 0, 0, 0}
+};
+
+static mi_export_t mi_cmds[] = {
+	{ "redis_nodes", "lists the Redis nodes, with their round trip times",
+		mi_redis_nodes, MI_NO_INPUT_FLAG, 0, 0},
+	{ 0, 0, 0, 0, 0, 0}
+};
+
 
 /** module exports */
 struct module_exports exports= {
@@ -68,10 +97,10 @@ struct module_exports exports= {
 	DEFAULT_DLFLAGS,			/* dlopen flags */
 	NULL,            /* OpenSIPS module dependencies */
 	0,						/* exported functions */
-	0,						/* exported async functions */
+	acmds,						/* exported async functions */
 	params,						/* exported parameters */
 	0,							/* exported statistics */
-	0,							/* exported MI functions */
+	mi_cmds,					/* exported MI functions */
 	0,							/* exported pseudo-variables */
 	0,							/* extra processes */
 	mod_init,					/* module initialization function */
@@ -110,12 +139,18 @@ static int mod_init(void)
 		return -1;
 	}
 
+	if (redis_stats_init() < 0) {
+		LM_ERR("failed to initialize the nodes statistics\n");
+		return -1;
+	}
+
 	return 0;
 }
 
 static int child_init(int rank)
 {
 	struct cachedb_url *it;
+	struct redis_script_con *sc;
 	cachedb_con *con;
 
 	if(rank == PROC_MAIN || rank == PROC_TCP_MAIN) {
@@ -133,6 +168,15 @@ static int child_init(int rank)
 			LM_ERR("failed to insert connection\n");
 			return -1;
 		}
+
+		sc = pkg_malloc(sizeof(struct redis_script_con));
+		if (sc == NULL) {
+			LM_ERR("no more pkg\n");
+			return -1;
+		}
+		sc->con = con;
+		sc->next = redis_script_cons;
+		redis_script_cons = sc;
 	}
 
 	cachedb_free_url(redis_script_urls);
@@ -146,5 +190,143 @@ static void destroy(void)
 {
 	LM_NOTICE("destroy module cachedb_redis ...\n");
 	cachedb_end_connections(&cache_mod_name);
+	redis_stats_destroy();
 	return;
 }
+
+
+/* "redis" or "redis:group", as for the cache_*() functions */
+static int fixup_redis_fetch(void** param, int param_no)
+{
+	str *grp;
+	char *p;
+
+	switch (param_no) {
+	case 1:
+		p = (char *)*param;
+		if (strncmp(p,cache_mod_name.s,cache_mod_name.len) != 0 ||
+		(p[cache_mod_name.len] != 0 && p[cache_mod_name.len] != ':')) {
+			LM_ERR("bad connection <%s> - expected redis[:group]\n",p);
+			return E_CFG;
+		}
+		grp = pkg_malloc(sizeof(str));
+		if (grp == NULL) {
+			LM_ERR("no more pkg\n");
+			return E_OUT_OF_MEM;
+		}
+		if (p[cache_mod_name.len] == ':') {
+			grp->s = p + cache_mod_name.len + 1;
+			grp->len = strlen(grp->s);
+		} else {
+			grp->s = NULL;
+			grp->len = 0;
+		}
+		*param = grp;
+		return 0;
+	case 2:
+		return fixup_spve(param);
+	case 3:
+		if (fixup_pvar(param) < 0)
+			return E_CFG;
+		if (((pv_spec_t *)*param)->setf == NULL) {
+			LM_ERR("the output variable must be writable\n");
+			return E_CFG;
+		}
+		return 0;
+	}
+
+	return 0;
+}
+
+static cachedb_con *redis_script_con(str *grp)
+{
+	struct redis_script_con *sc;
+	char *name;
+
+	for (sc=redis_script_cons;sc;sc=sc->next) {
+		name = ((redis_con *)sc->con->data)->id->group_name;
+		if (grp->len == 0) {
+			if (name == NULL)
+				return sc->con;
+		} else if (name && strlen(name) == grp->len &&
+		memcmp(name,grp->s,grp->len) == 0) {
+			return sc->con;
+		}
+	}
+
+	return NULL;
+}
+
+static int redis_fetch_done(struct sip_msg *msg,pv_spec_t *var,int ret,str *val)
+{
+	pv_value_t pval;
+
+	if (ret < 0)
+		return ret;
+
+	pval.flags = PV_VAL_STR;
+	pval.rs = *val;
+	if (pv_set_value(msg,var,0,&pval) < 0) {
+		LM_ERR("failed to set the output variable\n");
+		ret = -1;
+	} else {
+		ret = 1;
+	}
+
+	pkg_free(val->s);
+	return ret;
+}
+
+static int resume_async_redis_fetch(int fd, struct sip_msg *msg, void *param)
+{
+	pv_spec_t *var = (pv_spec_t *)((struct redis_async_op *)param)->data;
+	str val;
+	int ret;
+
+	ret = redis_async_resume(fd,param,&val);
+	if (ret == 1) {
+		async_status = ASYNC_CONTINUE;
+		return 1;
+	}
+
+	/* the connection is kept for the next queries */
+	async_status = ASYNC_DONE;
+	return redis_fetch_done(msg,var,ret,&val);
+}
+
+static int w_async_redis_fetch(struct sip_msg *msg,
+		async_resume_module **resume_f, void **resume_param,
+		char *grp, char *key, char *var)
+{
+	cachedb_con *con;
+	str k,val;
+	int fd;
+
+	*resume_f = NULL;
+	*resume_param = NULL;
+	async_status = ASYNC_NO_IO;
+
+	if (fixup_get_svalue(msg,(gparam_p)key,&k) < 0) {
+		LM_ERR("failed to get the key\n");
+		return -1;
+	}
+
+	con = redis_script_con((str *)grp);
+	if (con == NULL) {
+		LM_ERR("no redis connection for group [%.*s]\n",
+			((str *)grp)->len,((str *)grp)->s);
+		return -1;
+	}
+
+	fd = redis_async_fetch((redis_con *)con->data,&k,resume_param);
+	if (fd < 0) {
+		/* run the query right away */
+		return redis_fetch_done(msg,(pv_spec_t *)var,
+			redis_get(con,&k,&val),&val);
+	}
+
+	((struct redis_async_op *)*resume_param)->data = var;
+	*resume_f = resume_async_redis_fetch;
+	async_status = fd;
+	return 1;
+}
@@ -21,6 +21,8 @@
  * history:
  * ---------
  *  2011-09-xx  created (vlad-paiu)
+ *  2016-10-19  the commands of an operation are pipelined, MOVED and ASK
+ *               followed, async GET
  */
 
 #include "../../dprint.h"
@@ -31,6 +33,10 @@
 #include "../../cachedb/cachedb.h"
 
 #include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <sys/time.h>
 #include <hiredis/hiredis.h>
 
 int redis_query_tout = CACHEDB_REDIS_DEFAULT_TIMEOUT;
@@ -54,67 +60,72 @@ redisContext *redis_get_ctx(char *ip, int port)
 	if (ctx && ctx->err != REDIS_OK) {
 		LM_ERR("failed to open redis connection %s:%hu - %s\n",ip,
 				port,ctx->errstr);
+		redisFree(ctx);
 		return NULL;
 	}
 
-	if (redis_query_tout) {
+	if (ctx && redis_query_tout) {
 		tv.tv_sec = redis_query_tout / 1000;
 		tv.tv_usec = (redis_query_tout * 1000) % 1000000;
 		if (redisSetTimeout(ctx, tv) != REDIS_OK) {
 			LM_ERR("Cannot set query timeout to %dms\n", redis_query_tout);
+			redisFree(ctx);
 			return NULL;
 		}
 	}
 	return ctx;
 }
 
-int redis_connect_node(redis_con *con,cluster_node *node)
+static redisContext *redis_node_ctx(redis_con *con,cluster_node *node)
 {
+	redisContext *ctx;
 	redisReply *rpl;
 
-	node->context = redis_get_ctx(node->ip,node->port);
-	if (!node->context)
-		return -1;
+	ctx = redis_get_ctx(node->ip,node->port);
+	if (!ctx)
+		return NULL;
 
 	if (con->id->password) {
-		rpl = redisCommand(node->context,"AUTH %s",con->id->password);
+		rpl = redisCommand(ctx,"AUTH %s",con->id->password);
 		if (rpl == NULL || rpl->type == REDIS_REPLY_ERROR) {
 			LM_ERR("failed to auth to redis - %.*s\n",
 				rpl?rpl->len:7,rpl?rpl->str:"FAILURE");
 			freeReplyObject(rpl);
-			redisFree(node->context);
-			return -1;
+			redisFree(ctx);
+			return NULL;
 		}
 		LM_DBG("AUTH [password] -  %.*s\n",rpl->len,rpl->str);
 		freeReplyObject(rpl);
 	}
 
 	if ((con->type & REDIS_SINGLE_INSTANCE) && con->id->database) {
-		rpl = redisCommand(node->context,"SELECT %s",con->id->database);
+		rpl = redisCommand(ctx,"SELECT %s",con->id->database);
 		if (rpl == NULL || rpl->type == REDIS_REPLY_ERROR) {
 			LM_ERR("failed to select database %s - %.*s\n",con->id->database,
 				rpl?rpl->len:7,rpl?rpl->str:"FAILURE");
 			freeReplyObject(rpl);
-			redisFree(node->context);
-			return -1;
+			redisFree(ctx);
+			return NULL;
 		}
 
 		LM_DBG("SELECT [%s] - %.*s\n",con->id->database,rpl->len,rpl->str);
 		freeReplyObject(rpl);
 	}
 
-	return 0;
+	return ctx;
 }
 
-int redis_reconnect_node(redis_con *con,cluster_node *node)
+int redis_connect_node(redis_con *con,cluster_node *node)
 {
-	LM_DBG("reconnecting node %s:%d \n",node->ip,node->port);
+	LM_DBG("connecting node %s:%d \n",node->ip,node->port);
 
 	/* close the old connection */
-	if(node->context)
+	if (node->context)
 		redisFree(node->context);
 
-	return redis_connect_node(con,node);
+	node->context = redis_node_ctx(con,node);
+
+	return node->context ? 0 : -1;
 }
 
 
@@ -123,7 +134,6 @@ int redis_connect(redis_con *con)
 	redisContext *ctx;
 	redisReply *rpl;
 	cluster_node *it;
-	int len;
 
 	/* connect to redis DB */
 	ctx = redis_get_ctx(con->id->host,con->id->port);
@@ -144,34 +154,26 @@ int redis_connect(redis_con *con)
 		freeReplyObject(rpl);
 	}
 
-	rpl = redisCommand(ctx,"CLUSTER NODES");
+	rpl = redisCommand(ctx,"CLUSTER SLOTS");
 	if (rpl == NULL || rpl->type == REDIS_REPLY_ERROR) {
 		/* single instace mode */
 		con->type |= REDIS_SINGLE_INSTANCE;
-		len = strlen(con->id->host);
-		con->nodes = pkg_malloc(sizeof(cluster_node) + len + 1);
-		if (con->nodes == NULL) {
-			LM_ERR("no more pkg\n");
+		if (get_redis_node(con,con->id->host,strlen(con->id->host),
+		con->id->port) == NULL) {
 			freeReplyObject(rpl);
 			redisFree(ctx);
 			return -1;
 		}
-		con->nodes->ip = (char *)(con->nodes + 1);
-
-		strcpy(con->nodes->ip,con->id->host);
-		con->nodes->port = con->id->port;
-		con->nodes->start_slot = 0;
-		con->nodes->end_slot = 4096;
-		con->nodes->context = NULL;
-		con->nodes->next = NULL;
 		LM_DBG("single instance mode\n");
 	} else {
 		/* cluster instance mode */
 		con->type |= REDIS_CLUSTER_INSTANCE;
-		con->slots_assigned = 0;
 		LM_DBG("cluster instance mode\n");
-		if (build_cluster_nodes(con,rpl->str,rpl->len) < 0) {
+		if (build_cluster_slots(con,rpl) < 0) {
 			LM_ERR("failed to parse Redis cluster info\n");
+			freeReplyObject(rpl);
+			redisFree(ctx);
+			destroy_cluster_nodes(con);
 			return -1;
 		}
 	}
@@ -179,12 +181,9 @@ int redis_connect(redis_con *con)
 	freeReplyObject(rpl);
 	redisFree(ctx);
 	for (it=con->nodes;it;it=it->next) {
-
-		if (it->end_slot > con->slots_assigned )
-			con->slots_assigned = it->end_slot;
-
 		if (redis_connect_node(con,it) < 0) {
 			LM_ERR("failed to init connection \n");
+			destroy_cluster_nodes(con);
 			return -1;
 		}
 	}
@@ -247,56 +246,249 @@ void redis_destroy(cachedb_con *con) {
 	cachedb_do_close(con,redis_free_connection);
 }
 
-#define redis_run_command(con,key,fmt,args...) \
-	do {\
-		con = (redis_con *)connection->data; \
-		node = get_redis_connection(con,key); \
-		if (node == NULL) { \
-			LM_ERR("Bad cluster configuration\n"); \
-			return -10; \
-		} \
-		if (node->context == NULL) { \
-			if (redis_reconnect_node(con,node) < 0) { \
-				return -1; \
-			} \
-		} \
-		for (i=2;i;i--) { \
-			reply = redisCommand(node->context,fmt,##args); \
-			if (reply == NULL || reply->type == REDIS_REPLY_ERROR) { \
-				LM_ERR("Redis operation failure - %p %.*s\n",\
-					reply,reply?reply->len:7,reply?reply->str:"FAILURE"); \
-				if (reply) \
-					freeReplyObject(reply); \
-				if (node->context->err == REDIS_OK || redis_reconnect_node(con,node) < 0) { \
-					i = 0; break; \
-				}\
-			} else break; \
-		} \
-		if (i==0) { \
-			LM_ERR("giving up on query\n"); \
-			return -1; \
-		} \
-	} while (0)
+#define REDIS_ASKING "*1\r\n$6\r\nASKING\r\n"
 
-int redis_get(cachedb_con *connection,str *attr,str *val)
+/*
+ * Writes all the commands at once and reads their replies, in a single
+ * round trip; the ASKING command is sent first when following an ASK
+ */
+static int redis_pipeline(redisContext *ctx,char **cmd,int *len,int n,
+		redisReply **rpl,int asking)
 {
-	redis_con *con;
-	cluster_node *node;
-	redisReply *reply;
+	void *r;
 	int i;
 
-	if (!attr || !val || !connection) {
-		LM_ERR("null parameter\n");
+	if (asking && redisAppendFormattedCommand(ctx,REDIS_ASKING,
+	sizeof(REDIS_ASKING)-1) != REDIS_OK)
+		return -1;
+
+	for (i=0;i<n;i++)
+		if (redisAppendFormattedCommand(ctx,cmd[i],len[i]) != REDIS_OK)
+			return -1;
+
+	if (asking) {
+		if (redisGetReply(ctx,&r) != REDIS_OK)
+			return -1;
+		freeReplyObject(r);
+	}
+
+	for (i=0;i<n;i++) {
+		if (redisGetReply(ctx,&r) != REDIS_OK) {
+			while (i--)
+				freeReplyObject(rpl[i]);
+			return -1;
+		}
+		rpl[i] = r;
+	}
+
+	return 0;
+}
+
+static int redis_refresh_slots(redis_con *con,cluster_node *node)
+{
+	redisReply *rpl;
+	int ret;
+
+	if (node->context == NULL && redis_connect_node(con,node) < 0)
+		return -1;
+
+	rpl = redisCommand(node->context,"CLUSTER SLOTS");
+	if (rpl == NULL) {
+		redisFree(node->context);
+		node->context = NULL;
+		return -1;
+	}
+
+	ret = build_cluster_slots(con,rpl);
+	freeReplyObject(rpl);
+
+	return ret;
+}
+
+/*
+ * Returns the node a MOVED or ASK error redirects to, NULL for any other
+ * error; on MOVED the slots map is fetched again, as the cluster was
+ * resharded
+ */
+static cluster_node *redis_redirect(redis_con *con,cluster_node *node,
+		redisReply *r,int *asking)
+{
+	cluster_node *target;
+	char *p,*ip,*end;
+	unsigned int port;
+	int moved;
+	str s;
+
+	if (r->len > 6 && memcmp(r->str,"MOVED ",6) == 0)
+		moved = 1;
+	else if (r->len > 4 && memcmp(r->str,"ASK ",4) == 0)
+		moved = 0;
+	else
+		return NULL;
+
+	/* MOVED <slot> <ip>:<port> */
+	end = r->str + r->len;
+	p = memchr(r->str,' ',r->len);
+	p = memchr(p+1,' ',end - (p+1));
+	if (p == NULL)
+		return NULL;
+	ip = p+1;
+	for (p=end-1;p>ip && *p!=':';p--);
+	if (p == ip)
+		return NULL;
+	s.s = p+1;
+	s.len = end - s.s;
+	if (str2int(&s,&port) < 0 || port > 65535)
+		return NULL;
+
+	LM_DBG("%.*s (from %s:%hu)\n",r->len,r->str,node->ip,node->port);
+	redis_node_redirected(node);
+
+	target = get_redis_node(con,ip,p-ip,port);
+	if (target == NULL)
+		return NULL;
+
+	if (moved) {
+		if (redis_refresh_slots(con,target) < 0)
+			LM_WARN("failed to refresh the cluster slots map\n");
+	} else {
+		*asking = 1;
+	}
+
+	return target;
+}
+
+/*
+ * Runs "n" formatted commands, all on "key", in one round trip to the node
+ * serving the key, following the cluster redirections and retrying once on
+ * a broken connection; on success, "rpl" holds the "n" replies
+ */
+static int redis_run(redis_con *con,str *key,char **cmd,int *len,int n,
+		redisReply **rpl)
+{
+	cluster_node *node,*target;
+	struct timeval start;
+	int i,retries,redirects,asking,failed;
+
+	node = get_redis_connection(con,key);
+	if (node == NULL) {
+		LM_ERR("Bad cluster configuration\n");
+		return -10;
+	}
+
+	retries = 2;
+	redirects = 0;
+	asking = 0;
+
+	for (;;) {
+		if (node->context == NULL && redis_connect_node(con,node) < 0)
+			return -1;
+
+		gettimeofday(&start,NULL);
+		failed = redis_pipeline(node->context,cmd,len,n,rpl,asking);
+		redis_node_account(node,&start,failed);
+		asking = 0;
+
+		if (failed) {
+			LM_ERR("Redis operation failure on %s:%hu - %s\n",node->ip,
+				node->port,node->context->errstr);
+			/* the replies may be out of sync now */
+			redisFree(node->context);
+			node->context = NULL;
+			if (--retries)
+				continue;
+			LM_ERR("giving up on query\n");
+			return -1;
+		}
+
+		if (rpl[0]->type == REDIS_REPLY_ERROR &&
+		(con->type & REDIS_CLUSTER_INSTANCE) &&
+		redirects < REDIS_MAX_REDIRECTS &&
+		(target = redis_redirect(con,node,rpl[0],&asking)) != NULL) {
+			for (i=0;i<n;i++)
+				freeReplyObject(rpl[i]);
+			redirects++;
+			node = target;
+			continue;
+		}
+
+		for (i=0;i<n && rpl[i]->type != REDIS_REPLY_ERROR;i++);
+		if (i < n) {
+			LM_ERR("Redis operation failure - %.*s\n",rpl[i]->len,rpl[i]->str);
+			for (i=0;i<n;i++)
+				freeReplyObject(rpl[i]);
+			return -1;
+		}
+
+		return 0;
+	}
+}
+
+/*
+ * Runs a command on "key" and, if "expires", an EXPIRE of the key - both
+ * in one round trip
+ */
+static int redis_run_command(redis_con *con,str *key,int expires,
+		redisReply **reply,const char *fmt,...)
+{
+	redisReply *rpl[2];
+	char *cmd[2];
+	int len[2],n,ret;
+	va_list ap;
+
+	va_start(ap,fmt);
+	len[0] = redisvFormatCommand(&cmd[0],fmt,ap);
+	va_end(ap);
+	if (len[0] < 0) {
+		LM_ERR("failed to build the Redis command\n");
 		return -1;
 	}
 
-	redis_run_command(con,attr,"GET %b",attr->s,attr->len);
+	n = 1;
+	if (expires) {
+		len[1] = redisFormatCommand(&cmd[1],"EXPIRE %b %d",key->s,
+			(size_t)key->len,expires);
+		if (len[1] < 0) {
+			LM_ERR("failed to build the Redis command\n");
+			free(cmd[0]);
+			return -1;
+		}
+		n = 2;
+	}
+
+	ret = redis_run(con,key,cmd,len,n,rpl);
+
+	while (n--)
+		free(cmd[n]);
+	if (ret < 0)
+		return ret;
+
+	if (expires) {
+		LM_DBG("set %.*s to expire in %d s - %lld\n",key->len,key->s,expires,
+				rpl[1]->integer);
+		freeReplyObject(rpl[1]);
+	}
+
+	*reply = rpl[0];
+	return 0;
+}
+
+static int redis_do_get(redis_con *con,str *attr,str *val)
+{
+	redisReply *reply;
+	int ret;
+
+	ret = redis_run_command(con,attr,0,&reply,"GET %b",attr->s,
+		(size_t)attr->len);
+	if (ret < 0)
+		return ret;
 
 	if (reply->type == REDIS_REPLY_NIL || reply->str == NULL
 			|| reply->len == 0) {
 		LM_DBG("no such key - %.*s\n",attr->len,attr->s);
 		val->s = NULL;
 		val->len = 0;
+		freeReplyObject(reply);
 		return -2;
 	}
 
@@ -315,34 +507,35 @@ int redis_get(cachedb_con *connection,str *attr,str *val)
 	return 0;
 }
 
+int redis_get(cachedb_con *connection,str *attr,str *val)
+{
+	if (!attr || !val || !connection) {
+		LM_ERR("null parameter\n");
+		return -1;
+	}
+
+	return redis_do_get((redis_con *)connection->data,attr,val);
+}
+
 int redis_set(cachedb_con *connection,str *attr,str *val,int expires)
 {
-	redis_con *con;
-	cluster_node *node;
 	redisReply *reply;
-	int i;
+	int ret;
 
 	if (!attr || !val || !connection) {
 		LM_ERR("null parameter\n");
 		return -1;
 	}
 
-	redis_run_command(con,attr,"SET %b %b",attr->s,attr->len,val->s,val->len);
+	ret = redis_run_command((redis_con *)connection->data,attr,expires,&reply,
+		"SET %b %b",attr->s,(size_t)attr->len,val->s,(size_t)val->len);
+	if (ret < 0)
+		return ret;
 
 	LM_DBG("set %.*s to %.*s - status = %d - %.*s\n",attr->len,attr->s,val->len,
 			val->s,reply->type,reply->len,reply->str);
 
 	freeReplyObject(reply);
-
-	if (expires) {
-		redis_run_command(con,attr,"EXPIRE %b %d",attr->s,attr->len,expires);
-
-		LM_DBG("set %.*s to expire in %d s - %.*s\n",attr->len,attr->s,expires,
-				reply->len,reply->str);
-
-		freeReplyObject(reply);
-	}
-
 	return 0;
 }
 
@@ -351,17 +544,18 @@ int redis_set(cachedb_con *connection,str *attr,str *val,int expires)
  * return -1 in case of error */
 int redis_remove(cachedb_con *connection,str *attr)
 {
-	redis_con *con;
-	cluster_node *node;
 	redisReply *reply;
-	int ret=0,i;
+	int ret;
 
 	if (!attr || !connection) {
 		LM_ERR("null parameter\n");
 		return -1;
 	}
 
-	redis_run_command(con,attr,"DEL %b",attr->s,attr->len);
+	ret = redis_run_command((redis_con *)connection->data,attr,0,&reply,
+		"DEL %b",attr->s,(size_t)attr->len);
+	if (ret < 0)
+		return ret;
 
 	if (reply->integer == 0) {
 		LM_DBG("Key %.*s does not exist in DB\n",attr->len,attr->s);
@@ -376,70 +570,52 @@ int redis_remove(cachedb_con *connection,str *attr)
 /* returns the new value of the counter */
 int redis_add(cachedb_con *connection,str *attr,int val,int expires,int *new_val)
 {
-	redis_con *con;
-	cluster_node *node;
 	redisReply *reply;
-	int i;
+	int ret;
 
 	if (!attr || !connection) {
 		LM_ERR("null parameter\n");
 		return -1;
 	}
 
-	redis_run_command(con,attr,"INCRBY %b %d",attr->s,attr->len,val);
+	ret = redis_run_command((redis_con *)connection->data,attr,expires,&reply,
+		"INCRBY %b %d",attr->s,(size_t)attr->len,val);
+	if (ret < 0)
+		return ret;
 
 	if (new_val)
 		*new_val = reply->integer;
 	freeReplyObject(reply);
 
-	if (expires) {
-		redis_run_command(con,attr,"EXPIRE %b %d",attr->s,attr->len,expires);
-
-		LM_DBG("set %.*s to expire in %d s - %.*s\n",attr->len,attr->s,expires,
-				reply->len,reply->str);
-
-		freeReplyObject(reply);
-	}
-
 	return 0;
 }
 
 int redis_sub(cachedb_con *connection,str *attr,int val,int expires,int *new_val)
 {
-	redis_con *con;
-	cluster_node *node;
 	redisReply *reply;
-	int i;
+	int ret;
 
 	if (!attr || !connection) {
 		LM_ERR("null parameter\n");
 		return -1;
 	}
 
-	redis_run_command(con,attr,"DECRBY %b %d",attr->s,attr->len,val);
+	ret = redis_run_command((redis_con *)connection->data,attr,expires,&reply,
+		"DECRBY %b %d",attr->s,(size_t)attr->len,val);
+	if (ret < 0)
+		return ret;
 
 	if (new_val)
 		*new_val = reply->integer;
 	freeReplyObject(reply);
 
-	if (expires) {
-		redis_run_command(con,attr,"EXPIRE %b %d",attr->s,attr->len,expires);
-
-		LM_DBG("set %.*s to expire in %d s - %.*s\n",attr->len,attr->s,expires,
-				reply->len,reply->str);
-
-		freeReplyObject(reply);
-	}
-
 	return 0;
 }
 
 int redis_get_counter(cachedb_con *connection,str *attr,int *val)
 {
-	redis_con *con;
-	cluster_node *node;
 	redisReply *reply;
-	int i,ret;
+	int ret;
 	str response;
 
 	if (!attr || !val || !connection) {
@@ -447,11 +623,15 @@ int redis_get_counter(cachedb_con *connection,str *attr,int *val)
 		return -1;
 	}
 
-	redis_run_command(con,attr,"GET %b",attr->s,attr->len);
+	ret = redis_run_command((redis_con *)connection->data,attr,0,&reply,
+		"GET %b",attr->s,(size_t)attr->len);
+	if (ret < 0)
+		return ret;
 
 	if (reply->type == REDIS_REPLY_NIL || reply->str == NULL
 			|| reply->len == 0) {
 		LM_DBG("no such key - %.*s\n",attr->len,attr->s);
+		freeReplyObject(reply);
 		return -2;
 	}
 
@@ -604,56 +784,34 @@ int redis_raw_query_extract_key(str *attr,str *query_key)
 
 int redis_raw_query_send(cachedb_con *connection,redisReply **reply,cdb_raw_entry ***rpl,int expected_kv_no,int *reply_no,str *attr, ...)
 {
-	redis_con *con;
-	cluster_node *node;
-	int i,end;
+	char *cmd;
+	int len,end,ret;
 	va_list ap;
 	str query_key;
 
-	con = (redis_con *)connection->data;
 	if (redis_raw_query_extract_key(attr,&query_key) < 0) {
 		LM_ERR("Failed to extra Redis raw query key \n");
 		return -1;
 	}
 
-	node = get_redis_connection(con,&query_key);
-	if (node == NULL) {
-		LM_ERR("Bad cluster configuration\n");
-		return -10;
-	}
-
-	if (node->context == NULL) {
-		if (redis_reconnect_node(con,node) < 0) {
-			return -1;
-		}
-	}
-
 	va_start(ap,attr);
 	end = attr->s[attr->len];
 	attr->s[attr->len] = 0;
 
-	for (i=2;i;i--) {
-		*reply = redisvCommand(node->context,attr->s,ap);
-		if (*reply == NULL || (*reply)->type == REDIS_REPLY_ERROR) {
-			LM_ERR("Redis operation failure - %.*s\n",
-				*reply?(*reply)->len:7,*reply?(*reply)->str:"FAILURE");
-			if (*reply)
-				freeReplyObject(*reply);
-			if (node->context->err == REDIS_OK || redis_reconnect_node(con,node) < 0) {
-				i = 0; break;
-			}
-		} else break;
-	}
+	len = redisvFormatCommand(&cmd,attr->s,ap);
 
 	va_end(ap);
 	attr->s[attr->len]=end;
 
-	if (i==0) {
-		LM_ERR("giving up on query\n");
+	if (len < 0) {
+		LM_ERR("failed to build the Redis command\n");
 		return -1;
 	}
 
-	return 0;
+	ret = redis_run((redis_con *)connection->data,&query_key,&cmd,&len,1,reply);
+	free(cmd);
+
+	return ret;
 }
 
 int redis_raw_query(cachedb_con *connection,str *attr,cdb_raw_entry ***rpl,int expected_kv_no,int *reply_no)
@@ -699,3 +857,133 @@ int redis_raw_query(cachedb_con *connection,str *attr,cdb_raw_entry ***rpl,int e
 
 	return 1;
 }
+
+
+/*
+ * Sends a GET over the async connection of the node serving the key;
+ * returns the fd to wait on or -1 if the query is to be run in sync mode
+ * (a reply pending on the connection, a failure)
+ */
+int redis_async_fetch(redis_con *con,str *attr,void **param)
+{
+	struct redis_async_op *op;
+	cluster_node *node;
+	char *cmd;
+	int len,done;
+
+	node = get_redis_connection(con,attr);
+	if (node == NULL || node->async_busy > 0)
+		return -1;
+
+	/* broken by a previous query */
+	if (node->async_busy < 0) {
+		redisFree(node->async_ctx);
+		node->async_ctx = NULL;
+		node->async_busy = 0;
+	}
+
+	if (node->async_ctx == NULL) {
+		node->async_ctx = redis_node_ctx(con,node);
+		if (node->async_ctx == NULL)
+			return -1;
+	}
+
+	len = redisFormatCommand(&cmd,"GET %b",attr->s,(size_t)attr->len);
+	if (len < 0)
+		return -1;
+
+	op = pkg_malloc(sizeof(struct redis_async_op) + attr->len);
+	if (op == NULL) {
+		LM_ERR("no more pkg\n");
+		free(cmd);
+		return -1;
+	}
+	op->con = con;
+	op->node = node;
+	op->key.s = (char *)(op + 1);
+	op->key.len = attr->len;
+	memcpy(op->key.s,attr->s,attr->len);
+
+	gettimeofday(&op->start,NULL);
+	if (redisAppendFormattedCommand(node->async_ctx,cmd,len) != REDIS_OK)
+		goto error;
+	do {
+		if (redisBufferWrite(node->async_ctx,&done) != REDIS_OK)
+			goto error;
+	} while (!done);
+
+	free(cmd);
+	node->async_busy = 1;
+	*param = op;
+	return node->async_ctx->fd;
+
+error:
+	LM_ERR("failed to send the query to %s:%hu\n",node->ip,node->port);
+	free(cmd);
+	pkg_free(op);
+	node->async_busy = -1;
+	return -1;
+}
+
+/*
+ * Reads the reply of an async GET - returns 1 if not complete yet, else
+ * the same codes as redis_get(), releasing the operation
+ */
+int redis_async_resume(int fd,void *param,str *val)
+{
+	struct redis_async_op *op = (struct redis_async_op *)param;
+	cluster_node *node = op->node;
+	struct pollfd pfd;
+	redisReply *reply;
+	void *r;
+	int ret;
+
+	/* out of the reactor we are called in a loop, having to wait */
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd,1,redis_query_tout ? redis_query_tout : -1) <= 0 ||
+	redisBufferRead(node->async_ctx) != REDIS_OK ||
+	redisReaderGetReply(node->async_ctx->reader,&r) != REDIS_OK) {
+		LM_ERR("failed to read the reply from %s:%hu\n",node->ip,node->port);
+		redis_node_account(node,&op->start,1);
+		/* still in the reactor - closed on its next use */
+		node->async_busy = -1;
+		pkg_free(op);
+		return -1;
+	}
+
+	if (r == NULL)
+		return 1;
+
+	node->async_busy = 0;
+	redis_node_account(node,&op->start,0);
+	reply = r;
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		/* most likely a redirection - let the sync query follow it */
+		LM_DBG("async GET %.*s - %.*s\n",op->key.len,op->key.s,
+			reply->len,reply->str);
+		ret = redis_do_get(op->con,&op->key,val);
+	} else if (reply->type == REDIS_REPLY_NIL || reply->str == NULL
+			|| reply->len == 0) {
+		LM_DBG("no such key - %.*s\n",op->key.len,op->key.s);
+		val->s = NULL;
+		val->len = 0;
+		ret = -2;
+	} else {
+		val->s = pkg_malloc(reply->len);
+		if (val->s == NULL) {
+			LM_ERR("no more pkg\n");
+			ret = -1;
+		} else {
+			memcpy(val->s,reply->str,reply->len);
+			val->len = reply->len;
+			ret = 0;
+		}
+	}
+
+	freeReplyObject(reply);
+	pkg_free(op);
+	return ret;
+}
@@ -21,27 +21,58 @@
  * history:
  * ---------
  *  2011-09-xx  created (vlad-paiu)
+ *  2016-10-19  pipelining, async GET, cluster slots map (a reply of
+ *               CLUSTER SLOTS, refreshed on MOVED)
  */
 
 #ifndef CACHEDBREDIS_DBASE_H
 #define CACHEDBREDIS_DBASE_H
 
+#include <sys/time.h>
 #include <hiredis/hiredis.h>
 #include "../../cachedb/cachedb.h"
+#include "../../statistics.h"
+
+/* RTT and error counters of a Redis node, shared by all the processes;
+ * the counters are statistics named "<counter>-<ip:port>" */
+struct redis_node_stats {
+	char addr[64];					/* ip:port of the node, "" - free */
+	stat_var *queries;				/* round trips to the node */
+	stat_var *rtt_total;			/* sum of the round trips, in us */
+	stat_var *errors;				/* failed or timed out round trips */
+	stat_var *redirects;			/* MOVED / ASK replies */
+	/* slowest round trip, in us - a concurrent update may lose it */
+	volatile unsigned long rtt_max;
+};
 
 typedef struct cluster_nodes {
 	char *ip;							/* ip of this cluster node */
-	short port;						/* port of this cluster node */
-	unsigned short start_slot;		/* first slot for this server */
-	unsigned short end_slot;		/* last slot for this server */
+	unsigned short port;				/* port of this cluster node */
 
 	redisContext *context;			/* actual connection to this node */
+	redisContext *async_ctx;		/* connection of the async queries */
+	int async_busy;					/* 1 - a reply is pending on async_ctx,
+									   -1 - async_ctx is broken */
+	struct redis_node_stats *stats;	/* NULL if the table is full */
 	struct cluster_nodes *next;
 } cluster_node;
 
+/* a range of hash slots served by the same master */
+typedef struct redis_slot_range {
+	unsigned short start;
+	unsigned short end;
+	cluster_node *node;
+} redis_slot_range;
+
 
 #define CACHEDB_REDIS_DEFAULT_TIMEOUT 5000
 
+/* hash slots of a Redis Cluster */
+#define REDIS_CLUSTER_SLOTS 16384
+
+/* redirections followed by a query before giving up */
+#define REDIS_MAX_REDIRECTS 5
+
 extern int redis_query_tout;
 extern int redis_connnection_tout;
 
@@ -53,10 +84,20 @@ typedef struct {
 	struct cachedb_pool_con_t *next;
 
 	int type; /* single node or cluster node */
-	unsigned short slots_assigned; /* total slots for cluster */
+	int slots_no; /* ranges in the slots map */
+	redis_slot_range *slots; /* slots map of the cluster, sorted */
 	cluster_node *nodes; /* one or more Redis nodes */
 } redis_con;
 
+/* an async GET, waiting for its reply */
+struct redis_async_op {
+	redis_con *con;
+	cluster_node *node;
+	struct timeval start;
+	void *data;						/* owned by the caller */
+	str key;
+};
+
 cachedb_con* redis_init(str *url);
 void redis_destroy(cachedb_con *con);
 int redis_get(cachedb_con *con,str *attr,str *val);
@@ -67,5 +108,9 @@ int redis_sub(cachedb_con *con,str *attr,int val,int expires,int *new_val);
 int redis_get_counter(cachedb_con *connection,str *attr,int *val);
 int redis_raw_query(cachedb_con *connection,str *attr,cdb_raw_entry ***reply,int expected_kv_no,int *reply_no);
 
+int redis_connect_node(redis_con *con,cluster_node *node);
+int redis_async_fetch(redis_con *con,str *attr,void **param);
+int redis_async_resume(int fd,void *param,str *val);
+
 #endif /* CACHEDBREDIS_DBASE_H */
 
@@ -21,18 +21,21 @@
  * history:
  * ---------
  *  2011-09-xx  created (vlad-paiu)
+ *  2016-10-19  slots map built from CLUSTER SLOTS, per node statistics
  */
 
 #include "../../dprint.h"
 #include "cachedb_redis_dbase.h"
+#include "cachedb_redis_utils.h"
 #include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "../../locking.h"
 #include "../../ut.h"
 #include "../../cachedb/cachedb.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <hiredis/hiredis.h>
-#define is_valid(p,end) ((p) && (p)<(end))
 
 static const uint16_t crc16tab[256]= {
     0x0000,0x1021,0x2042,0x3063,0x4084,0x50a5,0x60c6,0x70e7,
@@ -78,26 +81,72 @@ uint16_t crc16(const char *buf, int len)
     return crc;
 }
 
-unsigned int redisHash(redis_con *con, str* key)
+/* only the {...} part of a key is hashed, if not empty */
+unsigned int redisHash(str* key)
 {
-	return crc16(key->s,key->len) & con->slots_assigned;
+	char *s, *e;
+
+	s = memchr(key->s,'{',key->len);
+	if (s) {
+		e = memchr(s+1,'}',key->len - (s+1 - key->s));
+		if (e && e > s+1)
+			return crc16(s+1,e - (s+1)) & (REDIS_CLUSTER_SLOTS-1);
+	}
+
+	return crc16(key->s,key->len) & (REDIS_CLUSTER_SLOTS-1);
 }
 
 inline cluster_node *get_redis_connection(redis_con *con,str *key)
 {
 	unsigned short hash_slot;
-	cluster_node *it;
+	int l,r,m;
 
 	if (con->type & REDIS_SINGLE_INSTANCE)
 		return con->nodes;
-	else {
-		hash_slot = redisHash(con, key);
-		for (it=con->nodes;it;it=it->next) {
-			if (it->start_slot <= hash_slot && it->end_slot >= hash_slot)
-				return it;
-		}
+
+	hash_slot = redisHash(key);
+
+	l = 0;
+	r = con->slots_no - 1;
+	while (l <= r) {
+		m = (l + r) / 2;
+		if (hash_slot < con->slots[m].start)
+			r = m - 1;
+		else if (hash_slot > con->slots[m].end)
+			l = m + 1;
+		else
+			return con->slots[m].node;
+	}
+
+	return NULL;
+}
+
+cluster_node *get_redis_node(redis_con *con,char *ip,int len,unsigned short port)
+{
+	cluster_node *node;
+
+	for (node=con->nodes;node;node=node->next)
+		if (node->port == port && strlen(node->ip) == len &&
+		memcmp(node->ip,ip,len) == 0)
+			return node;
+
+	node = pkg_malloc(sizeof(cluster_node) + len + 1);
+	if (!node) {
+		LM_ERR("no more pkg\n");
 		return NULL;
 	}
+	memset(node,0,sizeof(cluster_node));
+
+	node->ip = (char *)(node + 1);
+	memcpy(node->ip,ip,len);
+	node->ip[len] = 0;
+	node->port = port;
+	node->stats = redis_get_node_stats(node->ip,port);
+
+	node->next = con->nodes;
+	con->nodes = node;
+
+	return node;
 }
 
 void destroy_cluster_nodes(redis_con *con)
@@ -109,201 +158,298 @@ void destroy_cluster_nodes(redis_con *con)
 	new = con->nodes;
 	while (new) {
 		foo = new->next;
-		redisFree(new->context);
+		if (new->context)
+			redisFree(new->context);
+		if (new->async_ctx)
+			redisFree(new->async_ctx);
 		pkg_free(new);
 		new = foo;
 	}
+	con->nodes = NULL;
+
+	if (con->slots) {
+		pkg_free(con->slots);
+		con->slots = NULL;
+	}
+	con->slots_no = 0;
 }
 
-struct datavalues {
-	int count;
-	char **redisdata;
-};
+static int slot_range_cmp(const void *a,const void *b)
+{
+	return (int)((redis_slot_range *)a)->start -
+		(int)((redis_slot_range *)b)->start;
+}
 
-int chkmalloc1 (char *handle) {
-	if ( handle == NULL || handle == 0) {
-		LM_ERR("Error1 while parsing cluster redisdata \n");
+/*
+ * Builds the slots map out of a CLUSTER SLOTS reply - an array of
+ * [start, end, [master ip, master port, ...], replicas ...]; the nodes
+ * already known keep their connections, the others are only added to the
+ * list, being connected on their first use
+ */
+int build_cluster_slots(redis_con *con,redisReply *rpl)
+{
+	redis_slot_range *slots;
+	redisReply *range,*master;
+	cluster_node *node;
+	char *ip;
+	int i,n,len;
+
+	if (rpl->type != REDIS_REPLY_ARRAY || rpl->elements == 0) {
+		LM_ERR("no slots served by the cluster\n");
 		return -1;
 	}
-		return 1;
-}
-int chkmalloc2 (struct datavalues *handle) {
-	if ( handle == NULL || handle == 0) {
-		LM_ERR("Error2 while parsing cluster redisdata \n");
+
+	slots = pkg_malloc(rpl->elements * sizeof(redis_slot_range));
+	if (!slots) {
+		LM_ERR("no more pkg\n");
 		return -1;
 	}
-		return 1;
+
+	for (i=0,n=0;i<rpl->elements;i++) {
+		range = rpl->element[i];
+		if (range->type != REDIS_REPLY_ARRAY || range->elements < 3 ||
+		range->element[0]->type != REDIS_REPLY_INTEGER ||
+		range->element[1]->type != REDIS_REPLY_INTEGER ||
+		range->element[2]->type != REDIS_REPLY_ARRAY ||
+		range->element[2]->elements < 2) {
+			LM_ERR("bad slots range %d in the CLUSTER SLOTS reply\n",i);
+			goto error;
+		}
+
+		master = range->element[2];
+		if (master->element[0]->type != REDIS_REPLY_STRING ||
+		master->element[1]->type != REDIS_REPLY_INTEGER) {
+			LM_ERR("bad master of slots range %d\n",i);
+			goto error;
+		}
+
+		/* the node we asked may not know its own address */
+		if (master->element[0]->len) {
+			ip = master->element[0]->str;
+			len = master->element[0]->len;
+		} else {
+			ip = con->id->host;
+			len = strlen(ip);
+		}
+
+		node = get_redis_node(con,ip,len,
+			(unsigned short)master->element[1]->integer);
+		if (!node)
+			goto error;
+
+		slots[n].start = (unsigned short)range->element[0]->integer;
+		slots[n].end = (unsigned short)range->element[1]->integer;
+		slots[n].node = node;
+		LM_DBG("slots %hu-%hu on %s:%hu\n",slots[n].start,slots[n].end,
+			node->ip,node->port);
+		n++;
+	}
+
+	qsort(slots,n,sizeof(redis_slot_range),slot_range_cmp);
+
+	if (con->slots)
+		pkg_free(con->slots);
+	con->slots = slots;
+	con->slots_no = n;
+
+	return 0;
+
+error:
+	pkg_free(slots);
+	return -1;
 }
 
-int chkmalloc3 (struct datavalues **handle) {
-	if ( handle == NULL || handle == 0) {
-		LM_ERR("Error3 while parsing cluster redisdata \n");
+
+/* nodes tracked in the shared statistics table */
+#define REDIS_STATS_NODES 64
+
+#define REDIS_STATS_GROUP "cachedb_redis"
+
+static struct redis_node_stats *redis_stats;
+/* to claim an entry of the table */
+static gen_lock_t *redis_stats_lock;
+#ifdef STATISTICS
+/* nodes left out of the table */
+static stat_var *redis_untracked;
+#endif
+
+int redis_stats_init(void)
+{
+#ifndef STATISTICS
+	LM_DBG("no statistics support - the nodes are not tracked\n");
+	return 0;
+#endif
+	redis_stats = shm_malloc(REDIS_STATS_NODES * sizeof(struct redis_node_stats));
+	if (!redis_stats) {
+		LM_ERR("no more shm\n");
+		return -1;
+	}
+	memset(redis_stats,0,REDIS_STATS_NODES * sizeof(struct redis_node_stats));
+
+	redis_stats_lock = lock_alloc();
+	if (!redis_stats_lock || !lock_init(redis_stats_lock)) {
+		LM_ERR("failed to init lock\n");
 		return -1;
 	}
-		return 1;
-}
 
-int chkmalloc4 (char **handle) {
-	if ( handle == NULL || handle == 0) {
-		LM_ERR("Error4 while parsing cluster redisdata \n");
+	/* also creates the group, before forking, for the nodes to come */
+	if (register_stat(REDIS_STATS_GROUP,"untracked_nodes",
+	&redis_untracked,0) != 0) {
+		LM_ERR("failed to add stat variable\n");
 		return -1;
 	}
-		return 1;
+
+	return 0;
+}
+
+void redis_stats_destroy(void)
+{
+	if (redis_stats_lock) {
+		lock_destroy(redis_stats_lock);
+		lock_dealloc(redis_stats_lock);
+		redis_stats_lock = NULL;
+	}
+	if (redis_stats) {
+		shm_free(redis_stats);
+		redis_stats = NULL;
+	}
 }
 
-int explode(char *line, const char *delimeters, struct datavalues **newret) {
+static int redis_node_stat(char *counter,char *addr,stat_var **var)
+{
+#ifdef STATISTICS
+	str s;
+	char *name;
+
+	s.s = counter;
+	s.len = strlen(counter);
+	if ((name = build_stat_name(&s,addr)) == NULL ||
+	register_stat(REDIS_STATS_GROUP,name,var,STAT_SHM_NAME) != 0) {
+		LM_ERR("failed to add stat variable\n");
+		if (name)
+			shm_free(name);
+		return -1;
+	}
+#endif
+
+	return 0;
+}
 
-	int counter		= 0;
-	char *result 	= NULL;
-	char *data 		= NULL;
+struct redis_node_stats *redis_get_node_stats(char *ip,unsigned short port)
+{
+	struct redis_node_stats *st = NULL;
+	char addr[64];
+	int i;
 
-	data = pkg_malloc((strlen(line) * sizeof(char)) +1);
-	if (!chkmalloc1(data)) return 0;
-	strcpy(data,line);
+	if (!redis_stats)
+		return NULL;
 
-	result = strtok(data, delimeters);
-	while (result != NULL ) {
-		newret[0]->redisdata[counter] = pkg_malloc((strlen(result) * sizeof(char) ) +1 );
-		if (chkmalloc1(newret[0]->redisdata[counter])) {
-			strcpy(newret[0]->redisdata[counter],result);
-			counter++;
-			result = strtok(NULL, delimeters);
-		} else { return 0; }
+	snprintf(addr,sizeof(addr),"%s:%hu",ip,port);
+
+	lock_get(redis_stats_lock);
+	for (i=0;i<REDIS_STATS_NODES;i++) {
+		if (redis_stats[i].addr[0] == 0) {
+			if (redis_node_stat("queries",addr,&redis_stats[i].queries) < 0 ||
+			redis_node_stat("rtt_total_us",addr,&redis_stats[i].rtt_total) < 0 ||
+			redis_node_stat("errors",addr,&redis_stats[i].errors) < 0 ||
+			redis_node_stat("redirects",addr,&redis_stats[i].redirects) < 0)
+				break;
+			strcpy(redis_stats[i].addr,addr);
+			st = &redis_stats[i];
+			break;
+		}
+		if (strcmp(redis_stats[i].addr,addr) == 0) {
+			st = &redis_stats[i];
+			break;
+		}
 	}
-	newret[0]->count = counter-1;
+	lock_release(redis_stats_lock);
 
-	pkg_free(data);
+	if (!st) {
+		LM_WARN("no statistics for Redis node %s\n",addr);
+		update_stat(redis_untracked,1);
+	}
 
-	return 1;
+	return st;
+}
 
+void redis_node_account(cluster_node *node,struct timeval *start,int failed)
+{
+	struct redis_node_stats *st = node->stats;
+	struct timeval now;
+	unsigned long us;
+
+	if (!st)
+		return;
+
+	gettimeofday(&now,NULL);
+	us = (now.tv_sec - start->tv_sec) * 1000000 +
+		(now.tv_usec - start->tv_usec);
+
+	update_stat(st->queries,1);
+	update_stat(st->rtt_total,us);
+	if (us > st->rtt_max)
+		st->rtt_max = us;
+	if (failed)
+		update_stat(st->errors,1);
 }
 
-int build_cluster_nodes(redis_con *con,char *info,int size)
+void redis_node_redirected(cluster_node *node)
 {
+	if (!node->stats)
+		return;
 
-	cluster_node *new;
-	const char *delimeters = "\n";
-	int i		= 0, 	j	= 0;
-	int masters = 1, count	= 0;
-	char *ip, *block = NULL;
-	unsigned short port,start_slot,end_slot;
-	int len;
-
-	// Define **pointers for new structures 
-	struct datavalues **newret1 = pkg_malloc(sizeof(struct datavalues *));
-	if (!chkmalloc3(newret1)) goto error;
-	struct datavalues **newret2 = pkg_malloc(sizeof(struct datavalues *));
-	if (!chkmalloc3(newret2)) goto error;
-	struct datavalues **newret3 = pkg_malloc(sizeof(struct datavalues *));
-	if (!chkmalloc3(newret3)) goto error;
-
-	// Allocate space for the structures
-	newret1[0] = pkg_malloc(sizeof(struct datavalues));
-	if (!chkmalloc2(newret1[0])) goto error;
-	newret2[0] = pkg_malloc(sizeof(struct datavalues));
-	if (!chkmalloc2(newret2[0])) goto error;
-	newret3[0] = pkg_malloc(sizeof(struct datavalues));
-	if (!chkmalloc2(newret3[0])) goto error;
-
-	// Allocate space for data item "redisdata" within the structures
-	newret1[0]->redisdata = pkg_malloc((strlen(info) * sizeof(char)) +1);
-	if (!chkmalloc4(newret1[0]->redisdata)) goto error;
-	newret2[0]->redisdata = pkg_malloc((strlen(info) * sizeof(char)) +1);
-	if (!chkmalloc4(newret2[0]->redisdata)) goto error;
-	newret3[0]->redisdata = pkg_malloc((strlen(info) * sizeof(char)) +1);
-	if (!chkmalloc4(newret3[0]->redisdata)) goto error;
-
-	// Initialise the counter
-	newret1[0]->count = 0;
-	newret2[0]->count = 0;
-	newret3[0]->count = 0;
-
-
-	// Redis really only requires two connections ("myself,master" && one other master) || (at least two masters)
-	// but this will supply info for upto 1000 masters due to current Opensips design (hopefully representing the total hash slots)
-	// will always connect to myself,master
-	strstr(info,"myself,master")?(count = 999):(count = 1000);
-
-	// Cluster data into Array
-	if (explode(info,delimeters,newret1)) {
-		for (i=0;i<=newret1[0]->count;i++) {
-
-			if ((strstr(newret1[0]->redisdata[i],"master") && (masters <= count)) || strstr(newret1[0]->redisdata[i],"myself,master")) {
-
-				start_slot = end_slot = port = 0;
-				ip = NULL;
-				masters++;
-
-				// Break up the row 
-				if (explode(newret1[0]->redisdata[i]," ",newret2)) {
-					for (j=0 ; j <= newret2[0]->count ; j++ ) {
-
-						if (strstr(newret1[0]->redisdata[i],"myself") && strstr(newret2[0]->redisdata[j],"myself")) {
-							//myself no ip
-							ip = con->id->host;
-							port = con->id->port;
-							if (i==0) masters--;
-			
-						} else {
-							//Get the ip and port of other master
-							if (strstr(newret2[0]->redisdata[j],":") && (strlen(newret2[0]->redisdata[j]) > 5)) {
-
-								if (explode(newret2[0]->redisdata[j],":",newret3)) {
-									ip = (char *)newret3[0]->redisdata[0];
-									port = atoi(newret3[0]->redisdata[1]);
-								} else { block = ":parsing ip/port"; goto error;}
-							}
-						}
-						//Get slots
-						if (strstr(newret2[0]->redisdata[j],"-") && (strlen(newret2[0]->redisdata[j]) > 2)) {
-							if (explode(newret2[0]->redisdata[j],"-",newret3)) {
-								start_slot = atoi(newret3[0]->redisdata[0]);
-								end_slot   = atoi(newret3[0]->redisdata[1]);
-							} else {block = ":parsing slots"; goto error;}
-
-						}
-					}
-
-				} else { block = "row to array"; goto error;}
-
-				LM_DBG("ip port start end %s %hu %hu %hu\n",ip,port,start_slot,end_slot);
-
-				if ( ip == NULL || !(port > 0) || (start_slot > end_slot) || !(end_slot > 0) ) {block = ":processing row"; goto error;}
-
-				len = strlen(ip);
-				new = pkg_malloc(sizeof(cluster_node) + len + 1);
-				if (!new) {
-					LM_ERR("no more pkg\n");
-					goto error;
-				}
-
-				memset(new,0,sizeof(cluster_node) + len + 1);
-
-				new->ip = (char *)(new + 1);
-				strcpy(new->ip,ip);
-				new->port = port;
-				new->start_slot = start_slot;
-				new->end_slot = end_slot;
-
-				if (con->nodes == NULL)
-					con->nodes = new;
-				else {
-					new->next = con->nodes;
-					con->nodes = new;
-				}
-			}
-		}
+	update_stat(node->stats->redirects,1);
+}
+
+/*
+ * MI function - lists the Redis nodes used so far, with their round trip
+ * times and error counters
+ */
+struct mi_root *mi_redis_nodes(struct mi_root *cmd,void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *node;
+	unsigned long queries;
+	char *p;
+	int i,len;
 
-	} else { block = ":initial"; goto error;}
+	if (!redis_stats)
+		return init_mi_tree(400,MI_SSTR("Node statistics disabled"));
 
-	pkg_free(newret1);
-	pkg_free(newret2);
-	pkg_free(newret3);
+	rpl_tree = init_mi_tree(200,MI_SSTR(MI_OK));
+	if (!rpl_tree)
+		return NULL;
+	rpl_tree->node.flags |= MI_IS_ARRAY;
+
+	for (i=0;i<REDIS_STATS_NODES && redis_stats[i].addr[0];i++) {
+		node = add_mi_node_child(&rpl_tree->node,MI_DUP_VALUE,
+			MI_SSTR("node"),redis_stats[i].addr,strlen(redis_stats[i].addr));
+		if (!node)
+			goto error;
+
+		queries = get_stat_val(redis_stats[i].queries);
+		p = int2str(queries,&len);
+		if (!add_mi_attr(node,MI_DUP_VALUE,MI_SSTR("queries"),p,len))
+			goto error;
+		p = int2str(queries ?
+			get_stat_val(redis_stats[i].rtt_total) / queries : 0,&len);
+		if (!add_mi_attr(node,MI_DUP_VALUE,MI_SSTR("avg_rtt_us"),p,len))
+			goto error;
+		p = int2str(redis_stats[i].rtt_max,&len);
+		if (!add_mi_attr(node,MI_DUP_VALUE,MI_SSTR("max_rtt_us"),p,len))
+			goto error;
+		p = int2str(get_stat_val(redis_stats[i].errors),&len);
+		if (!add_mi_attr(node,MI_DUP_VALUE,MI_SSTR("errors"),p,len))
+			goto error;
+		p = int2str(get_stat_val(redis_stats[i].redirects),&len);
+		if (!add_mi_attr(node,MI_DUP_VALUE,MI_SSTR("redirects"),p,len))
+			goto error;
+	}
 
-	return 0;
+	return rpl_tree;
 
 error:
-	LM_ERR("Error while parsing cluster nodes in %s\n",block);
-	destroy_cluster_nodes(con);
-	return -1;
+	free_mi_tree(rpl_tree);
+	return NULL;
 }
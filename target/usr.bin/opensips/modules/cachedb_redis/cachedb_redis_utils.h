@@ -26,10 +26,20 @@
 #ifndef CACHEDB_REDIS_UTILSH
 #define CACHEDB_REDIS_UTILSH
 
+#include <sys/time.h>
+#include "../../mi/mi.h"
 #include "cachedb_redis_dbase.h"
 
-int build_cluster_nodes(redis_con *con,char *info,int size);
+int build_cluster_slots(redis_con *con,redisReply *rpl);
 extern inline cluster_node *get_redis_connection(redis_con *con,str *key);
+cluster_node *get_redis_node(redis_con *con,char *ip,int len,unsigned short port);
 void destroy_cluster_nodes(redis_con *con);
 
+int redis_stats_init(void);
+void redis_stats_destroy(void);
+struct redis_node_stats *redis_get_node_stats(char *ip,unsigned short port);
+void redis_node_account(cluster_node *node,struct timeval *start,int failed);
+void redis_node_redirected(cluster_node *node);
+struct mi_root *mi_redis_nodes(struct mi_root *cmd,void *param);
+
 #endif
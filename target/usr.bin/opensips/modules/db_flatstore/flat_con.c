@@ -23,15 +23,28 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
 #include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
 #include "../../dprint.h"
 #include "../../ut.h"
+#include "../../timer.h"
 #include "flatstore_mod.h"
 #include "flat_con.h"
 
 
-/* returns a pkg_malloc'ed file name */
-static char* get_name(struct flat_id* id)
+/* all the connections, of all the processes, for the idle timer */
+static struct flat_con** flat_cons = 0;
+static gen_lock_t* flat_cons_lock = 0;
+
+
+/*
+ * Returns a pkg_malloc'ed file name; stamp_pos is set to the offset the
+ * rotation stamp is to be inserted at (before the suffix)
+ */
+static char* get_name(struct flat_id* id, int* stamp_pos)
 {
 	char* buf;
 	int buf_len;
@@ -67,13 +80,12 @@ static char* get_name(struct flat_id* id)
 		prefix.s = 0;
 		prefix.len = 0;
 	}
-
-
 	total_len = id->dir.len + 1 /* / */ +
 		prefix.len /* table prefix */ +
 		id->table.len /* table name */ +
 		suffix.len /* table suffix */ +
-		flat_single_file ? 2 : 1 /* _ needed? + '\0' */;
+		(flat_compress ? FILE_GZ_SUFFIX_LEN : 0) +
+		(flat_single_file ? 1 : 2) /* _ needed? + '\0' */;
 				/* without pid */
 	if (buf_len<total_len){
 		LM_ERR("the path is too long (%d and PATHMAX is %d)\n",
@@ -113,18 +125,471 @@ static char* get_name(struct flat_id* id)
 		ptr += num_len;
 	}
 
+	*stamp_pos = ptr - buf;
+
 	memcpy(ptr, suffix.s, suffix.len);
 	ptr += suffix.len;
 
+	if (flat_compress) {
+		memcpy(ptr, FILE_GZ_SUFFIX, FILE_GZ_SUFFIX_LEN);
+		ptr += FILE_GZ_SUFFIX_LEN;
+	}
+
 	*ptr = '\0';
 	return buf;
 }
 
 
-struct flat_con* flat_new_connection(struct flat_id* id)
+static int flat_open_file(struct flat_con* con)
 {
+	struct stat st;
 	char* fn;
+	char* path;
+	int len;
+
+	fn = get_name(con->id, &con->stamp_pos);
+	if (fn==0){
+		LM_ERR("get_name() failed\n");
+		return -1;
+	}
+
+	con->file = fopen(fn, "a");
+	if (!con->file) {
+		LM_ERR("cannot open %s: %s\n", fn, strerror(errno));
+		pkg_free(fn);
+		return -1;
+	}
+
+	/* the name may change (prefix / suffix) with each reopening */
+	len = strlen(fn) + 1;
+	path = (char*)shm_malloc(len);
+	if (!path) {
+		LM_ERR("no shm memory left\n");
+		fclose(con->file);
+		con->file = 0;
+		pkg_free(fn);
+		return -1;
+	}
+	memcpy(path, fn, len);
+	pkg_free(fn); /* we don't need fn anymore */
+	if (con->path)
+		shm_free(con->path);
+	con->path = path;
+
+	con->file_gen = con->gen;
+	con->opened = time(0);
+	con->flushed = get_ticks();
+	con->size = 0;
+	con->dev = 0;
+	con->ino = 0;
+	if (fstat(fileno(con->file), &st) == 0) {
+		con->dev = st.st_dev;
+		con->ino = st.st_ino;
+		if (st.st_size > 0) {
+			/* appending to an older file - it belongs to the period of
+			 * its last change as far as the time based rotation is
+			 * concerned */
+			con->size = st.st_size;
+			if (st.st_mtime < con->opened)
+				con->opened = st.st_mtime;
+		}
+	}
+
+	return 0;
+}
+
+
+static void flat_close_file(struct flat_con* con)
+{
+	if (!con->file)
+		return;
+
+	flat_flush_connection(con);
+	if (flat_fsync != FLAT_FSYNC_NEVER && fsync(fileno(con->file)) < 0)
+		LM_ERR("cannot sync file: %s\n", strerror(errno));
+	fclose(con->file);
+	con->file = 0;
+}
+
+
+/*
+ * Writes the iovec to the file, as a complete gzip member if compressing
+ * (so that writes from several processes to the same file and the
+ * rotation never leave a broken stream behind)
+ */
+static int flat_write_out(struct flat_con* con, int fd, struct iovec* iov,
+																int n)
+{
+	static z_stream zs;
+	static int zs_init = 0;
+	static unsigned char* zbuf = 0;
+	static unsigned long zbuf_size = 0;
+	unsigned long len, bound;
+	int i, ret;
+	char *p;
+
+	if (!flat_compress) {
+		do {
+			ret = writev(fd, iov, n);
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0) {
+			LM_ERR("unable to write to file: %s - %d\n",
+				strerror(errno), errno);
+			return -1;
+		}
+		con->size += ret;
+		goto done;
+	}
+
+	if (!zs_init) {
+		memset(&zs, 0, sizeof zs);
+		/* 16 + window bits - gzip header and trailer */
+		if (deflateInit2(&zs, flat_compress, Z_DEFLATED, 16 + MAX_WBITS, 8,
+		Z_DEFAULT_STRATEGY) != Z_OK) {
+			LM_ERR("cannot initialize the compression\n");
+			return -1;
+		}
+		zs_init = 1;
+	} else {
+		deflateReset(&zs);
+	}
 
+	for (len = 0, i = 0; i < n; i++)
+		len += iov[i].iov_len;
+	bound = deflateBound(&zs, len);
+	if (bound > zbuf_size) {
+		if (zbuf)
+			pkg_free(zbuf);
+		zbuf = pkg_malloc(bound);
+		if (!zbuf) {
+			zbuf_size = 0;
+			LM_ERR("no more pkg memory\n");
+			return -1;
+		}
+		zbuf_size = bound;
+	}
+
+	zs.next_out = zbuf;
+	zs.avail_out = zbuf_size;
+	for (i = 0; i < n; i++) {
+		zs.next_in = (unsigned char *)iov[i].iov_base;
+		zs.avail_in = iov[i].iov_len;
+		ret = deflate(&zs, i == n - 1 ? Z_FINISH : Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			LM_ERR("compression failed (%d)\n", ret);
+			return -1;
+		}
+	}
+
+	/* a single write, to keep the member in one piece in the file */
+	for (p = (char *)zbuf, len = zs.total_out; len; ) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			LM_ERR("unable to write to file: %s - %d\n",
+				strerror(errno), errno);
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+	con->size += zs.total_out;
+
+done:
+	if (flat_fsync == FLAT_FSYNC_WRITE && fsync(fd) < 0)
+		LM_ERR("cannot sync file: %s\n", strerror(errno));
+	return 0;
+}
+
+
+/*
+ * Write a row (given as iovec) to the file, through the buffer if
+ * buffering is enabled
+ */
+int flat_write_row(struct flat_con* con, struct iovec* iov, int n)
+{
+	int i, len;
+
+	if (!flat_buffer_size)
+		return flat_write_out(con, fileno(con->file), iov, n);
+
+	for (len = 0, i = 0; i < n; i++)
+		len += iov[i].iov_len;
+
+	if (con->buf_len + len > flat_buffer_size &&
+	flat_flush_connection(con) < 0)
+		return -1;
+
+	/* rows that do not fit the buffer at all are written right away */
+	if (len > flat_buffer_size)
+		return flat_write_out(con, fileno(con->file), iov, n);
+
+	for (i = 0; i < n; i++) {
+		memcpy(con->buf + con->buf_len, iov[i].iov_base, iov[i].iov_len);
+		con->buf_len += iov[i].iov_len;
+	}
+
+	if (get_ticks() - con->flushed >= flat_flush_interval)
+		return flat_flush_connection(con);
+
+	return 0;
+}
+
+
+/* writes the buffered rows to fd */
+static int flat_flush_to(struct flat_con* con, int fd)
+{
+	struct iovec iov;
+	int ret = 0;
+
+	if (con->buf_len) {
+		iov.iov_base = con->buf;
+		iov.iov_len = con->buf_len;
+		ret = flat_write_out(con, fd, &iov, 1);
+		/* on failure the rows are dropped - there is nothing better to
+		 * do with them and the buffer is needed for the next ones */
+		con->buf_len = 0;
+	}
+	con->flushed = get_ticks();
+
+	return ret;
+}
+
+
+/*
+ * Write the buffered rows to the file
+ */
+int flat_flush_connection(struct flat_con* con)
+{
+	if (!con->file)
+		return 0;
+
+	return flat_flush_to(con, fileno(con->file));
+}
+
+
+/*
+ * Returns the pkg_malloc'ed name the file is to be moved to: its name
+ * stamped with the time it was started at, and a counter if taken
+ */
+static char* flat_rotated_name(struct flat_con* con)
+{
+	char stamp[32];
+	struct tm tm;
+	char *rn;
+	int len, plen, slen, i;
+
+	localtime_r(&con->opened, &tm);
+	len = strftime(stamp, sizeof stamp - 8, "%Y%m%d%H%M%S", &tm);
+	plen = strlen(con->path);
+
+	rn = pkg_malloc(plen + 1 /* . */ + sizeof stamp);
+	if (rn == 0) {
+		LM_ERR("no pkg memory left\n");
+		return 0;
+	}
+
+	for (i = 1; ; i++) {
+		slen = strlen(stamp);
+		memcpy(rn, con->path, con->stamp_pos);
+		rn[con->stamp_pos] = '.';
+		memcpy(rn + con->stamp_pos + 1, stamp, slen);
+		memcpy(rn + con->stamp_pos + 1 + slen, con->path + con->stamp_pos,
+			plen - con->stamp_pos + 1);
+		if (access(rn, F_OK) < 0 || i == 1000)
+			break;
+		sprintf(stamp + len, "-%d", i);
+	}
+
+	return rn;
+}
+
+
+/* renames the file to its rotated name */
+static void flat_move_aside(struct flat_con* con)
+{
+	time_t now;
+	char *rn;
+
+	rn = flat_rotated_name(con);
+	if (rn == 0)
+		return;
+
+	if (rename(con->path, rn) < 0)
+		LM_ERR("cannot rename %s to %s: %s\n", con->path, rn,
+			strerror(errno));
+	else
+		LM_DBG("rotated %s to %s\n", con->path, rn);
+	pkg_free(rn);
+
+	if (flat_single_file) {
+		/* make the other processes reopen the file */
+		now = time(0);
+		*flat_rotate = *flat_rotate >= now ? *flat_rotate + 1 : now;
+		local_timestamp = *flat_rotate;
+	}
+}
+
+
+/*
+ * Move the current file aside, under a name stamped with the time it
+ * was started at, and open a new one
+ */
+static int flat_rotate_file(struct flat_con* con)
+{
+	struct stat st_fd, st_fn;
+
+	/* all the processes share the file - some other one may have already
+	 * rotated it, so we just need to switch to the new one */
+	if (!flat_single_file || (fstat(fileno(con->file), &st_fd) == 0 &&
+	stat(con->path, &st_fn) == 0 && st_fd.st_ino == st_fn.st_ino &&
+	st_fd.st_dev == st_fn.st_dev))
+		flat_move_aside(con);
+
+	fclose(con->file);
+	con->file = 0;
+	return flat_open_file(con);
+}
+
+
+/*
+ * Move the file aside (rotate_size / rotate_interval) and start a new one
+ */
+int flat_check_rotation(struct flat_con* con)
+{
+	struct stat st;
+	time_t now;
+
+	if (!con->file)
+		return 0;
+
+	/* the idle timer moved the file aside meanwhile */
+	if (con->file_gen != con->gen) {
+		fclose(con->file);
+		con->file = 0;
+		return flat_open_file(con);
+	}
+
+	/* the file is written by all the processes */
+	if (flat_single_file && flat_rotate_size &&
+	fstat(fileno(con->file), &st) == 0)
+		con->size = st.st_size;
+
+	if (flat_rotate_size && con->size + con->buf_len >= flat_rotate_size)
+		goto rotate;
+
+	if (flat_rotate_interval) {
+		now = time(0);
+		if (now / flat_rotate_interval !=
+		con->opened / flat_rotate_interval)
+			goto rotate;
+	}
+
+	return 0;
+
+rotate:
+	flat_flush_connection(con);
+	if (flat_fsync != FLAT_FSYNC_NEVER && fsync(fileno(con->file)) < 0)
+		LM_ERR("cannot sync file: %s\n", strerror(errno));
+	return flat_rotate_file(con);
+}
+
+
+/* writes the buffered rows of a connection, by the name of its file,
+ * and syncs the file if asked to */
+static void flat_flush_idle(struct flat_con* con, int sync)
+{
+	int fd;
+
+	fd = open(con->path, O_WRONLY | O_APPEND | (con->buf_len ? O_CREAT : 0),
+		0666);
+	if (fd < 0) {
+		if (con->buf_len || errno != ENOENT)
+			LM_ERR("cannot open %s: %s\n", con->path, strerror(errno));
+		return;
+	}
+	flat_flush_to(con, fd);
+	if (sync && fsync(fd) < 0)
+		LM_ERR("cannot sync file: %s\n", strerror(errno));
+	close(fd);
+}
+
+
+/* moves aside the file of a connection its process did not write to
+ * since the current rotation period started */
+static void flat_rotate_idle(struct flat_con* con)
+{
+	struct stat st;
+
+	/* the buffered rows belong to the ending period */
+	if (con->buf_len || flat_fsync != FLAT_FSYNC_NEVER)
+		flat_flush_idle(con, flat_fsync != FLAT_FSYNC_NEVER);
+
+	/* not moved aside by some other process already (single file) */
+	if (stat(con->path, &st) == 0 && st.st_ino == con->ino &&
+	st.st_dev == con->dev) {
+		/* nothing written since the last rotation - keep it */
+		if (st.st_size == 0) {
+			con->opened = time(0);
+			return;
+		}
+		flat_move_aside(con);
+	}
+
+	/* the process opens the new file with its next row */
+	con->gen++;
+	con->opened = time(0);
+	con->size = 0;
+}
+
+
+static void flat_idle_timer(unsigned int ticks, void* param)
+{
+	struct flat_con* con;
+	time_t now;
+
+	now = time(0);
+
+	lock_get(flat_cons_lock);
+	for (con = *flat_cons; con; con = con->all_next) {
+		lock_get(&con->lock);
+		if (con->path && flat_rotate_interval &&
+		now / flat_rotate_interval != con->opened / flat_rotate_interval)
+			flat_rotate_idle(con);
+		else if (con->path && con->buf_len &&
+		ticks - con->flushed >= flat_flush_interval)
+			flat_flush_idle(con, 0);
+		lock_release(&con->lock);
+	}
+	lock_release(flat_cons_lock);
+}
+
+
+int flat_init_idle_timer(void)
+{
+	flat_cons = (struct flat_con**)shm_malloc(sizeof(struct flat_con*));
+	flat_cons_lock = lock_alloc();
+	if (!flat_cons || !flat_cons_lock) {
+		LM_ERR("no shm memory left\n");
+		return -1;
+	}
+	*flat_cons = 0;
+	lock_init(flat_cons_lock);
+
+	if ((flat_buffer_size || flat_rotate_interval) &&
+	register_timer("flatstore-idle", flat_idle_timer, 0, 1,
+	TIMER_FLAG_DELAY_ON_DELAY) < 0) {
+		LM_ERR("failed to register the idle timer\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+struct flat_con* flat_new_connection(struct flat_id* id)
+{
 	struct flat_con* res;
 
 	if (!id) {
@@ -132,30 +597,31 @@ struct flat_con* flat_new_connection(struct flat_id* id)
 		return 0;
 	}
 
-	res = (struct flat_con*)pkg_malloc(sizeof(struct flat_con));
+	res = (struct flat_con*)shm_malloc(sizeof(struct flat_con) +
+		flat_buffer_size);
 	if (!res) {
-		LM_ERR("no pkg memory left\n");
+		LM_ERR("no shm memory left\n");
 		return 0;
 	}
 
 	memset(res, 0, sizeof(struct flat_con));
 	res->ref = 1;
+	if (flat_buffer_size)
+		res->buf = (char *)(res + 1);
+	lock_init(&res->lock);
 
 	res->id = id;
 
-	fn = get_name(id);
-	if (fn==0){
-		LM_ERR("get_name() failed\n");
+	if (flat_open_file(res) < 0) {
+		lock_destroy(&res->lock);
+		shm_free(res);
 		return 0;
 	}
 
-	res->file = fopen(fn, "a");
-	pkg_free(fn); /* we don't need fn anymore */
-	if (!res->file) {
-		LM_ERR(" %s\n", strerror(errno));
-		pkg_free(res);
-		return 0;
-	}
+	lock_get(flat_cons_lock);
+	res->all_next = *flat_cons;
+	*flat_cons = res;
+	lock_release(flat_cons_lock);
 
 	return res;
 }
@@ -166,12 +632,24 @@ struct flat_con* flat_new_connection(struct flat_id* id)
  */
 void flat_free_connection(struct flat_con* con)
 {
+	struct flat_con** p;
+
 	if (!con) return;
+
+	/* out of the reach of the idle timer first */
+	lock_get(flat_cons_lock);
+	for (p = flat_cons; *p; p = &(*p)->all_next)
+		if (*p == con) {
+			*p = con->all_next;
+			break;
+		}
+	lock_release(flat_cons_lock);
+
+	flat_close_file(con);
 	if (con->id) free_flat_id(con->id);
-	if (con->file) {
-		fclose(con->file);
-	}
-	pkg_free(con);
+	if (con->path) shm_free(con->path);
+	lock_destroy(&con->lock);
+	shm_free(con);
 }
 
 
@@ -180,31 +658,23 @@ void flat_free_connection(struct flat_con* con)
  */
 int flat_reopen_connection(struct flat_con* con)
 {
-	char* fn;
+	int ret = 0;
 
 	if (!con) {
 		LM_ERR("invalid parameter value\n");
 		return -1;
 	}
 
+	lock_get(&con->lock);
 	if (con->file) {
-		fclose(con->file);
-		con->file = 0;
+		flat_close_file(con);
 
-		fn = get_name(con->id);
-		if (fn == 0) {
-			LM_ERR("failed to get_name\n");
-			return -1;
-		}
-
-		con->file = fopen(fn, "a");
-		pkg_free(fn);
-
-		if (!con->file) {
-			LM_ERR("invalid parameter value\n");
-			return -1;
+		if (flat_open_file(con) < 0) {
+			LM_ERR("cannot reopen file\n");
+			ret = -1;
 		}
 	}
+	lock_release(&con->lock);
 
-	return 0;
+	return ret;
 }
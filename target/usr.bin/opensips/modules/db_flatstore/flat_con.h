@@ -25,13 +25,34 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "../../locking.h"
 #include "flat_id.h"
 
+/*
+ * The connections are kept in shared memory, as the idle timer (run by
+ * any process) flushes and rotates the files of the idle ones by name.
+ * The fields after the lock are protected by it.
+ */
 struct flat_con {
 	struct flat_id* id;    /* Connection identifier */
 	int ref;               /* Reference count */
 	FILE* file;            /* File descriptor structure */
+	unsigned int file_gen; /* gen at the time the file was opened */
 	struct flat_con* next; /* Next connection in the pool */
+	gen_lock_t lock;       /* Shared with the idle timer */
+	char* path;            /* Name of the file (shm) */
+	int stamp_pos;         /* Where the rotation stamp goes in the name */
+	dev_t dev;             /* Device and inode of the file */
+	ino_t ino;
+	unsigned int gen;      /* Bumped when the timer rotated the file */
+	char* buf;             /* Rows not written yet, if buffering */
+	int buf_len;           /* Bytes in the buffer */
+	time_t flushed;        /* Last write of the buffer */
+	time_t opened;         /* When the file was opened */
+	unsigned long size;    /* Bytes written to the file */
+	struct flat_con* all_next; /* Next connection of any process */
 };
 
 
@@ -63,4 +84,33 @@ void flat_free_connection(struct flat_con* con);
 int flat_reopen_connection(struct flat_con* con);
 
 
+/*
+ * Write a row (given as iovec) to the file, through the buffer if
+ * buffering is enabled; called with the connection lock held
+ */
+int flat_write_row(struct flat_con* con, struct iovec* iov, int n);
+
+
+/*
+ * Write the buffered rows to the file; called with the connection lock
+ * held
+ */
+int flat_flush_connection(struct flat_con* con);
+
+
+/*
+ * Move the file aside (rotate_size / rotate_interval) and start a new
+ * one, or switch to the new one if the idle timer did it; called with the
+ * connection lock held
+ */
+int flat_check_rotation(struct flat_con* con);
+
+
+/*
+ * Register the timer flushing the buffers and rotating the files of the
+ * idle connections (if buffering or time based rotation is enabled)
+ */
+int flat_init_idle_timer(void);
+
+
 #endif /* _FLAT_CON_H */
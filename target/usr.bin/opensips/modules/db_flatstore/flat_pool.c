@@ -24,6 +24,7 @@
 #include "../../dprint.h"
 #include "flat_pool.h"
 #include "flat_id.h"
+#include "flatstore_mod.h"
 
 
 /* The head of the pool */
@@ -148,3 +149,24 @@ int flat_rotate_logs(void)
 
 	return 0;
 }
+
+
+/*
+ * Write the buffered rows of all connections
+ */
+void flat_flush_logs(void)
+{
+	struct flat_con* ptr;
+
+	/* the rows buffered by the parent are its own business */
+	if (pool_pid != getpid())
+		return;
+
+	for (ptr = pool; ptr; ptr = ptr->next) {
+		lock_get(&ptr->lock);
+		flat_flush_connection(ptr);
+		if (flat_fsync != FLAT_FSYNC_NEVER && ptr->file)
+			fsync(fileno(ptr->file));
+		lock_release(&ptr->lock);
+	}
+}
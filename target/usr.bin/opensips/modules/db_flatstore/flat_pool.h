@@ -45,4 +45,10 @@ void flat_release_connection(struct flat_con* con);
  */
 int flat_rotate_logs(void);
 
+
+/*
+ * Write the buffered rows of all connections
+ */
+void flat_flush_logs(void);
+
 #endif /* _FLAT_POOL_H */
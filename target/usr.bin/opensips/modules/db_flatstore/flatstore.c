@@ -308,6 +308,7 @@ static int flat_prepare_iovec(const int n)
 int flat_db_insert(const db_con_t* h, const db_key_t* k, const db_val_t* v,
 		const int n)
 {
+	struct flat_con* con;
 	FILE* f;
 	int i;
 	int auxl;
@@ -319,16 +320,27 @@ int flat_db_insert(const db_con_t* h, const db_key_t* k, const db_val_t* v,
 		local_timestamp = *flat_rotate;
 	}
 
-	if ( !h || !CON_TAIL(h) || (f=CON_FILE(h))==NULL ) {
+	if ( !h || !CON_TAIL(h) || CON_FILE(h)==NULL ) {
 		LM_ERR("uninitialized connection\n");
 		return -1;
 	}
 
+	con = (struct flat_con*)CON_TAIL(h);
 	if (flat_prepare_iovec(n) < 0) {
 		LM_ERR("cannot insert row\n");
 		return -1;
 	}
 
+	/* the idle timer may flush or rotate the file meanwhile */
+	lock_get(&con->lock);
+	if ((flat_rotate_size || flat_rotate_interval) &&
+	flat_check_rotation(con) < 0) {
+		LM_ERR("cannot rotate the file\n");
+		lock_release(&con->lock);
+		return -1;
+	}
+	f = CON_FILE(h);
+
 	FLAT_LOCK(f);
 
 	for(i = 0; i < n; i++) {
@@ -399,20 +411,18 @@ int flat_db_insert(const db_con_t* h, const db_key_t* k, const db_val_t* v,
 		}
 	}
 
-	do {
-		auxl = writev(fileno(f), flat_iov, 2 * n);
-	} while (auxl < 0 && errno == EINTR);
-
-	if (auxl < 0) {
-		LM_ERR("unable to write to file: %s - %d\n", strerror(errno), errno);
+	if (flat_write_row(con, flat_iov, 2 * n) < 0) {
+		FLAT_UNLOCK(f);
+		lock_release(&con->lock);
 		return -1;
 	}
 
 	/* XXX does this make sense any more? */
-	if (flat_flush && fflush(f) < 0) {
+	if (!flat_buffer_size && flat_flush && fflush(f) < 0) {
 		LM_ERR("cannot flush buffer: %s - %d\n", strerror(errno), errno);
 	}
 	FLAT_UNLOCK(f);
+	lock_release(&con->lock);
 
 
 	return 0;
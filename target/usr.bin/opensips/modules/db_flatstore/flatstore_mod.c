@@ -30,6 +30,8 @@
 #include "../../db/db.h"
 #include "flatstore.h"
 #include "flat_mi.h"
+#include "flat_pool.h"
+#include "flat_con.h"
 #include "flatstore_mod.h"
 
 
@@ -57,6 +59,30 @@ int flat_flush = 1;
  */
 int flat_single_file = 0;
 
+/*
+ * Size of the per file write buffer (0 - write each row)
+ * and how long may the rows stay in it
+ */
+int flat_buffer_size = 0;
+int flat_flush_interval = 1;
+
+/*
+ * Rotate the files when they grow over rotate_size bytes
+ * or every rotate_interval seconds (0 - disabled)
+ */
+int flat_rotate_size = 0;
+int flat_rotate_interval = 0;
+
+/*
+ * Gzip compression level of the files (0 - not compressed)
+ */
+int flat_compress = 0;
+
+/*
+ * fsync() policy
+ */
+int flat_fsync = FLAT_FSYNC_NEVER;
+
 
 /*
  * Delimiter delimiting columns
@@ -97,6 +123,12 @@ static param_export_t params[] = {
 	{"suffix", STR_PARAM, &flat_suffix_s},
 	{"prefix", STR_PARAM, &flat_prefix_s},
 	{"single_file", INT_PARAM, &flat_single_file},
+	{"buffer_size", INT_PARAM, &flat_buffer_size},
+	{"flush_interval", INT_PARAM, &flat_flush_interval},
+	{"rotate_size", INT_PARAM, &flat_rotate_size},
+	{"rotate_interval", INT_PARAM, &flat_rotate_interval},
+	{"compress", INT_PARAM, &flat_compress},
+	{"fsync", INT_PARAM, &flat_fsync},
 	{0, 0, 0}
 };
 
@@ -167,12 +199,39 @@ static int mod_init(void)
 		flat_prefix = 0;
 	}
 
+	if (flat_compress < 0 || flat_compress > 9) {
+		LM_ERR("compress must be a gzip level between 0 and 9\n");
+		return -1;
+	}
+	if (flat_fsync < FLAT_FSYNC_NEVER || flat_fsync > FLAT_FSYNC_ROTATE) {
+		LM_ERR("bad fsync policy %d\n", flat_fsync);
+		return -1;
+	}
+	if (flat_buffer_size < 0 || flat_rotate_size < 0 ||
+	flat_rotate_interval < 0) {
+		LM_ERR("buffer_size, rotate_size and rotate_interval cannot "
+			"be negative\n");
+		return -1;
+	}
+	if (flat_flush_interval < 0)
+		flat_flush_interval = 0;
+	/* a gzip member is written for each write, so rows are to be grouped */
+	if (flat_compress && !flat_buffer_size) {
+		LM_WARN("compression requires buffering - using a %d bytes "
+			"buffer\n", FLAT_DEFAULT_GZ_BUFFER);
+		flat_buffer_size = FLAT_DEFAULT_GZ_BUFFER;
+	}
+
+	if (flat_init_idle_timer() < 0)
+		return -1;
+
 	return 0;
 }
 
 
 static void mod_destroy(void)
 {
+	flat_flush_logs();
 	if (flat_rotate) shm_free(flat_rotate);
 }
 
@@ -184,6 +243,9 @@ static int child_init(int rank)
 	} else {
 		flat_pid = rank - PROC_TCP_MAIN;
 	}
+	/* do not lose the buffered rows when the process terminates */
+	if (flat_buffer_size && atexit(flat_flush_logs) != 0)
+		LM_WARN("cannot register the exit handler\n");
 	return 0;
 }
 
@@ -78,4 +78,36 @@ extern gparam_p flat_prefix;
 extern int flat_single_file;
 
 
+/*
+ * Buffering of the written rows (0 - disabled)
+ */
+extern int flat_buffer_size;
+#define FLAT_DEFAULT_GZ_BUFFER 65536
+extern int flat_flush_interval;
+
+
+/*
+ * Automatic rotation by size (bytes) and / or time (seconds)
+ */
+extern int flat_rotate_size;
+extern int flat_rotate_interval;
+
+
+/*
+ * Gzip compression level (0 - disabled)
+ */
+extern int flat_compress;
+#define FILE_GZ_SUFFIX ".gz"
+#define FILE_GZ_SUFFIX_LEN (sizeof(FILE_GZ_SUFFIX)-1)
+
+
+/*
+ * When to fsync() the files: never, after each write or when rotated
+ */
+#define FLAT_FSYNC_NEVER  0
+#define FLAT_FSYNC_WRITE  1
+#define FLAT_FSYNC_ROTATE 2
+extern int flat_fsync;
+
+
 #endif /* FLATSTORE_MOD_H */
@@ -25,21 +25,26 @@
  * --------
  *  2003-03-11  updated to the new module exports interface (andrei)
  *  2003-03-16  flags export parameter added (janakj)
+ *  2016-10-19  async connections pool, per query shape statistics
  */
 
 #include "../../sr_module.h"
 #include "../../db/db.h"
 #include "../../db/db_cap.h"
+#include "../../mi/mi.h"
 #include "dbase.h"
 #include "db_mysql.h"
+#include "my_stats.h"
 
 #include <mysql/mysql.h>
 
 unsigned int db_mysql_timeout_interval = 2;   /* Default is 6 seconds */
 unsigned int db_mysql_exec_query_threshold = 0;   /* Warning in case DB query
 											takes too long disabled by default*/
+int db_mysql_async_pool_size = 0;   /* async connections opened at once */
 
 static int mysql_mod_init(void);
+static void mysql_mod_destroy(void);
 
 
 
@@ -60,9 +65,20 @@ static cmd_export_t cmds[] = {
 static param_export_t params[] = {
 	{"timeout_interval", INT_PARAM, &db_mysql_timeout_interval},
 	{"exec_query_threshold", INT_PARAM, &db_mysql_exec_query_threshold},
+	{"async_pool_size",  INT_PARAM, &db_mysql_async_pool_size},
+	{"query_stats_size", INT_PARAM, &db_mysql_query_stats},
 	{0, 0, 0}
 };
 
+/*
+ * Exported MI functions
+ */
+static mi_export_t mi_cmds[] = {
+	{"mysql_query_stats", "lists the latency of the queries, by shape",
+		mi_mysql_query_stats, 0, 0, 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
 
 struct module_exports exports = {
 	"db_mysql",
@@ -74,12 +90,12 @@ struct module_exports exports = {
 	0,               /* exported async functions */
 	params,          /* module parameters */
 	0,               /* exported statistics */
-	0,               /* exported MI functions */
+	mi_cmds,         /* exported MI functions */
 	0,               /* exported pseudo-variables */
 	0,               /* extra processes */
 	mysql_mod_init,  /* module initialization function */
 	0,               /* response function*/
-	0,               /* destroy function */
+	mysql_mod_destroy, /* destroy function */
 	0                /* per-child init function */
 };
 
@@ -92,9 +108,20 @@ static int mysql_mod_init(void)
 		LM_ERR("Cannot register mysql event\n");
 		return -1;
 	}
+
+	if (my_stats_init() < 0) {
+		LM_ERR("failed to init the query statistics\n");
+		return -1;
+	}
 	return 0;
 }
 
+
+static void mysql_mod_destroy(void)
+{
+	my_stats_destroy();
+}
+
 int db_mysql_bind_api(const str* mod, db_func_t *dbb)
 {
 	if(dbb==NULL)
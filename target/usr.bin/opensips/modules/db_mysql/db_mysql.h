@@ -31,6 +31,7 @@
 
 extern unsigned int db_mysql_timeout_interval;
 extern unsigned int db_mysql_exec_query_threshold;
+extern int db_mysql_async_pool_size;
 
 int mysql_register_event(void);
 
@@ -48,6 +48,7 @@
 #include "row.h"
 #include "db_mysql.h"
 #include "dbase.h"
+#include "my_stats.h"
 
 static str mysql_event_name = str_init("E_MYSQL_CONNECTION");
 static str mysql_url_str = str_init("url");
@@ -279,7 +280,7 @@ static inline void switch_state_to_disconnected(const db_con_t *conn) {
 static int db_mysql_submit_query(const db_con_t* _h, const str* _s)
 {
 	int  code, i;
-	struct timeval start;
+	struct timeval start, qstart;
 
 	if (!_h || !_s || !_s->s) {
 		LM_ERR("invalid parameter value\n");
@@ -290,6 +291,9 @@ static int db_mysql_submit_query(const db_con_t* _h, const str* _s)
 	 * LM_DBG("submit_query(): %.*s\n", _s->len, _s->s);
 	 */
 
+	if (my_stats_on())
+		gettimeofday(&qstart, NULL);
+
 	for (i=0; i<2; i++) {
 		start_expire_timer(start,db_mysql_exec_query_threshold);
 		code = wrapper_single_mysql_real_query(_h, _s);
@@ -306,14 +310,20 @@ static int db_mysql_submit_query(const db_con_t* _h, const str* _s)
 			/* if reconnected, run the loop again */
 		} else if (code > 0) {
 			/* other problems - error already logged by the wrapper */
+			if (my_stats_on())
+				my_stats_account(_s, MY_Q_TEXT, &qstart, 1);
 			return -2;
 		} else {
 			mysql_raise_event(_h);
+			if (my_stats_on())
+				my_stats_account(_s, MY_Q_TEXT, &qstart, 0);
 			return 0; /* success */
 		}
 	}
 	mysql_raise_event(_h);
 	LM_CRIT("too many mysql server reconnection failures\n");
+	if (my_stats_on())
+		my_stats_account(_s, MY_Q_TEXT, &qstart, 1);
 
 	return -2;
 }
@@ -581,7 +591,7 @@ static int db_mysql_do_prepared_query(const db_con_t* conn, const str *query,
 	struct prep_stmt *pq_ptr;
 	struct my_stmt_ctx *ctx;
 	MYSQL_BIND *mysql_bind;
-	struct timeval start;
+	struct timeval start, qstart;
 	db_val_t **buffered_rows = NULL;
 
 	LM_DBG("conn=%p (tail=%ld) MC=%p\n",conn, conn->tail,CON_CONNECTION(conn));
@@ -690,6 +700,9 @@ static int db_mysql_do_prepared_query(const db_con_t* conn, const str *query,
 	}
 
 
+	if (my_stats_on())
+		gettimeofday(&qstart, NULL);
+
 	/* run the query */
 	i=0;
 	do {
@@ -734,12 +747,16 @@ static int db_mysql_do_prepared_query(const db_con_t* conn, const str *query,
 			i++;
 		} else if (code > 0) {
 			/* other problems */
+			if (my_stats_on())
+				my_stats_account(&ctx->query, MY_Q_PS, &qstart, 1);
 			cleanup_rows(buffered_rows);
 			return -1;
 		}
 	} while (code!=0 && i<2 );
 
 	mysql_raise_event(conn);
+	if (my_stats_on())
+		my_stats_account(&ctx->query, MY_Q_PS, &qstart, code != 0);
 	if (code != 0) {
 		LM_CRIT("too many mysql server reconnection failures\n");
 		cleanup_rows(buffered_rows);
@@ -1138,6 +1155,9 @@ int db_mysql_async_raw_query(db_con_t *_h, const str *_s, void **_priv)
 		return -1;
 	}
 
+	if (db_mysql_async_pool_size > 1)
+		db_mysql_warm_async_pool((struct my_con *)_h->tail);
+
 	con = (struct my_con *)db_init_async(_h, db_mysql_get_con_fd,
 	                           &fd_ref, (void *)db_mysql_new_connection);
 	*_priv = con;
@@ -1148,6 +1168,11 @@ int db_mysql_async_raw_query(db_con_t *_h, const str *_s, void **_priv)
 	/* no prepared statements support */
 	CON_RESET_CURR_PS(_h);
 
+	if (con && my_stats_on()) {
+		gettimeofday(&con->async_start, NULL);
+		con->async_shape = my_stats_shape(_s, MY_Q_ASYNC);
+	}
+
 	for (i = 0; i < 2; i++) {
 		start_expire_timer(start, db_mysql_exec_query_threshold);
 
@@ -1218,6 +1243,10 @@ int db_mysql_async_resume(db_con_t *_h, int fd, db_res_t **_r, void *_priv)
 	       mysql_errno(CON_CONNECTION(_h)), mysql_sqlstate(CON_CONNECTION(_h)),
 		   mysql_error(CON_CONNECTION(_h)));
 
+	if (my_stats_on())
+		my_stats_update(((struct my_con *)con)->async_shape,
+			&((struct my_con *)con)->async_start, rc != 0);
+
 	/* error status (most likely from a bad query) */
 	if (rc != 0) {
 		LM_ERR("error [%d, %s]: %s\n", mysql_errno(CON_CONNECTION(_h)),
@@ -26,6 +26,7 @@
 #include "../../mem/mem.h"
 #include "../../dprint.h"
 #include "../../ut.h"
+#include "../../globals.h"
 
 
 int db_mysql_connect(struct my_con* ptr)
@@ -120,16 +121,58 @@ err:
 }
 
 
+/**
+ * Opens ahead the idle connections of the async queries, so the first
+ * queries do not wait for a connect
+ */
+void db_mysql_warm_async_pool(struct my_con* con)
+{
+	struct pool_con *new;
+	int i, n;
+
+	if (con->async_warm)
+		return;
+	con->async_warm = 1;
+
+	n = db_mysql_async_pool_size;
+	if (n > db_max_async_connections)
+		n = db_max_async_connections;
+
+	for (i = 0; i < n; i++) {
+		new = (struct pool_con*)db_mysql_new_connection(con->id);
+		if (!new) {
+			LM_WARN("opened only %d async connections out of %d\n", i, n);
+			break;
+		}
+		new->next = con->async_pool;
+		con->async_pool = new;
+	}
+
+	LM_DBG("%d idle async connections opened for %p\n", i, con);
+}
+
+
 /**
  * Close the connection and release memory
  */
 void db_mysql_free_connection(struct pool_con* con)
 {
+	struct pool_con *async, *next;
+
 	if (!con) return;
 
 	struct my_con * _c;
 	_c = (struct my_con*) con;
 
+	/* the idle async connections share the db_id of the main one */
+	for (async = _c->async_pool; async; async = next) {
+		next = async->next;
+		async->id = NULL;
+		db_mysql_free_connection(async);
+	}
+	_c->async_pool = NULL;
+	if (_c->transfers) pkg_free(_c->transfers);
+
 	if (_c->ps_list) db_mysql_free_stmt_list(_c->ps_list);
 	if (_c->res) mysql_free_result(_c->res);
 	if (_c->id) free_db_id(_c->id);
@@ -26,6 +26,7 @@
 #include "../../db/db_id.h"
 
 #include <time.h>
+#include <sys/time.h>
 #include <mysql/mysql.h>
 
 
@@ -82,6 +83,10 @@ struct my_con {
 
 	struct prep_stmt *ps_list; /* list of prepared statements */
 	unsigned int disconnected; /* (CR_CONNECTION_ERROR) was detected */
+
+	unsigned int async_warm;   /* the async connections were pre-opened */
+	struct timeval async_start; /* when the ongoing async query was sent */
+	void *async_shape;         /* statistics slot of the async query */
 };
 
 
@@ -120,4 +125,10 @@ struct my_con* db_mysql_new_connection(const struct db_id* id);
  */
 void db_mysql_free_connection(struct pool_con* con);
 
+
+/*
+ * Opens ahead the idle connections used for the async queries
+ */
+void db_mysql_warm_async_pool(struct my_con* con);
+
 #endif /* MY_CON_H */
@@ -0,0 +1,435 @@
+/*
+ * Per query shape statistics for the MySQL driver
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  created - the queries are grouped by their text with the
+ *               literal values stripped out
+ */
+
+#include <string.h>
+#include "../../dprint.h"
+#include "../../ut.h"
+#include "../../atomic.h"
+#include "../../locking.h"
+#include "../../statistics.h"
+#include "../../mem/shm_mem.h"
+#include "my_stats.h"
+
+/* slots probed for a shape before giving up */
+#define MY_SHAPE_PROBES 8
+
+/* the statistics of a shape are registered in this group, as
+ * "<counter>-<mode>-<shape>" */
+#define MY_STATS_GROUP "db_mysql"
+
+struct my_shape {
+	volatile unsigned int hash;    /* 0 - free slot */
+	unsigned int type;
+	int len;
+	char shape[MY_SHAPE_LEN];
+	stat_var *count;
+	stat_var *failed;
+	stat_var *total_us;
+	/* a concurrent update may lose a maximum, harmless for a hint */
+	volatile unsigned long max_us;
+};
+
+struct my_shape_table {
+	gen_lock_t lock;               /* to claim a slot */
+	unsigned int size;
+	stat_var *dropped;             /* queries of shapes not fitting */
+	struct my_shape slots[0];
+};
+
+unsigned int db_mysql_query_stats = 0;
+
+static struct my_shape_table *my_shapes = NULL;
+
+static char *my_q_types[] = {"text", "prepared", "async"};
+
+
+int my_stats_init(void)
+{
+	unsigned int size;
+
+	if (db_mysql_query_stats == 0)
+		return 0;
+#ifndef STATISTICS
+	LM_WARN("the query statistics need the statistics support - "
+		"disabled\n");
+	db_mysql_query_stats = 0;
+	return 0;
+#endif
+
+	for (size = 1; size < db_mysql_query_stats; size <<= 1);
+	db_mysql_query_stats = size;
+
+	my_shapes = shm_malloc(sizeof *my_shapes + size * sizeof(struct my_shape));
+	if (my_shapes == NULL) {
+		LM_ERR("no more shm memory for %u query shapes\n", size);
+		return -1;
+	}
+	memset(my_shapes, 0, sizeof *my_shapes + size * sizeof(struct my_shape));
+	my_shapes->size = size;
+
+	if (lock_init(&my_shapes->lock) == NULL) {
+		LM_ERR("failed to init lock\n");
+		shm_free(my_shapes);
+		my_shapes = NULL;
+		return -1;
+	}
+
+	/* also creates the group, before forking, for the shapes to come */
+	if (register_stat(MY_STATS_GROUP, "not_tracked", &my_shapes->dropped,
+	0) != 0) {
+		LM_ERR("failed to add stat variable\n");
+		lock_destroy(&my_shapes->lock);
+		shm_free(my_shapes);
+		my_shapes = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void my_stats_destroy(void)
+{
+	if (my_shapes) {
+		lock_destroy(&my_shapes->lock);
+		shm_free(my_shapes);
+		my_shapes = NULL;
+	}
+}
+
+
+static inline int is_ident_char(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		(c >= '0' && c <= '9') || c == '_' || c == '$';
+}
+
+
+/*
+ * Copies the query, replacing the string and numeric literals with "?",
+ * lists of values with a single "?" and runs of white spaces with one
+ * space; returns the length of the shape
+ */
+static int my_query_shape(const str *q, char *out)
+{
+	char *p, *end, quote;
+	int n, prev_ident;
+
+	n = 0;
+	prev_ident = 0;
+	p = q->s;
+	end = q->s + q->len;
+
+	while (p < end && n < MY_SHAPE_LEN) {
+		if (*p == '\'' || *p == '"') {
+			/* string literal - '' and \' do not end it */
+			quote = *p++;
+			while (p < end) {
+				if (*p == '\\' && p + 1 < end) {
+					p += 2;
+				} else if (*p == quote) {
+					if (p + 1 < end && p[1] == quote)
+						p += 2;
+					else
+						break;
+				} else {
+					p++;
+				}
+			}
+			p++;
+			goto literal;
+		}
+
+		if (*p >= '0' && *p <= '9' && !prev_ident) {
+			while (p < end && (is_ident_char(*p) || *p == '.'))
+				p++;
+			goto literal;
+		}
+
+		if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+			*p == '\n'))
+				p++;
+			if (n && out[n - 1] != ' ')
+				out[n++] = ' ';
+			prev_ident = 0;
+			continue;
+		}
+
+		prev_ident = is_ident_char(*p);
+		out[n++] = *p++;
+		continue;
+
+literal:
+		prev_ident = 0;
+		/* "?,?" or "?, ?" -> "?" */
+		if (n >= 2 && out[n - 1] == ',' && out[n - 2] == '?') {
+			n--;
+			continue;
+		}
+		if (n >= 3 && out[n - 1] == ' ' && out[n - 2] == ',' &&
+		out[n - 3] == '?') {
+			n -= 2;
+			continue;
+		}
+		out[n++] = '?';
+	}
+
+	while (n && out[n - 1] == ' ')
+		n--;
+
+	return n;
+}
+
+
+static inline unsigned int my_shape_hash(char *s, int len, int type)
+{
+	unsigned int h = 2166136261u;
+	int i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619u;
+	h ^= type;
+
+	return h ? h : 1;
+}
+
+
+static int my_shape_stat(struct my_shape *s, char *counter, stat_var **var)
+{
+	char *name;
+	int len;
+
+	len = strlen(counter) + 1 + strlen(my_q_types[s->type]) + 1 + s->len;
+	name = shm_malloc(len + 1);
+	if (name == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	sprintf(name, "%s-%s-%.*s", counter, my_q_types[s->type], s->len,
+		s->shape);
+	if (register_stat(MY_STATS_GROUP, name, var, STAT_SHM_NAME) != 0) {
+		LM_ERR("failed to add stat variable\n");
+		shm_free(name);
+		return -1;
+	}
+	return 0;
+}
+
+
+static struct my_shape *my_get_shape(char *shape, int len, int type)
+{
+	struct my_shape *s;
+	unsigned int h, i, pos;
+
+	h = my_shape_hash(shape, len, type);
+
+	/* most of the times the shape is there already */
+	for (i = 0; i < MY_SHAPE_PROBES; i++) {
+		s = &my_shapes->slots[(h + i) & (my_shapes->size - 1)];
+		if (s->hash == 0)
+			break;
+		if (s->hash == h && s->type == type && s->len == len &&
+		memcmp(s->shape, shape, len) == 0)
+			return s;
+	}
+	if (i == MY_SHAPE_PROBES)
+		return NULL;
+
+	lock_get(&my_shapes->lock);
+
+	for (; i < MY_SHAPE_PROBES; i++) {
+		pos = (h + i) & (my_shapes->size - 1);
+		s = &my_shapes->slots[pos];
+		if (s->hash == 0) {
+			s->type = type;
+			s->len = len;
+			memcpy(s->shape, shape, len);
+			if (my_shape_stat(s, "count", &s->count) < 0 ||
+			my_shape_stat(s, "failed", &s->failed) < 0 ||
+			my_shape_stat(s, "total_us", &s->total_us) < 0) {
+				/* the registered ones are kept for a next try */
+				i = MY_SHAPE_PROBES;
+				break;
+			}
+			/* publish the slot only when filled in */
+			membar_full();
+			s->hash = h;
+			break;
+		}
+		if (s->hash == h && s->type == type && s->len == len &&
+		memcmp(s->shape, shape, len) == 0)
+			break;
+	}
+
+	lock_release(&my_shapes->lock);
+
+	return i < MY_SHAPE_PROBES ? s : NULL;
+}
+
+
+void *my_stats_shape(const str *query, int type)
+{
+	struct my_shape *s;
+	char shape[MY_SHAPE_LEN];
+	int len;
+
+	if (my_shapes == NULL || query == NULL || query->s == NULL)
+		return NULL;
+
+	len = my_query_shape(query, shape);
+	s = my_get_shape(shape, len, type);
+	if (s == NULL)
+		update_stat(my_shapes->dropped, 1);
+
+	return s;
+}
+
+
+void my_stats_update(void *shape, struct timeval *start, int failed)
+{
+	struct my_shape *s = (struct my_shape *)shape;
+	struct timeval now;
+	unsigned long us;
+
+	if (s == NULL)
+		return;
+
+	gettimeofday(&now, NULL);
+	us = (now.tv_sec - start->tv_sec) * 1000000 +
+		(now.tv_usec - start->tv_usec);
+
+	update_stat(s->count, 1);
+	if (failed)
+		update_stat(s->failed, 1);
+	update_stat(s->total_us, us);
+	if (us > s->max_us)
+		s->max_us = us;
+}
+
+
+void my_stats_account(const str *query, int type, struct timeval *start,
+		int failed)
+{
+	my_stats_update(my_stats_shape(query, type), start, failed);
+}
+
+
+/*
+ * MI function - lists the query shapes, with their statistics
+ * Params: [reset]
+ */
+struct mi_root *mi_mysql_query_stats(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *node, *rpl;
+	struct my_shape *s;
+	unsigned long count, failed, total_us, max_us, dropped;
+	unsigned int i;
+	int reset, len;
+	char *p;
+
+	if (my_shapes == NULL)
+		return init_mi_tree(400, MI_SSTR("Query statistics disabled"));
+
+	reset = 0;
+	node = cmd->node.kids;
+	if (node) {
+		if (node->next || node->value.len != 5 ||
+		strncasecmp(node->value.s, "reset", 5) != 0)
+			return init_mi_tree(400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
+		reset = 1;
+	}
+
+	rpl_tree = init_mi_tree(200, MI_OK_S, MI_OK_LEN);
+	if (rpl_tree == NULL)
+		return NULL;
+	rpl = &rpl_tree->node;
+	rpl->flags |= MI_IS_ARRAY;
+
+	for (i = 0; i < my_shapes->size; i++) {
+		s = &my_shapes->slots[i];
+		if (s->hash == 0)
+			continue;
+
+		if (reset) {
+			reset_stat(s->count);
+			reset_stat(s->failed);
+			reset_stat(s->total_us);
+			s->max_us = 0;
+			continue;
+		}
+		count = get_stat_val(s->count);
+		failed = get_stat_val(s->failed);
+		total_us = get_stat_val(s->total_us);
+		max_us = s->max_us;
+		if (count == 0)
+			continue;
+
+		node = add_mi_node_child(rpl, MI_DUP_VALUE, MI_SSTR("query"),
+			s->shape, s->len);
+		if (node == NULL)
+			goto error;
+
+		if (add_mi_attr(node, 0, MI_SSTR("mode"), my_q_types[s->type],
+		strlen(my_q_types[s->type])) == NULL)
+			goto error;
+
+		p = int2str(count, &len);
+		if (add_mi_attr(node, MI_DUP_VALUE, MI_SSTR("count"), p, len) == NULL)
+			goto error;
+
+		p = int2str(failed, &len);
+		if (add_mi_attr(node, MI_DUP_VALUE, MI_SSTR("failed"), p, len) == NULL)
+			goto error;
+
+		p = int2str(total_us / count, &len);
+		if (add_mi_attr(node, MI_DUP_VALUE, MI_SSTR("avg_us"), p, len)==NULL)
+			goto error;
+
+		p = int2str(max_us, &len);
+		if (add_mi_attr(node, MI_DUP_VALUE, MI_SSTR("max_us"), p, len)==NULL)
+			goto error;
+	}
+
+	dropped = get_stat_val(my_shapes->dropped);
+	if (reset)
+		reset_stat(my_shapes->dropped);
+
+	if (!reset && dropped) {
+		p = int2str(dropped, &len);
+		if (add_mi_node_child(rpl, MI_DUP_VALUE, MI_SSTR("not_tracked"),
+		p, len) == NULL)
+			goto error;
+	}
+
+	return rpl_tree;
+
+error:
+	free_mi_tree(rpl_tree);
+	return NULL;
+}
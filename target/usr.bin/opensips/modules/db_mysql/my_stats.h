@@ -0,0 +1,62 @@
+/*
+ * Per query shape statistics for the MySQL driver
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#ifndef MY_STATS_H
+#define MY_STATS_H
+
+#include <sys/time.h>
+#include "../../str.h"
+#include "../../mi/mi.h"
+
+/* how much of a query shape is kept (and compared) */
+#define MY_SHAPE_LEN 128
+
+/* the query runs over a text or a prepared statement / an async con */
+#define MY_Q_TEXT   0
+#define MY_Q_PS     1
+#define MY_Q_ASYNC  2
+
+/* slots of the shape table; 0 disables the statistics */
+extern unsigned int db_mysql_query_stats;
+
+int my_stats_init(void);
+
+void my_stats_destroy(void);
+
+/* the statistics slot of a query, NULL if not tracked */
+void *my_stats_shape(const str *query, int type);
+
+/* accounts a query of the given slot, run since "start" */
+void my_stats_update(void *shape, struct timeval *start, int failed);
+
+/* accounts a query run since "start"; "failed" if it returned an error */
+void my_stats_account(const str *query, int type, struct timeval *start,
+		int failed);
+
+static inline int my_stats_on(void)
+{
+	return db_mysql_query_stats != 0;
+}
+
+struct mi_root *mi_mysql_query_stats(struct mi_root *cmd, void *param);
+
+#endif /* MY_STATS_H */
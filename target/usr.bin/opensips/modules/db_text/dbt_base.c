@@ -168,10 +168,10 @@ int dbt_query(db_con_t* _h, db_key_t* _k, db_op_t* _op, db_val_t* _v,
 			db_key_t* _c, int _n, int _nc, db_key_t _o, db_res_t** _r)
 {
 	dbt_table_p _tbc = NULL;
-	dbt_row_p _drp = NULL;
+	dbt_row_p *_rows = NULL;
 	dbt_result_p _dres = NULL;
 
-	int *lkey=NULL, *lres=NULL;
+	int *lkey=NULL, *lres=NULL, i, nr;
 
 	if ((!_h) || (!_r) || !CON_TABLE(_h))
 	{
@@ -215,18 +215,17 @@ int dbt_query(db_con_t* _h, db_key_t* _k, db_op_t* _op, db_val_t* _v,
 	if(!_dres)
 		goto error;
 
-	_drp = _tbc->rows;
-	while(_drp)
+	nr = dbt_table_match(_tbc, lkey, _op, _v, _n, &_rows);
+	if(nr<0)
+		goto clean;
+
+	for(i=0; i<nr; i++)
 	{
-		if(dbt_row_match(_tbc, _drp, lkey, _op, _v, _n))
+		if(dbt_result_extract_fields(_tbc, _rows[i], lres, _dres))
 		{
-			if(dbt_result_extract_fields(_tbc, _drp, lres, _dres))
-			{
-				LM_ERR("failed to extract result fields!\n");
-				goto clean;
-			}
+			LM_ERR("failed to extract result fields!\n");
+			goto clean;
 		}
-		_drp = _drp->next;
 	}
 
 	dbt_table_update_flags(_tbc, DBT_TBFL_ZERO, DBT_FL_IGN, 1);
@@ -286,6 +285,7 @@ int dbt_insert(db_con_t* _h, db_key_t* _k, db_val_t* _v, int _n)
 {
 	dbt_table_p _tbc = NULL;
 	dbt_row_p _drp = NULL;
+	FILE *_jf;
 
 	int *lkey=NULL, i, j;
 
@@ -351,6 +351,10 @@ int dbt_insert(db_con_t* _h, db_key_t* _k, db_val_t* _v, int _n)
 		goto clean;
 	}
 
+	_jf = dbt_journal_open(_tbc);
+	dbt_journal_row(_jf, _tbc, _drp, DBT_JNL_INSERT);
+	dbt_journal_close(_jf, _tbc);
+
 	/* dbt_print_table(_tbc, NULL); */
 
 	/* unlock databse */
@@ -387,8 +391,9 @@ clean:
 int dbt_delete(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v, int _n)
 {
 	dbt_table_p _tbc = NULL;
-	dbt_row_p _drp = NULL, _drp0 = NULL;
-	int *lkey = NULL;
+	dbt_row_p *_rows = NULL;
+	FILE *_jf;
+	int *lkey = NULL, i, nr;
 
 	if (!_h || !CON_TABLE(_h))
 	{
@@ -409,6 +414,9 @@ int dbt_delete(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v, int _n)
 	{
 		LM_DBG("deleting all records\n");
 		dbt_table_free_rows(_tbc);
+		_jf = dbt_journal_open(_tbc);
+		dbt_journal_row(_jf, _tbc, NULL, DBT_JNL_CLEAR);
+		dbt_journal_close(_jf, _tbc);
 		/* unlock databse */
 
 		dbt_release_table(DBT_CON_CONNECTION(_h), CON_TABLE(_h));
@@ -419,25 +427,17 @@ int dbt_delete(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v, int _n)
 	if(!lkey)
 		goto error;
 
-	_drp = _tbc->rows;
-	while(_drp)
+	nr = dbt_table_match(_tbc, lkey, _o, _v, _n, &_rows);
+	if(nr<0)
+		goto error;
+
+	_jf = (nr>0) ? dbt_journal_open(_tbc) : NULL;
+	for(i=0; i<nr; i++)
 	{
-		_drp0 = _drp->next;
-		if(dbt_row_match(_tbc, _drp, lkey, _o, _v, _n))
-		{
-			// delete row
-			if(_drp->prev)
-				(_drp->prev)->next = _drp->next;
-			else
-				_tbc->rows = _drp->next;
-			if(_drp->next)
-				(_drp->next)->prev = _drp->prev;
-			_tbc->nrrows--;
-			// free row
-			dbt_row_free(_tbc, _drp);
-		}
-		_drp = _drp0;
+		dbt_journal_row(_jf, _tbc, _rows[i], DBT_JNL_DELETE);
+		dbt_table_del_row(_tbc, _rows[i]);
 	}
+	dbt_journal_close(_jf, _tbc);
 
 	dbt_table_update_flags(_tbc, DBT_TBFL_MODI, DBT_FL_SET, 1);
 
@@ -455,6 +455,8 @@ error:
 	/* unlock database */
 	dbt_release_table(DBT_CON_CONNECTION(_h), CON_TABLE(_h));
 
+	if(lkey)
+		pkg_free(lkey);
 	LM_ERR("failed to delete from table!\n");
 	return -1;
 }
@@ -466,8 +468,9 @@ int dbt_update(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v,
 	      db_key_t* _uk, db_val_t* _uv, int _n, int _un)
 {
 	dbt_table_p _tbc = NULL;
-	dbt_row_p _drp = NULL;
-	int i;
+	dbt_row_p *_rows = NULL;
+	FILE *_jf = NULL;
+	int i, j, nr;
 	int *lkey=NULL, *lres=NULL;
 
 	if (!_h || !CON_TABLE(_h) || !_uk || !_uv || _un <= 0)
@@ -493,30 +496,44 @@ int dbt_update(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v,
 	lres = dbt_get_refs(_tbc, _uk, _un);
 	if(!lres)
 		goto error;
-	_drp = _tbc->rows;
-	while(_drp)
+	for(i=0; i<_un; i++)
 	{
-		if(dbt_row_match(_tbc, _drp, lkey, _o, _v, _n))
-		{ // update fields
-			for(i=0; i<_un; i++)
+		if(dbt_is_neq_type(_tbc->colv[lres[i]]->type, _uv[i].type))
+		{
+			LM_ERR("incompatible types!\n");
+			goto error;
+		}
+	}
+
+	/* the matching rows are collected first, as updating an indexed
+	 * column moves the rows inside its index */
+	nr = dbt_table_match(_tbc, lkey, _o, _v, _n, &_rows);
+	if(nr<0)
+		goto error;
+
+	if(nr>0)
+		_jf = dbt_journal_open(_tbc);
+	for(j=0; j<nr; j++)
+	{ // update fields
+		dbt_journal_row(_jf, _tbc, _rows[j], DBT_JNL_DELETE);
+		for(i=0; i<_un; i++)
+		{
+			dbt_index_del_field(_tbc, _rows[j], lres[i]);
+			if(dbt_row_update_val(_rows[j], &(_uv[i]),
+						_tbc->colv[lres[i]]->type, lres[i]))
 			{
-				if(dbt_is_neq_type(_tbc->colv[lres[i]]->type, _uv[i].type))
-				{
-					LM_ERR("incompatible types!\n");
-					goto error;
-				}
-
-				if(dbt_row_update_val(_drp, &(_uv[i]),
-							_tbc->colv[lres[i]]->type, lres[i]))
-				{
-					LM_ERR("cannot set v[%d] in c[%d]!\n",
-							i, lres[i]);
-					goto error;
-				}
+				LM_ERR("cannot set v[%d] in c[%d]!\n",
+						i, lres[i]);
+				dbt_index_add_field(_tbc, _rows[j], lres[i]);
+				dbt_journal_row(_jf, _tbc, _rows[j], DBT_JNL_INSERT);
+				dbt_journal_close(_jf, _tbc);
+				goto error;
 			}
+			dbt_index_add_field(_tbc, _rows[j], lres[i]);
 		}
-		_drp = _drp->next;
+		dbt_journal_row(_jf, _tbc, _rows[j], DBT_JNL_INSERT);
 	}
+	dbt_journal_close(_jf, _tbc);
 
 	dbt_table_update_flags(_tbc, DBT_TBFL_MODI, DBT_FL_SET, 1);
 
@@ -27,6 +27,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -83,6 +85,303 @@ int dbt_check_mtime(const str *tbn, const str *dbn, time_t *mt)
 	return ret;
 }
 
+/**
+ * Reads the value of the column ccol of a row. On entry, *_c is the first
+ * character of the field, on return the one ending it (the delimiter, the
+ * end of line or EOF).
+ */
+static int dbt_read_field(FILE *fin, dbt_table_p dtp, dbt_row_p rowp,
+		int ccol, int *_c, char *buf, int *max_auto)
+{
+	dbt_val_t dtval;
+	int c, bp, sign;
+
+	c = *_c;
+
+		switch(dtp->colv[ccol]->type)
+		{
+			case DB_INT:
+			case DB_BIGINT:
+			case DB_DATETIME:
+				//LM_DBG("INT/BIGINT/DATETIME value!\n");
+				dtval.val.bigint_val = 0;
+				dtval.type = dtp->colv[ccol]->type;
+
+				if(c==DBT_DELIM ||
+						(ccol==dtp->nrcols-1
+						 && (c==DBT_DELIM_R || c==EOF)))
+					dtval.nul = 1;
+				else
+				{
+					dtval.nul = 0;
+					sign = 1;
+					if(c=='-')
+					{
+						sign = -1;
+						c = fgetc(fin);
+					}
+					if(c<'0' || c>'9')
+						goto error;
+					while(c>='0' && c<='9')
+					{
+						dtval.val.bigint_val=dtval.val.bigint_val*10+c-'0';
+						c = fgetc(fin);
+					}
+					dtval.val.bigint_val *= sign;
+					//LM_DBG("data[%d,%d]=%d\n", crow,
+					//	ccol, dtval.val.bigint_val);
+				}
+				if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
+					goto error;
+				if(dbt_row_set_val(rowp,&dtval,dtp->colv[ccol]->type,
+							ccol))
+					goto error;
+				if(ccol == dtp->auto_col)
+					*max_auto = (*max_auto<dtval.val.bigint_val)?
+							dtval.val.bigint_val:*max_auto;
+				if (dtval.type!=DB_BIGINT)
+					dtval.val.int_val = (int)dtval.val.bigint_val;
+			break;
+
+			case DB_DOUBLE:
+				//LM_DBG("DOUBLE value!\n");
+				dtval.val.double_val = 0.0;
+				dtval.type = DB_DOUBLE;
+
+				if(c==DBT_DELIM ||
+						(ccol==dtp->nrcols-1
+						 && (c==DBT_DELIM_R || c==EOF)))
+					dtval.nul = 1;
+				else
+				{
+					dtval.nul = 0;
+					sign = 1;
+					if(c=='-')
+					{
+						sign = -1;
+						c = fgetc(fin);
+					}
+					if(c<'0' || c>'9')
+						goto error;
+					while(c>='0' && c<='9')
+					{
+						dtval.val.double_val = dtval.val.double_val*10
+								+ c - '0';
+						c = fgetc(fin);
+					}
+					if(c=='.')
+					{
+						c = fgetc(fin);
+						bp = 1;
+						while(c>='0' && c<='9')
+						{
+							bp *= 10;
+							dtval.val.double_val+=((double)(c-'0'))/bp;
+							c = fgetc(fin);
+						}
+					}
+					dtval.val.double_val *= sign;
+					//LM_DBG("data[%d,%d]=%10.2f\n",
+					//	crow, ccol, dtval.val.double_val);
+				}
+				if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
+					goto error;
+				if(dbt_row_set_val(rowp,&dtval,DB_DOUBLE,ccol))
+					goto error;
+			break;
+
+			case DB_STR:
+			case DB_STRING:
+			case DB_BLOB:
+				//LM_DBG("STR value!\n");
+
+				dtval.val.str_val.s = NULL;
+				dtval.val.str_val.len = 0;
+				dtval.type = dtp->colv[ccol]->type;
+
+				bp = 0;
+				if(c==DBT_DELIM ||
+						(ccol == dtp->nrcols-1
+						 && (c == DBT_DELIM_R || c==EOF)))
+					dtval.nul = 1;
+				else
+				{
+					dtval.nul = 0;
+					while(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
+					{
+						if(c=='\\')
+						{
+							c = fgetc(fin);
+							switch(c)
+							{
+								case 'n':
+									c = '\n';
+								break;
+								case 'r':
+									c = '\r';
+								break;
+								case 't':
+									c = '\t';
+								break;
+								case '\\':
+									c = '\\';
+								break;
+								case DBT_DELIM:
+									c = DBT_DELIM;
+								break;
+								case '0':
+									c = 0;
+								break;
+								default:
+									goto error;
+							}
+						}
+						buf[bp++] = c;
+						c = fgetc(fin);
+					}
+					dtval.val.str_val.s = buf;
+					dtval.val.str_val.len = bp;
+					//LM_DBG("data[%d,%d]=%.*s\n",
+					///	crow, ccol, bp, buf);
+				}
+				if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
+					goto error;
+				if(dbt_row_set_val(rowp,&dtval,dtp->colv[ccol]->type,
+							ccol))
+					goto error;
+			break;
+			default:
+				goto error;
+		}
+
+	*_c = c;
+	return 0;
+error:
+	*_c = c;
+	return -1;
+}
+
+/**
+ * Applies the records of the journal file to a freshly loaded table.
+ * Returns the number of applied records.
+ */
+static int dbt_journal_replay(dbt_table_p dtp, const char *path)
+{
+	FILE *fin;
+	char buf[4096];
+	unsigned long ino;
+	int c, op, ccol, nr, recs, max_auto, *lkey;
+	dbt_row_p rowp = NULL, *rows;
+	long pos = 0;
+
+	fin = fopen(path, "rt");
+	if(!fin)
+		return 0;
+
+	/* the journal applies to the table file it was started for - if
+	 * the file was rewritten since, the records are already in it */
+	if(fscanf(fin, "#%lu\n", &ino)!=1 || ino!=dtp->ino)
+	{
+		LM_INFO("discarding stale journal [%s]\n", path);
+		fclose(fin);
+		unlink(path);
+		return 0;
+	}
+
+	lkey = (int*)pkg_malloc(dtp->nrcols*sizeof(int));
+	if(!lkey)
+	{
+		LM_ERR("no more pkg memory\n");
+		fclose(fin);
+		return -1;
+	}
+	for(ccol=0; ccol<dtp->nrcols; ccol++)
+		lkey[ccol] = ccol;
+
+	recs = 0;
+	max_auto = 0;
+	c = fgetc(fin);
+	while(c!=EOF)
+	{
+		pos = ftell(fin) - 1;
+		op = c;
+		c = fgetc(fin);
+
+		if(op==DBT_JNL_CLEAR)
+		{
+			if(c!=DBT_DELIM_R)
+				goto incomplete;
+			dbt_table_free_rows(dtp);
+			c = fgetc(fin);
+			recs++;
+			continue;
+		}
+		if(op!=DBT_JNL_INSERT && op!=DBT_JNL_DELETE)
+			goto incomplete;
+
+		rowp = dbt_row_new(dtp->nrcols);
+		if(!rowp)
+		{
+			LM_ERR("no more shm memory\n");
+			break;
+		}
+		for(ccol=0; ccol<dtp->nrcols; ccol++)
+		{
+			if(dbt_read_field(fin, dtp, rowp, ccol, &c, buf, &max_auto))
+				goto incomplete;
+			if(ccol<dtp->nrcols-1)
+			{
+				if(c!=DBT_DELIM)
+					goto incomplete;
+				c = fgetc(fin);
+			}
+		}
+		/* a record is complete only with its end of line */
+		if(c!=DBT_DELIM_R)
+			goto incomplete;
+		c = fgetc(fin);
+
+		if(op==DBT_JNL_INSERT)
+		{
+			if(dbt_table_add_row(dtp, rowp))
+				goto incomplete;
+		} else {
+			nr = dbt_table_match(dtp, lkey, NULL, rowp->fields,
+					dtp->nrcols, &rows);
+			if(nr>0)
+				dbt_table_del_row(dtp, rows[0]);
+			dbt_row_free(dtp, rowp);
+		}
+		rowp = NULL;
+		recs++;
+	}
+
+	goto done;
+incomplete:
+	/* most likely the last record, partially written - cut it off, so
+	 * that the records appended from now on are not lost */
+	LM_WARN("journal [%s]: dropping the records after %d\n", path, recs);
+	if(rowp)
+		dbt_row_free(dtp, rowp);
+	if(truncate(path, pos)<0)
+		LM_ERR("failed to truncate [%s]: %s\n", path, strerror(errno));
+done:
+	fclose(fin);
+	pkg_free(lkey);
+
+	if(max_auto > dtp->auto_val)
+		dtp->auto_val = max_auto;
+	dtp->jrecs = recs;
+	if(recs)
+	{
+		dbt_table_update_flags(dtp, DBT_TBFL_MODI, DBT_FL_SET, 1);
+		LM_DBG("%d journal records applied to [%.*s]\n", recs,
+				dtp->name.len, dtp->name.s);
+	}
+
+	return recs;
+}
+
 /**
  *
  */
@@ -90,8 +389,7 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 {
 	FILE *fin=NULL;
 	char path[512], buf[4096];
-	int c, crow, ccol, bp, sign, max_auto;
-	dbt_val_t dtval;
+	int c, crow, ccol, bp, max_auto;
 	dbt_table_p dtp = NULL;
 	dbt_column_p colp, colp0 = NULL;
 	dbt_row_p rowp, rowp0 = NULL;
@@ -228,7 +526,7 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 					}
 					c = fgetc(fin);
 				}
-				if(c==',')
+				while(c==',')
 				{
 					//LM_DBG("c=%c!\n", c);
 					c = fgetc(fin);
@@ -246,9 +544,14 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 						colp->flag |= DBT_FLAG_AUTO;
 						dtp->auto_col = ccol+1;
 					}
+					else if(c=='I' || c=='i')
+					{
+						//LM_DBG("INDEX flag set!\n");
+						colp->flag |= DBT_FLAG_INDEX;
+					}
 					else
 						goto clean;
-					while(c!=')' && c!=DBT_DELIM_R && c!=EOF)
+					while(c!=')' && c!=',' && c!=DBT_DELIM_R && c!=EOF)
 						c = fgetc(fin);
 				}
 				if(c == ')')
@@ -320,161 +623,8 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 				if(ccol>= dtp->nrcols)
 					goto clean;
 
-				switch(dtp->colv[ccol]->type)
-				{
-					case DB_INT:
-					case DB_BIGINT:
-					case DB_DATETIME:
-						//LM_DBG("INT/BIGINT/DATETIME value!\n");
-						dtval.val.bigint_val = 0;
-						dtval.type = dtp->colv[ccol]->type;
-
-						if(c==DBT_DELIM ||
-								(ccol==dtp->nrcols-1
-								 && (c==DBT_DELIM_R || c==EOF)))
-							dtval.nul = 1;
-						else
-						{
-							dtval.nul = 0;
-							sign = 1;
-							if(c=='-')
-							{
-								sign = -1;
-								c = fgetc(fin);
-							}
-							if(c<'0' || c>'9')
-								goto clean;
-							while(c>='0' && c<='9')
-							{
-								dtval.val.bigint_val=dtval.val.bigint_val*10+c-'0';
-								c = fgetc(fin);
-							}
-							dtval.val.bigint_val *= sign;
-							//LM_DBG("data[%d,%d]=%d\n", crow,
-							//	ccol, dtval.val.bigint_val);
-						}
-						if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
-							goto clean;
-						if(dbt_row_set_val(rowp,&dtval,dtp->colv[ccol]->type,
-									ccol))
-							goto clean;
-						if(ccol == dtp->auto_col)
-							max_auto = (max_auto<dtval.val.bigint_val)?
-									dtval.val.bigint_val:max_auto;
-						if (dtval.type!=DB_BIGINT)
-							dtval.val.int_val = (int)dtval.val.bigint_val;
-					break;
-
-					case DB_DOUBLE:
-						//LM_DBG("DOUBLE value!\n");
-						dtval.val.double_val = 0.0;
-						dtval.type = DB_DOUBLE;
-
-						if(c==DBT_DELIM ||
-								(ccol==dtp->nrcols-1
-								 && (c==DBT_DELIM_R || c==EOF)))
-							dtval.nul = 1;
-						else
-						{
-							dtval.nul = 0;
-							sign = 1;
-							if(c=='-')
-							{
-								sign = -1;
-								c = fgetc(fin);
-							}
-							if(c<'0' || c>'9')
-								goto clean;
-							while(c>='0' && c<='9')
-							{
-								dtval.val.double_val = dtval.val.double_val*10
-										+ c - '0';
-								c = fgetc(fin);
-							}
-							if(c=='.')
-							{
-								c = fgetc(fin);
-								bp = 1;
-								while(c>='0' && c<='9')
-								{
-									bp *= 10;
-									dtval.val.double_val+=((double)(c-'0'))/bp;
-									c = fgetc(fin);
-								}
-							}
-							dtval.val.double_val *= sign;
-							//LM_DBG("data[%d,%d]=%10.2f\n",
-							//	crow, ccol, dtval.val.double_val);
-						}
-						if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
-							goto clean;
-						if(dbt_row_set_val(rowp,&dtval,DB_DOUBLE,ccol))
-							goto clean;
-					break;
-
-					case DB_STR:
-					case DB_STRING:
-					case DB_BLOB:
-						//LM_DBG("STR value!\n");
-
-						dtval.val.str_val.s = NULL;
-						dtval.val.str_val.len = 0;
-						dtval.type = dtp->colv[ccol]->type;
-
-						bp = 0;
-						if(c==DBT_DELIM ||
-								(ccol == dtp->nrcols-1
-								 && (c == DBT_DELIM_R || c==EOF)))
-							dtval.nul = 1;
-						else
-						{
-							dtval.nul = 0;
-							while(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
-							{
-								if(c=='\\')
-								{
-									c = fgetc(fin);
-									switch(c)
-									{
-										case 'n':
-											c = '\n';
-										break;
-										case 'r':
-											c = '\r';
-										break;
-										case 't':
-											c = '\t';
-										break;
-										case '\\':
-											c = '\\';
-										break;
-										case DBT_DELIM:
-											c = DBT_DELIM;
-										break;
-										case '0':
-											c = 0;
-										break;
-										default:
-											goto clean;
-									}
-								}
-								buf[bp++] = c;
-								c = fgetc(fin);
-							}
-							dtval.val.str_val.s = buf;
-							dtval.val.str_val.len = bp;
-							//LM_DBG("data[%d,%d]=%.*s\n",
-							///	crow, ccol, bp, buf);
-						}
-						if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
-							goto clean;
-						if(dbt_row_set_val(rowp,&dtval,dtp->colv[ccol]->type,
-									ccol))
-							goto clean;
-					break;
-					default:
-						goto clean;
-				}
+				if(dbt_read_field(fin, dtp, rowp, ccol, &c, buf, &max_auto))
+					goto clean;
 
 				/* do not skip last row if it does not end with a newline */
 				if (c == EOF)
@@ -490,6 +640,23 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 	if(max_auto)
 		dtp->auto_val = max_auto;
 
+	fclose(fin);
+	fin = NULL;
+
+	for(ccol=0; ccol<dtp->nrcols; ccol++)
+		if((dtp->colv[ccol]->flag & DBT_FLAG_INDEX)
+				&& dbt_index_build(dtp, ccol)<0)
+			LM_WARN("table [%.*s] not indexed on [%.*s]\n",
+					tbn->len, tbn->s, dtp->colv[ccol]->name.len,
+					dtp->colv[ccol]->name.s);
+
+	/* apply the changes not yet written to the table file */
+	if(strlen(path)+sizeof(DBT_JOURNAL_EXT) <= sizeof(path))
+	{
+		strcat(path, DBT_JOURNAL_EXT);
+		dbt_journal_replay(dtp, path);
+	}
+
 done:
 	if(fin)
 		fclose(fin);
@@ -509,13 +676,89 @@ clean:
 /**
  *
  */
+static int dbt_print_row(FILE *fout, dbt_table_p _dtp, dbt_row_p rowp)
+{
+	int ccol;
+	char *p;
+
+	for(ccol=0; ccol<_dtp->nrcols; ccol++)
+	{
+		switch(_dtp->colv[ccol]->type)
+		{
+			case DB_DATETIME:
+			case DB_INT:
+				if(!rowp->fields[ccol].nul)
+					fprintf(fout,"%d",
+							rowp->fields[ccol].val.int_val);
+			break;
+			case DB_BIGINT:
+				if(!rowp->fields[ccol].nul)
+					fprintf(fout,"%lld",
+							rowp->fields[ccol].val.bigint_val);
+			break;
+			case DB_DOUBLE:
+				if(!rowp->fields[ccol].nul)
+					fprintf(fout, "%.2f",
+							rowp->fields[ccol].val.double_val);
+			break;
+			case DB_STR:
+			case DB_STRING:
+			case DB_BLOB:
+				if(!rowp->fields[ccol].nul)
+				{
+					p = rowp->fields[ccol].val.str_val.s;
+					while(p < rowp->fields[ccol].val.str_val.s
+							+ rowp->fields[ccol].val.str_val.len)
+					{
+						switch(*p)
+						{
+							case '\n':
+								fprintf(fout, "\\n");
+							break;
+							case '\r':
+								fprintf(fout, "\\r");
+							break;
+							case '\t':
+								fprintf(fout, "\\t");
+							break;
+							case '\\':
+								fprintf(fout, "\\\\");
+							break;
+							case DBT_DELIM:
+								fprintf(fout, "\\%c", DBT_DELIM);
+							break;
+							case '\0':
+								fprintf(fout, "\\0");
+							break;
+							default:
+								fprintf(fout, "%c", *p);
+						}
+						p++;
+					}
+				}
+			break;
+			default:
+				return -1;
+		}
+		if(ccol<_dtp->nrcols-1)
+			fprintf(fout, "%c",DBT_DELIM);
+	}
+	fprintf(fout, "%c", DBT_DELIM_R);
+
+	return 0;
+}
+
+/**
+ * The table file is written under a temporary name and renamed over the
+ * old one, so that it is never left incomplete.
+ */
 int dbt_print_table(dbt_table_p _dtp, str *_dbn)
 {
 	dbt_column_p colp = NULL;
 	dbt_row_p rowp = NULL;
 	FILE *fout = NULL;
-	int ccol;
-	char *p, path[512];
+	struct stat s;
+	char path[512], tmp[516];
 
 	if(!_dtp || !_dtp->name.s || _dtp->name.len <= 0)
 		return -1;
@@ -535,7 +778,8 @@ int dbt_print_table(dbt_table_p _dtp, str *_dbn)
 		path[_dbn->len] = '/';
 		strncpy(path+_dbn->len+1, _dtp->name.s, _dtp->name.len);
 		path[_dbn->len+_dtp->name.len+1] = 0;
-		fout = fopen(path, "wt");
+		snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+		fout = fopen(tmp, "wt");
 		if(!fout)
 			return -1;
 	}
@@ -567,15 +811,15 @@ int dbt_print_table(dbt_table_p _dtp, str *_dbn)
 				fprintf(fout, "%.*s(time", colp->name.len, colp->name.s);
 			break;
 			default:
-				if(fout!=stdout)
-					fclose(fout);
-				return -1;
+				goto error;
 		}
 
 		if(colp->flag & DBT_FLAG_NULL)
 				fprintf(fout,",null");
 		else if(colp->type==DB_INT && colp->flag & DBT_FLAG_AUTO)
 					fprintf(fout,",auto");
+		if(colp->flag & DBT_FLAG_INDEX)
+				fprintf(fout,",index");
 		fprintf(fout,")");
 
 		colp = colp->next;
@@ -586,77 +830,142 @@ int dbt_print_table(dbt_table_p _dtp, str *_dbn)
 	rowp = _dtp->rows;
 	while(rowp)
 	{
-		for(ccol=0; ccol<_dtp->nrcols; ccol++)
-		{
-			switch(_dtp->colv[ccol]->type)
-			{
-				case DB_DATETIME:
-				case DB_INT:
-					if(!rowp->fields[ccol].nul)
-						fprintf(fout,"%d",
-								rowp->fields[ccol].val.int_val);
-				break;
-				case DB_BIGINT:
-					if(!rowp->fields[ccol].nul)
-						fprintf(fout,"%lld",
-								rowp->fields[ccol].val.bigint_val);
-				break;
-				case DB_DOUBLE:
-					if(!rowp->fields[ccol].nul)
-						fprintf(fout, "%.2f",
-								rowp->fields[ccol].val.double_val);
-				break;
-				case DB_STR:
-				case DB_STRING:
-				case DB_BLOB:
-					if(!rowp->fields[ccol].nul)
-					{
-						p = rowp->fields[ccol].val.str_val.s;
-						while(p < rowp->fields[ccol].val.str_val.s
-								+ rowp->fields[ccol].val.str_val.len)
-						{
-							switch(*p)
-							{
-								case '\n':
-									fprintf(fout, "\\n");
-								break;
-								case '\r':
-									fprintf(fout, "\\r");
-								break;
-								case '\t':
-									fprintf(fout, "\\t");
-								break;
-								case '\\':
-									fprintf(fout, "\\\\");
-								break;
-								case DBT_DELIM:
-									fprintf(fout, "\\%c", DBT_DELIM);
-								break;
-								case '\0':
-									fprintf(fout, "\\0");
-								break;
-								default:
-									fprintf(fout, "%c", *p);
-							}
-							p++;
-						}
-					}
-				break;
-				default:
-					if(fout!=stdout)
-						fclose(fout);
-					return -1;
-			}
-			if(ccol<_dtp->nrcols-1)
-				fprintf(fout, "%c",DBT_DELIM);
-		}
-		fprintf(fout, "%c", DBT_DELIM_R);
+		if(dbt_print_row(fout, _dtp, rowp))
+			goto error;
 		rowp = rowp->next;
 	}
 
+	if(fout==stdout)
+		return 0;
+
+	if(fclose(fout)!=0)
+	{
+		LM_ERR("failed to write [%s]: %s\n", tmp, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	if(rename(tmp, path)<0)
+	{
+		LM_ERR("failed to rename [%s]: %s\n", tmp, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	/* our own change - no need to reload the table */
+	if(stat(path, &s) == 0)
+	{
+		_dtp->mt = s.st_mtime;
+		_dtp->ino = (unsigned long)s.st_ino;
+	}
+
+	return 0;
+error:
 	if(fout!=stdout)
+	{
 		fclose(fout);
+		unlink(tmp);
+	}
+	return -1;
+}
+
+
+/**
+ *
+ */
+static int dbt_journal_path(dbt_table_p _dtp, char *path, int size)
+{
+	if(snprintf(path, size, "%.*s/%.*s%s", _dtp->dbname.len, _dtp->dbname.s,
+			_dtp->name.len, _dtp->name.s, DBT_JOURNAL_EXT) >= size)
+		return -1;
+	return 0;
+}
+
+/**
+ * Opens the journal of the table for appending records; NULL if the
+ * journal is not enabled (or on error). To be called with the table locked.
+ */
+FILE *dbt_journal_open(dbt_table_p _dtp)
+{
+	char path[512];
+	FILE *f;
+
+	if(!journal || !_dtp)
+		return NULL;
+
+	if(dbt_journal_path(_dtp, path, sizeof(path))<0)
+		return NULL;
+
+	f = fopen(path, "a");
+	if(!f)
+	{
+		LM_ERR("cannot open journal [%s]: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	/* a new journal is bound to the current table file */
+	fseek(f, 0, SEEK_END);
+	if(ftell(f)==0)
+		fprintf(f, "#%lu\n", _dtp->ino);
+
+	return f;
+}
+
+/**
+ * Adds a record: the inserted or deleted row (no row for DBT_JNL_CLEAR)
+ */
+int dbt_journal_row(FILE *f, dbt_table_p _dtp, dbt_row_p _drp, char op)
+{
+	if(!f)
+		return 0;
+
+	fputc(op, f);
+	if(_drp)
+	{
+		if(dbt_print_row(f, _dtp, _drp))
+			return -1;
+	} else {
+		fputc(DBT_DELIM_R, f);
+	}
+	_dtp->jrecs++;
 
 	return 0;
 }
 
+/**
+ * The records are written (in one go, for small changes) when closing
+ */
+int dbt_journal_close(FILE *f, dbt_table_p _dtp)
+{
+	if(!f)
+		return 0;
+
+	if(fclose(f)!=0)
+	{
+		LM_ERR("failed to write the journal of [%.*s]: %s\n",
+				_dtp->name.len, _dtp->name.s, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Drops the journal, once the table file is up to date
+ */
+int dbt_journal_reset(dbt_table_p _dtp)
+{
+	char path[512];
+
+	_dtp->jrecs = 0;
+
+	if(dbt_journal_path(_dtp, path, sizeof(path))<0)
+		return -1;
+
+	if(unlink(path)<0 && errno!=ENOENT)
+	{
+		LM_ERR("cannot remove journal [%s]: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
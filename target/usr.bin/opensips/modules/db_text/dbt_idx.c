@@ -0,0 +1,557 @@
+/*
+ * DBText library - hash indexes
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ */
+
+#include <string.h>
+#include <ctype.h>
+
+#include "../../mem/shm_mem.h"
+#include "../../mem/mem.h"
+#include "../../dprint.h"
+
+#include "dbt_lib.h"
+#include "dbt_res.h"
+
+/* per process buffer holding the rows matched by a lookup */
+static dbt_row_p *dbt_match_buf = NULL;
+static int dbt_match_size = 0;
+
+/*
+ * The hashes must agree with dbt_cmp_val(): strings are compared case
+ * insensitive, up to the first 0
+ */
+static inline unsigned int dbt_str_hash(const char *_s, int _l)
+{
+	unsigned int h = 2166136261u;
+	int i;
+
+	for(i=0; i<_l && _s[i]; i++)
+		h = (h ^ (unsigned char)tolower((unsigned char)_s[i])) * 16777619u;
+
+	return h;
+}
+
+static inline unsigned int dbt_int_hash(long long _v)
+{
+	return (unsigned int)(_v ^ (_v >> 32)) * 2654435761u;
+}
+
+/**
+ * hash of a field of a row, -1 if it cannot be indexed
+ */
+static int dbt_field_hash(dbt_table_p _dtp, dbt_row_p _drp, int _c,
+		unsigned int *_h)
+{
+	dbt_val_p _vp = &_drp->fields[_c];
+
+	if(_vp->nul)
+		return -1;
+
+	switch(_dtp->colv[_c]->type)
+	{
+		case DB_STR:
+		case DB_STRING:
+		case DB_BLOB:
+			*_h = dbt_str_hash(_vp->val.str_val.s, _vp->val.str_val.len);
+			return 0;
+		case DB_INT:
+		case DB_DATETIME:
+			*_h = dbt_int_hash(_vp->val.int_val);
+			return 0;
+		case DB_BIGINT:
+			*_h = dbt_int_hash(_vp->val.bigint_val);
+			return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * hash of a value looked up in the column _c, -1 if the index of the
+ * column cannot be used for it
+ */
+static int dbt_key_hash(dbt_table_p _dtp, int _c, db_val_t *_v,
+		unsigned int *_h)
+{
+	if(_v->nul)
+		return -1;
+
+	switch(_dtp->colv[_c]->type)
+	{
+		case DB_STR:
+		case DB_STRING:
+		case DB_BLOB:
+			switch(VAL_TYPE(_v))
+			{
+				case DB_STRING:
+					*_h = dbt_str_hash(_v->val.string_val,
+							strlen(_v->val.string_val));
+					return 0;
+				case DB_STR:
+					*_h = dbt_str_hash(_v->val.str_val.s, _v->val.str_val.len);
+					return 0;
+				case DB_BLOB:
+					*_h = dbt_str_hash(_v->val.blob_val.s,
+							_v->val.blob_val.len);
+					return 0;
+				default:
+					return -1;
+			}
+		case DB_INT:
+		case DB_DATETIME:
+			switch(VAL_TYPE(_v))
+			{
+				case DB_INT:
+					*_h = dbt_int_hash(_v->val.int_val);
+					return 0;
+				case DB_DATETIME:
+					*_h = dbt_int_hash(_v->val.time_val);
+					return 0;
+				case DB_BITMAP:
+					*_h = dbt_int_hash((int)_v->val.bitmap_val);
+					return 0;
+				default:
+					return -1;
+			}
+		case DB_BIGINT:
+			if(VAL_TYPE(_v)!=DB_BIGINT)
+				return -1;
+			*_h = dbt_int_hash(_v->val.bigint_val);
+			return 0;
+	}
+
+	return -1;
+}
+
+/**
+ *
+ */
+static dbt_index_p dbt_index_new(unsigned int _size)
+{
+	dbt_index_p _dip;
+
+	_dip = (dbt_index_p)shm_malloc(sizeof(dbt_index_t));
+	if(!_dip)
+		return NULL;
+
+	_dip->buckets = (dbt_idx_entry_p*)shm_malloc(
+			_size*sizeof(dbt_idx_entry_p));
+	if(!_dip->buckets)
+	{
+		shm_free(_dip);
+		return NULL;
+	}
+	memset(_dip->buckets, 0, _size*sizeof(dbt_idx_entry_p));
+	_dip->size = _size;
+	_dip->nr = 0;
+
+	return _dip;
+}
+
+/**
+ * doubles the number of buckets
+ */
+static int dbt_index_grow(dbt_index_p _dip)
+{
+	dbt_idx_entry_p *_bv, _ep, _ep0;
+	unsigned int i, size;
+
+	size = _dip->size << 1;
+	_bv = (dbt_idx_entry_p*)shm_malloc(size*sizeof(dbt_idx_entry_p));
+	if(!_bv)
+		return -1;
+	memset(_bv, 0, size*sizeof(dbt_idx_entry_p));
+
+	for(i=0; i<_dip->size; i++)
+	{
+		_ep = _dip->buckets[i];
+		while(_ep)
+		{
+			_ep0 = _ep->next;
+			_ep->next = _bv[_ep->hash & (size-1)];
+			_bv[_ep->hash & (size-1)] = _ep;
+			_ep = _ep0;
+		}
+	}
+
+	shm_free(_dip->buckets);
+	_dip->buckets = _bv;
+	_dip->size = size;
+
+	return 0;
+}
+
+/**
+ *
+ */
+static int dbt_index_insert(dbt_index_p _dip, dbt_row_p _drp, unsigned int _h)
+{
+	dbt_idx_entry_p _ep;
+
+	/* a failed grow only makes the chains longer */
+	if(_dip->nr >= 2*_dip->size)
+		dbt_index_grow(_dip);
+
+	_ep = (dbt_idx_entry_p)shm_malloc(sizeof(dbt_idx_entry_t));
+	if(!_ep)
+		return -1;
+
+	_ep->row = _drp;
+	_ep->hash = _h;
+	_ep->next = _dip->buckets[_h & (_dip->size-1)];
+	_dip->buckets[_h & (_dip->size-1)] = _ep;
+	_dip->nr++;
+
+	return 0;
+}
+
+/**
+ *
+ */
+static void dbt_index_remove(dbt_index_p _dip, dbt_row_p _drp,
+		unsigned int _h)
+{
+	dbt_idx_entry_p *_epp, _ep;
+
+	_epp = &_dip->buckets[_h & (_dip->size-1)];
+	while(*_epp)
+	{
+		_ep = *_epp;
+		if(_ep->row==_drp)
+		{
+			*_epp = _ep->next;
+			shm_free(_ep);
+			_dip->nr--;
+			return;
+		}
+		_epp = &_ep->next;
+	}
+}
+
+/**
+ *
+ */
+static void dbt_index_empty(dbt_index_p _dip)
+{
+	dbt_idx_entry_p _ep, _ep0;
+	unsigned int i;
+
+	for(i=0; i<_dip->size; i++)
+	{
+		_ep = _dip->buckets[i];
+		while(_ep)
+		{
+			_ep0 = _ep;
+			_ep = _ep->next;
+			shm_free(_ep0);
+		}
+		_dip->buckets[i] = NULL;
+	}
+	_dip->nr = 0;
+}
+
+/**
+ * builds (if not already there) the index of the column _c
+ */
+int dbt_index_build(dbt_table_p _dtp, int _c)
+{
+	dbt_index_p _dip;
+	dbt_row_p _drp;
+	unsigned int size, h;
+
+	if(!_dtp || _c<0 || _c>=_dtp->nrcols)
+		return -1;
+
+	if(!_dtp->idxv)
+	{
+		_dtp->idxv = (dbt_index_p*)shm_malloc(
+				_dtp->nrcols*sizeof(dbt_index_p));
+		if(!_dtp->idxv)
+		{
+			LM_ERR("no more shm memory\n");
+			return -1;
+		}
+		memset(_dtp->idxv, 0, _dtp->nrcols*sizeof(dbt_index_p));
+	}
+
+	if(_dtp->idxv[_c])
+		return 0;
+
+	for(size=DBT_IDX_MIN_SIZE; size<_dtp->nrrows; size<<=1);
+
+	_dip = dbt_index_new(size);
+	if(!_dip)
+	{
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+
+	for(_drp=_dtp->rows; _drp; _drp=_drp->next)
+	{
+		if(dbt_field_hash(_dtp, _drp, _c, &h)<0)
+			continue;
+		if(dbt_index_insert(_dip, _drp, h)<0)
+		{
+			LM_ERR("no more shm memory\n");
+			dbt_index_empty(_dip);
+			shm_free(_dip->buckets);
+			shm_free(_dip);
+			return -1;
+		}
+	}
+
+	LM_DBG("index on [%.*s].[%.*s] built (%u rows)\n",
+			_dtp->name.len, _dtp->name.s, _dtp->colv[_c]->name.len,
+			_dtp->colv[_c]->name.s, _dip->nr);
+
+	_dtp->idxv[_c] = _dip;
+	return 0;
+}
+
+/**
+ *
+ */
+void dbt_index_free_all(dbt_table_p _dtp)
+{
+	int i;
+
+	if(!_dtp || !_dtp->idxv)
+		return;
+
+	for(i=0; i<_dtp->nrcols; i++)
+	{
+		if(!_dtp->idxv[i])
+			continue;
+		dbt_index_empty(_dtp->idxv[i]);
+		shm_free(_dtp->idxv[i]->buckets);
+		shm_free(_dtp->idxv[i]);
+	}
+	shm_free(_dtp->idxv);
+	_dtp->idxv = NULL;
+}
+
+/**
+ * removes all the rows from the indexes
+ */
+void dbt_index_clear(dbt_table_p _dtp)
+{
+	int i;
+
+	if(!_dtp || !_dtp->idxv)
+		return;
+
+	for(i=0; i<_dtp->nrcols; i++)
+		if(_dtp->idxv[i])
+			dbt_index_empty(_dtp->idxv[i]);
+}
+
+/**
+ *
+ */
+int dbt_index_add_field(dbt_table_p _dtp, dbt_row_p _drp, int _c)
+{
+	unsigned int h;
+
+	if(!_dtp->idxv || !_dtp->idxv[_c])
+		return 0;
+
+	if(dbt_field_hash(_dtp, _drp, _c, &h)<0)
+		return 0;
+
+	if(dbt_index_insert(_dtp->idxv[_c], _drp, h)<0)
+	{
+		/* the index would miss the row - drop it */
+		LM_ERR("no more shm memory, dropping the index of [%.*s]\n",
+				_dtp->colv[_c]->name.len, _dtp->colv[_c]->name.s);
+		dbt_index_empty(_dtp->idxv[_c]);
+		shm_free(_dtp->idxv[_c]->buckets);
+		shm_free(_dtp->idxv[_c]);
+		_dtp->idxv[_c] = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ *
+ */
+void dbt_index_del_field(dbt_table_p _dtp, dbt_row_p _drp, int _c)
+{
+	unsigned int h;
+
+	if(!_dtp->idxv || !_dtp->idxv[_c])
+		return;
+
+	if(dbt_field_hash(_dtp, _drp, _c, &h)<0)
+		return;
+
+	dbt_index_remove(_dtp->idxv[_c], _drp, h);
+}
+
+/**
+ *
+ */
+int dbt_index_add_row(dbt_table_p _dtp, dbt_row_p _drp)
+{
+	int i, ret = 0;
+
+	if(!_dtp || !_dtp->idxv)
+		return 0;
+
+	for(i=0; i<_dtp->nrcols; i++)
+		if(dbt_index_add_field(_dtp, _drp, i)<0)
+			ret = -1;
+
+	return ret;
+}
+
+/**
+ *
+ */
+void dbt_index_del_row(dbt_table_p _dtp, dbt_row_p _drp)
+{
+	int i;
+
+	if(!_dtp || !_dtp->idxv)
+		return;
+
+	for(i=0; i<_dtp->nrcols; i++)
+		dbt_index_del_field(_dtp, _drp, i);
+}
+
+/**
+ * unlinks a row from the table and frees it
+ */
+void dbt_table_del_row(dbt_table_p _dtp, dbt_row_p _drp)
+{
+	dbt_index_del_row(_dtp, _drp);
+
+	if(_drp->prev)
+		(_drp->prev)->next = _drp->next;
+	else
+		_dtp->rows = _drp->next;
+	if(_drp->next)
+		(_drp->next)->prev = _drp->prev;
+	_dtp->nrrows--;
+
+	dbt_row_free(_dtp, _drp);
+}
+
+/**
+ *
+ */
+static int dbt_match_add(dbt_row_p _drp, int _n)
+{
+	dbt_row_p *_rv;
+	int size;
+
+	if(_n==dbt_match_size)
+	{
+		size = dbt_match_size ? 2*dbt_match_size : 64;
+		_rv = (dbt_row_p*)pkg_realloc(dbt_match_buf, size*sizeof(dbt_row_p));
+		if(!_rv)
+		{
+			LM_ERR("no more pkg memory\n");
+			return -1;
+		}
+		dbt_match_buf = _rv;
+		dbt_match_size = size;
+	}
+
+	dbt_match_buf[_n] = _drp;
+	return 0;
+}
+
+/**
+ * Collects the rows matching the conditions. If one of them is an equality
+ * on an indexed column, only the rows in its bucket are checked. The array
+ * of rows is valid up to the next call.
+ * Returns the number of rows, -1 on error.
+ */
+int dbt_table_match(dbt_table_p _dtp, int *_lkey, db_op_t *_op,
+		db_val_t *_v, int _n, dbt_row_p **_rows)
+{
+	dbt_idx_entry_p _ep;
+	dbt_row_p _drp;
+	unsigned int h;
+	int i, k, nr;
+
+	if(!_dtp || !_rows)
+		return -1;
+
+	/* look for an equality on an indexed column, else index the first
+	 * column looked up by equality */
+	k = -1;
+	if(_lkey)
+	{
+		for(i=0; i<_n; i++)
+		{
+			if(_op && strcmp(_op[i], OP_EQ))
+				continue;
+			if(dbt_key_hash(_dtp, _lkey[i], &_v[i], &h)<0)
+				continue;
+			if(_dtp->idxv && _dtp->idxv[_lkey[i]])
+			{
+				k = i;
+				break;
+			}
+			if(k<0)
+				k = i;
+		}
+		if(k>=0 && (!_dtp->idxv || !_dtp->idxv[_lkey[k]]))
+		{
+			if(!auto_index || _dtp->nrrows<DBT_IDX_MIN_ROWS
+					|| dbt_index_build(_dtp, _lkey[k])<0)
+				k = -1;
+		}
+	}
+
+	nr = 0;
+	if(k>=0)
+	{
+		dbt_key_hash(_dtp, _lkey[k], &_v[k], &h);
+		_ep = _dtp->idxv[_lkey[k]]->buckets[
+				h & (_dtp->idxv[_lkey[k]]->size-1)];
+		for( ; _ep; _ep=_ep->next)
+		{
+			if(_ep->hash!=h
+					|| !dbt_row_match(_dtp, _ep->row, _lkey, _op, _v, _n))
+				continue;
+			if(dbt_match_add(_ep->row, nr)<0)
+				return -1;
+			nr++;
+		}
+	} else {
+		for(_drp=_dtp->rows; _drp; _drp=_drp->next)
+		{
+			if(!dbt_row_match(_dtp, _drp, _lkey, _op, _v, _n))
+				continue;
+			if(dbt_match_add(_drp, nr)<0)
+				return -1;
+			nr++;
+		}
+	}
+
+	*_rows = dbt_match_buf;
+	return nr;
+}
@@ -379,6 +379,51 @@ int dbt_cache_destroy(void)
 	return 0;
 }
 
+/**
+ * writes the table file and drops the journal, now redundant
+ */
+static int dbt_table_sync(dbt_table_p _tbc)
+{
+	if(dbt_print_table(_tbc, &(_tbc->dbname)))
+	{
+		LM_ERR("failed to write table [%.*s]\n",
+				_tbc->name.len, _tbc->name.s);
+		return -1;
+	}
+	dbt_journal_reset(_tbc);
+	dbt_table_update_flags(_tbc,DBT_TBFL_MODI, DBT_FL_UNSET, 0);
+
+	return 0;
+}
+
+/**
+ * rewrites the tables with at least _min records in their journal
+ */
+int dbt_cache_compact(int _min)
+{
+	int i;
+	dbt_table_p _tbc;
+
+	if(!_dbt_cachetbl)
+		return -1;
+
+	for(i=0; i< DBT_CACHETBL_SIZE; i++)
+	{
+		lock_get(&_dbt_cachetbl[i].sem);
+		for(_tbc=_dbt_cachetbl[i].dtp; _tbc; _tbc=_tbc->next)
+		{
+			if(_tbc->jrecs < _min || !(_tbc->flag & DBT_TBFL_MODI))
+				continue;
+			LM_DBG("compacting [%.*s] (%d journal records)\n",
+					_tbc->name.len, _tbc->name.s, _tbc->jrecs);
+			dbt_table_sync(_tbc);
+		}
+		lock_release(&_dbt_cachetbl[i].sem);
+	}
+
+	return 0;
+}
+
 /**
  *
  */
@@ -409,10 +454,7 @@ int dbt_cache_print(int _f)
 				dbt_print_table(_tbc, NULL);
 			} else {
 				if(_tbc->flag & DBT_TBFL_MODI)
-				{
-					dbt_print_table(_tbc, &(_tbc->dbname));
-					dbt_table_update_flags(_tbc,DBT_TBFL_MODI, DBT_FL_UNSET, 0);
-				}
+					dbt_table_sync(_tbc);
 			}
 			_tbc = _tbc->next;
 		}
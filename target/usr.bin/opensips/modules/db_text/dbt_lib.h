@@ -29,13 +29,17 @@
 #ifndef _DBT_LIB_H_
 #define _DBT_LIB_H_
 
+#include <stdio.h>
+
 #include "../../str.h"
 #include "../../db/db_val.h"
 #include "../../locking.h"
+#include "../../db/db_op.h"
 
 #define DBT_FLAG_UNSET  0
 #define DBT_FLAG_NULL   1
 #define DBT_FLAG_AUTO   2
+#define DBT_FLAG_INDEX  4
 
 #define DBT_TBFL_ZERO	0
 #define DBT_TBFL_MODI	1
@@ -52,6 +56,18 @@
  *  * Module parameters variables
  *   */
 extern int db_mode; /* Database usage mode: 0 = no cache, 1 = cache */
+extern int auto_index; /* index the columns used in equality lookups */
+extern int journal; /* log the changes to a per table journal file */
+extern int journal_compact; /* journal records triggering a table rewrite */
+
+/* auto-built indexes are only worth it for tables with more rows */
+#define DBT_IDX_MIN_ROWS	64
+#define DBT_IDX_MIN_SIZE	64
+
+#define DBT_JOURNAL_EXT	".journal"
+#define DBT_JNL_INSERT	'+'
+#define DBT_JNL_DELETE	'-'
+#define DBT_JNL_CLEAR	'!'
 
 typedef db_val_t dbt_val_t, *dbt_val_p;
 
@@ -73,6 +89,21 @@ typedef struct _dbt_column
 
 } dbt_column_t, *dbt_column_p;
 
+typedef struct _dbt_idx_entry
+{
+	dbt_row_p row;
+	unsigned int hash;
+	struct _dbt_idx_entry *next;
+} dbt_idx_entry_t, *dbt_idx_entry_p;
+
+/* hash index on the values of a column */
+typedef struct _dbt_index
+{
+	unsigned int size;     /* number of buckets - power of 2 */
+	unsigned int nr;       /* number of indexed rows */
+	dbt_idx_entry_p *buckets;
+} dbt_index_t, *dbt_index_p;
+
 
 typedef struct _dbt_table
 {
@@ -88,6 +119,9 @@ typedef struct _dbt_table
 	dbt_column_p *colv;
 	int nrrows;
 	dbt_row_p rows;
+	dbt_index_p *idxv;     /* per column index, if any */
+	int jrecs;             /* records in the journal file */
+	unsigned long ino;     /* inode of the table file */
 	time_t mt;
 	struct _dbt_table *next;
 	struct _dbt_table *prev;
@@ -111,6 +145,7 @@ typedef struct _dbt_cache
 int dbt_init_cache();
 int dbt_cache_destroy();
 int dbt_cache_print(int);
+int dbt_cache_compact(int);
 
 dbt_cache_p dbt_cache_get_db(str*);
 int dbt_cache_check_db(str*);
@@ -141,5 +176,20 @@ dbt_table_p dbt_load_file(const str *, const str *);
 int dbt_print_table(dbt_table_p, str *);
 int dbt_is_neq_type(db_type_t _t0, db_type_t _t1);
 
+int dbt_index_build(dbt_table_p, int);
+void dbt_index_free_all(dbt_table_p);
+void dbt_index_clear(dbt_table_p);
+int dbt_index_add_row(dbt_table_p, dbt_row_p);
+void dbt_index_del_row(dbt_table_p, dbt_row_p);
+int dbt_index_add_field(dbt_table_p, dbt_row_p, int);
+void dbt_index_del_field(dbt_table_p, dbt_row_p, int);
+void dbt_table_del_row(dbt_table_p, dbt_row_p);
+int dbt_table_match(dbt_table_p, int*, db_op_t*, db_val_t*, int, dbt_row_p**);
+
+FILE *dbt_journal_open(dbt_table_p);
+int dbt_journal_row(FILE *, dbt_table_p, dbt_row_p, char);
+int dbt_journal_close(FILE *, dbt_table_p);
+int dbt_journal_reset(dbt_table_p);
+
 #endif
 
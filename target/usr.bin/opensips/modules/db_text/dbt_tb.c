@@ -178,6 +178,7 @@ dbt_table_p dbt_table_new(const str *_tbname, const str *_dbname, const char *pa
 	if(stat(path, &s) == 0)
 	{
 		dtp->mt = s.st_mtime;
+		dtp->ino = (unsigned long)s.st_ino;
 		LM_DBG("mtime is %d\n", (int)s.st_mtime);
 	}
 
@@ -201,6 +202,7 @@ int dbt_table_free_rows(dbt_table_p _dtp)
 		_rp=_rp->next;
 		dbt_row_free(_dtp, _rp0);
 	}
+	dbt_index_clear(_dtp);
 
 	dbt_table_update_flags(_dtp, DBT_TBFL_MODI, DBT_FL_SET, 1);
 
@@ -229,6 +231,8 @@ int dbt_table_add_row(dbt_table_p _dtp, dbt_row_p _drp)
 	_dtp->rows = _drp;
 	_dtp->nrrows++;
 
+	dbt_index_add_row(_dtp, _drp);
+
 	return 0;
 }
 
@@ -249,6 +253,7 @@ int dbt_table_free(dbt_table_p _dtp)
 
 	if(_dtp->rows && _dtp->nrrows>0)
 		dbt_table_free_rows(_dtp);
+	dbt_index_free_all(_dtp);
 
 	_cp = _dtp->cols;
 	while(_cp)
@@ -32,6 +32,7 @@
 
 #include "../../sr_module.h"
 #include "../../db/db.h"
+#include "../../timer.h"
 #include "dbtext.h"
 #include "dbt_lib.h"
 #include "dbt_api.h"
@@ -42,11 +43,18 @@ static int mod_init(void);
 static void destroy(void);
 
 static struct mi_root* mi_dbt_dump(struct mi_root* cmd, void* param);
+static void dbt_compact_routine(unsigned int ticks, void *param);
+
+/* how often the journals are checked for compaction (s) */
+#define DBT_COMPACT_INTERVAL	10
 
 /*
  * Module parameter variables
  */
 int db_mode = 0;  /* Database usage mode: 0 = cache, 1 = no cache */
+int auto_index = 1;
+int journal = 0;
+int journal_compact = 10000;
 
 int dbt_bind_api(const str* mod, db_func_t *dbb);
 
@@ -64,6 +72,9 @@ static cmd_export_t cmds[] = {
  */
 static param_export_t params[] = {
 	{"db_mode", INT_PARAM, &db_mode},
+	{"auto_index", INT_PARAM, &auto_index},
+	{"journal", INT_PARAM, &journal},
+	{"journal_compact", INT_PARAM, &journal_compact},
 	{0, 0, 0}
 };
 
@@ -98,6 +109,14 @@ static int mod_init(void)
 {
 	if(dbt_init_cache())
 		return -1;
+
+	if(journal && journal_compact>0 &&
+	register_timer("dbt-compact", dbt_compact_routine, NULL,
+	DBT_COMPACT_INTERVAL, TIMER_FLAG_SKIP_ON_DELAY)<0)
+	{
+		LM_ERR("failed to register timer\n");
+		return -1;
+	}
 	/* return make_demo(); */
 
 	return 0;
@@ -131,6 +150,11 @@ int dbt_bind_api(const str* mod, db_func_t *dbb)
 	return 0;
 }
 
+static void dbt_compact_routine(unsigned int ticks, void *param)
+{
+	dbt_cache_compact(journal_compact);
+}
+
 static struct mi_root* mi_dbt_dump(struct mi_root* cmd, void* param)
 {
 	struct mi_root *rpl_tree;
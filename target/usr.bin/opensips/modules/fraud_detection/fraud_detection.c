@@ -22,9 +22,12 @@
  * History
  * -------
  *  2014-09-26  initial version (Andrei Datcu)
+ *  2016-10-19  stats kept as sliding window ring counters, sequential
+ *               calls detected per user and prefix
 */
 
 #include "../../ut.h"
+#include "../../timer.h"
 #include "../../db/db.h"
 #include "../../time_rec.h"
 #include "../../mod_fix.h"
@@ -68,7 +71,6 @@ DEF_PARAM_STR_NAME(seq_calls, "sequential calls");
 dr_head_p *dr_head;
 struct dr_binds drb;
 rw_lock_t *frd_data_lock;
-gen_lock_t *frd_seq_calls_lock;
 
 struct dlg_binds dlgb;
 
@@ -106,6 +108,9 @@ static param_export_t params[]={
 	{"concalls_thresh_crit_col",    STR_PARAM, &concalls_thresh_crit_col.s},
 	{"seqcalls_thresh_warn_col",    STR_PARAM, &seqcalls_thresh_warn_col.s},
 	{"seqcalls_thresh_crit_col",    STR_PARAM, &seqcalls_thresh_crit_col.s},
+	{"stats_hash_size",             INT_PARAM, &frd_stats_hash_size},
+	{"stats_max_entries",           INT_PARAM, &frd_stats_max_entries},
+	{"stats_idle_timeout",          INT_PARAM, &frd_stats_idle_timeout},
 	{0,0,0}
 };
 
@@ -117,6 +122,13 @@ static mi_export_t mi_cmds[] = {
 	{0,0,0,0,0,0}
 };
 
+static stat_export_t mod_stats[] = {
+	{"tracked_entries",   STAT_NO_RESET, &frd_tracked_entries },
+	{"evicted_entries",   0,             &frd_evicted_entries },
+	{"untracked_calls",   0,             &frd_untracked_calls },
+	{0,0,0}
+};
+
 static dep_export_t deps = {
 	{
 		{MOD_TYPE_SQLDB, NULL, DEP_ABORT},
@@ -139,7 +151,7 @@ struct module_exports exports= {
 	cmds,                       /* exported functions */
 	0,                          /* exported async functions */
 	params,                     /* exported parameters */
-	0,                          /* exported statistics */
+	mod_stats,                  /* exported statistics */
 	mi_cmds,                    /* exported MI functions */
 	0,                          /* exported pseudo-variables */
 	0,                          /* extra processes */
@@ -181,15 +193,6 @@ static int mod_init(void)
 		return -1;
 	}
 
-	if ((frd_seq_calls_lock = lock_alloc()) == NULL) {
-		LM_ERR("cannot alloc seq_calls lock\n");
-		return -1;
-	}
-	if (lock_init(frd_seq_calls_lock) == NULL) {
-		LM_ERR ("cannot init seq_calls lock\n");
-		return -1;
-	}
-
 	if (load_dlg_api(&dlgb) != 0) {
 		LM_ERR("failed to load dialog binds\n");
 		return -1;
@@ -216,6 +219,13 @@ static int mod_init(void)
 	if (init_stats_table() != 0)
 		return -1;
 
+	if (frd_stats_idle_timeout > 0 && register_timer("frd-stats-evict",
+	frd_evict_idle_stats, NULL, FRD_SECS_PER_WINDOW,
+	TIMER_FLAG_DELAY_ON_DELAY) < 0) {
+		LM_ERR("failed to register timer\n");
+		return -1;
+	}
+
 	/* Check if table version is ok */
 	frd_init_db();
 	frd_disconnect_db();
@@ -270,7 +280,6 @@ static int check_fraud(struct sip_msg *msg, char *_user, char *_number, char *_p
 	str user, number;
 	unsigned int pid;
 
-	static str last_called_prefix;
 	extern unsigned int frd_data_rev;
 
 	if (dr_head == NULL) {
@@ -312,89 +321,17 @@ static int check_fraud(struct sip_msg *msg, char *_user, char *_number, char *_p
 	/* We matched a rule */
 	str prefix = number;
 	prefix.len = matched_len;
-	str shm_user;
-	frd_stats_entry_t *se = get_stats(user, prefix, &shm_user);
-
-	/* Check if we need to reset the stats */
-
-	struct tm now, then;
-	time_t nowt = time(NULL);
-
-	/* We lock all the stats values */
-	lock_get(&se->lock);
-	if (gmtime_r(&se->stats.last_matched_time, &then) == NULL
-			|| gmtime_r(&nowt, &now) == NULL) {
-		LM_ERR ("Cannot use gmtime function. Will exit\n");
-		lock_release(&se->lock);
-		return rc_ok_thr;
-	}
-
-	if (se->stats.last_matched_time == 0 || se->stats.last_matched_rule != rule->id
-			|| then.tm_yday != now.tm_yday || then.tm_year != now.tm_year) {
-		se->stats.cpm = 0;
-		se->stats.total_calls = 0;
-		se->stats.concurrent_calls = 0;
-	}
-
-	/* Update the stats */
-
-	lock_get(frd_seq_calls_lock);
-	if (last_called_prefix.len == matched_len &&
-			memcmp(last_called_prefix.s, number.s, matched_len) == 0) {
-
-		/* We have called the same number last time */
-		++se->stats.seq_calls;
-	}
-	else {
-		last_called_prefix.s = shm_realloc(last_called_prefix.s,
-				matched_len * sizeof(char));
-		last_called_prefix.len = matched_len;
-		memcpy(last_called_prefix.s, number.s, matched_len);
-		se->stats.seq_calls = 1;
-	}
-	lock_release(frd_seq_calls_lock);
-
-	se->stats.last_matched_rule = rule->id;
-	++se->stats.total_calls;
-
-	/* Calls per FRD_SECS_PER_WINDOW */
-	if (nowt - se->stats.last_matched_time >= 2 * FRD_SECS_PER_WINDOW) {
-		/* outside the range of t0 + 2*WINDOW_SIZE; we can't use any of the
-		 * data since they are too old */
-		se->stats.cpm = 0;
-		memset(se->stats.calls_window, 0,
-				sizeof(unsigned short) * FRD_SECS_PER_WINDOW);
-		se->stats.calls_window[nowt % FRD_SECS_PER_WINDOW] = 1;
-		se->stats.last_matched_time = nowt;
-	}
-	else if (nowt - se->stats.last_matched_time >= FRD_SECS_PER_WINDOW) {
-		/* more than t0 + WINDOW_SIZE but less than 2 * WINDOW_SIZE
-		 * we can consider calls from t0 + (now - WINDOW_SIZE)
-		 * all cals from t0 to t0 + (now - WINDOW_SIZE) shall be invalidated */
-		unsigned int old_matched_time = se->stats.last_matched_time;
-
-		se->stats.last_matched_time = nowt - FRD_SECS_PER_WINDOW + 1;
-
-		/*interval [old_last_matched_time; current_last_matched_time) shall
-		 * be invalidated */
-		unsigned int i = (se->stats.last_matched_time - 1) % FRD_SECS_PER_WINDOW;
-		unsigned int j = (old_matched_time - 1) % FRD_SECS_PER_WINDOW;
-		for (;i != j; i = (i - 1 + FRD_SECS_PER_WINDOW) % FRD_SECS_PER_WINDOW) {
-			se->stats.cpm -= se->stats.calls_window[i];
-			se->stats.calls_window[i] = 0;
-		}
-		se->stats.calls_window[nowt%FRD_SECS_PER_WINDOW]++;
-	} else {
-		/* less than t0 + WINDOW_SIZE; all we need to do is to increase
-		 * the number of calls for nowt */
-		se->stats.calls_window[nowt%FRD_SECS_PER_WINDOW]++;
+	frd_stats_entry_t *se = get_stats(&user, &prefix, 1);
+	if (se == NULL) {
+		lock_stop_read(frd_data_lock);
+		return rc_error;
 	}
 
-	++se->stats.cpm;
-	++se->stats.concurrent_calls;
+	/* Update the stats - the entry is locked */
+	frd_stats_new_call(se, rule->id, &number, time(NULL));
 
 	/* Check the thresholds */
-	int rc = rc_no_rule;
+	int rc = rc_ok_thr;
 
 	frd_thresholds_t *thr = (frd_thresholds_t*)rule->attrs.s;
 
@@ -416,7 +353,7 @@ static int check_fraud(struct sip_msg *msg, char *_user, char *_number, char *_p
 
 #undef CHECK_AND_RAISE
 
-	lock_release(&se->lock);
+	release_stats(se);
 
 	/* Set dialog callback to check call duration */
 	struct dlg_cell *dlgc = dlgb.get_dlg();
@@ -427,32 +364,38 @@ static int check_fraud(struct sip_msg *msg, char *_user, char *_number, char *_p
 			LM_ERR("cannot get the new dlg\n");
 	}
 
+	int tracked = 0;
 	if (dlgc) {
 		frd_dlg_param *param = shm_malloc(sizeof(frd_dlg_param));
 		if (param == NULL)
-			LM_ERR("no more shm memory");
+			LM_ERR("no more shm memory\n");
 		else if (shm_str_dup(&param->number, &number) == 0){
 			param->stats = se;
 			param->thr = thr;
-			param->user = shm_user;
+			param->user = se->user;
 			param->ruleid = rule->id;
 			param->data_rev = frd_data_rev;
 
 			/* Register the dlg_terminate cb */
-			if (shm_str_dup(&param->number, &number) != 0)
-				shm_free(param);
-			else if (dlgb.register_dlgcb(dlgc, DLGCB_TERMINATED,
+			if (dlgb.register_dlgcb(dlgc, DLGCB_TERMINATED,
 						dialog_terminate_CB, param, NULL) != 0) {
 				LM_ERR("cannot register dialog callback\n");
 				shm_free(param->number.s);
 				shm_free(param);
 			}
+			else {
+				tracked = 1;
+			}
 		}
 		else {
 			shm_free(param);
 		}
 	}
 
+	/* no callback to end the call - it holds the entry otherwise */
+	if (!tracked)
+		frd_stats_end_call(se);
+
 	lock_stop_read(frd_data_lock);
 
 	return rc;
@@ -487,7 +430,8 @@ static struct mi_root* mi_show_stats(struct mi_root *cmd_tree, void *param)
 		return init_mi_tree(400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
 	}
 
-	if (!stats_exist(user, prefix)) {
+	frd_stats_entry_t *se = get_stats(&user, &prefix, 0);
+	if (se == NULL) {
 		LM_WARN("There is no data for user<%.*s> and prefix=<%.*s>\n",
 				user.len, user.s, prefix.len, prefix.s);
 		return init_mi_tree(400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
@@ -495,12 +439,14 @@ static struct mi_root* mi_show_stats(struct mi_root *cmd_tree, void *param)
 
 
 	struct mi_root* rpl_tree = init_mi_tree(200, MI_OK_S, MI_OK_LEN);
-	if (rpl_tree == NULL)
+	if (rpl_tree == NULL) {
+		release_stats(se);
 		return 0;
+	}
 	rpl_tree->node.flags |= MI_IS_ARRAY;
 
-	frd_stats_entry_t *se = get_stats(user, prefix, NULL);
-	lock_get(&se->lock);
+	/* drop the calls gone out of the window since the last one */
+	frd_stats_update_window(se, time(NULL));
 
 #define ADD_STAT_CHILD(pname, pval) do {\
 	int val_len;\
@@ -517,11 +463,11 @@ static struct mi_root* mi_show_stats(struct mi_root *cmd_tree, void *param)
 
 #undef ADD_STAT_CHILD
 
-	lock_release(&se->lock);
+	release_stats(se);
 	return rpl_tree;
 
 add_error:
-	lock_release(&se->lock);
+	release_stats(se);
 	LM_ERR("failed to add node\n");
 	free_mi_tree(rpl_tree);
 	return 0;
@@ -22,6 +22,8 @@
  * History
  * -------
  *  2014-09-26  initial version (Andrei Datcu)
+ *  2016-10-19  the ended call is released by frd_stats_end_call(), under
+ *               the bucket lock
 */
 
 #include "../../evi/evi_params.h"
@@ -165,9 +167,8 @@ void raise_critical_event(str *param, unsigned int *val, unsigned int *thr,
 					&frdparam->user, &frdparam->number, &frdparam->ruleid);
 	}
 
-	lock_get(&frdparam->stats->lock);
-	--frdparam->stats->stats.concurrent_calls;
-	lock_release(&frdparam->stats->lock);
+	/* last access to the entry - it may be evicted from now on */
+	frd_stats_end_call(frdparam->stats);
 
 	shm_free(frdparam->number.s);
 	shm_free(frdparam);
@@ -22,27 +22,44 @@
  * History
  * -------
  *  2014-09-26  initial version (Andrei Datcu)
+ *  2016-10-19  single level hash, sharded over a lock set, replacing the
+ *               AVL maps; per-second ring of calls, idle entries evicted
 */
 
 #include <string.h>
+#include <time.h>
 #include "frd_stats.h"
-#include "frd_hashmap.h"
 #include "../../ut.h"
+#include "../../hash_func.h"
+#include "../../mem/shm_mem.h"
 
-
-/* Struct used for the first level of the hashmap
- * the user is kept in shm for two reasons :
- *     a) to keep using core's map
- *     b) to pass it for the dialog_end callback
+/*
+ * All the (user, prefix) entries live in one hash table; the buckets are
+ * spread over a set of locks, the bucket i being guarded by the lock
+ * (i & (locks_no - 1)). An entry is never freed while it still has
+ * ongoing calls, as their dialogs point to it.
 */
 
 typedef struct {
+	gen_lock_set_t *locks;
+	unsigned int locks_no;
+	unsigned int size;
+	frd_stats_entry_t *buckets[0];
+} frd_stats_table_t;
+
+int frd_stats_hash_size = 4096;
+int frd_stats_max_entries = 0;
+int frd_stats_idle_timeout = 86400;
 
-	hash_map_t numbers_hm;
-	str user;
-} frd_users_map_item_t;
+static frd_stats_table_t *stats_table;
 
-static hash_map_t stats_table;
+/* both sizes are powers of 2, with locks_no <= size */
+#define frd_lock_idx(_hash) ((_hash) & (stats_table->locks_no - 1))
+
+/* counters of the table, exported as module statistics */
+stat_var *frd_tracked_entries;
+stat_var *frd_evicted_entries;
+stat_var *frd_untracked_calls;
 
 /*
  * Function to init the stats hash table
@@ -50,100 +67,296 @@ static hash_map_t stats_table;
 
 int init_stats_table(void)
 {
-	stats_table.size = FRD_USER_HASH_SIZE;
-	return init_hash_map(&stats_table);
+	unsigned int size;
+
+	if (frd_stats_hash_size <= 0) {
+		LM_ERR("invalid stats_hash_size %d\n", frd_stats_hash_size);
+		return -1;
+	}
+	for (size = 1; size < frd_stats_hash_size; size <<= 1);
+	frd_stats_hash_size = size;
+
+#ifndef STATISTICS
+	/* the number of entries is only counted by the statistics */
+	if (frd_stats_max_entries) {
+		LM_WARN("stats_max_entries needs statistics support, ignored\n");
+		frd_stats_max_entries = 0;
+	}
+#endif
+
+	stats_table = shm_malloc(sizeof *stats_table +
+			size * sizeof(frd_stats_entry_t*));
+	if (stats_table == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(stats_table, 0, sizeof *stats_table +
+			size * sizeof(frd_stats_entry_t*));
+
+	stats_table->size = size;
+	stats_table->locks_no = size < FRD_STATS_LOCKS ? size : FRD_STATS_LOCKS;
+
+	stats_table->locks = lock_set_alloc(stats_table->locks_no);
+	if (stats_table->locks == NULL) {
+		LM_ERR("cannot alloc the stats locks\n");
+		goto error;
+	}
+	if (lock_set_init(stats_table->locks) == NULL) {
+		LM_ERR("cannot init the stats locks\n");
+		lock_set_dealloc(stats_table->locks);
+		goto error;
+	}
+
+	return 0;
+
+error:
+	shm_free(stats_table);
+	stats_table = NULL;
+	return -1;
 }
 
 
-frd_stats_entry_t* get_stats(str user, str prefix, str *shm_user)
+static frd_stats_entry_t *new_stats_entry(str *user, str *prefix,
+		unsigned int hash)
 {
-	/* First go one level below using the user key */
-	frd_users_map_item_t **hm =
-		(frd_users_map_item_t **)get_item(&stats_table, user);
-
-	if (*hm == NULL) {
-		/* First time the user is seen, we must create a hashmap */
-		*hm = shm_malloc(sizeof(frd_users_map_item_t));
-		if (*hm == NULL) {
-			LM_ERR("no more shm memory\n");
-			return NULL;
-		}
+	frd_stats_entry_t *se;
 
-		(*hm)->numbers_hm.size = FRD_PREFIX_HASH_SIZE;
-		if (init_hash_map(&(*hm)->numbers_hm) != 0) {
-			LM_ERR("cannot init hashmap\n");
-			shm_free(*hm);
-			return NULL;
-		}
+	/* the user and the prefix are kept right after the entry */
+	se = shm_malloc(sizeof *se + user->len + prefix->len);
+	if (se == NULL) {
+		LM_ERR("no more shm memory\n");
+		return NULL;
+	}
+	memset(se, 0, sizeof *se);
+
+	se->hash = hash;
+	se->user.s = (char*)(se + 1);
+	se->user.len = user->len;
+	memcpy(se->user.s, user->s, user->len);
+	se->prefix.s = se->user.s + user->len;
+	se->prefix.len = prefix->len;
+	memcpy(se->prefix.s, prefix->s, prefix->len);
+
+	return se;
+}
+
+
+/*
+ * Called with the lock of the bucket taken, when the table is full;
+ * drops the least recently used entry of the bucket having no calls
+ * going on, if any
+*/
+
+static int evict_from_bucket(frd_stats_entry_t **bucket)
+{
+	frd_stats_entry_t **it, **lru = NULL, *se;
+
+	for (it = bucket; *it; it = &(*it)->next)
+		if ((*it)->stats.concurrent_calls == 0 &&
+				(lru == NULL || (*it)->last_seen < (*lru)->last_seen))
+			lru = it;
+
+	if (lru == NULL)
+		return -1;
+
+	se = *lru;
+	*lru = se->next;
+	shm_free(se);
+	return 0;
+}
 
-		if (shm_str_dup(&(*hm)->user, &user) != 0) {
-			shm_free(*hm);
-			return NULL;
+
+frd_stats_entry_t* get_stats(str *user, str *prefix, int create)
+{
+	frd_stats_entry_t *se, **bucket;
+	unsigned int hash, lock_idx;
+
+	hash = core_hash(user, prefix, 0);
+	bucket = &stats_table->buckets[hash & (stats_table->size - 1)];
+	lock_idx = frd_lock_idx(hash);
+
+	lock_set_get(stats_table->locks, lock_idx);
+
+	for (se = *bucket; se; se = se->next)
+		if (se->hash == hash && se->user.len == user->len &&
+				se->prefix.len == prefix->len &&
+				memcmp(se->user.s, user->s, user->len) == 0 &&
+				memcmp(se->prefix.s, prefix->s, prefix->len) == 0)
+			return se;
+
+	if (!create)
+		goto not_found;
+
+	/* first time the user calls this prefix */
+	if (frd_stats_max_entries &&
+			get_stat_val(frd_tracked_entries) >=
+			(unsigned long)frd_stats_max_entries) {
+		if (evict_from_bucket(bucket) != 0) {
+			LM_WARN("stats table full (%d entries), not tracking user "
+				"<%.*s>\n", frd_stats_max_entries, user->len, user->s);
+			update_stat(frd_untracked_calls, 1);
+			goto not_found;
 		}
+		update_stat(frd_evicted_entries, 1);
+		update_stat(frd_tracked_entries, -1);
 	}
 
-	if (shm_user)
-		*shm_user = (*hm)->user;
-
-	frd_stats_entry_t **stats_entry =
-		(frd_stats_entry_t**)get_item(&(*hm)->numbers_hm, prefix);
-	if (*stats_entry == NULL) {
-		/* First time the prefix is seen for this user */
-		*stats_entry = shm_malloc(sizeof(frd_stats_entry_t));
-		if (*stats_entry == NULL) {
-			LM_ERR("no more shm memory\n");
-			return NULL;
-		}
+	se = new_stats_entry(user, prefix, hash);
+	if (se == NULL) {
+		update_stat(frd_untracked_calls, 1);
+		goto not_found;
+	}
+
+	se->next = *bucket;
+	*bucket = se;
+	update_stat(frd_tracked_entries, 1);
 
-		/* Now init the auxiliary info for a stats structure */
-		if (!lock_init(&(*stats_entry)->lock)) {
-			LM_ERR ("cannot init lock\n");
-			shm_free(*stats_entry);
-			return NULL;
+	return se;
+
+not_found:
+	lock_set_release(stats_table->locks, lock_idx);
+	return NULL;
+}
+
+
+void release_stats(frd_stats_entry_t *se)
+{
+	lock_set_release(stats_table->locks, frd_lock_idx(se->hash));
+}
+
+
+/*
+ * The window keeps the calls of each of the last FRD_SECS_PER_WINDOW
+ * seconds; the slots between the last accounted second and now are
+ * cleared, so cpm is always the exact count of the sliding minute
+*/
+
+void frd_stats_update_window(frd_stats_entry_t *se, unsigned int now)
+{
+	frd_stats_t *st = &se->stats;
+	unsigned int i;
+
+	if (now - st->window_sec >= FRD_SECS_PER_WINDOW) {
+		memset(st->calls_window, 0, sizeof st->calls_window);
+		st->cpm = 0;
+	} else {
+		while (st->window_sec != now) {
+			i = ++st->window_sec % FRD_SECS_PER_WINDOW;
+			st->cpm -= st->calls_window[i];
+			st->calls_window[i] = 0;
 		}
-		memset(&((*stats_entry)->stats), 0, sizeof(frd_stats_t));
 	}
 
-	return *stats_entry;
+	st->window_sec = now;
 }
 
 
-int stats_exist(str user, str prefix)
+void frd_stats_new_call(frd_stats_entry_t *se, unsigned int ruleid,
+		str *number, unsigned int now)
 {
-	/* First go one level below using the user key */
-	frd_users_map_item_t **hm =
-		(frd_users_map_item_t **)get_item(&stats_table, user);
+	frd_stats_t *st = &se->stats;
+	unsigned int day = now / 86400;
+	unsigned int number_hash;
 
-	if (*hm == NULL)
-		return 0;
+	/* the total is counted per rule and per day */
+	if (st->last_matched_rule != ruleid || st->day != day) {
+		st->total_calls = 0;
+		st->last_matched_rule = ruleid;
+		st->day = day;
+	}
+	++st->total_calls;
+
+	number_hash = core_hash(number, NULL, 0);
+	if (st->seq_calls && st->last_number_hash == number_hash) {
+		++st->seq_calls;
+	} else {
+		st->last_number_hash = number_hash;
+		st->seq_calls = 1;
+	}
 
-	frd_stats_entry_t **stats_entry =
-		(frd_stats_entry_t**)get_item(&(*hm)->numbers_hm, prefix);
-	if (*stats_entry == NULL)
-		return 0;
+	frd_stats_update_window(se, now);
+	st->calls_window[now % FRD_SECS_PER_WINDOW]++;
+	++st->cpm;
 
-	return 1;
+	++st->concurrent_calls;
+	se->last_seen = now;
 }
 
-/*
- * Functions for freeing the stats hash table
-*/
 
-static void destroy_stats_entry(void *e)
+void frd_stats_end_call(frd_stats_entry_t *se)
 {
-	lock_destroy( &((frd_stats_entry_t*)e)->lock );
-	shm_free(e);
+	unsigned int lock_idx = frd_lock_idx(se->hash);
+
+	lock_set_get(stats_table->locks, lock_idx);
+	--se->stats.concurrent_calls;
+	lock_set_release(stats_table->locks, lock_idx);
 }
 
-static void destroy_users(void *u)
+
+/*
+ * Timer routine dropping the entries with no calls for more than
+ * stats_idle_timeout seconds; the locks are taken one at a time
+*/
+
+void frd_evict_idle_stats(unsigned int ticks, void *param)
 {
-	frd_users_map_item_t *hm = (frd_users_map_item_t*)u;
-	free_hash_map(&hm->numbers_hm, destroy_stats_entry);
-	shm_free(hm->user.s);
-	shm_free(u);
+	frd_stats_entry_t **it, *se;
+	unsigned int l, i, now, evicted = 0;
+
+	if (stats_table == NULL || frd_stats_idle_timeout <= 0)
+		return;
+
+	now = time(NULL);
+
+	for (l = 0; l < stats_table->locks_no; l++) {
+		lock_set_get(stats_table->locks, l);
+
+		for (i = l; i < stats_table->size; i += stats_table->locks_no) {
+			it = &stats_table->buckets[i];
+			while (*it) {
+				se = *it;
+				if (se->stats.concurrent_calls == 0 &&
+				now - se->last_seen >= (unsigned int)frd_stats_idle_timeout) {
+					*it = se->next;
+					shm_free(se);
+					evicted++;
+				} else {
+					it = &se->next;
+				}
+			}
+		}
+
+		lock_set_release(stats_table->locks, l);
+	}
+
+	if (evicted) {
+		LM_DBG("evicted %u idle entries\n", evicted);
+		update_stat(frd_tracked_entries, -(long)evicted);
+		update_stat(frd_evicted_entries, evicted);
+	}
 }
 
+
+/*
+ * Functions for freeing the stats hash table
+*/
+
 void free_stats_table(void)
 {
-	free_hash_map(&stats_table, destroy_users);
+	frd_stats_entry_t *se, *next;
+	unsigned int i;
+
+	if (stats_table == NULL)
+		return;
+
+	for (i = 0; i < stats_table->size; i++)
+		for (se = stats_table->buckets[i]; se; se = next) {
+			next = se->next;
+			shm_free(se);
+		}
+
+	lock_set_destroy(stats_table->locks);
+	lock_set_dealloc(stats_table->locks);
+	shm_free(stats_table);
+	stats_table = NULL;
 }
@@ -22,6 +22,7 @@
  * History
  * -------
  *  2014-09-26  initial version (Andrei Datcu)
+ *  2016-10-19  lock sharded hash of ring counters, with idle eviction
 */
 
 #ifndef __FRD_STATS_H__
@@ -30,32 +31,66 @@
 #include "../../str.h"
 #include "../../locking.h"
 #include "../../rw_locking.h"
+#include "../../statistics.h"
 
-#define FRD_USER_HASH_SIZE 1000
-#define FRD_PREFIX_HASH_SIZE 10
 #define FRD_SECS_PER_WINDOW 60
+/* max number of locks guarding the stats table */
+#define FRD_STATS_LOCKS 256
 
 typedef struct {
+	/* exact calls in the last FRD_SECS_PER_WINDOW seconds */
 	unsigned int cpm;
+	/* calls of the current (UTC) day */
 	unsigned int total_calls;
+	/* changed under the lock of the entry's bucket, as the rest */
 	unsigned int concurrent_calls;
+	/* calls in a row to the same number */
 	unsigned int seq_calls;
 
 	unsigned int last_matched_rule;
-	time_t last_matched_time;
+	unsigned int last_number_hash;
+	unsigned int day;
+	/* last second accounted into calls_window */
+	unsigned int window_sec;
 	unsigned short calls_window[FRD_SECS_PER_WINDOW];
 } frd_stats_t;
 
-typedef struct _frd_hash_item {
-	gen_lock_t            lock;
-	frd_stats_t           stats;
+typedef struct _frd_stats_entry {
+	struct _frd_stats_entry *next;
+	unsigned int hash;
+	/* time of the last call - used for evicting idle entries */
+	unsigned int last_seen;
+	str user;
+	str prefix;
+	frd_stats_t stats;
 } frd_stats_entry_t;
 
+extern int frd_stats_hash_size;
+extern int frd_stats_max_entries;
+extern int frd_stats_idle_timeout;
+
 int init_stats_table(void);
-frd_stats_entry_t* get_stats(str user, str prefix, str *shm_user);
-int stats_exist(str user, str prefix);
 void free_stats_table(void);
 
+/* returns the entry with its lock taken, NULL if not found (or not
+ * tracked); must be released with release_stats() */
+frd_stats_entry_t* get_stats(str *user, str *prefix, int create);
+void release_stats(frd_stats_entry_t *se);
+
+/* accounts a new call to "number" done at "now"; entry must be locked */
+void frd_stats_new_call(frd_stats_entry_t *se, unsigned int ruleid,
+		str *number, unsigned int now);
+/* brings the calls window of a locked entry up to "now" */
+void frd_stats_update_window(frd_stats_entry_t *se, unsigned int now);
+/* a call accounted by frd_stats_new_call() is over; entry must be unlocked */
+void frd_stats_end_call(frd_stats_entry_t *se);
+
+void frd_evict_idle_stats(unsigned int ticks, void *param);
+
+extern stat_var *frd_tracked_entries;
+extern stat_var *frd_evicted_entries;
+extern stat_var *frd_untracked_calls;
+
 
 typedef struct {
 	unsigned int warning;
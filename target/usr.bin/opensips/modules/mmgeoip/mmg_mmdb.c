@@ -0,0 +1,457 @@
+/*
+ * MaxMind DB (GeoIP2) lookups for the mmgeoip module
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  created - mmapped MMDB files, per process LRU cache of the
+ *               lookups, reload on file change
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <maxminddb.h>
+
+#include "../../dprint.h"
+#include "../../ut.h"
+#include "../../resolve.h"
+#include "../../ip_addr.h"
+#include "../../usr_avp.h"
+#include "../../statistics.h"
+#include "../../locking.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "mmg_mmdb.h"
+
+#define MMG_OP_DELIMS ":|,/ "
+
+int mmg_cache_size = 4096;
+int mmg_reload_interval = 0;
+
+stat_var *mmg_cache_hits;
+stat_var *mmg_cache_misses;
+stat_var *mmg_db_reloads;
+
+/* the path, as given to mmg_mmdb_open() */
+static char *mmg_db_path;
+/* per process mapping of the db */
+static MMDB_s mmg_db;
+static int mmg_db_open = 0;
+
+/* bumped in shm each time a new version of the file is to be used (by the
+ * timer or by the MI process, under the lock) */
+static volatile unsigned int *mmg_db_gen;
+static gen_lock_t *mmg_gen_lock;
+static unsigned int mmg_local_gen;
+
+/* last state of the file, as seen by the timer */
+static struct stat mmg_db_stat;
+
+/*
+ * The lookup cache of a process: a hash of the recently looked up
+ * addresses, with their results (the position of the record in the
+ * mmapped file, or its absence), kept in a LRU list
+ */
+struct mmg_cache_entry {
+	struct ip_addr ip;
+	MMDB_lookup_result_s res;
+	int used;
+	struct mmg_cache_entry *hnext;
+	struct mmg_cache_entry *prev, *next;
+};
+
+static struct mmg_cache_entry *mmg_cache;
+static struct mmg_cache_entry **mmg_cache_hash;
+static unsigned int mmg_cache_hsize;
+/* sentinel: next is the most, prev the least recently used */
+static struct mmg_cache_entry mmg_lru;
+
+/* how the fields map into the GeoIP2 City records */
+static struct mmg_field {
+	char *name;
+	const char *path[5];
+} mmg_fields[] = {
+	{"lat",  {"location", "latitude", NULL}},
+	{"lon",  {"location", "longitude", NULL}},
+	{"cont", {"continent", "code", NULL}},
+	{"cc",   {"country", "iso_code", NULL}},
+	{"reg",  {"subdivisions", "0", "iso_code", NULL}},
+	{"city", {"city", "names", "en", NULL}},
+	{"pc",   {"postal", "code", NULL}},
+	{"dma",  {"location", "metro_code", NULL}},
+	{"ac",   {NULL}},  /* no area codes in GeoIP2 */
+	{"rbc",  {"subdivisions", "0", "names", "en", NULL}},
+	{"tz",   {"location", "time_zone", NULL}},
+	{NULL,   {NULL}}
+};
+
+
+int mmg_mmdb_open(str *path)
+{
+	int rc;
+
+	rc = MMDB_open(path->s, MMDB_MODE_MMAP, &mmg_db);
+	if (rc == MMDB_INVALID_METADATA_ERROR)
+		return 0;
+	if (rc != MMDB_SUCCESS) {
+		LM_ERR("failed to open '%.*s': %s\n", path->len, path->s,
+			MMDB_strerror(rc));
+		return -1;
+	}
+
+	mmg_db_path = path->s;
+	mmg_db_open = 1;
+	return 1;
+}
+
+
+void mmg_mmdb_close(void)
+{
+	if (mmg_db_open) {
+		MMDB_close(&mmg_db);
+		mmg_db_open = 0;
+	}
+}
+
+
+int mmg_mmdb_in_use(void)
+{
+	return mmg_db_open;
+}
+
+
+int mmg_mmdb_init(void)
+{
+	mmg_db_gen = shm_malloc(sizeof *mmg_db_gen);
+	if (mmg_db_gen == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	*mmg_db_gen = mmg_local_gen = 0;
+
+	mmg_gen_lock = lock_alloc();
+	if (mmg_gen_lock == NULL || lock_init(mmg_gen_lock) == NULL) {
+		LM_ERR("failed to create the reload lock\n");
+		return -1;
+	}
+
+	if (stat(mmg_db_path, &mmg_db_stat) != 0)
+		memset(&mmg_db_stat, 0, sizeof mmg_db_stat);
+
+	return 0;
+}
+
+
+static int mmg_cache_init(void)
+{
+	unsigned int i;
+
+	for (mmg_cache_hsize = 1; mmg_cache_hsize < mmg_cache_size;
+	mmg_cache_hsize <<= 1);
+
+	mmg_cache = pkg_malloc(mmg_cache_size * sizeof *mmg_cache +
+		mmg_cache_hsize * sizeof *mmg_cache_hash);
+	if (mmg_cache == NULL) {
+		LM_ERR("no more pkg memory for %d cache entries\n", mmg_cache_size);
+		return -1;
+	}
+	memset(mmg_cache, 0, mmg_cache_size * sizeof *mmg_cache +
+		mmg_cache_hsize * sizeof *mmg_cache_hash);
+	mmg_cache_hash = (struct mmg_cache_entry **)(mmg_cache + mmg_cache_size);
+
+	mmg_lru.next = mmg_lru.prev = &mmg_lru;
+	for (i = 0; i < mmg_cache_size; i++) {
+		mmg_cache[i].next = mmg_lru.next;
+		mmg_cache[i].prev = &mmg_lru;
+		mmg_lru.next->prev = &mmg_cache[i];
+		mmg_lru.next = &mmg_cache[i];
+	}
+
+	return 0;
+}
+
+
+/* the cached results point into the mapping of the db */
+static void mmg_cache_flush(void)
+{
+	unsigned int i;
+
+	if (mmg_cache == NULL)
+		return;
+
+	memset(mmg_cache_hash, 0, mmg_cache_hsize * sizeof *mmg_cache_hash);
+	for (i = 0; i < mmg_cache_size; i++)
+		mmg_cache[i].used = 0;
+}
+
+
+static inline unsigned int mmg_ip_hash(struct ip_addr *ip)
+{
+	unsigned int h = ip->u.addr32[0];
+
+	if (ip->af == AF_INET6)
+		h ^= ip->u.addr32[1] ^ ip->u.addr32[2] ^ ip->u.addr32[3];
+
+	return (h * 2654435761u) >> 8 & (mmg_cache_hsize - 1);
+}
+
+
+static inline void mmg_lru_to_front(struct mmg_cache_entry *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+	e->next = mmg_lru.next;
+	e->prev = &mmg_lru;
+	mmg_lru.next->prev = e;
+	mmg_lru.next = e;
+}
+
+
+static MMDB_lookup_result_s *mmg_db_lookup(struct ip_addr *ip)
+{
+	static MMDB_lookup_result_s res;
+	struct mmg_cache_entry *e, **it;
+	union sockaddr_union su;
+	unsigned int h = 0;
+	int rc;
+
+	if (mmg_cache) {
+		h = mmg_ip_hash(ip);
+		for (e = mmg_cache_hash[h]; e; e = e->hnext)
+			if (ip_addr_cmp(&e->ip, ip)) {
+				mmg_lru_to_front(e);
+				update_stat(mmg_cache_hits, 1);
+				return &e->res;
+			}
+		update_stat(mmg_cache_misses, 1);
+	}
+
+	init_su(&su, ip, 0);
+	res = MMDB_lookup_sockaddr(&mmg_db, &su.s, &rc);
+	if (rc != MMDB_SUCCESS) {
+		LM_ERR("lookup failed: %s\n", MMDB_strerror(rc));
+		return NULL;
+	}
+
+	if (mmg_cache == NULL)
+		return &res;
+
+	/* recycle the least recently used entry */
+	e = mmg_lru.prev;
+	if (e->used) {
+		for (it = &mmg_cache_hash[mmg_ip_hash(&e->ip)]; *it != e;
+		it = &(*it)->hnext);
+		*it = e->hnext;
+	}
+
+	e->ip = *ip;
+	e->res = res;
+	e->used = 1;
+	e->hnext = mmg_cache_hash[h];
+	mmg_cache_hash[h] = e;
+	mmg_lru_to_front(e);
+
+	return &e->res;
+}
+
+
+/* maps the new version of the db in this process */
+static void mmg_db_reopen(void)
+{
+	MMDB_s db;
+	int rc;
+
+	rc = MMDB_open(mmg_db_path, MMDB_MODE_MMAP, &db);
+	if (rc != MMDB_SUCCESS) {
+		LM_ERR("failed to reopen '%s', keeping the old one: %s\n",
+			mmg_db_path, MMDB_strerror(rc));
+		return;
+	}
+
+	mmg_cache_flush();
+	MMDB_close(&mmg_db);
+	mmg_db = db;
+
+	LM_DBG("now using version %u of '%s'\n", mmg_local_gen, mmg_db_path);
+}
+
+
+static int mmg_add_value(MMDB_entry_data_s *d, int dst_name,
+		unsigned short dst_type)
+{
+	static char buf[64];
+	int_str rslt;
+	int len;
+
+	rslt.s.s = buf;
+	rslt.s.len = 0;
+
+	if (d->has_data) {
+		switch (d->type) {
+		case MMDB_DATA_TYPE_UTF8_STRING:
+			/* straight out of the mapping */
+			rslt.s.s = (char *)d->utf8_string;
+			rslt.s.len = d->data_size;
+			break;
+		case MMDB_DATA_TYPE_DOUBLE:
+			rslt.s.len = snprintf(buf, sizeof buf, "%f", d->double_value);
+			break;
+		case MMDB_DATA_TYPE_FLOAT:
+			rslt.s.len = snprintf(buf, sizeof buf, "%f", d->float_value);
+			break;
+		case MMDB_DATA_TYPE_UINT16:
+			rslt.s.s = int2str(d->uint16, &len);
+			rslt.s.len = len;
+			break;
+		case MMDB_DATA_TYPE_UINT32:
+			rslt.s.s = int2str(d->uint32, &len);
+			rslt.s.len = len;
+			break;
+		case MMDB_DATA_TYPE_INT32:
+			rslt.s.len = snprintf(buf, sizeof buf, "%d", d->int32);
+			break;
+		default:
+			LM_DBG("unsupported data type %u\n", d->type);
+		}
+	}
+
+	return add_avp(dst_type|AVP_VAL_STR, dst_name, rslt);
+}
+
+
+int mmg_mmdb_lookup(str *ip_s, char *fields, int dst_name,
+		unsigned short dst_type)
+{
+	MMDB_lookup_result_s *res;
+	MMDB_entry_data_s data;
+	struct ip_addr *ip;
+	struct mmg_field *f;
+	char *token, *saveptr = NULL;
+	int rc;
+
+	if (*mmg_db_gen != mmg_local_gen) {
+		mmg_local_gen = *mmg_db_gen;
+		mmg_db_reopen();
+	}
+
+	if (mmg_cache == NULL && mmg_cache_size > 0 && mmg_cache_init() < 0)
+		mmg_cache_size = 0;
+
+	if ((ip = str2ip(ip_s)) == NULL && (ip = str2ip6(ip_s)) == NULL) {
+		LM_ERR("'%.*s' is not an IP address\n", ip_s->len, ip_s->s);
+		return -1;
+	}
+
+	if ((res = mmg_db_lookup(ip)) == NULL)
+		return -1;
+	if (!res->found_entry) {
+		LM_DBG("'%.*s'--> 'Unknown'.\n", ip_s->len, ip_s->s);
+		return -1;
+	}
+
+	for (token = strtok_r(fields, MMG_OP_DELIMS, &saveptr); token;
+	token = strtok_r(NULL, MMG_OP_DELIMS, &saveptr)) {
+		for (f = mmg_fields; f->name && strcmp(f->name, token); f++);
+		if (f->name == NULL) {
+			LM_ERR("unknown field:'%s'\n", token);
+			return -1;
+		}
+
+		if (f->path[0] == NULL) {
+			data.has_data = 0;
+		} else {
+			rc = MMDB_aget_value(&res->entry, &data, f->path);
+			if (rc != MMDB_SUCCESS) {
+				LM_DBG("no %s for '%.*s': %s\n", token, ip_s->len, ip_s->s,
+					MMDB_strerror(rc));
+				data.has_data = 0;
+			}
+		}
+
+		if (mmg_add_value(&data, dst_name, dst_type) == -1) {
+			LM_ERR("Internal error processing field/IP '%s/%.*s'.\n",
+				token, ip_s->len, ip_s->s);
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+
+/* makes sure the new file is a good one before all the processes switch */
+static int mmg_db_bump_gen(void)
+{
+	MMDB_s db;
+	int rc;
+
+	rc = MMDB_open(mmg_db_path, MMDB_MODE_MMAP, &db);
+	if (rc != MMDB_SUCCESS) {
+		LM_ERR("not reloading '%s': %s\n", mmg_db_path, MMDB_strerror(rc));
+		return -1;
+	}
+	MMDB_close(&db);
+
+	lock_get(mmg_gen_lock);
+	(*mmg_db_gen)++;
+	lock_release(mmg_gen_lock);
+	update_stat(mmg_db_reloads, 1);
+	LM_INFO("reloading '%s'\n", mmg_db_path);
+
+	return 0;
+}
+
+
+void mmg_mmdb_check_file(unsigned int ticks, void *param)
+{
+	struct stat st;
+
+	if (stat(mmg_db_path, &st) != 0) {
+		/* probably being replaced */
+		LM_DBG("cannot stat '%s'\n", mmg_db_path);
+		return;
+	}
+
+	if (st.st_mtime == mmg_db_stat.st_mtime &&
+	st.st_size == mmg_db_stat.st_size && st.st_ino == mmg_db_stat.st_ino)
+		return;
+
+	/* a file still being written fails and is retried next time */
+	if (mmg_db_bump_gen() == 0)
+		mmg_db_stat = st;
+}
+
+
+/*
+ * MI function - switches all the processes to the current version of
+ * the db file
+ */
+struct mi_root *mi_mmg_reload(struct mi_root *cmd, void *param)
+{
+	if (!mmg_db_open)
+		return init_mi_tree(400, MI_SSTR("Not using a MaxMind DB"));
+
+	if (mmg_db_bump_gen() != 0)
+		return init_mi_tree(500, MI_INTERNAL_ERR_S, MI_INTERNAL_ERR_LEN);
+
+	return init_mi_tree(200, MI_OK_S, MI_OK_LEN);
+}
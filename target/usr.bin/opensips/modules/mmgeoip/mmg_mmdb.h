@@ -0,0 +1,59 @@
+/*
+ * MaxMind DB (GeoIP2) lookups for the mmgeoip module
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  created - mmapped MMDB files, per process LRU cache of the
+ *               lookups, reload on file change
+ */
+
+#ifndef MMG_MMDB_H
+#define MMG_MMDB_H
+
+#include "../../str.h"
+#include "../../parser/msg_parser.h"
+#include "../../mi/mi.h"
+
+/* entries of the per process lookup cache; 0 disables it */
+extern int mmg_cache_size;
+/* seconds between checks of the db file for changes; 0 - never */
+extern int mmg_reload_interval;
+
+/* 1 if the db is an MMDB one, 0 if not, -1 on error */
+int mmg_mmdb_open(str *path);
+
+void mmg_mmdb_close(void);
+
+int mmg_mmdb_in_use(void);
+
+/* shm and cache setup - to be called once the db is open */
+int mmg_mmdb_init(void);
+
+/* adds to the AVP the values of the "fields", for the "ip" address */
+int mmg_mmdb_lookup(str *ip, char *fields, int dst_name,
+		unsigned short dst_type);
+
+/* timer routine, spots the changes of the db file */
+void mmg_mmdb_check_file(unsigned int ticks, void *param);
+
+struct mi_root *mi_mmg_reload(struct mi_root *cmd, void *param);
+
+#endif /* MMG_MMDB_H */
@@ -19,6 +19,7 @@
  * History:
  * --------
  * 080511 -- Initial revision, KE
+ * 161019 -- MaxMind DB (GeoIP2) files, when built with libmaxminddb
  *
  * XXX -- todo: Add command variant to pull source/dest IP from
  *              current SIP message.
@@ -34,8 +35,16 @@
 #include "../../usr_avp.h"
 #include "../../mod_fix.h"
 #include "../../ut.h"
+#include "../../timer.h"
 #include "GeoIP.h"
 #include "GeoIPCity.h"
+#ifdef HAVE_MAXMINDDB
+#include "mmg_mmdb.h"
+
+extern stat_var *mmg_cache_hits;
+extern stat_var *mmg_cache_misses;
+extern stat_var *mmg_db_reloads;
+#endif
 
 
 #define MMG_OP_DELIMS ":|,/ "
@@ -85,6 +94,27 @@ mod_init(void)
 	}
 
 	MMG_city_db_path.len=strlen(MMG_city_db_path.s);
+
+#ifdef HAVE_MAXMINDDB
+	/* a GeoIP2 db? */
+	switch (mmg_mmdb_open(&MMG_city_db_path)) {
+		case -1:
+			return -1;
+		case 1:
+			if (mmg_mmdb_init() < 0)
+				return -1;
+			if (mmg_reload_interval > 0 && register_timer("mmg-reload",
+			mmg_mmdb_check_file, NULL, mmg_reload_interval,
+			TIMER_FLAG_SKIP_ON_DELAY) < 0) {
+				LM_ERR("failed to register timer\n");
+				return -1;
+			}
+			LM_INFO("MM GeoIP module - city_db_path:'%s' (MaxMind DB)\n",
+				MMG_city_db_path.s);
+			return 0;
+	}
+#endif
+
 	if(0==(MMG_gi = GeoIP_open(MMG_city_db_path.s,
 					geoip_cache_option))){
 		LM_ERR("Unable to open City DB at path '%.*s'.\n",
@@ -100,6 +130,9 @@ static void
 mod_destroy(void)
 {
 	if(MMG_gi)GeoIP_delete(MMG_gi);
+#ifdef HAVE_MAXMINDDB
+	mmg_mmdb_close();
+#endif
 	return;
 }
 
@@ -198,6 +231,11 @@ mmg_lookup_cmd(struct sip_msg *msg, char *_fields_pv, char *_ipaddr_pv, char *_d
 		return -1;
 	}
 
+#ifdef HAVE_MAXMINDDB
+	if (mmg_mmdb_in_use())
+		return mmg_mmdb_lookup(&ipaddr_str, field_buf, dst_name, dstType);
+#endif
+
 	/* Attempt lookup */
 	if(!(gir=GeoIP_record_by_name (MMG_gi,ipaddr_buf))){
 		LM_DBG("'%s'--> 'Unknown'.\n", *ipaddr_buf?ipaddr_buf:"Undefined");
@@ -269,9 +307,30 @@ w_lookup_cmd2(struct sip_msg *m, char *ipaddr, char *dst)
 static param_export_t mod_params[]={
 	{"mmgeoip_city_db_path",   STR_PARAM, &MMG_city_db_path.s},
 	{"cache_type", STR_PARAM|USE_FUNC_PARAM, parse_mem_option},
+#ifdef HAVE_MAXMINDDB
+	{"lookup_cache_size",      INT_PARAM, &mmg_cache_size},
+	{"db_reload_interval",     INT_PARAM, &mmg_reload_interval},
+#endif
 	{ 0,0,0 }
 };
 
+static stat_export_t mod_stats[] = {
+#ifdef HAVE_MAXMINDDB
+	{"lookup_cache_hits",   0, &mmg_cache_hits   },
+	{"lookup_cache_misses", 0, &mmg_cache_misses },
+	{"db_reloads",          0, &mmg_db_reloads   },
+#endif
+	{0,0,0}
+};
+
+static mi_export_t mi_cmds[] = {
+#ifdef HAVE_MAXMINDDB
+	{"mmg_reload", "reload the MaxMind DB file in all the processes",
+		mi_mmg_reload, MI_NO_INPUT_FLAG, 0, 0},
+#endif
+	{0,0,0,0,0,0}
+};
+
 static cmd_export_t cmds[] = {
 	{"mmg_lookup",  (cmd_function)w_lookup_cmd2, 2, fixup_lookup2, 0,
 		REQUEST_ROUTE|FAILURE_ROUTE|ONREPLY_ROUTE|BRANCH_ROUTE|ERROR_ROUTE|LOCAL_ROUTE|
@@ -291,8 +350,8 @@ struct module_exports exports= {
 	cmds,             /* exported functions */
 	0,                /* exported async functions */
 	mod_params,       /* param exports */
-	0,                /* exported statistics */
-	0,                /* exported MI functions */
+	mod_stats,        /* exported statistics */
+	mi_cmds,          /* exported MI functions */
 	0,                /* exported pseudo-variables */
 	0,				  /* extra processes */
 	mod_init,         /* module initialization function */
@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  created - fixed memory detector, as an alternative to the
+ *               IP tree (count-min sketch + heavy hitters table)
+ */
+
+/*
+ * The hits of each source (address masked to a prefix) are counted in two
+ * count-min sketches - one for the current sampling unit and one for the
+ * previous one - without locking: two processes raising the same counter
+ * at once may lose a hit or two, which is noise next to the limits. So the
+ * detection takes no lock and allocates nothing, whatever the number of
+ * sources.
+ * The sources estimated above 1/4 of the limit are kept in a small set
+ * associative table of heavy hitters, which remembers the blocked ones
+ * and is listed over MI.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../dprint.h"
+#include "../../atomic.h"
+#include "../../locking.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "ip_tree.h"
+#include "ip_sketch.h"
+
+#define HH_LOCKS 64
+
+struct ip_sketch {
+	unsigned int width;            /* counters per row - power of 2 */
+	unsigned int seeds[SKETCH_DEPTH];
+	volatile unsigned int curr;    /* sketch of the current unit */
+	unsigned int *counters[2];
+	unsigned int max_hits;
+	unsigned char prefix[2];       /* IPv4, IPv6 */
+	unsigned int hh_sets;
+	struct hh_entry *hh;
+	gen_lock_set_t *hh_locks;
+	unsigned int hh_locks_no;
+};
+
+static struct ip_sketch *sketch = 0;
+
+extern int pike_log_level;
+
+
+int init_ip_sketch(int max_hits, int mem_kb, int hh_size,
+		int ipv4_prefix, int ipv6_prefix)
+{
+	unsigned long cells;
+	int i;
+
+	if (ipv4_prefix < 1 || ipv4_prefix > 32 ||
+			ipv6_prefix < 1 || ipv6_prefix > 128) {
+		LM_ERR("bad prefix lengths /%d, /%d\n", ipv4_prefix, ipv6_prefix);
+		return -1;
+	}
+
+	sketch = (struct ip_sketch*)shm_malloc(sizeof(struct ip_sketch));
+	if (sketch==0) {
+		LM_ERR("no more shm mem\n");
+		return -1;
+	}
+	memset(sketch, 0, sizeof(struct ip_sketch));
+
+	/* the largest power of 2 width fitting the two sketches in the memory */
+	cells = (unsigned long)mem_kb * 1024 /
+		(2 * SKETCH_DEPTH * sizeof(unsigned int));
+	for (sketch->width = 1; sketch->width * 2 <= cells; sketch->width <<= 1);
+	if (sketch->width < 256) {
+		LM_ERR("%d KB is too little memory for the sketch\n", mem_kb);
+		goto error;
+	}
+
+	sketch->counters[0] = (unsigned int*)shm_malloc(2 * SKETCH_DEPTH *
+		sketch->width * sizeof(unsigned int));
+	if (sketch->counters[0]==0) {
+		LM_ERR("no more shm mem for %u counters\n",
+			2 * SKETCH_DEPTH * sketch->width);
+		goto error;
+	}
+	memset(sketch->counters[0], 0,
+		2 * SKETCH_DEPTH * sketch->width * sizeof(unsigned int));
+	sketch->counters[1] = sketch->counters[0] + SKETCH_DEPTH * sketch->width;
+
+	/* random seeds, so the collisions cannot be guessed from outside */
+	for (i = 0; i < SKETCH_DEPTH; i++)
+		sketch->seeds[i] = rand() ^ (rand() << 16);
+
+	sketch->max_hits = max_hits;
+	sketch->prefix[0] = ipv4_prefix;
+	sketch->prefix[1] = ipv6_prefix;
+
+	sketch->hh_sets = (hh_size + SKETCH_HH_WAYS - 1) / SKETCH_HH_WAYS;
+	if (sketch->hh_sets == 0)
+		sketch->hh_sets = 1;
+	sketch->hh = (struct hh_entry*)shm_malloc(sketch->hh_sets *
+		SKETCH_HH_WAYS * sizeof(struct hh_entry));
+	if (sketch->hh==0) {
+		LM_ERR("no more shm mem for the heavy hitters\n");
+		goto error;
+	}
+	memset(sketch->hh, 0,
+		sketch->hh_sets * SKETCH_HH_WAYS * sizeof(struct hh_entry));
+
+	sketch->hh_locks_no = sketch->hh_sets < HH_LOCKS ?
+		sketch->hh_sets : HH_LOCKS;
+	sketch->hh_locks = lock_set_alloc(sketch->hh_locks_no);
+	if (sketch->hh_locks==0 || lock_set_init(sketch->hh_locks)==0) {
+		LM_ERR("failed to create the locks\n");
+		if (sketch->hh_locks)
+			lock_set_dealloc(sketch->hh_locks);
+		sketch->hh_locks = 0;
+		goto error;
+	}
+
+	LM_INFO("sketch of %dx%u counters, %u heavy hitters, /%d and /%d "
+		"prefixes\n", SKETCH_DEPTH, sketch->width,
+		sketch->hh_sets * SKETCH_HH_WAYS, ipv4_prefix, ipv6_prefix);
+
+	return 0;
+error:
+	destroy_ip_sketch();
+	return -1;
+}
+
+
+void destroy_ip_sketch(void)
+{
+	if (sketch==0)
+		return;
+
+	if (sketch->hh_locks) {
+		lock_set_destroy(sketch->hh_locks);
+		lock_set_dealloc(sketch->hh_locks);
+	}
+	if (sketch->hh)
+		shm_free(sketch->hh);
+	if (sketch->counters[0])
+		shm_free(sketch->counters[0]);
+	shm_free(sketch);
+	sketch = 0;
+}
+
+
+static inline void ip2sketch_key(struct ip_addr *ip, struct sketch_key *key)
+{
+	int prefix, i;
+
+	memset(key, 0, sizeof(struct sketch_key));
+	key->len = ip->len;
+	prefix = sketch->prefix[ip->len == 16];
+	if (prefix > ip->len * 8)
+		prefix = ip->len * 8;
+	key->prefix = prefix;
+
+	for (i = 0; i < prefix >> 3; i++)
+		key->addr[i] = ip->u.addr[i];
+	if (prefix & 7)
+		key->addr[i] = ip->u.addr[i] & (0xff << (8 - (prefix & 7)));
+}
+
+
+/* seeded FNV-1a, with a final avalanche of the bits */
+static inline unsigned int sketch_hash(struct sketch_key *key,
+		unsigned int seed)
+{
+	unsigned char *p = (unsigned char*)key;
+	unsigned int h = seed;
+	int i;
+
+	for (i = 0; i < 2 + key->len; i++) {
+		h ^= p[i];
+		h *= 0x01000193;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+
+static inline void sketch_slots(struct sketch_key *key, unsigned int *slot)
+{
+	int i;
+
+	for (i = 0; i < SKETCH_DEPTH; i++)
+		slot[i] = i * sketch->width +
+			(sketch_hash(key, sketch->seeds[i]) & (sketch->width - 1));
+}
+
+
+static inline unsigned int sketch_estimate(unsigned int *counters,
+		unsigned int *slot)
+{
+	unsigned int est, v;
+	int i;
+
+	est = counters[slot[0]];
+	for (i = 1; i < SKETCH_DEPTH; i++) {
+		v = counters[slot[i]];
+		if (v < est)
+			est = v;
+	}
+	return est;
+}
+
+
+#define is_hot(_prev, _curr, _max) \
+	( (_prev) >= (_max) || (_curr) >= (_max) || \
+	  (((_prev) + (_curr)) >> 1) >= (_max) )
+
+
+/* is "a" less worth keeping than "b" ? the blocked sources go last */
+#define hh_less(_a, _b) \
+	( ((_a)->flags & HH_RED_FLAG) < ((_b)->flags & HH_RED_FLAG) || \
+	  (((_a)->flags & HH_RED_FLAG) == ((_b)->flags & HH_RED_FLAG) && \
+	   (_a)->hits[CURR_POS] < (_b)->hits[CURR_POS]) )
+
+/* looks up the key in the heavy hitters, taking a slot for it if missing;
+ * the set must be locked */
+static struct hh_entry *hh_get(struct sketch_key *key, unsigned int set)
+{
+	struct hh_entry *e, *victim = 0, *free_e = 0;
+	int i;
+
+	e = &sketch->hh[set * SKETCH_HH_WAYS];
+	for (i = 0; i < SKETCH_HH_WAYS; i++, e++) {
+		if (!(e->flags & HH_USED_FLAG)) {
+			if (free_e == 0)
+				free_e = e;
+			continue;
+		}
+		if (memcmp(&e->key, key, 2 + key->len) == 0)
+			return e;
+		if (victim == 0 || hh_less(e, victim))
+			victim = e;
+	}
+
+	if (free_e) {
+		victim = free_e;
+	} else {
+		LM_DBG("heavy hitter %s replaced\n", sketch_key2a(&victim->key));
+	}
+
+	memset(victim, 0, sizeof(struct hh_entry));
+	victim->key = *key;
+	victim->flags = HH_USED_FLAG;
+	return victim;
+}
+
+
+unsigned char mark_ip_sketch(struct ip_addr *ip)
+{
+	struct sketch_key key;
+	struct hh_entry *e;
+	unsigned int slot[SKETCH_DEPTH];
+	unsigned int *curr, *prev;
+	unsigned int ec, ep, v, set;
+	unsigned char flags = 0;
+	int i;
+
+	ip2sketch_key(ip, &key);
+	sketch_slots(&key, slot);
+
+	i = sketch->curr;
+	curr = sketch->counters[i];
+	prev = sketch->counters[i ^ 1];
+
+	/* conservative update - only the counters at the minimum are raised,
+	 * which keeps the over-estimation of the sketch low */
+	ec = sketch_estimate(curr, slot);
+	for (i = 0; i < SKETCH_DEPTH; i++) {
+		v = curr[slot[i]];
+		if (v <= ec)
+			curr[slot[i]] = ec + 1;
+	}
+	ec++;
+
+	/* the bulk of the sources stops here */
+	if (ec < sketch->max_hits >> 2)
+		return 0;
+
+	ep = sketch_estimate(prev, slot);
+
+	set = sketch_hash(&key, sketch->seeds[0] ^ 0x5bd1e995) % sketch->hh_sets;
+	lock_set_get(sketch->hh_locks, set % sketch->hh_locks_no);
+
+	e = hh_get(&key, set);
+	e->hits[PREV_POS] = ep;
+	e->hits[CURR_POS] = ec;
+	if (e->flags & HH_RED_FLAG) {
+		flags = RED_NODE;
+	} else if (is_hot(ep, ec, sketch->max_hits)) {
+		e->flags |= HH_RED_FLAG;
+		flags = RED_NODE|NEWRED_NODE;
+	}
+
+	lock_set_release(sketch->hh_locks, set % sketch->hh_locks_no);
+
+	return flags;
+}
+
+
+void swap_ip_sketch(void)
+{
+	struct hh_entry *e;
+	unsigned int slot[SKETCH_DEPTH];
+	unsigned int next, set, ep;
+	int i;
+
+	/* the sketch of the previous unit becomes the current one */
+	next = sketch->curr ^ 1;
+	memset(sketch->counters[next], 0,
+		SKETCH_DEPTH * sketch->width * sizeof(unsigned int));
+	membar_full();
+	sketch->curr = next;
+
+	for (set = 0; set < sketch->hh_sets; set++) {
+		lock_set_get(sketch->hh_locks, set % sketch->hh_locks_no);
+		e = &sketch->hh[set * SKETCH_HH_WAYS];
+		for (i = 0; i < SKETCH_HH_WAYS; i++, e++) {
+			if (!(e->flags & HH_USED_FLAG))
+				continue;
+
+			sketch_slots(&e->key, slot);
+			ep = sketch_estimate(sketch->counters[next ^ 1], slot);
+			e->hits[PREV_POS] = ep;
+			e->hits[CURR_POS] = 0;
+
+			if (e->flags & HH_RED_FLAG && !is_hot(ep, 0, sketch->max_hits)) {
+				e->flags &= ~HH_RED_FLAG;
+				LM_GEN1(pike_log_level, "PIKE - UNBLOCKing ip %s\n",
+					sketch_key2a(&e->key));
+			}
+			/* cooled down - make room for others */
+			if (!(e->flags & HH_RED_FLAG) && ep < sketch->max_hits >> 2)
+				e->flags = 0;
+		}
+		lock_set_release(sketch->hh_locks, set % sketch->hh_locks_no);
+	}
+}
+
+
+static int hh_cmp(const void *a, const void *b)
+{
+	const struct hh_entry *x = a, *y = b;
+	unsigned int hx, hy;
+
+	hx = x->hits[PREV_POS] + x->hits[CURR_POS];
+	hy = y->hits[PREV_POS] + y->hits[CURR_POS];
+	return hx < hy ? 1 : (hx > hy ? -1 : 0);
+}
+
+
+int get_ip_sketch_hh(struct hh_entry **list)
+{
+	struct hh_entry *e;
+	unsigned int set;
+	int i, n = 0;
+
+	*list = (struct hh_entry*)pkg_malloc(sketch->hh_sets * SKETCH_HH_WAYS *
+		sizeof(struct hh_entry));
+	if (*list==0) {
+		LM_ERR("no more pkg mem\n");
+		return -1;
+	}
+
+	for (set = 0; set < sketch->hh_sets; set++) {
+		lock_set_get(sketch->hh_locks, set % sketch->hh_locks_no);
+		e = &sketch->hh[set * SKETCH_HH_WAYS];
+		for (i = 0; i < SKETCH_HH_WAYS; i++, e++)
+			if (e->flags & HH_USED_FLAG)
+				(*list)[n++] = *e;
+		lock_set_release(sketch->hh_locks, set % sketch->hh_locks_no);
+	}
+
+	qsort(*list, n, sizeof(struct hh_entry), hh_cmp);
+	return n;
+}
+
+
+char *sketch_key2a(struct sketch_key *key)
+{
+	static char buf[IP_ADDR_MAX_STR_SIZE + 4];
+	struct ip_addr ip;
+	char *p;
+	int l;
+
+	memset(&ip, 0, sizeof(struct ip_addr));
+	ip.af = key->len == 16 ? AF_INET6 : AF_INET;
+	ip.len = key->len;
+	memcpy(ip.u.addr, key->addr, key->len);
+
+	p = ip_addr2a(&ip);
+	l = strlen(p);
+	memcpy(buf, p, l);
+	if (key->prefix < key->len * 8)
+		l += sprintf(buf + l, "/%d", key->prefix);
+	else
+		buf[l] = 0;
+
+	return buf;
+}
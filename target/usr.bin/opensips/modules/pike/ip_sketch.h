@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  created - fixed memory detector, as an alternative to the
+ *               IP tree (count-min sketch + heavy hitters table)
+ */
+
+#ifndef _IP_SKETCH_H
+#define _IP_SKETCH_H
+
+#include "../../ip_addr.h"
+
+/* rows of the count-min sketch */
+#define SKETCH_DEPTH   4
+/* slots of a set of the heavy hitters table */
+#define SKETCH_HH_WAYS 4
+
+#define HH_USED_FLAG   (1<<0)
+#define HH_RED_FLAG    (1<<1)
+
+/* an address, masked to the prefix length of its family */
+struct sketch_key {
+	unsigned char len;         /* 4 or 16 */
+	unsigned char prefix;
+	unsigned char addr[16];
+};
+
+/* a source hitting the sketch above 1/4 of the limit */
+struct hh_entry {
+	struct sketch_key key;
+	unsigned short flags;
+	unsigned int hits[2];      /* estimations, PREV_POS/CURR_POS */
+};
+
+int  init_ip_sketch(int max_hits, int mem_kb, int hh_size,
+		int ipv4_prefix, int ipv6_prefix);
+void destroy_ip_sketch(void);
+
+/* counts a hit for the IP; returns RED_NODE/NEWRED_NODE flags */
+unsigned char mark_ip_sketch(struct ip_addr *ip);
+
+/* starts a new sampling unit, unblocking the sources cooling down */
+void swap_ip_sketch(void);
+
+/* copies in pkg the used heavy hitters, the most active first;
+ * returns the number of entries or -1 on error */
+int get_ip_sketch_hh(struct hh_entry **list);
+
+/* prints the address (and prefix) of the key into a static buffer */
+char *sketch_key2a(struct sketch_key *key);
+
+#endif
@@ -46,6 +46,7 @@
 #include "../../timer.h"
 #include "../../locking.h"
 #include "ip_tree.h"
+#include "ip_sketch.h"
 #include "timer.h"
 #include "pike_mi.h"
 #include "pike_funcs.h"
@@ -65,6 +66,12 @@ static int max_reqs  = 30;
 static char *pike_route_s = NULL;
 int timeout   = 120;
 int pike_log_level = L_WARN;
+static char *detector_s = "tree";
+static int sketch_memory = 1024;
+static int heavy_hitters = 1024;
+static int ipv4_prefix = 32;
+static int ipv6_prefix = 64;
+int pike_use_sketch = 0;
 
 /* global variables */
 gen_lock_t*             timer_lock=0;
@@ -86,6 +93,11 @@ static param_export_t params[]={
 	{"remove_latency",        INT_PARAM,  &timeout},
 	{"pike_log_level",        INT_PARAM,  &pike_log_level},
 	{"check_route",           STR_PARAM,  &pike_route_s},
+	{"detector",              STR_PARAM,  &detector_s},
+	{"sketch_memory",         INT_PARAM,  &sketch_memory},
+	{"heavy_hitters",         INT_PARAM,  &heavy_hitters},
+	{"ipv4_prefix",           INT_PARAM,  &ipv4_prefix},
+	{"ipv6_prefix",           INT_PARAM,  &ipv6_prefix},
 	{0,0,0}
 };
 
@@ -93,6 +105,8 @@ static param_export_t params[]={
 static mi_export_t mi_cmds [] = {
 	{MI_PIKE_LIST, "lists the nodes in the pike tree",
 		mi_pike_list,   MI_NO_INPUT_FLAG,  0,  0 },
+	{MI_PIKE_TOP, "lists the most active sources (sketch detector)",
+		mi_pike_top,    0,                 0,  0 },
 	{0,0,0,0,0,0}
 };
 
@@ -125,6 +139,13 @@ static int pike_init(void)
 
 	LM_INFO("initializing...\n");
 
+	if (strcasecmp(detector_s, "sketch")==0) {
+		pike_use_sketch = 1;
+	} else if (strcasecmp(detector_s, "tree")!=0) {
+		LM_ERR("unknown detector <%s>\n", detector_s);
+		return -1;
+	}
+
 	/* alloc the timer lock */
 	timer_lock=lock_alloc();
 	if (timer_lock==0) {
@@ -137,6 +158,14 @@ static int pike_init(void)
 		goto error1;
 	}
 
+	if (pike_use_sketch) {
+		/* fixed memory, no per source nodes and timers */
+		if (init_ip_sketch(max_reqs, sketch_memory, heavy_hitters,
+		ipv4_prefix, ipv6_prefix)!=0) {
+			LM_ERR(" ip_sketch creation failed!\n");
+			goto error2;
+		}
+	} else
 	/* init the IP tree */
 	if ( init_ip_tree(max_reqs)!=0 ) {
 		LM_ERR(" ip_tree creation failed!\n");
@@ -152,8 +181,9 @@ static int pike_init(void)
 	timer->next = timer->prev = timer;
 
 	/* registering timing functions  */
-	register_timer( "pike-clean", clean_routine , 0, 1 ,
-		TIMER_FLAG_DELAY_ON_DELAY);
+	if (!pike_use_sketch)
+		register_timer( "pike-clean", clean_routine , 0, 1 ,
+			TIMER_FLAG_DELAY_ON_DELAY);
 	register_timer( "pike-swap", swap_routine , 0, time_unit,
 		TIMER_FLAG_DELAY_ON_DELAY );
 
@@ -177,6 +207,7 @@ static int pike_init(void)
 	return 0;
 error3:
 	destroy_ip_tree();
+	destroy_ip_sketch();
 error2:
 	lock_destroy(timer_lock);
 error1:
@@ -205,6 +236,7 @@ static int pike_exit(void)
 
 	/* destroy the IP tree */
 	destroy_ip_tree();
+	destroy_ip_sketch();
 
 	return 0;
 }
@@ -46,6 +46,7 @@
 #include "../../route.h"
 #include "../../script_cb.h"
 #include "ip_tree.h"
+#include "ip_sketch.h"
 #include "pike_funcs.h"
 #include "timer.h"
 
@@ -59,6 +60,7 @@ extern int               pike_log_level;
 extern int               pike_start_level;
 extern int               pike_stop_level;
 extern event_id_t        pike_event_id;
+extern int               pike_use_sketch;
 
 static inline void pike_raise_event(char *ip)
 {
@@ -112,6 +114,12 @@ int pike_check_req(struct sip_msg *msg)
 	ip = &(msg->rcv.src_ip);
 #endif
 
+	if (pike_use_sketch) {
+		/* no lock and no timer to update */
+		flags = mark_ip_sketch( ip );
+		node = 0;
+		goto check;
+	}
 
 	/* first lock the proper tree branch and mark the IP with one more hit*/
 	lock_tree_branch( ip->u.addr[0] );
@@ -183,6 +191,7 @@ int pike_check_req(struct sip_msg *msg)
 	unlock_tree_branch( ip->u.addr[0] );
 	/*print_tree( 0 );*/ /* debug */
 
+check:
 	if (flags&RED_NODE) {
 		if (flags&NEWRED_NODE) {
 			LM_GEN1( pike_log_level,
@@ -337,6 +346,11 @@ void swap_routine( unsigned int ticks, void *param)
 	struct ip_node *node;
 	int i;
 
+	if (pike_use_sketch) {
+		swap_ip_sketch();
+		return;
+	}
+
 	/* LM_DBG("entering \n"); */
 	for(i=0;i<MAX_IP_BRANCHES;i++) {
 		node = get_tree_branch(i);
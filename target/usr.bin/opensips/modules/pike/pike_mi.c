@@ -24,7 +24,9 @@
  *  2006-12-05  created (bogdan)
  */
 
+#include "../../ut.h"
 #include "ip_tree.h"
+#include "ip_sketch.h"
 #include "pike_mi.h"
 
 #define IPv6_LEN 16
@@ -34,6 +36,8 @@
 
 static struct ip_node *ip_stack[MAX_IP_LEN];
 
+extern int pike_use_sketch;
+
 
 static inline void print_ip_stack( int level, struct mi_node *node)
 {
@@ -103,6 +107,23 @@ struct mi_root* mi_pike_list(struct mi_root* cmd_tree, void* param)
 		return 0;
 	rpl_tree->node.flags |= MI_IS_ARRAY;
 
+	if (pike_use_sketch) {
+		/* the blocked sources are the red heavy hitters */
+		struct hh_entry *list;
+		int n;
+
+		if ( (n=get_ip_sketch_hh(&list))<0 ) {
+			free_mi_tree(rpl_tree);
+			return 0;
+		}
+		for( i=0 ; i<n ; i++ )
+			if (list[i].flags&HH_RED_FLAG)
+				addf_mi_node_child( &rpl_tree->node, 0, 0, 0, "%s",
+					sketch_key2a(&list[i].key));
+		pkg_free(list);
+		return rpl_tree;
+	}
+
 	for( i=0 ; i<MAX_IP_BRANCHES ; i++ ) {
 
 		if (get_tree_branch(i)==0)
@@ -120,3 +141,55 @@ struct mi_root* mi_pike_list(struct mi_root* cmd_tree, void* param)
 }
 
 
+
+/*
+  Syntax of "pike_top" :
+    [number of sources]
+*/
+struct mi_root* mi_pike_top(struct mi_root* cmd_tree, void* param)
+{
+	struct mi_root* rpl_tree;
+	struct mi_node *node;
+	struct hh_entry *list;
+	unsigned int max;
+	int i, n;
+
+	if (!pike_use_sketch)
+		return init_mi_tree( 400, MI_SSTR("Only with the sketch detector"));
+
+	max = (unsigned int)-1;
+	node = cmd_tree->node.kids;
+	if (node && str2int( &node->value, &max)!=0)
+		return init_mi_tree( 400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
+
+	rpl_tree = init_mi_tree( 200, MI_OK_S, MI_OK_LEN);
+	if (rpl_tree==0)
+		return 0;
+	rpl_tree->node.flags |= MI_IS_ARRAY;
+
+	if ( (n=get_ip_sketch_hh(&list))<0 )
+		goto error;
+
+	for( i=0 ; i<n && i<max ; i++ ) {
+		node = add_mi_node_child( &rpl_tree->node, MI_DUP_VALUE, "ip", 2,
+			sketch_key2a(&list[i].key), strlen(sketch_key2a(&list[i].key)));
+		if (node==0)
+			goto error_list;
+		if (addf_mi_attr( node, 0, "prev_hits", 9, "%u",
+		list[i].hits[PREV_POS])==0 ||
+		addf_mi_attr( node, 0, "curr_hits", 9, "%u",
+		list[i].hits[CURR_POS])==0 ||
+		add_mi_attr( node, 0, "blocked", 7,
+		(list[i].flags&HH_RED_FLAG)?"yes":"no",
+		(list[i].flags&HH_RED_FLAG)?3:2)==0 )
+			goto error_list;
+	}
+
+	pkg_free(list);
+	return rpl_tree;
+error_list:
+	pkg_free(list);
+error:
+	free_mi_tree(rpl_tree);
+	return 0;
+}
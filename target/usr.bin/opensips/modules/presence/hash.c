@@ -431,6 +431,18 @@ error:
 
 }
 
+static void free_nbody_list(nbody_entry_t* nb)
+{
+	nbody_entry_t* prev_nb;
+
+	while(nb)
+	{
+		prev_nb= nb;
+		nb= nb->next;
+		shm_free(prev_nb);
+	}
+}
+
 void destroy_phtable(void)
 {
 	int i;
@@ -451,6 +463,7 @@ void destroy_phtable(void)
 				shm_free(prev_p->sphere);
 			shm_free(prev_p);
 		}
+		free_nbody_list(pres_htable[i].nbodies);
 	}
 	shm_free(pres_htable);
 }
@@ -701,3 +714,79 @@ done:
 		pkg_free(sphere);
 	return ret;
 }
+
+/* entry must be locked before calling this function */
+nbody_entry_t* search_nbody_cache(str* pres_uri, struct pres_ev* event,
+		unsigned int hash_code)
+{
+	nbody_entry_t* nb;
+
+	for(nb= pres_htable[hash_code].nbodies; nb; nb= nb->next)
+	{
+		if(nb->event== event && nb->pres_uri.len== pres_uri->len &&
+				strncmp(nb->pres_uri.s, pres_uri->s, pres_uri->len)== 0)
+			return nb;
+	}
+	return NULL;
+}
+
+/* entry must be locked before calling this function */
+int insert_nbody_cache(str* pres_uri, struct pres_ev* event, str* body,
+		str* extra_hdrs, unsigned int hash_code)
+{
+	nbody_entry_t* nb;
+	int size;
+
+	if(search_nbody_cache(pres_uri, event, hash_code))
+		return 0;
+
+	size= sizeof(nbody_entry_t)+ pres_uri->len+ body->len+
+		(extra_hdrs?extra_hdrs->len:0);
+	nb= (nbody_entry_t*)shm_malloc(size);
+	if(nb== NULL)
+	{
+		LM_ERR("No more %s memory\n", SHARE_MEM);
+		return -1;
+	}
+	memset(nb, 0, size);
+
+	size= sizeof(nbody_entry_t);
+	CONT_COPY(nb, nb->pres_uri, (*pres_uri));
+	CONT_COPY(nb, nb->body, (*body));
+	if(extra_hdrs && extra_hdrs->len)
+		CONT_COPY(nb, nb->extra_hdrs, (*extra_hdrs));
+	nb->event= event;
+
+	nb->next= pres_htable[hash_code].nbodies;
+	pres_htable[hash_code].nbodies= nb;
+
+	return 0;
+}
+
+/* drops the bodies cached for all the events of the presentity; to be
+ * called after its records were changed in the database */
+void invalidate_nbody_cache(str* pres_uri)
+{
+	nbody_entry_t* nb, **prev;
+	unsigned int hash_code;
+
+	hash_code= core_hash(pres_uri, NULL, phtable_size);
+	lock_get(&pres_htable[hash_code].lock);
+
+	pres_htable[hash_code].nbody_gen++;
+
+	prev= &pres_htable[hash_code].nbodies;
+	while((nb= *prev)!= NULL)
+	{
+		if(nb->pres_uri.len== pres_uri->len &&
+				strncmp(nb->pres_uri.s, pres_uri->s, pres_uri->len)== 0)
+		{
+			*prev= nb->next;
+			shm_free(nb);
+			continue;
+		}
+		prev= &nb->next;
+	}
+
+	lock_release(&pres_htable[hash_code].lock);
+}
@@ -33,6 +33,7 @@
 //#include "presentity.h"
 
 struct presentity;
+struct pres_ev;
 #define REMOTE_TYPE   1<<1
 #define LOCAL_TYPE    1<<2
 
@@ -131,9 +132,22 @@ typedef struct pres_entry
 	struct pres_entry* next;
 }pres_entry_t;
 
+/* aggregated NOTIFY body of a presentity, for an event */
+typedef struct nbody_entry
+{
+	str pres_uri;
+	struct pres_ev* event;
+	str body;
+	str extra_hdrs;
+	struct nbody_entry* next;
+}nbody_entry_t;
+
 typedef struct pres_htable
 {
 	pres_entry_t* entries;
+	nbody_entry_t* nbodies;
+	/* bumped when the presentities of the entry change */
+	unsigned int nbody_gen;
 	gen_lock_t lock;
 }phtable_t;
 
@@ -156,5 +170,12 @@ int delete_phtable_query(str *pres_uri, int event, str* etag);
 
 void destroy_phtable(void);
 
+/* NOTIFY body cache - entry must be locked before calling the first two */
+nbody_entry_t* search_nbody_cache(str* pres_uri, struct pres_ev* event,
+		unsigned int hash_code);
+int insert_nbody_cache(str* pres_uri, struct pres_ev* event, str* body,
+		str* extra_hdrs, unsigned int hash_code);
+void invalidate_nbody_cache(str* pres_uri);
+
 #endif
 
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include <libxml/parser.h>
 
 #include "../../trim.h"
@@ -37,6 +38,7 @@
 #include "../../db/db.h"
 #include "../../db/db_val.h"
 #include "../../socket_info.h"
+#include "../../statistics.h"
 #include "../tm/tm_load.h"
 #include "../pua/hash.h"
 #include "presentity.h"
@@ -95,6 +97,45 @@ char* get_status_str(int status_flag)
 	return NULL;
 }
 
+/* how long an idle notifier process sleeps (us) */
+#define NOTIFY_FANOUT_IDLE 2000
+
+/* NOTIFY statistics */
+stat_var* publish_fanouts;      /* PUBLISHes with watchers to notify */
+stat_var* publish_notifies;     /* NOTIFYs triggered by them */
+stat_var* nbody_builds;         /* NOTIFY bodies built */
+stat_var* nbody_build_us;       /* time spent building them */
+stat_var* nbody_cache_hits;     /* bodies taken from the cache */
+
+/* a batch of watchers handed to a notifier process */
+typedef struct fanout_job
+{
+	pres_ev_t* event;
+	subs_t* subs;                   /* shm copies */
+	int subs_no;
+	str body;                       /* no body if s is NULL */
+	str extra_hdrs;
+	str rules_doc;
+	int has_rules_doc;
+	int from_publish;
+	int prebuilt;
+	struct fanout_job* next;
+}fanout_job_t;
+
+typedef struct fanout_queue
+{
+	gen_lock_t lock;
+	fanout_job_t* first;
+	fanout_job_t* last;
+	unsigned int jobs;
+}fanout_queue_t;
+
+static fanout_queue_t* fanout_q= NULL;
+
+/* set while notifying the watchers of a presentity with a body built once
+ * for all of them - it is not built again for each watcher, even if NULL */
+static int nbody_prebuilt= 0;
+
 static void pkg_free_w(char* s)
 {
 	pkg_free(s);
@@ -919,8 +960,9 @@ error:
 	return NULL;
 }
 
-str* get_p_notify_body(str pres_uri, pres_ev_t* event, str* etag, str* publ_body,
-		str* contact, str* dbody, str* extra_hdrs, free_body_t** free_fct, int from_publish)
+static str* build_p_notify_body(str pres_uri, pres_ev_t* event, str* etag,
+		str* publ_body, str* contact, str* dbody, str* extra_hdrs,
+		free_body_t** free_fct, int from_publish)
 {
 	int body_col, extra_hdrs_col, expires_col, etag_col= 0;
 	db_res_t *result = NULL;
@@ -1328,6 +1370,108 @@ error:
 	return NULL;
 }
 
+static str* dup_cached_nbody(nbody_entry_t* nb, str* extra_hdrs)
+{
+	str* body;
+
+	body= (str*)pkg_malloc(sizeof(str));
+	if(body== NULL)
+	{
+		ERR_MEM(PKG_MEM_STR);
+	}
+	body->s= (char*)pkg_malloc(nb->body.len);
+	if(body->s== NULL)
+	{
+		pkg_free(body);
+		ERR_MEM(PKG_MEM_STR);
+	}
+	memcpy(body->s, nb->body.s, nb->body.len);
+	body->len= nb->body.len;
+
+	if(extra_hdrs && !extra_hdrs->s && nb->extra_hdrs.len)
+	{
+		extra_hdrs->s= (char*)pkg_malloc(nb->extra_hdrs.len);
+		if(extra_hdrs->s== NULL)
+		{
+			pkg_free(body->s);
+			pkg_free(body);
+			ERR_MEM(PKG_MEM_STR);
+		}
+		memcpy(extra_hdrs->s, nb->extra_hdrs.s, nb->extra_hdrs.len);
+		extra_hdrs->len= nb->extra_hdrs.len;
+	}
+	return body;
+
+error:
+	return NULL;
+}
+
+/* builds the body of the NOTIFY for a presentity, taking it from the
+ * NOTIFY body cache when it only depends on what is stored for the
+ * presentity (no PUBLISH in progress) */
+str* get_p_notify_body(str pres_uri, pres_ev_t* event, str* etag, str* publ_body,
+		str* contact, str* dbody, str* extra_hdrs, free_body_t** free_fct, int from_publish)
+{
+	struct timeval start, end;
+	unsigned int hash_code= 0;
+	unsigned int gen= 0;
+	nbody_entry_t* nb;
+	str* notify_body;
+	char* hdrs_s;
+	int cached;
+
+	cached= notify_body_cache && !fallback2db && !etag && !publ_body && !dbody;
+	if(cached)
+	{
+		hash_code= core_hash(&pres_uri, NULL, phtable_size);
+		lock_get(&pres_htable[hash_code].lock);
+		nb= search_nbody_cache(&pres_uri, event, hash_code);
+		if(nb)
+		{
+			notify_body= dup_cached_nbody(nb, extra_hdrs);
+			lock_release(&pres_htable[hash_code].lock);
+			if(notify_body)
+			{
+				LM_DBG("NOTIFY body for %.*s taken from cache\n",
+						pres_uri.len, pres_uri.s);
+				*free_fct= (free_body_t*)pkg_free_w;
+				update_stat(nbody_cache_hits, 1);
+			}
+			return notify_body;
+		}
+		gen= pres_htable[hash_code].nbody_gen;
+		lock_release(&pres_htable[hash_code].lock);
+	}
+
+	hdrs_s= extra_hdrs?extra_hdrs->s:NULL;
+
+	gettimeofday(&start, NULL);
+	notify_body= build_p_notify_body(pres_uri, event, etag, publ_body, contact,
+			dbody, extra_hdrs, free_fct, from_publish);
+	gettimeofday(&end, NULL);
+
+	update_stat(nbody_builds, 1);
+	update_stat(nbody_build_us,
+		(end.tv_sec- start.tv_sec)*1000000+ end.tv_usec- start.tv_usec);
+
+	/* the extra headers of the presentity must be known as well */
+	if(cached && notify_body && notify_body->s && extra_hdrs && !hdrs_s)
+	{
+		lock_get(&pres_htable[hash_code].lock);
+		/* not if the presentity changed in the meantime */
+		if(gen== pres_htable[hash_code].nbody_gen &&
+				search_phtable(&pres_uri, event->evp->parsed, hash_code))
+		{
+			if(insert_nbody_cache(&pres_uri, event, notify_body, extra_hdrs,
+					hash_code)< 0)
+				LM_ERR("failed to cache the NOTIFY body\n");
+		}
+		lock_release(&pres_htable[hash_code].lock);
+	}
+
+	return notify_body;
+}
+
 int free_tm_dlg(dlg_t *td)
 {
 	if(td)
@@ -1731,14 +1875,271 @@ error:
 	return NULL;
 }
 
+int init_notify_fanout(void)
+{
+	int i;
+
+	if(notify_fanout_procs<= 0)
+		return 0;
+
+	fanout_q= (fanout_queue_t*)shm_malloc(notify_fanout_procs*
+			sizeof(fanout_queue_t));
+	if(fanout_q== NULL)
+	{
+		ERR_MEM(SHARE_MEM);
+	}
+	memset(fanout_q, 0, notify_fanout_procs* sizeof(fanout_queue_t));
+
+	for(i= 0; i< notify_fanout_procs; i++)
+	{
+		if(lock_init(&fanout_q[i].lock)== 0)
+		{
+			LM_ERR("initializing lock [%d]\n", i);
+			goto error;
+		}
+	}
+	return 0;
+
+error:
+	return -1;
+}
+
+void destroy_notify_fanout(void)
+{
+	fanout_job_t* job;
+	int i;
+
+	if(fanout_q)
+	{
+		for(i= 0; i< notify_fanout_procs; i++)
+		{
+			while((job= fanout_q[i].first)!= NULL)
+			{
+				fanout_q[i].first= job->next;
+				free_subs_list(job->subs, SHM_MEM_TYPE, 0);
+				shm_free(job);
+			}
+			lock_destroy(&fanout_q[i].lock);
+		}
+		shm_free(fanout_q);
+		fanout_q= NULL;
+	}
+}
+
+static fanout_job_t* new_fanout_job(pres_ev_t* event, str* body,
+		str* extra_hdrs, str* rules_doc, int from_publish, int prebuilt)
+{
+	fanout_job_t* job;
+	int size;
+
+	size= sizeof(fanout_job_t);
+	if(body && body->s)
+		size+= body->len;
+	if(extra_hdrs && extra_hdrs->s)
+		size+= extra_hdrs->len;
+	if(rules_doc && rules_doc->s)
+		size+= rules_doc->len;
+
+	job= (fanout_job_t*)shm_malloc(size);
+	if(job== NULL)
+	{
+		LM_ERR("No more %s memory\n", SHARE_MEM);
+		return NULL;
+	}
+	memset(job, 0, size);
+
+	size= sizeof(fanout_job_t);
+	if(body && body->s)
+		CONT_COPY(job, job->body, (*body));
+	if(extra_hdrs && extra_hdrs->s)
+		CONT_COPY(job, job->extra_hdrs, (*extra_hdrs));
+	if(rules_doc)
+	{
+		if(rules_doc->s)
+			CONT_COPY(job, job->rules_doc, (*rules_doc));
+		job->has_rules_doc= 1;
+	}
+	job->event= event;
+	job->from_publish= from_publish;
+	job->prebuilt= prebuilt;
+
+	return job;
+}
+
+static void free_fanout_jobs(fanout_job_t* job)
+{
+	fanout_job_t* next;
+
+	while(job)
+	{
+		next= job->next;
+		free_subs_list(job->subs, SHM_MEM_TYPE, 0);
+		shm_free(job);
+		job= next;
+	}
+}
+
+/* hands the watchers to the notifier processes, in batches; the watchers
+ * of a dialog always go to the same process, so its NOTIFYs keep their
+ * order. Returns 0, or -1 if nothing was queued */
+static int fanout_dispatch(pres_ev_t* event, subs_t* subs_array, str* body,
+		str* extra_hdrs, str* rules_doc, int from_publish, int prebuilt)
+{
+	fanout_job_t** cur;   /* the batch being filled, per process */
+	fanout_job_t** full;  /* the filled ones, per process */
+	fanout_job_t* job, *first, *last;
+	subs_t* s, *s_new;
+	int size, i, n;
+
+	size= 2* notify_fanout_procs* sizeof(fanout_job_t*);
+	cur= (fanout_job_t**)pkg_malloc(size);
+	if(cur== NULL)
+	{
+		LM_ERR("No more %s memory\n", PKG_MEM_STR);
+		return -1;
+	}
+	memset(cur, 0, size);
+	full= cur+ notify_fanout_procs;
+
+	for(s= subs_array; s; s= s->next)
+	{
+		i= core_hash(&s->callid, &s->to_tag, 0)% notify_fanout_procs;
+		if(cur[i]== NULL)
+		{
+			cur[i]= new_fanout_job(event, body, extra_hdrs, rules_doc,
+					from_publish, prebuilt);
+			if(cur[i]== NULL)
+				goto error;
+		}
+
+		s_new= mem_copy_subs(s, SHM_MEM_TYPE);
+		if(s_new== NULL)
+		{
+			LM_ERR("copying subs_t structure\n");
+			goto error;
+		}
+		s_new->next= cur[i]->subs;
+		cur[i]->subs= s_new;
+
+		if(++cur[i]->subs_no>= notify_fanout_batch)
+		{
+			cur[i]->next= full[i];
+			full[i]= cur[i];
+			cur[i]= NULL;
+		}
+	}
+
+	for(i= 0; i< notify_fanout_procs; i++)
+	{
+		if(cur[i])
+		{
+			cur[i]->next= full[i];
+			full[i]= cur[i];
+		}
+		if(full[i]== NULL)
+			continue;
+
+		/* the batches were stacked, the last one first */
+		first= NULL;
+		last= full[i];
+		n= 0;
+		while((job= full[i])!= NULL)
+		{
+			full[i]= job->next;
+			job->next= first;
+			first= job;
+			n++;
+		}
+
+		lock_get(&fanout_q[i].lock);
+		if(fanout_q[i].last)
+			fanout_q[i].last->next= first;
+		else
+			fanout_q[i].first= first;
+		fanout_q[i].last= last;
+		fanout_q[i].jobs+= n;
+		lock_release(&fanout_q[i].lock);
+	}
+
+	pkg_free(cur);
+	return 0;
+
+error:
+	for(i= 0; i< notify_fanout_procs; i++)
+	{
+		free_fanout_jobs(cur[i]);
+		free_fanout_jobs(full[i]);
+	}
+	pkg_free(cur);
+	return -1;
+}
+
+static void send_fanout_job(fanout_job_t* job)
+{
+	subs_t* s;
+
+	nbody_prebuilt= job->prebuilt;
+	for(s= job->subs; s; s= s->next)
+	{
+		s->auth_rules_doc= job->has_rules_doc?&job->rules_doc:NULL;
+		if(notify(s, NULL, job->body.s?&job->body:NULL, 0, &job->extra_hdrs,
+				job->from_publish)< 0)
+		{
+			LM_ERR("Could not send notify for %.*s\n",
+					job->event->name.len, job->event->name.s);
+		}
+	}
+	nbody_prebuilt= 0;
+}
+
+/* main loop of a notifier process - never returns */
+void notify_fanout_process(int rank)
+{
+	fanout_queue_t* q= &fanout_q[rank];
+	fanout_job_t* job;
+
+	LM_DBG("notifier process %d started\n", rank);
+
+	for( ;; )
+	{
+		lock_get(&q->lock);
+		job= q->first;
+		if(job)
+		{
+			q->first= job->next;
+			if(q->first== NULL)
+				q->last= NULL;
+			q->jobs--;
+		}
+		lock_release(&q->lock);
+
+		if(job== NULL)
+		{
+			sleep_us(NOTIFY_FANOUT_IDLE);
+			continue;
+		}
+
+		job->next= NULL;
+		send_fanout_job(job);
+		free_fanout_jobs(job);
+	}
+}
+
 int publ_notify(presentity_t* p, str pres_uri, str* body, str* offline_etag,
 		str* rules_doc, str* dialog_body, int from_publish)
 {
 	str *notify_body = NULL;
 	str notify_extra_hdrs = {NULL, 0};
+	str *extra_hdrs;
 	subs_t* subs_array= NULL, *s= NULL;
 	int ret_code= -1;
 	free_body_t* free_fct = 0;
+	int prebuilt= 0;
+	int n= 0;
+
+	/* the presentity changed */
+	if(notify_body_cache)
+		invalidate_nbody_cache(&pres_uri);
 
 	subs_array= get_subs_dialog(&pres_uri, p->event , p->sender);
 	if(subs_array == NULL)
@@ -1748,28 +2149,54 @@ int publ_notify(presentity_t* p, str pres_uri, str* body, str* offline_etag,
 		goto done;
 	}
 
+	extra_hdrs= p->extra_hdrs?p->extra_hdrs:&notify_extra_hdrs;
+
 	/* if the event does not require aggregation - we have the final body */
 	if(p->event->agg_nbody)
 	{
 		notify_body = get_p_notify_body(pres_uri, p->event , offline_etag, body,
-				NULL, dialog_body,
-				p->extra_hdrs?p->extra_hdrs:&notify_extra_hdrs, &free_fct,
-				from_publish);
+				NULL, dialog_body, extra_hdrs, &free_fct, from_publish);
 	}
 
+	/* no body to send - build once what each watcher would get */
+	if(notify_body== NULL && (body== NULL || body->s== NULL))
+	{
+		if(!p->event->agg_nbody || offline_etag || dialog_body)
+			notify_body = get_p_notify_body(pres_uri, p->event, 0, 0, 0, 0,
+					extra_hdrs, &free_fct, from_publish);
+		prebuilt= 1;
+	}
+
+	for(s= subs_array; s; s= s->next)
+	{
+		s->auth_rules_doc= rules_doc;
+		n++;
+	}
+	update_stat(publish_fanouts, 1);
+	update_stat(publish_notifies, n);
+
+	if(fanout_q && fanout_dispatch(p->event, subs_array,
+			notify_body?notify_body:body, extra_hdrs, rules_doc,
+			from_publish, prebuilt)== 0)
+	{
+		ret_code= 0;
+		goto done;
+	}
+
+	nbody_prebuilt= prebuilt;
 	s= subs_array;
 	while(s)
 	{
-		s->auth_rules_doc= rules_doc;
 		LM_INFO("notify\n");
 		if(notify(s, NULL, notify_body?notify_body:body,
-			0, p->extra_hdrs?p->extra_hdrs:&notify_extra_hdrs, from_publish)< 0 )
+			0, extra_hdrs, from_publish)< 0 )
 		{
 			LM_ERR("Could not send notify for %.*s\n",
 					p->event->name.len, p->event->name.s);
 		}
 		s= s->next;
 	}
+	nbody_prebuilt= 0;
 	ret_code= 0;
 
 done:
@@ -1812,6 +2239,8 @@ int query_db_notify(str* pres_uri, pres_ev_t* event, subs_t* watcher_subs)
 	{
 		notify_body = get_p_notify_body(*pres_uri, event, 0, 0, 0, 0,
 				&notify_extra_hdrs, &free_fct, 0);
+		/* the same for all the watchers */
+		nbody_prebuilt= 1;
 	}
 
 	s= subs_array;
@@ -1819,13 +2248,15 @@ int query_db_notify(str* pres_uri, pres_ev_t* event, subs_t* watcher_subs)
 	while(s)
 	{
 		LM_INFO("notify\n");
-		if(notify(s, watcher_subs, notify_body, 0, NULL, 0)< 0 )
+		if(notify(s, watcher_subs, notify_body, 0,
+				(event->type & PUBL_TYPE)?&notify_extra_hdrs:NULL, 0)< 0 )
 		{
 			LM_ERR("Could not send notify for [event]=%.*s\n",
 					event->name.len, event->name.s);
 		}
 		s= s->next;
 	}
+	nbody_prebuilt= 0;
 
 	ret_code= 1;
 
@@ -1919,7 +2350,7 @@ int send_notify_request(subs_t* subs, subs_t * watcher_subs,
 			{
 				if (from_publish && n_body!= 0 && n_body->s!= 0)
 					notify_body = n_body;
-				else
+				else if (!nbody_prebuilt)
 					notify_body = get_p_notify_body(subs->pres_uri,
 							subs->event, 0, 0, (subs->contact.s)?&subs->contact:NULL,
 							NULL, extra_hdrs?extra_hdrs:&notify_extra_hdrs,
@@ -2064,6 +2495,9 @@ error:
 				if(subs->event->type& WINFO_TYPE)
 					xmlFree(notify_body->s);
 				else
+				if(free_fct)
+					free_fct(notify_body->s);
+				else
 				if(subs->event->apply_auth_nbody== NULL && subs->event->agg_nbody== NULL)
 					pkg_free(notify_body->s);
 				else
@@ -2305,3 +2739,33 @@ error:
 	return NULL;
 }
 
+
+#ifdef STATISTICS
+unsigned long get_notifies_per_publish(void* foo)
+{
+	unsigned long fanouts;
+
+	fanouts= get_stat_val(publish_fanouts);
+	return fanouts?get_stat_val(publish_notifies)/ fanouts:0;
+}
+
+/* average, in microseconds */
+unsigned long get_nbody_build_time(void* foo)
+{
+	unsigned long builds;
+
+	builds= get_stat_val(nbody_builds);
+	return builds?get_stat_val(nbody_build_us)/ builds:0;
+}
+
+unsigned long get_fanout_queued(void* foo)
+{
+	unsigned long n= 0;
+	int i;
+
+	if(fanout_q)
+		for(i= 0; i< notify_fanout_procs; i++)
+			n+= fanout_q[i].jobs;
+	return n;
+}
+#endif
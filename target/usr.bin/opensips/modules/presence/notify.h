@@ -114,4 +114,23 @@ str* create_winfo_xml(watcher_t* watchers, char* version,
 str* xml_dialog2presence(str* pres_uri, str* body);
 str* build_offline_presence(str* pres_uri);
 
+/* NOTIFYs of a PUBLISH sent by the notifier processes */
+int init_notify_fanout(void);
+void destroy_notify_fanout(void);
+void notify_fanout_process(int rank);
+
+#ifdef STATISTICS
+#include "../../statistics.h"
+
+extern stat_var* publish_fanouts;
+extern stat_var* publish_notifies;
+extern stat_var* nbody_builds;
+extern stat_var* nbody_build_us;
+extern stat_var* nbody_cache_hits;
+
+unsigned long get_notifies_per_publish(void* foo);
+unsigned long get_nbody_build_time(void* foo);
+unsigned long get_fanout_queued(void* foo);
+#endif
+
 #endif
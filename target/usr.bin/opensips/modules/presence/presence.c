@@ -127,6 +127,12 @@ unsigned long waiting_subs_time = 3*24*3600;
 str bla_presentity_spec_param = {0, 0};
 pv_spec_t bla_presentity_spec;
 int fix_remote_target=1;
+/* cache the aggregated NOTIFY bodies of the presentities */
+int notify_body_cache= 0;
+/* processes sending the NOTIFYs triggered by PUBLISH (0 - sent by the
+ * process handling the PUBLISH) and watchers per batch */
+int notify_fanout_procs= 0;
+int notify_fanout_batch= 32;
 
 /* event id */
 static str presence_publish_event = str_init("E_PRESENCE_PUBLISH");
@@ -163,9 +169,31 @@ static param_export_t params[]={
 	{ "bla_fix_remote_target",  INT_PARAM, &fix_remote_target},
 	{ "notify_offline_body",    INT_PARAM, &notify_offline_body},
 	{ "end_sub_on_timeout",     INT_PARAM, &end_sub_on_timeout},
+	{ "notify_body_cache",      INT_PARAM, &notify_body_cache},
+	{ "notify_fanout_procs",    INT_PARAM, &notify_fanout_procs},
+	{ "notify_fanout_batch",    INT_PARAM, &notify_fanout_batch},
 	{0,0,0}
 };
 
+static proc_export_t procs[] = {
+	{"presence notifier", 0, 0, notify_fanout_process, 0, PROC_FLAG_INITCHILD},
+	{0,0,0,0,0,0}
+};
+
+#ifdef STATISTICS
+static stat_export_t presence_stats[] = {
+	{"publish_fanouts",        STAT_NO_RESET, &publish_fanouts                    },
+	{"publish_notifies",       STAT_NO_RESET, &publish_notifies                   },
+	{"notifies_per_publish",   STAT_IS_FUNC, (stat_var**)get_notifies_per_publish},
+	{"notify_body_builds",     STAT_NO_RESET, &nbody_builds                       },
+	{"notify_build_us",        STAT_NO_RESET, &nbody_build_us                     },
+	{"notify_build_time",      STAT_IS_FUNC, (stat_var**)get_nbody_build_time    },
+	{"notify_body_cache_hits", STAT_NO_RESET, &nbody_cache_hits                   },
+	{"notify_fanout_queued",   STAT_IS_FUNC, (stat_var**)get_fanout_queued       },
+	{0,0,0}
+};
+#endif
+
 static mi_export_t mi_cmds[] = {
 	{ "refreshWatchers",   0, mi_refreshWatchers,    0,  0,  0},
 	{ "cleanup",           0, mi_cleanup,            0,  0,  0},
@@ -196,10 +224,14 @@ struct module_exports exports= {
 	cmds,						/* exported functions */
 	0,							/* exported async functions */
 	params,						/* exported parameters */
+#ifdef STATISTICS
+	presence_stats,				/* exported statistics */
+#else
 	0,							/* exported statistics */
+#endif
 	mi_cmds,					/* exported MI functions */
 	0,							/* exported pseudo-variables */
-	0,							/* extra processes */
+	procs,						/* extra processes */
 	mod_init,					/* module initialization function */
 	(response_function) 0,      /* response handling function */
 	(destroy_function) destroy, /* destroy function */
@@ -350,6 +382,24 @@ static int mod_init(void)
 		return -1;
 	}
 
+	if(notify_body_cache && fallback2db)
+	{
+		LM_WARN("the NOTIFY bodies are not cached in fallback2db mode\n");
+		notify_body_cache= 0;
+	}
+
+	if(notify_fanout_procs< 0)
+		notify_fanout_procs= 0;
+	if(notify_fanout_batch<= 0)
+		notify_fanout_batch= 32;
+
+	if(init_notify_fanout()< 0)
+	{
+		LM_ERR("initializing the NOTIFY fan-out\n");
+		return -1;
+	}
+	procs[0].no= notify_fanout_procs;
+
 	if(clean_period>0)
 	{
 		register_timer("presence-pclean", msg_presentity_clean, 0,
@@ -456,6 +506,8 @@ static void destroy(void)
 	if(pres_htable)
 		destroy_phtable();
 
+	destroy_notify_fanout();
+
 	if(pa_db && pa_dbf.close)
 		pa_dbf.close(pa_db);
 
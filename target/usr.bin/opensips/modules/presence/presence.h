@@ -64,6 +64,9 @@ extern shtable_t subs_htable;
 extern int mix_dialog_presence;
 extern int notify_offline_body;
 extern int end_sub_on_timeout;
+extern int notify_body_cache;
+extern int notify_fanout_procs;
+extern int notify_fanout_batch;
 
 extern int phtable_size;
 extern phtable_t* pres_htable;
@@ -361,7 +361,12 @@ clean:
 			if(p[i].p)
 				pkg_free(p[i].p);
 			if(p[i].uri.s)
+			{
+				/* no longer in the database */
+				if(notify_body_cache)
+					invalidate_nbody_cache(&p[i].uri);
 				pkg_free(p[i].uri.s);
+			}
 			else
 				break;
 		}
@@ -61,6 +61,7 @@ int * rl_network_count;	/* flag for counting network algo users */
 
 /* these only change in the mod_init() process -- no locking needed */
 int rl_timer_interval = RL_TIMER_INTERVAL;
+int rl_cdb_batch = 1;
 
 static str db_url = {0,0};
 str db_prefix = str_init("rl_pipe_");
@@ -120,6 +121,7 @@ static param_export_t params[] = {
 	{ "default_algorithm",	STR_PARAM,				 &rl_default_algo_s.s},
 	{ "cachedb_url",		STR_PARAM,				 &db_url.s},
 	{ "db_prefix",			STR_PARAM,				 &db_prefix.s},
+	{ "cachedb_batch",		INT_PARAM,				 &rl_cdb_batch},
 	{ 0,					0,						0}
 };
 
@@ -280,6 +282,10 @@ static int mod_init(void)
 		LM_ERR("invalid expire time\n");
 		return -1;
 	}
+	if (rl_cdb_batch < 1) {
+		LM_ERR("invalid cachedb batch %d\n", rl_cdb_batch);
+		return -1;
+	}
 
 	if (db_url.s) {
 		db_url.len = strlen(db_url.s);
@@ -393,6 +399,147 @@ int hash[100] = {18, 50, 51, 39, 49, 68, 8, 78, 61, 75, 53, 32, 45, 77, 31,
 	38, 71, 23, 2, 67, 36, 65, 27, 1, 19, 59, 89, 48};
 
 
+/* TOKEN_BUCKET and SLIDING_WINDOW keep their state in a single 64 bits
+ * word, changed with RL_STATE_SET (compare and swap, or a plain store
+ * under the lock of the pipe); the time is taken from the micro-timer,
+ * so it moves in UTIMER_TICK steps */
+#define RL_NOW_MS() ((unsigned int)(get_uticks() / 1000))
+
+/* the most tokens a bucket holds (in thousandths), to fit in 32 bits */
+#define RL_TB_MAX_LIMIT		4000000
+
+/* per window counters of SLIDING_WINDOW are 24 bits wide */
+#define RL_SW_MAX			0xffffffULL
+
+/*
+ * TOKEN_BUCKET - the bucket holds up to "limit" tokens and is refilled
+ * with "limit" tokens per second; each request takes one token.
+ * The state holds the time of the last refill, in ms, in the upper half
+ * and the thousandths of tokens in the lower half.
+ */
+static int rl_token_bucket(rl_pipe_t *pipe)
+{
+	unsigned long long old, new, tokens, max;
+	unsigned int now, last;
+	int limit, ret;
+
+	limit = pipe->limit < RL_TB_MAX_LIMIT ? pipe->limit : RL_TB_MAX_LIMIT;
+	if (limit <= 0)
+		return -1;
+	max = (unsigned long long)limit * 1000;
+
+	do {
+		old = pipe->state;
+		now = RL_NOW_MS();
+		last = (unsigned int)(old >> 32);
+		tokens = old & 0xffffffffULL;
+		/* another process may have refilled at a later time */
+		if ((int)(now - last) > 0) {
+			tokens += (unsigned long long)(now - last) * limit;
+			if (tokens > max)
+				tokens = max;
+		} else {
+			now = last;
+		}
+		if (tokens >= 1000) {
+			tokens -= 1000;
+			ret = 1;
+		} else {
+			ret = -1;
+		}
+		new = ((unsigned long long)now << 32) | tokens;
+	} while (!RL_STATE_SET(pipe, old, new));
+
+	return ret;
+}
+
+/*
+ * SLIDING_WINDOW - allows "limit * timer_interval" requests in any
+ * timer_interval seconds, estimating the requests of the sliding window
+ * from the ones accepted in the current and in the previous fixed windows.
+ * The state holds the (truncated) number of the current window in the upper
+ * 16 bits, followed by the counters of the previous and current windows.
+ */
+static int rl_sliding_window(rl_pipe_t *pipe)
+{
+	unsigned long long old, new, prev, cur, max;
+	unsigned int now, win, epoch, e;
+
+	win = (rl_timer_interval > 0 ? rl_timer_interval : 1) * 1000;
+	max = (unsigned long long)(pipe->limit > 0 ? pipe->limit : 0) *
+		(win / 1000);
+
+	do {
+		old = pipe->state;
+		now = RL_NOW_MS();
+		epoch = (now / win) & 0xffff;
+		e = (unsigned int)(old >> 48);
+		prev = (old >> 24) & RL_SW_MAX;
+		cur = old & RL_SW_MAX;
+		if (e != epoch) {
+			if (((epoch + 1) & 0xffff) == e) {
+				/* another process already moved to the next window */
+				epoch = e;
+				now = (now / win + 1) * win;
+			} else {
+				prev = (((epoch - 1) & 0xffff) == e) ? cur : 0;
+				cur = 0;
+			}
+		}
+		/* the previous window only counts for the part still covered */
+		if (prev * (win - now % win) / win + cur >= max)
+			return -1;
+
+		if (cur < RL_SW_MAX)
+			cur++;
+		new = ((unsigned long long)epoch << 48) | (prev << 24) | cur;
+	} while (!RL_STATE_SET(pipe, old, new));
+
+	return 1;
+}
+
+/**
+ * gives back "val" accesses to a TOKEN_BUCKET or SLIDING_WINDOW pipe, or
+ * fully resets it when val is 0
+ * (expects the pipe lock to be taken)
+ */
+void rl_pipe_release(rl_pipe_t *pipe, int val)
+{
+	unsigned long long old, new, tokens, max, cur, n;
+	unsigned int win;
+	int limit;
+
+	limit = pipe->limit < RL_TB_MAX_LIMIT ? pipe->limit : RL_TB_MAX_LIMIT;
+	max = (unsigned long long)(limit > 0 ? limit : 0) * 1000;
+	win = (rl_timer_interval > 0 ? rl_timer_interval : 1) * 1000;
+	n = val < 0 ? -val : val;
+
+	/* the pipe may still be checked without the lock */
+	do {
+		old = pipe->state;
+		if (pipe->algo == PIPE_ALGO_TOKEN_BUCKET) {
+			tokens = old & 0xffffffffULL;
+			if (!val)
+				tokens = max;
+			else if (val < 0)
+				tokens = tokens + n * 1000 > max ? max : tokens + n * 1000;
+			else
+				tokens = tokens > n * 1000 ? tokens - n * 1000 : 0;
+			new = (old & ~0xffffffffULL) | tokens;
+		} else if (!val) {
+			/* both windows are dropped */
+			new = (unsigned long long)((RL_NOW_MS() / win) & 0xffff) << 48;
+		} else {
+			cur = old & RL_SW_MAX;
+			if (val < 0)
+				cur = cur > n ? cur - n : 0;
+			else
+				cur = cur + n > RL_SW_MAX ? RL_SW_MAX : cur + n;
+			new = (old & ~RL_SW_MAX) | cur;
+		}
+	} while (!RL_STATE_SET(pipe, old, new));
+}
+
 /**
  * runs the pipe's algorithm
  * (expects rl_lock to be taken)
@@ -415,6 +562,10 @@ int rl_pipe_check(rl_pipe_t *pipe)
 			return pipe->load;
 		case PIPE_ALGO_FEEDBACK:
 			return (hash[pipe->counter % 100] < *drop_rate) ? -1 : 1;
+		case PIPE_ALGO_TOKEN_BUCKET:
+			return rl_token_bucket(pipe);
+		case PIPE_ALGO_SLIDING_WINDOW:
+			return rl_sliding_window(pipe);
 		default:
 			LM_ERR("ratelimit algorithm %d not implemented\n", pipe->algo);
 	}
@@ -39,9 +39,28 @@ typedef enum {
 	PIPE_ALGO_TAILDROP,
 	PIPE_ALGO_RED,
 	PIPE_ALGO_FEEDBACK,
-	PIPE_ALGO_NETWORK
+	PIPE_ALGO_NETWORK,
+	PIPE_ALGO_TOKEN_BUCKET,
+	PIPE_ALGO_SLIDING_WINDOW
 } rl_algo_t;
 
+/* algorithms keeping their own state, besides the counter - always local
+ * (never shared through the cachedb) */
+#define RL_ALGO_LOCAL(_a) \
+	((_a) == PIPE_ALGO_TOKEN_BUCKET || (_a) == PIPE_ALGO_SLIDING_WINDOW)
+
+/* if the compiler can do a 64 bits compare and swap, the state of the
+ * local algorithms is only changed with atomic operations, so the pipe
+ * lock is not needed to check them; else they are checked under it */
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+#define RL_ALGO_ATOMIC(_a) RL_ALGO_LOCAL(_a)
+#define RL_STATE_SET(_p, _old, _new) \
+	__sync_bool_compare_and_swap(&(_p)->state, (_old), (_new))
+#else
+#define RL_ALGO_ATOMIC(_a) 0
+#define RL_STATE_SET(_p, _old, _new) ((_p)->state = (_new), 1)
+#endif
+
 typedef struct rl_pipe {
 	int limit;					/* limit used by algorithm */
 	int counter;				/* countes the accesses */
@@ -50,6 +69,8 @@ typedef struct rl_pipe {
 	int load;					/* countes the accesses */
 	rl_algo_t algo;				/* the algorithm used */
 	unsigned long last_used;	/* timestamp when the pipe was last accessed */
+	int pending;				/* accesses not pushed to the cachedb yet */
+	volatile unsigned long long state;	/* TOKEN_BUCKET/SLIDING_WINDOW */
 } rl_pipe_t;
 
 /* big hashtable */
@@ -66,6 +87,7 @@ extern rl_big_htable rl_htable;
 extern int rl_timer_interval;
 extern int rl_expire_time;
 extern int rl_hash_size;
+extern int rl_cdb_batch;
 extern int *rl_network_count;
 extern int *rl_network_load;
 extern str rl_default_algo_s;
@@ -83,6 +105,7 @@ int w_rl_reset(struct sip_msg*, char *);
 int w_rl_set_count(str, int);
 int rl_stats(struct mi_root *, str *);
 int rl_pipe_check(rl_pipe_t *);
+void rl_pipe_release(rl_pipe_t *, int);
 /* update load */
 int get_cpuload(void);
 void do_update_load(void);
@@ -78,7 +78,8 @@ static cachedb_con *cdbc = 0;
 
 /* returns true if the pipe should use cachedb interface */
 #define RL_USE_CDB(_p) \
-	(cdbc && (_p)->algo!=PIPE_ALGO_NETWORK && (_p)->algo!=PIPE_ALGO_FEEDBACK)
+	(cdbc && (_p)->algo!=PIPE_ALGO_NETWORK && (_p)->algo!=PIPE_ALGO_FEEDBACK \
+		&& !RL_ALGO_LOCAL((_p)->algo))
 
 
 
@@ -143,6 +144,20 @@ static int rl_change_counter(str *name, rl_pipe_t *pipe, int c)
 	return 0;
 }
 
+/* pushes the accesses counted locally since the last update to the cachedb
+ * NOTE: assumes that the pipe has been locked */
+static int rl_flush_pending(str *name, rl_pipe_t *pipe)
+{
+	if (!pipe->pending)
+		return 0;
+
+	if (rl_change_counter(name, pipe, pipe->pending) < 0)
+		return -1;
+
+	pipe->pending = 0;
+	return 0;
+}
+
 /* NOTE: assumes that the pipe has been locked */
 static int rl_get_counter(str *name, rl_pipe_t * pipe)
 {
@@ -273,6 +288,8 @@ struct {
 	{ str_init("TAILDROP"),	PIPE_ALGO_TAILDROP},
 	{ str_init("FEEDBACK"),	PIPE_ALGO_FEEDBACK},
 	{ str_init("NETWORK"),	PIPE_ALGO_NETWORK},
+	{ str_init("TOKEN_BUCKET"),		PIPE_ALGO_TOKEN_BUCKET},
+	{ str_init("SLIDING_WINDOW"),	PIPE_ALGO_SLIDING_WINDOW},
 	{ { 0, 0 },				0},
 };
 
@@ -311,7 +328,7 @@ int w_rl_check_3(struct sip_msg *_m, char *_n, char *_l, char *_a)
 	int limit = 0, ret = 1, should_update = 0;
 	str algorithm;
 	unsigned int hash_idx;
-	rl_pipe_t **pipe;
+	rl_pipe_t **pipe, *p;
 
 	rl_algo_t algo = -1;
 
@@ -394,9 +411,28 @@ int w_rl_check_3(struct sip_msg *_m, char *_n, char *_l, char *_a)
 
 	/* set the last used time */
 	(*pipe)->last_used = time(0);
+	if (RL_ALGO_ATOMIC((*pipe)->algo)) {
+		/* the pipe cannot expire now that it was used - the lock is
+		 * only needed for the lookup */
+		p = *pipe;
+		RL_RELEASE_LOCK(hash_idx);
+		__sync_fetch_and_add(&p->counter, 1);
+		ret = rl_pipe_check(p);
+		LM_DBG("Pipe %.*s limit:%d should %sbe blocked (%p)\n",
+				name.len, name.s, p->limit, ret == 1? "NOT " : "", p);
+		goto end;
+	}
 	if (RL_USE_CDB(*pipe)) {
-		/* release the counter for a while */
-		if (rl_change_counter(&name, *pipe, 1) < 0) {
+		if (rl_cdb_batch > 1) {
+			/* counted locally, and pushed to the cachedb only once
+			 * every rl_cdb_batch requests */
+			(*pipe)->pending++;
+			(*pipe)->counter++;
+			if ((*pipe)->pending >= rl_cdb_batch &&
+					rl_flush_pending(&name, *pipe) < 0)
+				LM_ERR("cannot push the counter - using the local one\n");
+		} else if (rl_change_counter(&name, *pipe, 1) < 0) {
+			/* release the counter for a while */
 			LM_ERR("cannot increase counter\n");
 			goto release;
 		}
@@ -488,6 +524,8 @@ void rl_timer(unsigned int ticks, void *param)
 			} else {
 				/* leave the lock if a cachedb query should be done*/
 				if (RL_USE_CDB(*pipe)) {
+					if (rl_flush_pending(key, *pipe) < 0)
+						LM_ERR("cannot push the pending counter\n");
 					if (rl_get_counter(key, *pipe) < 0) {
 						LM_ERR("cannot get pipe counter\n");
 						goto next_pipe;
@@ -508,12 +546,19 @@ void rl_timer(unsigned int ticks, void *param)
 					default:
 						break;
 				}
-				(*pipe)->last_counter = (*pipe)->counter;
+				if (RL_ALGO_ATOMIC((*pipe)->algo)) {
+					/* only kept for statistics, updated without the lock */
+					(*pipe)->last_counter =
+						__sync_fetch_and_and(&(*pipe)->counter, 0);
+				} else {
+					(*pipe)->last_counter = (*pipe)->counter;
+				}
 				if (RL_USE_CDB(*pipe)) {
+					(*pipe)->pending = 0;
 					if (rl_change_counter(key, *pipe, 0) < 0) {
 						LM_ERR("cannot reset counter\n");
 					}
-				} else {
+				} else if (!RL_ALGO_ATOMIC((*pipe)->algo)) {
 					(*pipe)->counter = 0;
 				}
 				/* TODO delete this */
@@ -656,10 +701,22 @@ int w_rl_set_count(str key, int val)
 		goto release;
 	}
 
-	if (RL_USE_CDB(*pipe)) {
-		if (rl_change_counter(&key, *pipe, val) < 0) {
-			LM_ERR("cannot decrease counter\n");
-			goto release;
+	if (RL_ALGO_LOCAL((*pipe)->algo)) {
+		rl_pipe_release(*pipe, val);
+	} else if (RL_USE_CDB(*pipe)) {
+		if (val < 0 && (*pipe)->pending >= -val) {
+			/* not pushed to the cachedb yet */
+			(*pipe)->pending += val;
+			(*pipe)->counter += val;
+		} else {
+			if (!val)
+				(*pipe)->pending = 0;
+			else if (rl_flush_pending(&key, *pipe) < 0)
+				goto release;
+			if (rl_change_counter(&key, *pipe, val) < 0) {
+				LM_ERR("cannot decrease counter\n");
+				goto release;
+			}
 		}
 	} else {
 		if (val && (val + (*pipe)->counter >= 0)) {
@@ -20,6 +20,7 @@
  * History:
  * -------
  * 2013-02-28: Created (Liviu)
+ * 2016-10-19: tcp_keepalive parameter, transfer statistics
  */
 
 
@@ -33,6 +34,7 @@
 #include "../../mem/mem.h"
 #include "../../mem/shm_mem.h"
 #include "../../mod_fix.h"
+#include "../../statistics.h"
 
 #include "rest_methods.h"
 
@@ -49,6 +51,17 @@ char *ssl_capath;
 int ssl_verifypeer = 1;
 int ssl_verifyhost = 1;
 
+/* idle time (s) before probing the cached connections, 0 - disabled */
+long tcp_keepalive = 0;
+
+/*
+ * Module statistics
+ */
+stat_var *rest_inflight_transfers;
+stat_var *rest_completed_transfers;
+stat_var *rest_failed_transfers;
+stat_var *rest_latency[6];
+
 /*
  * Module initialization and cleanup
  */
@@ -123,6 +136,20 @@ static param_export_t params[] = {
 	{ "ssl_capath",			STR_PARAM, &ssl_capath			},
 	{ "ssl_verifypeer",		INT_PARAM, &ssl_verifypeer		},
 	{ "ssl_verifyhost",		INT_PARAM, &ssl_verifyhost		},
+	{ "tcp_keepalive",		INT_PARAM, &tcp_keepalive		},
+	{ 0, 0, 0 }
+};
+
+static stat_export_t mod_stats[] = {
+	{ "inflight_transfers",  STAT_NO_RESET, &rest_inflight_transfers  },
+	{ "completed_transfers", 0,             &rest_completed_transfers },
+	{ "failed_transfers",    0,             &rest_failed_transfers    },
+	{ "latency_under_10ms",  0,             &rest_latency[0]          },
+	{ "latency_under_50ms",  0,             &rest_latency[1]          },
+	{ "latency_under_100ms", 0,             &rest_latency[2]          },
+	{ "latency_under_500ms", 0,             &rest_latency[3]          },
+	{ "latency_under_1s",    0,             &rest_latency[4]          },
+	{ "latency_over_1s",     0,             &rest_latency[5]          },
 	{ 0, 0, 0 }
 };
 
@@ -139,7 +166,7 @@ struct module_exports exports = {
 	cmds,     /* Exported functions */
 	acmds,    /* Exported async functions */
 	params,   /* Exported parameters */
-	NULL,     /* exported statistics */
+	mod_stats, /* exported statistics */
 	NULL,     /* exported MI functions */
 	NULL,     /* exported pseudo-variables */
 	NULL,     /* extra processes */
@@ -205,7 +232,8 @@ static int mod_init(void)
 						 osips_strdup,
 						 osips_calloc);
 
-	multi_handle = curl_multi_init();
+	if (rest_init_multi() < 0)
+		return -1;
 
 	LM_INFO("Module initialized!\n");
 
@@ -217,13 +245,7 @@ static int child_init(int rank)
 	if (rank <= PROC_MAIN)
 		return 0;
 
-	multi_handle = curl_multi_init();
-	if (!multi_handle) {
-		LM_ERR("failed to init CURLM handle\n");
-		return -1;
-	}
-
-	return 0;
+	return rest_init_multi();
 }
 
 static void mod_destroy(void)
@@ -363,11 +385,16 @@ static int w_async_rest_get(struct sip_msg *msg, async_resume_module **resume_f,
 	}
 	memset(param, '\0', sizeof *param);
 
-	read_fd = start_async_http_req(msg, REST_CLIENT_GET, url.s, NULL, NULL,
-				&param->handle, &param->body, ctype_pv ? &param->ctype : NULL);
+	param->method = REST_CLIENT_GET;
+	param->body_pv = (pv_spec_p)body_pv;
+	param->ctype_pv = (pv_spec_p)ctype_pv;
+	param->code_pv = (pv_spec_p)code_pv;
+
+	read_fd = start_async_http_req(msg, REST_CLIENT_GET, url.s, NULL, NULL, param);
 
 	/* error occurred; no transfer done */
 	if (read_fd == ASYNC_NO_IO) {
+		pkg_free(param);
 		*resume_param = NULL;
 		*resume_f = NULL;
 		/* keep default async status of NO_IO */
@@ -389,11 +416,6 @@ static int w_async_rest_get(struct sip_msg *msg, async_resume_module **resume_f,
 	}
 
 	*resume_f = resume_async_http_req;
-
-	param->method = REST_CLIENT_GET;
-	param->body_pv = (pv_spec_p)body_pv;
-	param->ctype_pv = (pv_spec_p)ctype_pv;
-	param->code_pv = (pv_spec_p)code_pv;
 	*resume_param = param;
 	/* async started with success */
 	async_status = read_fd;
@@ -433,11 +455,16 @@ static int w_async_rest_post(struct sip_msg *msg, async_resume_module **resume_f
 	}
 	memset(param, '\0', sizeof *param);
 
-	read_fd = start_async_http_req(msg, REST_CLIENT_POST, url.s, body.s, ctype.s,
-				&param->handle, &param->body, ctype_pv ? &param->ctype : NULL);
+	param->method = REST_CLIENT_POST;
+	param->body_pv = (pv_spec_p)body_pv;
+	param->ctype_pv = (pv_spec_p)ctype_pv;
+	param->code_pv = (pv_spec_p)code_pv;
+
+	read_fd = start_async_http_req(msg, REST_CLIENT_POST, url.s, body.s, ctype.s, param);
 
 	/* error occurred; no transfer done */
 	if (read_fd == ASYNC_NO_IO) {
+		pkg_free(param);
 		*resume_param = NULL;
 		*resume_f = NULL;
 		/* keep default async status of NO_IO */
@@ -459,11 +486,6 @@ static int w_async_rest_post(struct sip_msg *msg, async_resume_module **resume_f
 	}
 
 	*resume_f = resume_async_http_req;
-
-	param->method = REST_CLIENT_POST;
-	param->body_pv = (pv_spec_p)body_pv;
-	param->ctype_pv = (pv_spec_p)ctype_pv;
-	param->code_pv = (pv_spec_p)code_pv;
 	*resume_param = param;
 	/* async started with success */
 	async_status = read_fd;
@@ -20,11 +20,17 @@
  * History:
  * -------
  * 2013-02-28: Created (Liviu)
+ * 2016-10-19: transfers driven by the libcurl socket/timer callbacks,
+ *             connections kept alive between transfers
  */
 
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
 #include <curl/curl.h>
 
 #include "../../mem/shm_mem.h"
@@ -36,14 +42,17 @@ static char print_buff[MAX_CONTENT_TYPE_LEN];
 
 CURLM *multi_handle;
 
-/* simultaneous ongoing transfers within this process */
-static int transfers;
-static int read_fds[FD_SETSIZE];
-
 /* libcurl's reported running handles */
 static int running_handles;
 
-static long sleep_on_bad_timeout = 500; /* ms */
+/* when the next libcurl timeout expires (ms), 0 if none is set */
+static long long next_timeout;
+
+/* the handle of the blocking transfers, kept for its connection cache */
+static CURL *sync_handle;
+
+/* longest sleep while waiting for a socket (e.g. name resolution) */
+#define REST_IDLE_WAIT 10 /* ms */
 
 
 #define clean_header_list(list) \
@@ -63,95 +72,278 @@ static long sleep_on_bad_timeout = 500; /* ms */
 		} \
 	} while (0)
 
-static inline char is_new_transfer(int fd)
+#if LIBCURL_VERSION_NUM >= 0x071900
+#define w_curl_set_keepalive(h) \
+	do { \
+		if (tcp_keepalive) { \
+			w_curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE, 1L); \
+			w_curl_easy_setopt(h, CURLOPT_TCP_KEEPIDLE, tcp_keepalive); \
+			w_curl_easy_setopt(h, CURLOPT_TCP_KEEPINTVL, tcp_keepalive); \
+		} \
+	} while (0)
+#else
+#define w_curl_set_keepalive(h)
+#endif
+
+static inline long long rest_now_ms(void)
 {
-	int it;
+	struct timeval tv;
 
-	for (it = 0; it < transfers; it++) {
-		if (fd == read_fds[it])
-			return 0;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+/* libcurl asks to be called back in @timeout_ms (-1: no timeout) */
+static int timer_cb(CURLM *multi, long timeout_ms, void *userp)
+{
+	next_timeout = timeout_ms < 0 ? 0 : rest_now_ms() + timeout_ms;
+	return 0;
+}
+
+/* libcurl tells which socket a transfer waits on, and for what */
+static int socket_cb(CURL *e, curl_socket_t s, int what, void *userp,
+                     void *socketp)
+{
+	rest_async_param *param = NULL;
+
+	if (!e || curl_easy_getinfo(e, CURLINFO_PRIVATE, (char **)&param) !=
+	        CURLE_OK || !param)
+		return 0;
+
+	LM_DBG("transfer %p: fd %d, what %d\n", param, s, what);
+
+	if (what == CURL_POLL_REMOVE) {
+		if (param->fd == s) {
+			param->fd = -1;
+			param->what = 0;
+		}
+	} else {
+		param->fd = s;
+		param->what = what;
 	}
 
-	return 1;
+	return 0;
+}
+
+int rest_init_multi(void)
+{
+	multi_handle = curl_multi_init();
+	if (!multi_handle) {
+		LM_ERR("failed to init CURLM handle\n");
+		return -1;
+	}
+
+	if (curl_multi_setopt(multi_handle, CURLMOPT_SOCKETFUNCTION, socket_cb)
+	        != CURLM_OK ||
+	    curl_multi_setopt(multi_handle, CURLMOPT_TIMERFUNCTION, timer_cb)
+	        != CURLM_OK) {
+		LM_ERR("failed to set the CURLM callbacks\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * rest_account - updates the transfer statistics
+ */
+static void rest_account(CURL *handle, CURLcode result)
+{
+	double total;
+	long ms;
+
+	if (result != CURLE_OK) {
+		update_stat(rest_failed_transfers, 1);
+		return;
+	}
+
+	update_stat(rest_completed_transfers, 1);
+
+	if (curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total) != CURLE_OK)
+		return;
+
+	ms = (long)(total * 1000);
+	if (ms < 10)
+		update_stat(rest_latency[0], 1);
+	else if (ms < 50)
+		update_stat(rest_latency[1], 1);
+	else if (ms < 100)
+		update_stat(rest_latency[2], 1);
+	else if (ms < 500)
+		update_stat(rest_latency[3], 1);
+	else if (ms < 1000)
+		update_stat(rest_latency[4], 1);
+	else
+		update_stat(rest_latency[5], 1);
 }
 
-static inline void add_transfer(int fd)
+static void rest_run_timers(int force)
 {
-	read_fds[transfers++] = fd;
+	CURLMcode mrc;
+
+	if (!force && (!next_timeout || rest_now_ms() < next_timeout))
+		return;
+
+	next_timeout = 0;
+	mrc = curl_multi_socket_action(multi_handle, CURL_SOCKET_TIMEOUT, 0,
+	                               &running_handles);
+	if (mrc != CURLM_OK)
+		LM_ERR("curl_multi_socket_action: %s\n", curl_multi_strerror(mrc));
 }
 
-static inline char del_transfer(int fd)
+/* marks the completed transfers of this process */
+static void rest_collect_done(void)
 {
-	int it;
+	rest_async_param *param;
+	CURLMsg *cmsg;
+	int msgs_in_queue;
+
+	while ((cmsg = curl_multi_info_read(multi_handle, &msgs_in_queue))) {
+		if (cmsg->msg != CURLMSG_DONE)
+			continue;
+
+		param = NULL;
+		curl_easy_getinfo(cmsg->easy_handle, CURLINFO_PRIVATE, (char **)&param);
+		if (param) {
+			param->done = 1;
+			param->result = cmsg->data.result;
+		}
+	}
+}
 
-	LM_DBG("del fd %d\n", fd);
+/**
+ * rest_drive - runs a transfer until it completes or, if @until_read, until
+ *		it only waits for the reply. Only the socket of this transfer (and
+ *		libcurl's timers) are served, the other transfers of the process are
+ *		left to their own reactor events
+ *
+ * Return: 1 - completed, 0 - waiting for the reply, -1 - timeout / error
+ */
+static int rest_drive(rest_async_param *param, long long deadline,
+                      int until_read)
+{
+	struct pollfd pfd;
+	CURLMcode mrc;
+	long long now;
+	int wait, rc, ev;
 
-	for (it = 0; it < transfers; it++) {
-		if (fd == read_fds[it]) {
-			transfers--;
-			for (; it < transfers; it++)
-				read_fds[it] = read_fds[it + 1];
+	for (;;) {
+		rest_collect_done();
+		if (param->done)
+			return 1;
 
+		if (until_read && param->fd >= 0 && param->what == CURL_POLL_IN)
 			return 0;
+
+		now = rest_now_ms();
+		if (now >= deadline)
+			return -1;
+
+		wait = deadline - now;
+		if (next_timeout && next_timeout - now < wait)
+			wait = next_timeout > now ? next_timeout - now : 0;
+
+		if (param->fd >= 0) {
+			pfd.fd = param->fd;
+			pfd.events = ((param->what & CURL_POLL_IN) ? POLLIN : 0) |
+			             ((param->what & CURL_POLL_OUT) ? POLLOUT : 0);
+			pfd.revents = 0;
+			rc = poll(&pfd, 1, wait);
+		} else {
+			/* no socket yet (the name resolution is ongoing) */
+			rc = poll(NULL, 0, wait < REST_IDLE_WAIT ? wait : REST_IDLE_WAIT);
+		}
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			LM_ERR("poll: %s\n", strerror(errno));
+			return -1;
+		}
+
+		if (rc == 0) {
+			rest_run_timers(1);
+			continue;
+		}
+
+		ev = 0;
+		if (pfd.revents & POLLIN)
+			ev |= CURL_CSELECT_IN;
+		if (pfd.revents & POLLOUT)
+			ev |= CURL_CSELECT_OUT;
+		if (pfd.revents & (POLLERR|POLLHUP))
+			ev |= CURL_CSELECT_ERR;
+
+		mrc = curl_multi_socket_action(multi_handle, pfd.fd, ev,
+		                               &running_handles);
+		if (mrc != CURLM_OK) {
+			LM_ERR("curl_multi_socket_action: %s\n", curl_multi_strerror(mrc));
+			return -1;
 		}
+		rest_run_timers(0);
 	}
+}
 
-	return -1;
+static void rest_remove_handle(rest_async_param *param)
+{
+	CURLMcode mrc;
+
+	/* no more socket callbacks about this transfer */
+	curl_easy_setopt(param->handle, CURLOPT_PRIVATE, NULL);
+
+	mrc = curl_multi_remove_handle(multi_handle, param->handle);
+	if (mrc != CURLM_OK)
+		LM_ERR("curl_multi_remove_handle: %s\n", curl_multi_strerror(mrc));
+
+	clean_header_list(param->hdrs);
 }
 
 /**
  * start_async_http_req - performs an HTTP request, stores results in pvars
- *		- TCP connect phase is synchronous, due to libcurl limitations
- *		- TCP read phase is asynchronous, thanks to the libcurl multi interface
+ *		- the transfer is driven until the request is sent (TCP connect
+ *		  included, if no idle connection to the host is cached)
+ *		- the reply is read asynchronously, on the reactor events of the
+ *		  transfer's socket
  *
  * @msg:		sip message struct
  * @method:		HTTP verb
  * @url:		HTTP URL to be queried
  * @req_body:	Body of the request (NULL if not needed)
  * @req_ctype:	Value for the "Content-Type: " header of the request (same as ^)
- * @out_handle: CURL easy handle used to perform the transfer
- * @body:	    reply body; gradually reallocated as data arrives
- * @ctype:	    will eventually hold the last "Content-Type" header of the reply
+ * @param:		the transfer; its handle is set and its body is gradually
+ *				reallocated as data arrives, while its ctype will eventually
+ *				hold the last "Content-Type" header of the reply, if asked for
  */
 int start_async_http_req(struct sip_msg *msg, enum rest_client_method method,
 					     char *url, char *req_body, char *req_ctype,
-					     CURL **out_handle, str *body, str *ctype)
+					     rest_async_param *param)
 {
 	CURL *handle;
 	CURLcode rc;
 	CURLMcode mrc;
-	struct curl_slist *list = NULL;
-	fd_set rset, wset, eset;
-	int max_fd, fd, i;
-	long busy_wait, timeout;
-	long retry_time, check_time = 5; /* 5ms looping time */
-	int msgs_in_queue;
-	CURLMsg *cmsg;
+	int ret;
 
-	if (transfers == FD_SETSIZE) {
-		LM_ERR("too many ongoing tranfers: %d\n", FD_SETSIZE);
-		clean_header_list(list);
-		return ASYNC_NO_IO;
-	}
+	param->fd = -1;
 
 	handle = curl_easy_init();
 	if (!handle) {
 		LM_ERR("Init curl handle failed!\n");
-		clean_header_list(list);
 		return ASYNC_NO_IO;
 	}
+	param->handle = handle;
 
 	w_curl_easy_setopt(handle, CURLOPT_URL, url);
 
 	switch (method) {
 	case REST_CLIENT_POST:
 		w_curl_easy_setopt(handle, CURLOPT_POST, 1);
-		w_curl_easy_setopt(handle, CURLOPT_POSTFIELDS, req_body);
+		/* the request may be sent again on a fresh connection */
+		w_curl_easy_setopt(handle, CURLOPT_COPYPOSTFIELDS, req_body);
 
 		if (req_ctype) {
 			sprintf(print_buff, "Content-Type: %s", req_ctype);
-			list = curl_slist_append(list, print_buff);
-			w_curl_easy_setopt(handle, CURLOPT_HTTPHEADER, list);
+			param->hdrs = curl_slist_append(param->hdrs, print_buff);
+			w_curl_easy_setopt(handle, CURLOPT_HTTPHEADER, param->hdrs);
 		}
 		break;
 	case REST_CLIENT_GET:
@@ -163,17 +355,18 @@ int start_async_http_req(struct sip_msg *msg, enum rest_client_method method,
 
 	w_curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, connection_timeout);
 	w_curl_easy_setopt(handle, CURLOPT_TIMEOUT, curl_timeout);
+	w_curl_set_keepalive(handle);
 
 	w_curl_easy_setopt(handle, CURLOPT_VERBOSE, 1);
 	w_curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1);
 	w_curl_easy_setopt(handle, CURLOPT_STDERR, stdout);
 
 	w_curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_func);
-	w_curl_easy_setopt(handle, CURLOPT_WRITEDATA, body);
+	w_curl_easy_setopt(handle, CURLOPT_WRITEDATA, &param->body);
 
-	if (ctype) {
+	if (param->ctype_pv) {
 		w_curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, header_func);
-		w_curl_easy_setopt(handle, CURLOPT_HEADERDATA, ctype);
+		w_curl_easy_setopt(handle, CURLOPT_HEADERDATA, &param->ctype);
 	}
 
 	if (ssl_capath)
@@ -185,90 +378,41 @@ int start_async_http_req(struct sip_msg *msg, enum rest_client_method method,
 	if (!ssl_verifyhost)
 		w_curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
 
-	curl_multi_add_handle(multi_handle, handle);
-
-	timeout = connection_timeout_ms;
-	/* obtain a read fd in "connection_timeout" seconds at worst */
-	for (timeout = connection_timeout_ms; timeout > 0; timeout -= busy_wait) {
-		mrc = curl_multi_perform(multi_handle, &running_handles);
-		if (mrc != CURLM_OK) {
-			LM_ERR("curl_multi_perform: %s\n", curl_multi_strerror(mrc));
-			goto error;
-		}
+	w_curl_easy_setopt(handle, CURLOPT_PRIVATE, param);
 
-		mrc = curl_multi_timeout(multi_handle, &retry_time);
-		if (mrc != CURLM_OK) {
-			LM_ERR("curl_multi_timeout: %s\n", curl_multi_strerror(mrc));
-			goto error;
-		}
+	mrc = curl_multi_add_handle(multi_handle, handle);
+	if (mrc != CURLM_OK) {
+		LM_ERR("curl_multi_add_handle: %s\n", curl_multi_strerror(mrc));
+		goto cleanup;
+	}
 
-		if (retry_time == -1) {
-			LM_INFO("curl_multi_timeout() returned -1, pausing %ldms...\n",
-					sleep_on_bad_timeout);
-			busy_wait = sleep_on_bad_timeout;
-			usleep(1000UL * busy_wait);
-			continue;
-		}
+	/* kick off the transfer */
+	rest_run_timers(1);
 
-		busy_wait = retry_time < timeout ? retry_time : timeout;
-
-		/**
-		 * libcurl is currently stuck in internal operations (connect)
-		 *    we have to wait a bit until we receive a read fd
-		 */
-		for (i = 0; i < busy_wait; i += check_time) {
-			/* transfer may have already been completed!! */
-			while ((cmsg = curl_multi_info_read(multi_handle, &msgs_in_queue))) {
-				if (cmsg->easy_handle == handle && cmsg->msg == CURLMSG_DONE) {
-					LM_DBG("done, no need for async!\n");
-
-					clean_header_list(list);
-					*out_handle = handle;
-					return ASYNC_SYNC;
-				}
-			}
-
-			FD_ZERO(&rset);
-			mrc = curl_multi_fdset(multi_handle, &rset, &wset, &eset, &max_fd);
-			if (mrc != CURLM_OK) {
-				LM_ERR("curl_multi_fdset: %s\n", curl_multi_strerror(mrc));
-				goto error;
-			}
-
-			if (max_fd != -1) {
-				for (fd = 0; fd <= max_fd; fd++) {
-					if (FD_ISSET(fd, &rset)) {
-
-						LM_DBG(" >>>>>>>>>> fd %d ISSET(read)\n", fd);
-						if (is_new_transfer(fd)) {
-							LM_DBG("add fd to read list: %d\n", fd);
-							add_transfer(fd);
-							goto success;
-						}
-					}
-				}
-			}
-
-			usleep(1000UL * check_time);
-		}
+	/* get the request out in "connection_timeout" seconds at worst */
+	ret = rest_drive(param, rest_now_ms() + connection_timeout_ms, 1);
+	if (ret == 1) {
+		LM_DBG("done, no need for async!\n");
+		rest_account(handle, param->result);
+		rest_remove_handle(param);
+		return ASYNC_SYNC;
 	}
 
-	LM_ERR("timeout while connecting to '%s' (%ld sec)\n", url, connection_timeout);
-	goto error;
-
-success:
-	clean_header_list(list);
-	*out_handle = handle;
-	return fd;
+	if (ret < 0) {
+		LM_ERR("timeout while connecting to '%s' (%ld sec)\n", url,
+		       connection_timeout);
+		rest_remove_handle(param);
+		update_stat(rest_failed_transfers, 1);
+		goto cleanup;
+	}
 
-error:
-	mrc = curl_multi_remove_handle(multi_handle, handle);
-	if (mrc != CURLM_OK)
-		LM_ERR("curl_multi_remove_handle: %s\n", curl_multi_strerror(mrc));
+	update_stat(rest_inflight_transfers, 1);
+	return param->fd;
 
 cleanup:
-	clean_header_list(list);
+	clean_header_list(param->hdrs);
 	curl_easy_cleanup(handle);
+	param->handle = NULL;
 	return ASYNC_NO_IO;
 }
 
@@ -277,84 +421,51 @@ enum async_ret_code resume_async_http_req(int fd, struct sip_msg *msg, void *_pa
 	CURLcode rc;
 	CURLMcode mrc;
 	rest_async_param *param = (rest_async_param *)_param;
-	int running, max_fd;
 	long http_rc;
-	fd_set rset, wset, eset;
+	int ret = 1;
+	struct pollfd pfd;
 	pv_value_t val;
 
-	mrc = curl_multi_perform(multi_handle, &running);
-	if (mrc != CURLM_OK) {
-		LM_ERR("curl_multi_perform: %s\n", curl_multi_strerror(mrc));
-		return -1;
-	}
-	LM_DBG("running handles: %d\n", running);
-
-	if (running == running_handles) {
-		async_status = ASYNC_CONTINUE;
-		return 1;
+	/* out of the reactor we are called in a loop, having to wait */
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, curl_timeout * 1000) <= 0) {
+		LM_ERR("timeout while reading the reply on fd %d\n", fd);
+		param->result = CURLE_OPERATION_TIMEDOUT;
+		goto done;
 	}
 
-	if (running > running_handles) {
-		LM_BUG("incremented handles!!");
-		/* default async status is DONE */
-		return -1;
-	}
-
-	running_handles = running;
-
-	FD_ZERO(&rset);
-	mrc = curl_multi_fdset(multi_handle, &rset, &wset, &eset, &max_fd);
+	mrc = curl_multi_socket_action(multi_handle, fd, CURL_CSELECT_IN,
+	                               &running_handles);
 	if (mrc != CURLM_OK) {
-		LM_ERR("curl_multi_fdset: %s\n", curl_multi_strerror(mrc));
-		/* default async status is DONE */
-		return -1;
+		LM_ERR("curl_multi_socket_action: %s\n", curl_multi_strerror(mrc));
+		param->result = CURLE_RECV_ERROR;
+		goto done;
 	}
-
-	if (max_fd == -1) {
-		if (running_handles != 0) {
-			LM_BUG("running_handles == %d", running_handles);
-			abort();
-			/* default async status is DONE */
-			return -1;
+	rest_run_timers(0);
+	rest_collect_done();
+
+	if (!param->done) {
+		if (param->fd == fd) {
+			LM_DBG("fd %d still transferring...\n", fd);
+			async_status = ASYNC_CONTINUE;
+			return 1;
 		}
 
-		if (FD_ISSET(fd, &rset)) {
-			LM_BUG("fd %d is still in rset!", fd);
-			abort();
-			/* default async status is DONE */
-			return -1;
+		/* libcurl moved the transfer to another connection (e.g. the
+		 * cached one was closed by the server) - finish it here */
+		LM_DBG("transfer moved from fd %d to %d\n", fd, param->fd);
+		if (rest_drive(param, rest_now_ms() + curl_timeout * 1000, 0) != 1) {
+			LM_ERR("timeout while reading the reply\n");
+			param->result = CURLE_OPERATION_TIMEDOUT;
 		}
-
-	} else if (FD_ISSET(fd, &rset)) {
-		LM_DBG("fd %d still transferring...\n", fd);
-		async_status = ASYNC_CONTINUE;
-		return 1;
 	}
 
-	if (del_transfer(fd) != 0) {
-		LM_BUG("failed to delete fd %d", fd);
-		abort();
-		/* default async status is DONE */
-		return -1;
-	}
-
-	mrc = curl_multi_remove_handle(multi_handle, param->handle);
-	if (mrc != CURLM_OK) {
-		LM_ERR("curl_multi_remove_handle: %s\n", curl_multi_strerror(mrc));
-		/* default async status is DONE */
-		return -1;
-	}
-
-	val.flags = PV_VAL_STR;
-	val.rs = param->body;
-	if (pv_set_value(msg, param->body_pv, 0, &val) != 0)
-		LM_ERR("failed to set output body pv\n");
-
-	if (param->ctype_pv) {
-		val.rs = param->ctype;
-		if (pv_set_value(msg, param->ctype_pv, 0, &val) != 0)
-			LM_ERR("failed to set output ctype pv\n");
-	}
+done:
+	update_stat(rest_inflight_transfers, -1);
+	rest_account(param->handle, param->result);
+	rest_remove_handle(param);
 
 	if (param->code_pv) {
 		rc = curl_easy_getinfo(param->handle, CURLINFO_RESPONSE_CODE, &http_rc);
@@ -371,14 +482,45 @@ enum async_ret_code resume_async_http_req(int fd, struct sip_msg *msg, void *_pa
 			LM_ERR("failed to set output code pv\n");
 	}
 
-	pkg_free(param->body.s);
+	if (param->result != CURLE_OK) {
+		LM_ERR("async transfer failed: %s\n", curl_easy_strerror(param->result));
+		ret = -1;
+		goto out;
+	}
+
+	val.flags = PV_VAL_STR;
+	val.rs = param->body;
+	if (pv_set_value(msg, param->body_pv, 0, &val) != 0)
+		LM_ERR("failed to set output body pv\n");
+
+	if (param->ctype_pv) {
+		val.rs = param->ctype;
+		if (pv_set_value(msg, param->ctype_pv, 0, &val) != 0)
+			LM_ERR("failed to set output ctype pv\n");
+	}
+
+out:
+	if (param->body.s)
+		pkg_free(param->body.s);
 	if (param->ctype_pv && param->ctype.s)
 		pkg_free(param->ctype.s);
 	curl_easy_cleanup(param->handle);
 	pkg_free(param);
 
-	/* default async status is DONE */
-	return 1;
+	/* default async status is DONE - the connection stays cached */
+	return ret;
+}
+
+/* the blocking transfers reuse one handle, and so the idle connections */
+static CURL *rest_sync_handle(void)
+{
+	if (sync_handle) {
+		curl_easy_reset(sync_handle);
+		return sync_handle;
+	}
+
+	sync_handle = curl_easy_init();
+	return sync_handle;
 }
 
 /**
@@ -399,7 +541,7 @@ int rest_get_method(struct sip_msg *msg, char *url,
 	str st = { 0, 0 };
 	str body = { NULL, 0 }, tbody;
 
-	handle = curl_easy_init();
+	handle = rest_sync_handle();
 	if (!handle) {
 		LM_ERR("Init curl handle failed!\n");
 		return -1;
@@ -409,6 +551,7 @@ int rest_get_method(struct sip_msg *msg, char *url,
 
 	w_curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, connection_timeout);
 	w_curl_easy_setopt(handle, CURLOPT_TIMEOUT, curl_timeout);
+	w_curl_set_keepalive(handle);
 
 	w_curl_easy_setopt(handle, CURLOPT_VERBOSE, 1);
 	w_curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1);
@@ -430,6 +573,7 @@ int rest_get_method(struct sip_msg *msg, char *url,
 		w_curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
 
 	rc = curl_easy_perform(handle);
+	rest_account(handle, rc);
 
 	if (code_pv) {
 		curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &http_rc);
@@ -476,11 +620,9 @@ int rest_get_method(struct sip_msg *msg, char *url,
 			pkg_free(st.s);
 	}
 
-	curl_easy_cleanup(handle);
 	return 1;
 
 cleanup:
-	curl_easy_cleanup(handle);
 	return -1;
 }
 
@@ -505,7 +647,7 @@ int rest_post_method(struct sip_msg *msg, char *url, char *body, char *ctype,
 	str res_body = { NULL, 0 }, tbody;
 	pv_value_t pv_val;
 
-	handle = curl_easy_init();
+	handle = rest_sync_handle();
 	if (!handle) {
 		LM_ERR("Init curl handle failed!\n");
 		return -1;
@@ -524,6 +666,7 @@ int rest_post_method(struct sip_msg *msg, char *url, char *body, char *ctype,
 
 	w_curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, connection_timeout);
 	w_curl_easy_setopt(handle, CURLOPT_TIMEOUT, curl_timeout);
+	w_curl_set_keepalive(handle);
 
 	w_curl_easy_setopt(handle, CURLOPT_VERBOSE, 1);
 	w_curl_easy_setopt(handle, CURLOPT_STDERR, stdout);
@@ -545,6 +688,7 @@ int rest_post_method(struct sip_msg *msg, char *url, char *body, char *ctype,
 		w_curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
 
 	rc = curl_easy_perform(handle);
+	rest_account(handle, rc);
 	clean_header_list(list);
 
 	if (code_pv) {
@@ -592,11 +736,9 @@ int rest_post_method(struct sip_msg *msg, char *url, char *body, char *ctype,
 			pkg_free(st.s);
 	}
 
-	curl_easy_cleanup(handle);
 	return 1;
 
 cleanup:
 	clean_header_list(list);
-	curl_easy_cleanup(handle);
 	return -1;
 }
@@ -29,6 +29,7 @@
 #include "../../dprint.h"
 #include "../../error.h"
 #include "../../mem/mem.h"
+#include "../../statistics.h"
 
 extern CURLM *multi_handle;
 
@@ -39,6 +40,13 @@ extern long curl_timeout;
 extern char *ssl_capath;
 extern int ssl_verifypeer;
 extern int ssl_verifyhost;
+extern long tcp_keepalive;
+
+extern stat_var *rest_inflight_transfers;
+extern stat_var *rest_completed_transfers;
+extern stat_var *rest_failed_transfers;
+/* < 10ms, < 50ms, < 100ms, < 500ms, < 1s, >= 1s */
+extern stat_var *rest_latency[6];
 
 /* Currently supported HTTP verbs */
 enum rest_client_method {
@@ -49,9 +57,15 @@ enum rest_client_method {
 typedef struct rest_async_param_ {
 	enum rest_client_method method;
 	CURL *handle;
+	struct curl_slist *hdrs;
 	str body;
 	str ctype;
 
+	int fd;          /* the socket libcurl waits on, -1 if none */
+	int what;        /* CURL_POLL_* - what it waits for */
+	int done;
+	CURLcode result;
+
 	pv_spec_p body_pv;
 	pv_spec_p ctype_pv;
 	pv_spec_p code_pv;
@@ -62,9 +76,11 @@ int rest_get_method(struct sip_msg *msg, char *url,
 int rest_post_method(struct sip_msg *msg, char *url, char *body, char *ctype,
                      pv_spec_p body_pv, pv_spec_p ctype_pv, pv_spec_p code_pv);
 
+int rest_init_multi(void);
+
 int start_async_http_req(struct sip_msg *msg, enum rest_client_method method,
 					     char *url, char *req_body, char *req_ctype,
-					     CURL **out_handle, str *body, str *ctype);
+					     rest_async_param *param);
 enum async_ret_code resume_async_http_req(int fd, struct sip_msg *msg, void *param);
 
 #endif /* _REST_METHODS_ */
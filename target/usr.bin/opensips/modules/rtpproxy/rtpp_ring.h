@@ -0,0 +1,80 @@
+/*
+ * Points of the consistent hashing ring of the RTPProxy nodes
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#ifndef _RTPPROXY_RING_H
+#define _RTPPROXY_RING_H
+
+#include "../../str.h"
+
+struct rtpp_node;
+
+struct rtpp_ring_point {
+	unsigned int hash;
+	struct rtpp_node *node;
+};
+
+/*
+ * Hash of the ring points (node url and point index) and of the Call-IDs.
+ * core_hash() adds up the words of the strings, so the points of nodes
+ * with close urls collide and close Call-IDs stay close; this is a FNV-1a
+ * over the bytes, with the murmur3 finalizer to cover the whole ring.
+ */
+static inline unsigned int rtpp_ring_hash(const str *s1, const str *s2)
+{
+	unsigned int h;
+	int i;
+
+	h = 2166136261u;
+	for (i = 0; i < s1->len; i++)
+		h = (h ^ (unsigned char)s1->s[i]) * 16777619u;
+	if (s2)
+		for (i = 0; i < s2->len; i++)
+			h = (h ^ (unsigned char)s2->s[i]) * 16777619u;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/* index of the first point not below the hash (npoints if none), out of
+ * points sorted by hash */
+static inline unsigned int rtpp_ring_find(struct rtpp_ring_point *points,
+		unsigned int npoints, unsigned int hash)
+{
+	unsigned int lo, hi, mid;
+
+	lo = 0;
+	hi = npoints;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (points[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+#endif
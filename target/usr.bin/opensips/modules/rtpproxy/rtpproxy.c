@@ -153,6 +153,14 @@
 #include <poll.h>
 #include <stdlib.h>
 #include <sys/uio.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#elif defined(HAVE_KQUEUE)
+#include <sys/event.h>
+#endif
 
 #include "../../dprint.h"
 #include "../../data_lump.h"
@@ -173,6 +181,10 @@
 #include "../../parser/parse_multipart.h"
 #include "../../msg_callbacks.h"
 #include "../../evi/evi_modules.h"
+#include "../../ip_addr.h"
+#include "../../locking.h"
+#include "../../async.h"
+#include "../../hash_func.h"
 
 #include "../dialog/dlg_load.h"
 #include "../tm/tm_load.h"
@@ -180,6 +192,7 @@
 #include "nhelpr_funcs.h"
 #include "rtpproxy_stream.h"
 #include "rtpproxy_callbacks.h"
+#include "rtpp_ring.h"
 
 #define NH_TABLE_VERSION  0
 
@@ -217,6 +230,24 @@
 #define MI_WEIGHT_LEN				(sizeof(MI_WEIGHT)-1)
 #define MI_RECHECK_TICKS			"recheck_ticks"
 #define MI_RECHECK_T_LEN			(sizeof(MI_RECHECK_TICKS)-1)
+#define MI_RTT						"rtt"
+#define MI_RTT_LEN					(sizeof(MI_RTT)-1)
+#define MI_LOSS						"loss"
+#define MI_LOSS_LEN					(sizeof(MI_LOSS)-1)
+#define MI_REPLIES					"replies"
+#define MI_REPLIES_LEN				(sizeof(MI_REPLIES)-1)
+#define MI_TIMEOUTS					"timeouts"
+#define MI_TIMEOUTS_LEN				(sizeof(MI_TIMEOUTS)-1)
+#define MI_SESSIONS					"sessions"
+#define MI_SESSIONS_LEN				(sizeof(MI_SESSIONS)-1)
+
+/* upper limits (us) of the reply time histogram buckets */
+static const unsigned int rtpp_rtt_bounds[RTPP_RTT_BUCKETS - 1] =
+	{1000, 5000, 20000, 100000, 500000};
+static str rtpp_rtt_names[RTPP_RTT_BUCKETS] = {
+	str_init("rtt_1ms"), str_init("rtt_5ms"), str_init("rtt_20ms"),
+	str_init("rtt_100ms"), str_init("rtt_500ms"), str_init("rtt_over")
+};
 
 
 
@@ -262,6 +293,15 @@ static int force_rtp_proxy(struct sip_msg *, char *, char *, char *, char *, int
 static int start_recording_f(struct sip_msg *, char *, char *);
 static int rtpproxy_answer4_f(struct sip_msg *, char *, char *, char *, char *);
 static int rtpproxy_offer4_f(struct sip_msg *, char *, char *, char *, char *);
+static int w_async_rtpproxy_offer(struct sip_msg *, async_resume_module **,
+		void **, char *, char *, char *, char *);
+static int w_async_rtpproxy_answer(struct sip_msg *, async_resume_module **,
+		void **, char *, char *, char *, char *);
+static int w_async_rtpproxy_unforce(struct sip_msg *, async_resume_module **,
+		void **, char *, char *);
+static int init_rtpp_async(void);
+static void rtpp_load_process(int rank);
+static void free_rtpp_rings(void);
 
 static int add_rtpproxy_socks(struct rtpp_set * rtpp_list, char * rtpproxy);
 static int fixup_set_id(void ** param);
@@ -330,6 +370,11 @@ static int rtpproxy_retr = 5;
 static int rtpproxy_tout = -1;
 static char *rtpproxy_timeout = 0;
 static int rtpproxy_autobridge = 0;
+static int rtpproxy_async_slots = 512;
+static int rtpproxy_rtt_weighting = 0;
+static int rtpproxy_ring_vnodes = 0;
+static int rtpproxy_load_factor = 0;
+static int rtpproxy_load_interval = 10;
 static pid_t mypid;
 static unsigned int myseqn = 0;
 static str nortpproxy_str = str_init("a=nortpproxy:yes");
@@ -346,6 +391,8 @@ struct rtpp_set ** default_rtpp_set=0;
 
 /* array with the sockets used by rtpporxy (per process)*/
 static int *rtpp_socks = 0;
+/* and with the addresses of the UDP ones, for the async commands */
+static union sockaddr_union *rtpp_addrs = 0;
 static unsigned int *rtpp_no = 0;
 static unsigned int *list_version;
 static unsigned int my_version = 0;
@@ -499,6 +546,33 @@ static cmd_export_t cmds[] = {
 	{0, 0, 0, 0, 0, 0}
 };
 
+static acmd_export_t acmds[] = {
+	{"rtpproxy_offer",   (acmd_function)w_async_rtpproxy_offer,   0, 0 },
+	{"rtpproxy_offer",   (acmd_function)w_async_rtpproxy_offer,   1,
+		fixup_spve_null },
+	{"rtpproxy_offer",   (acmd_function)w_async_rtpproxy_offer,   2,
+		fixup_spve_spve },
+	{"rtpproxy_offer",   (acmd_function)w_async_rtpproxy_offer,   3,
+		fixup_offer_answer },
+	{"rtpproxy_offer",   (acmd_function)w_async_rtpproxy_offer,   4,
+		fixup_offer_answer },
+	{"rtpproxy_answer",  (acmd_function)w_async_rtpproxy_answer,  0, 0 },
+	{"rtpproxy_answer",  (acmd_function)w_async_rtpproxy_answer,  1,
+		fixup_spve_null },
+	{"rtpproxy_answer",  (acmd_function)w_async_rtpproxy_answer,  2,
+		fixup_spve_spve },
+	{"rtpproxy_answer",  (acmd_function)w_async_rtpproxy_answer,  3,
+		fixup_offer_answer },
+	{"rtpproxy_answer",  (acmd_function)w_async_rtpproxy_answer,  4,
+		fixup_offer_answer },
+	{"rtpproxy_unforce", (acmd_function)w_async_rtpproxy_unforce, 0, 0 },
+	{"rtpproxy_unforce", (acmd_function)w_async_rtpproxy_unforce, 1,
+		fixup_two_options },
+	{"rtpproxy_unforce", (acmd_function)w_async_rtpproxy_unforce, 2,
+		fixup_two_options },
+	{0, 0, 0, 0}
+};
+
 static param_export_t params[] = {
 	{"nortpproxy_str",        STR_PARAM, &nortpproxy_str.s        },
 	{"rtpproxy_sock",         STR_PARAM|USE_FUNC_PARAM,
@@ -513,6 +587,11 @@ static param_export_t params[] = {
 	{"rtpp_socket_col",       STR_PARAM, &rtpp_sock_col.s         },
 	{"set_id_col",            STR_PARAM, &set_id_col.s            },
 	{"rtpp_notify_socket",    STR_PARAM, &rtpp_notify_socket.s    },
+	{"rtpproxy_async_slots",  INT_PARAM, &rtpproxy_async_slots    },
+	{"rtpproxy_rtt_weighting",INT_PARAM, &rtpproxy_rtt_weighting  },
+	{"rtpproxy_ring_vnodes",  INT_PARAM, &rtpproxy_ring_vnodes    },
+	{"rtpproxy_load_factor",  INT_PARAM, &rtpproxy_load_factor    },
+	{"rtpproxy_load_interval",INT_PARAM, &rtpproxy_load_interval  },
 	{0, 0, 0}
 };
 
@@ -526,6 +605,7 @@ static mi_export_t mi_cmds[] = {
 
 static proc_export_t procs[] = {
 	{"RTPP timeout receiver",  0,  0, timeout_listener_process, 1, 0},
+	{"RTPP load poller",       0,  0, rtpp_load_process,        1, 0},
 	{0,0,0,0,0,0}
 };
 
@@ -548,7 +628,7 @@ struct module_exports exports = {
 	DEFAULT_DLFLAGS, /* dlopen flags */
 	&deps,           /* OpenSIPS module dependencies */
 	cmds,
-	NULL,
+	acmds,       /* exported async functions */
 	params,
 	0,           /* exported statistics */
 	mi_cmds,     /* exported MI functions */
@@ -604,6 +684,44 @@ static int rtpproxy_set_store(modparam_t type, void * val){
 }
 
 
+/* registers the session and reply counters of a node, named after its
+ * url; a node reloaded with the same url gets its former counters back */
+static int rtpp_node_stats(struct rtpp_node *node)
+{
+#ifdef STATISTICS
+	str s;
+	char *name;
+	int i;
+
+	s.s = MI_SESSIONS; s.len = MI_SESSIONS_LEN;
+	if ( (name=build_stat_name( &s, node->rn_url.s))==0 ||
+	register_stat("rtpproxy", name, &node->rn_sessions,
+	STAT_SHM_NAME|STAT_NO_RESET)!=0 )
+		goto error;
+	s.s = MI_REPLIES; s.len = MI_REPLIES_LEN;
+	if ( (name=build_stat_name( &s, node->rn_url.s))==0 ||
+	register_stat("rtpproxy", name, &node->rn_replies, STAT_SHM_NAME)!=0 )
+		goto error;
+	s.s = MI_TIMEOUTS; s.len = MI_TIMEOUTS_LEN;
+	if ( (name=build_stat_name( &s, node->rn_url.s))==0 ||
+	register_stat("rtpproxy", name, &node->rn_timeouts, STAT_SHM_NAME)!=0 )
+		goto error;
+	for (i = 0; i < RTPP_RTT_BUCKETS; i++) {
+		if ( (name=build_stat_name( &rtpp_rtt_names[i], node->rn_url.s))==0 ||
+		register_stat("rtpproxy", name, &node->rn_rtt_hist[i],
+		STAT_SHM_NAME)!=0 )
+			goto error;
+	}
+	return 0;
+error:
+	LM_ERR("failed to add stat variable\n");
+	return -1;
+#else
+	return 0;
+#endif
+}
+
+
 static int add_rtpproxy_socks(struct rtpp_set * rtpp_list,
 										char * rtpproxy){
 	/* Make rtp proxies list. */
@@ -655,6 +773,11 @@ static int add_rtpproxy_socks(struct rtpp_set * rtpp_list,
 		pnode->rn_url.len 			= p2-p1;
 
 		LM_DBG("url is %s, len is %i\n", pnode->rn_url.s, pnode->rn_url.len);
+		if (rtpp_node_stats(pnode) < 0) {
+			shm_free(pnode->rn_url.s);
+			shm_free(pnode);
+			return -1;
+		}
 		/* Leave only address in rn_address */
 		pnode->rn_address = pnode->rn_url.s;
 		if (strncasecmp(pnode->rn_address, "udp:", 4) == 0) {
@@ -1102,7 +1225,7 @@ static struct mi_root* mi_show_rtpproxies(struct mi_root* cmd_tree,
 	struct rtpp_set * rtpp_list;
 	struct rtpp_node * crt_rtpp;
 	char * string, *id;
-	int id_len, len;
+	int id_len, len, i;
 
 	string = id = 0;
 
@@ -1153,6 +1276,24 @@ static struct mi_root* mi_show_rtpproxies(struct mi_root* cmd_tree,
 				crt_rtpp->rn_weight,  attr, len, string,error);
 			add_rtpp_node_int_info(crt_node, MI_RECHECK_TICKS,MI_RECHECK_T_LEN,
 				crt_rtpp->rn_recheck_ticks, attr, len, string, error);
+			add_rtpp_node_int_info(crt_node, MI_SESSIONS, MI_SESSIONS_LEN,
+				get_stat_val(crt_rtpp->rn_sessions), attr, len, string,
+				error);
+			add_rtpp_node_int_info(crt_node, MI_RTT, MI_RTT_LEN,
+				crt_rtpp->rn_rtt, attr, len, string, error);
+			add_rtpp_node_int_info(crt_node, MI_LOSS, MI_LOSS_LEN,
+				crt_rtpp->rn_loss, attr, len, string, error);
+			add_rtpp_node_int_info(crt_node, MI_REPLIES, MI_REPLIES_LEN,
+				get_stat_val(crt_rtpp->rn_replies), attr, len, string,
+				error);
+			add_rtpp_node_int_info(crt_node, MI_TIMEOUTS, MI_TIMEOUTS_LEN,
+				get_stat_val(crt_rtpp->rn_timeouts), attr, len, string,
+				error);
+			for (i = 0; i < RTPP_RTT_BUCKETS; i++)
+				add_rtpp_node_int_info(crt_node, rtpp_rtt_names[i].s,
+					rtpp_rtt_names[i].len,
+					get_stat_val(crt_rtpp->rn_rtt_hist[i]),
+					attr, len, string, error);
 		}
 	}
 
@@ -1365,7 +1506,40 @@ mod_init(void)
 			return -1;
 		}
 	} else {
-		exports.procs = 0;
+		procs[0].no = 0;
+	}
+
+	if (rtpproxy_ring_vnodes < 0)
+		rtpproxy_ring_vnodes = 0;
+	if (rtpproxy_load_factor && rtpproxy_load_factor <= 100) {
+		LM_ERR("rtpproxy_load_factor must be above 100 (percent)\n");
+		return -1;
+	}
+#ifndef STATISTICS
+	if (rtpproxy_load_factor) {
+		LM_WARN("the bounded load needs the statistics support - "
+			"disabled\n");
+		rtpproxy_load_factor = 0;
+	}
+#endif
+	if (rtpproxy_load_factor && !rtpproxy_ring_vnodes)
+		LM_WARN("the bounded load needs the hashing ring "
+			"(rtpproxy_ring_vnodes) - disabled\n");
+	if (!rtpproxy_ring_vnodes || !rtpproxy_load_factor) {
+		rtpproxy_load_factor = 0;
+		procs[1].no = 0;
+	} else if (rtpproxy_load_interval <= 0) {
+		LM_ERR("the load of the nodes must be polled "
+			"(rtpproxy_load_interval) for the bounded load\n");
+		return -1;
+	} else if (dlg_api.get_dlg == NULL) {
+		LM_WARN("dialog module not loaded - the bounded load cannot "
+			"be used\n");
+	}
+
+	if (init_rtpp_async() < 0) {
+		LM_ERR("failed to init the async commands support\n");
+		return -1;
 	}
 
 	ei_id = evi_publish_event(event_name);
@@ -1509,6 +1683,12 @@ int connect_rtpproxies(void)
 			LM_ERR("no more pkg memory\n");
 			return -1;
 		}
+		rtpp_addrs = (union sockaddr_union*)pkg_realloc(rtpp_addrs,
+			*rtpp_no * sizeof(union sockaddr_union));
+		if (rtpp_addrs==NULL) {
+			LM_ERR("no more pkg memory\n");
+			return -1;
+		}
 	}
 	rtpp_number = *rtpp_no;
 
@@ -1568,6 +1748,8 @@ int connect_rtpproxies(void)
 				freeaddrinfo(res);
 				return -1;
 			}
+			memset(&rtpp_addrs[pnode->idx], 0, sizeof(union sockaddr_union));
+			memcpy(&rtpp_addrs[pnode->idx], res->ai_addr, res->ai_addrlen);
 			freeaddrinfo(res);
 			LM_DBG("connected %s\n", pnode->rn_address);
 rptest:
@@ -1584,6 +1766,8 @@ int update_rtpp_proxies(void) {
 
 	LM_DBG("updating list from %d to %d [%d]\n", my_version, *list_version, rtpp_number);
 	my_version = *list_version;
+	/* the rings point to the old sets */
+	free_rtpp_rings();
 	for (i = 0; i < rtpp_number; i++) {
 		shutdown(rtpp_socks[i], SHUT_RDWR);
 		close(rtpp_socks[i]);
@@ -1630,6 +1814,7 @@ static void mod_destroy(void)
 	if (default_rtpp_set)
 		shm_free(default_rtpp_set);
 
+
 	if(!rtpp_set_list || *rtpp_set_list == NULL)
 		return;
 
@@ -2051,6 +2236,196 @@ alter_mediaport(struct sip_msg *msg, str *body, str *oldport, str *newport,
 	return 0;
 }
 
+/*
+ * Control channel health - every reply and every timeout of a node is
+ * accounted, by the blocking and by the async commands alike
+ */
+static inline utime_t rtpp_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (utime_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static inline unsigned int rtpp_elapsed(utime_t since)
+{
+	utime_t now;
+
+	now = rtpp_now();
+	return (now > since) ? (unsigned int)(now - since) : 0;
+}
+
+static void rtpp_account_reply(struct rtpp_node *node, unsigned int rtt)
+{
+	int b;
+
+	for (b = 0; b < RTPP_RTT_BUCKETS - 1 && rtt >= rtpp_rtt_bounds[b]; b++);
+	update_stat(node->rn_rtt_hist[b], 1);
+	update_stat(node->rn_replies, 1);
+
+	/* moving averages with a 1/8 gain; a concurrent update may lose a
+	 * sample, which is harmless for a weighting hint */
+	node->rn_rtt = node->rn_rtt ?
+		node->rn_rtt - (node->rn_rtt >> 3) + (rtt >> 3) : rtt;
+	node->rn_loss -= node->rn_loss >> 3;
+}
+
+static void rtpp_account_failure(struct rtpp_node *node)
+{
+	update_stat(node->rn_timeouts, 1);
+	node->rn_loss = node->rn_loss - (node->rn_loss >> 3) + 1000 / 8;
+}
+
+/* weight of a node scaled down by its reply time (once slower than
+ * RTPP_RTT_REF) and by the share of the commands it lost lately */
+#define RTPP_HEALTH_SCALE	1000
+#define RTPP_RTT_REF		5000
+
+static inline unsigned int rtpp_health_weight(struct rtpp_node *node)
+{
+	unsigned long long w;
+	unsigned int rtt, loss;
+
+	rtt = node->rn_rtt;
+	loss = node->rn_loss;
+
+	w = (unsigned long long)node->rn_weight * RTPP_HEALTH_SCALE;
+	if (rtt > RTPP_RTT_REF)
+		w = w * RTPP_RTT_REF / rtt;
+	if (loss)
+		w = w * (1000 - (loss > 1000 ? 1000 : loss)) / 1000;
+
+	return (w || !node->rn_weight) ? (unsigned int)w : 1;
+}
+
+
+/*
+ * Async commands - the function runs twice: a first pass only gathers the
+ * commands it would send (nothing is changed in the message), they are
+ * sent together over a socket watched by the reactor and, once all the
+ * replies are in, the second pass runs for real, with send_rtpp_command()
+ * handing out the replies received meanwhile.
+ */
+#define RTPP_PASS_SYNC		0
+#define RTPP_PASS_COLLECT	1
+#define RTPP_PASS_REPLAY	2
+
+#define RTPP_ASYNC_OFFER	0
+#define RTPP_ASYNC_ANSWER	1
+#define RTPP_ASYNC_UNFORCE	2
+
+#define RTPP_ASYNC_MAX_CMDS	16
+
+struct rtpp_async_cmd {
+	unsigned int node_idx;
+	str cmd;				/* without the cookie */
+	char cookie[34];
+	int cookie_len;
+	char *reply;			/* NULL until answered */
+	utime_t sent;			/* first transmission */
+	unsigned int rtt;
+};
+
+struct rtpp_async_op {
+	int type;
+	char *param1;			/* evaluated flags */
+	char *param2;			/* evaluated IP */
+	char *setid;
+	char *var;
+	int sync;				/* cannot be done async, fall back */
+	unsigned int version;	/* of the rtpproxy list */
+	int fd;					/* connected to the node */
+	int tfd;				/* timer, fires on the reply timeout */
+	int mfd;				/* watches both, handed to the reactor */
+	int tries;
+	int ncmds;
+	int nreplies;
+	int next;				/* next command to replay */
+	struct rtpp_async_cmd cmds[RTPP_ASYNC_MAX_CMDS];
+};
+
+static int rtpp_pass = RTPP_PASS_SYNC;
+static struct rtpp_async_op *rtpp_async_op = NULL;
+/* the ops waiting for their replies, over all the processes */
+static int *rtpp_async_busy = NULL;
+static gen_lock_t *rtpp_async_lock = NULL;
+
+static char *rtpp_async_collect(struct rtpp_node *node, struct iovec *v,
+		int vcnt)
+{
+	static char no_reply[] = "";
+	struct rtpp_async_op *op = rtpp_async_op;
+	struct rtpp_async_cmd *c;
+	char *p;
+	int i, len;
+
+	/* unix sockets are stream based, one command per connection - leave
+	 * them for the blocking mode, like several nodes in the same op */
+	if (node->rn_umode == 0 || op->ncmds == RTPP_ASYNC_MAX_CMDS ||
+	(op->ncmds && op->cmds[0].node_idx != node->idx)) {
+		op->sync = 1;
+		return no_reply;
+	}
+
+	for (i = 1, len = 0; i < vcnt; i++)
+		len += v[i].iov_len;
+
+	c = &op->cmds[op->ncmds];
+	c->cmd.s = pkg_malloc(len);
+	if (c->cmd.s == NULL) {
+		LM_ERR("no more pkg memory\n");
+		op->sync = 1;
+		return no_reply;
+	}
+	for (i = 1, p = c->cmd.s; i < vcnt; i++) {
+		memcpy(p, v[i].iov_base, v[i].iov_len);
+		p += v[i].iov_len;
+	}
+	c->cmd.len = len;
+	c->node_idx = node->idx;
+	c->cookie_len = strlen(strcpy(c->cookie, gencookie()));
+	c->reply = NULL;
+	op->ncmds++;
+
+	return no_reply;
+}
+
+/* returns 1 (and the reply) if the command was answered in advance,
+ * 0 if it timed out and -1 if it was not sent in advance */
+static int rtpp_async_replay(struct rtpp_node *node, struct iovec *v,
+		int vcnt, char **reply)
+{
+	struct rtpp_async_op *op = rtpp_async_op;
+	struct rtpp_async_cmd *c;
+	char *p;
+	int i;
+
+	if (op->next >= op->ncmds || op->version != *list_version)
+		return -1;
+
+	c = &op->cmds[op->next];
+	if (c->node_idx != node->idx)
+		return -1;
+	for (i = 1, p = c->cmd.s; i < vcnt; i++) {
+		if (p + v[i].iov_len > c->cmd.s + c->cmd.len ||
+		memcmp(p, v[i].iov_base, v[i].iov_len) != 0)
+			return -1;
+		p += v[i].iov_len;
+	}
+	if (p != c->cmd.s + c->cmd.len)
+		return -1;
+
+	op->next++;
+	if (c->reply == NULL)
+		return 0;
+
+	rtpp_account_reply(node, c->rtt);
+	*reply = c->reply;
+	return 1;
+}
+
+
 static char * gencookie(void)
 {
 	static char cook[34];
@@ -2110,12 +2485,12 @@ free:
 
 
 
+static int rtpp_test_node(struct rtpp_node *node, int force);
+
 static int
 rtpp_test(struct rtpp_node *node, int isdisabled, int force)
 {
-	int rtpp_ver, rval;
-	char *cp;
-	struct iovec v[2] = {{NULL, 0}, {"V", 1}};
+	int pass, rval;
 
 	if(node->rn_recheck_ticks == MI_MAX_RECHECK_TICKS){
 	    LM_DBG("rtpp %s disabled for ever\n", node->rn_url.s);
@@ -2128,6 +2503,21 @@ rtpp_test(struct rtpp_node *node, int isdisabled, int force)
 		if (node->rn_recheck_ticks > get_ticks())
 			return 1;
 	}
+	/* probes are never part of an async command */
+	pass = rtpp_pass;
+	rtpp_pass = RTPP_PASS_SYNC;
+	rval = rtpp_test_node(node, force);
+	rtpp_pass = pass;
+	return rval;
+}
+
+static int
+rtpp_test_node(struct rtpp_node *node, int force)
+{
+	int rtpp_ver, rval;
+	char *cp;
+	struct iovec v[2] = {{NULL, 0}, {"V", 1}};
+
 	cp = send_rtpp_command(node, v, 2);
 	if (cp == NULL) {
 		LM_WARN("can't get version of the RTP proxy\n");
@@ -2195,7 +2585,22 @@ send_rtpp_command(struct rtpp_node *node, struct iovec *v, int vcnt)
 	char *cp;
 	static char buf[RTPPROXY_BUF_SIZE];
 	struct pollfd fds[1];
-
+	utime_t start;
+
+	switch (rtpp_pass) {
+		case RTPP_PASS_COLLECT:
+			return rtpp_async_collect(node, v, vcnt);
+		case RTPP_PASS_REPLAY:
+			i = rtpp_async_replay(node, v, vcnt, &cp);
+			if (i > 0)
+				return cp;
+			if (i == 0) {
+				LM_ERR("timeout waiting reply from a RTP proxy\n");
+				goto badproxy;
+			}
+			/* not sent in advance (list reloaded, node changed) */
+			break;
+	}
 
 #ifdef IOV_MAX
 	/* normalize vcntl to IOV_MAX, as on some systems this limit is very low (16 on Solaris) */
@@ -2225,6 +2630,7 @@ send_rtpp_command(struct rtpp_node *node, struct iovec *v, int vcnt)
 
 	len = 0;
 	cp = buf;
+	start = rtpp_now();
 
 	if (node->rn_umode == 0) {
 		memset(&addr, 0, sizeof(addr));
@@ -2312,9 +2718,11 @@ send_rtpp_command(struct rtpp_node *node, struct iovec *v, int vcnt)
 	}
 
 out:
+	rtpp_account_reply(node, rtpp_elapsed(start));
 	cp[len] = '\0';
 	return cp;
 badproxy:
+	rtpp_account_failure(node);
 	LM_ERR("proxy <%s> does not respond, disable it\n", node->rn_url.s);
 	node->rn_disabled = 1;
 	node->rn_recheck_ticks = get_ticks() + rtpproxy_disable_tout;
@@ -2345,6 +2753,292 @@ static struct rtpp_set * select_rtpp_set(int id_set){
 
 	return rtpp_list;
 }
+/*
+ * Consistent hashing - every process keeps, for each set, a ring with
+ * rtpproxy_ring_vnodes points per unit of weight of each enabled node; a
+ * call goes to the first enabled node found clockwise from its Call-ID
+ * hash, so a node going down or up only moves its own share of the calls.
+ * The ring is rebuilt when the nodes it was built from change state.
+ */
+struct rtpp_ring {
+	struct rtpp_set *set;
+	unsigned int nodes;			/* nodes of the set when built */
+	unsigned char *enabled;		/* and their state */
+	unsigned int npoints;
+	struct rtpp_ring_point *points;
+	struct rtpp_ring *next;
+};
+
+/* upper limit of the points of a ring */
+#define RTPP_RING_MAX_POINTS	65536
+
+static struct rtpp_ring *rtpp_rings = NULL;
+
+static void free_rtpp_rings(void)
+{
+	struct rtpp_ring *ring;
+
+	while (rtpp_rings) {
+		ring = rtpp_rings;
+		rtpp_rings = ring->next;
+		if (ring->points)
+			pkg_free(ring->points);
+		pkg_free(ring);
+	}
+}
+
+static int rtpp_ring_cmp(const void *a, const void *b)
+{
+	const struct rtpp_ring_point *p1 = a, *p2 = b;
+
+	if (p1->hash != p2->hash)
+		return p1->hash < p2->hash ? -1 : 1;
+	/* keep the order of the collisions the same in all processes */
+	return (int)p1->node->idx - (int)p2->node->idx;
+}
+
+static int build_rtpp_ring(struct rtpp_ring *ring)
+{
+	struct rtpp_node *node;
+	unsigned long total;
+	unsigned int i, n, vnodes;
+	str idx;
+
+	total = 0;
+	for (node=ring->set->rn_first, n=0; node!=NULL; node=node->rn_next, n++) {
+		ring->enabled[n] = !node->rn_disabled;
+		if (ring->enabled[n])
+			total += node->rn_weight;
+	}
+
+	vnodes = rtpproxy_ring_vnodes;
+	if (total * vnodes > RTPP_RING_MAX_POINTS)
+		vnodes = RTPP_RING_MAX_POINTS / total;
+	if (vnodes == 0)
+		vnodes = 1;
+
+	if (ring->points)
+		pkg_free(ring->points);
+	ring->npoints = 0;
+	ring->points = total ?
+		pkg_malloc(total * vnodes * sizeof(struct rtpp_ring_point)) : NULL;
+	if (total && ring->points == NULL) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+
+	for (node=ring->set->rn_first; node!=NULL; node=node->rn_next) {
+		if (node->rn_disabled)
+			continue;
+		for (i = 0; i < node->rn_weight * vnodes; i++) {
+			idx.s = int2str(i, &idx.len);
+			ring->points[ring->npoints].hash =
+				rtpp_ring_hash(&node->rn_url, &idx);
+			ring->points[ring->npoints].node = node;
+			ring->npoints++;
+		}
+	}
+	qsort(ring->points, ring->npoints, sizeof(struct rtpp_ring_point),
+		rtpp_ring_cmp);
+
+	LM_DBG("ring of set %d rebuilt with %u points\n",
+		ring->set->id_set, ring->npoints);
+	return 0;
+}
+
+static struct rtpp_ring *get_rtpp_ring(struct rtpp_set *set)
+{
+	struct rtpp_ring *ring;
+	struct rtpp_node *node;
+	unsigned int n;
+
+	for (ring = rtpp_rings; ring && ring->set != set; ring = ring->next);
+
+	if (ring == NULL) {
+		ring = pkg_malloc(sizeof(*ring) + set->rtpp_node_count);
+		if (ring == NULL) {
+			LM_ERR("no more pkg memory\n");
+			return NULL;
+		}
+		memset(ring, 0, sizeof(*ring));
+		ring->set = set;
+		ring->nodes = set->rtpp_node_count;
+		ring->enabled = (unsigned char *)(ring + 1);
+		if (build_rtpp_ring(ring) < 0) {
+			pkg_free(ring);
+			return NULL;
+		}
+		ring->next = rtpp_rings;
+		rtpp_rings = ring;
+		return ring;
+	}
+
+	for (node=set->rn_first, n=0; node!=NULL && n<ring->nodes;
+	node=node->rn_next, n++)
+		if (ring->enabled[n] != !node->rn_disabled)
+			break;
+	if (node != NULL && build_rtpp_ring(ring) < 0)
+		return NULL;
+
+	return ring;
+}
+
+/* Bounded load - out of the initial INVITEs of calls tracked by the
+ * dialog module (where the node can be remembered), a node is skipped if
+ * it has more than rtpproxy_load_factor percent of its share of the
+ * sessions; with rtpproxy_rtt_weighting, the share is health scaled */
+static str rtpp_node_dlg_var = str_init("rtpproxy_node");
+
+static struct rtpp_node *
+select_rtpp_ring(struct sip_msg *msg, struct rtpp_set *set, unsigned int hash)
+{
+	struct rtpp_ring *ring;
+	struct rtpp_node *node, *first;
+	struct dlg_cell *dlg = NULL;
+	unsigned long long load, wsum, cap;
+	unsigned int lo, i, w;
+	str url;
+
+	ring = get_rtpp_ring(set);
+	if (ring == NULL || ring->npoints == 0)
+		return NULL;
+
+	if (rtpproxy_load_factor && dlg_api.get_dlg && (dlg=dlg_api.get_dlg())) {
+		if (dlg_api.fetch_dlg_value(dlg, &rtpp_node_dlg_var, &url, 0) == 0) {
+			for (node=set->rn_first; node!=NULL; node=node->rn_next)
+				if (!node->rn_disabled && node->rn_url.len == url.len &&
+				memcmp(node->rn_url.s, url.s, url.len) == 0)
+					return node;
+			/* its node is gone, place the call again */
+		} else if (msg->first_line.type != SIP_REQUEST ||
+		msg->REQ_METHOD != METHOD_INVITE ||
+		(!msg->to && parse_headers(msg, HDR_TO_F, 0) < 0) || !msg->to ||
+		get_to(msg)->tag_value.len) {
+			/* not the first node selection of the call */
+			dlg = NULL;
+		}
+	}
+
+	load = wsum = 0;
+	if (dlg) {
+		for (node=set->rn_first; node!=NULL; node=node->rn_next) {
+			if (node->rn_disabled)
+				continue;
+			load += get_stat_val(node->rn_sessions);
+			wsum += rtpproxy_rtt_weighting ?
+				rtpp_health_weight(node) : node->rn_weight;
+		}
+	}
+
+	lo = rtpp_ring_find(ring->points, ring->npoints, hash);
+
+	first = NULL;
+	for (i = 0; i < ring->npoints; i++) {
+		node = ring->points[(lo + i) % ring->npoints].node;
+		if (node->rn_disabled)
+			continue;
+		if (dlg == NULL || wsum == 0)
+			return node;
+		if (first == NULL)
+			first = node;
+		w = rtpproxy_rtt_weighting ? rtpp_health_weight(node) : node->rn_weight;
+		cap = ((load + 1) * rtpproxy_load_factor * w + 100 * wsum - 1) /
+			(100 * wsum);
+		if (get_stat_val(node->rn_sessions) < cap)
+			goto placed;
+	}
+	/* all above their share */
+	if ((node = first) == NULL)
+		return NULL;
+
+placed:
+	if (dlg_api.store_dlg_value(dlg, &rtpp_node_dlg_var, &node->rn_url) < 0)
+		LM_ERR("failed to store the rtpproxy node in the dialog\n");
+	/* counted until the next poll of the node */
+	update_stat(node->rn_sessions, 1);
+	return node;
+}
+
+/* refreshes the session counters from the nodes */
+static void rtpp_load_process(int rank)
+{
+	struct iovec v[2] = {{NULL, 0}, {"I", 1}};
+	struct rtpp_set *set;
+	struct rtpp_node *node;
+	char *cp;
+	unsigned int n;
+	int delta;
+
+	mypid = getpid();
+
+	for (;;) {
+		sleep(rtpproxy_load_interval);
+
+		if (nh_lock)
+			lock_start_read(nh_lock);
+
+		if (*rtpp_set_list == NULL)
+			goto next;
+		if ((rtpp_socks == NULL || my_version != *list_version) &&
+		update_rtpp_proxies() < 0) {
+			LM_ERR("cannot update rtpp proxies list\n");
+			goto next;
+		}
+
+		for (set = (*rtpp_set_list)->rset_first; set; set = set->rset_next)
+			for (node = set->rn_first; node; node = node->rn_next) {
+				if (node->rn_disabled)
+					continue;
+				cp = send_rtpp_command(node, v, 2);
+				if (cp && (cp = strstr(cp, "active sessions:")) != NULL) {
+					/* the calls placed meanwhile are lost, like with a
+					 * plain store */
+					n = strtoul(cp + 16, NULL, 10);
+					delta = (int)n - (int)get_stat_val(node->rn_sessions);
+					LM_DBG("%u sessions on %s (%+d)\n", n,
+						node->rn_url.s, delta);
+					update_stat(node->rn_sessions, delta);
+				}
+			}
+next:
+		if (nh_lock)
+			lock_stop_read(nh_lock);
+	}
+}
+
+/*
+ * Picks one of the enabled nodes of the set, with a chance proportional
+ * to its health scaled weight.
+ */
+static struct rtpp_node *
+select_rtpp_healthy(struct rtpp_set *set, unsigned int hash)
+{
+	struct rtpp_node *node, *last;
+	unsigned long long sum, cut;
+	unsigned int w;
+
+	sum = 0;
+	for (node=set->rn_first; node!=NULL; node=node->rn_next)
+		if (!node->rn_disabled)
+			sum += rtpp_health_weight(node);
+	if (sum == 0)
+		return NULL;
+
+	cut = hash % sum;
+	last = NULL;
+	for (node=set->rn_first; node!=NULL; node=node->rn_next) {
+		if (node->rn_disabled)
+			continue;
+		w = rtpp_health_weight(node);
+		if (cut < w)
+			return node;
+		cut -= w;
+		last = node;
+	}
+	/* the weights moved meanwhile */
+	return last;
+}
+
 /*
  * Main balancing routine. This does not try to keep the same proxy for
  * the call if some proxies were disabled or enabled; proxy death considered
@@ -2355,7 +3049,7 @@ struct rtpp_node *
 select_rtpp_node(struct sip_msg * msg,
 		str callid, struct rtpp_set *set, pv_spec_p spec, int do_test)
 {
-	unsigned sum, weight_sum;
+	unsigned sum, weight_sum, hash = 0;
 	struct rtpp_node* node;
 	int was_forced, sumcut, found, constant_weight_sum;
 	pv_value_t val;
@@ -2382,6 +3076,9 @@ select_rtpp_node(struct sip_msg * msg,
 		goto done;
 	}
 
+	if (rtpproxy_ring_vnodes || rtpproxy_rtt_weighting)
+		hash = rtpp_ring_hash(&callid, NULL);
+
 	/* XXX Use quick-and-dirty hashing algo */
 	for(sum = 0; callid.len > 0; callid.len--)
 		sum += callid.s[callid.len - 1];
@@ -2414,6 +3111,9 @@ retry:
 		}
 		goto retry;
 	}
+	if (rtpproxy_ring_vnodes &&
+	(node = select_rtpp_ring(msg, set, hash)) != NULL)
+		goto found;
 	sumcut = weight_sum ? sum % constant_weight_sum : -1;
 	/*
 	 * sumcut here lays from 0 to constant_weight_sum-1.
@@ -2426,6 +3126,13 @@ retry:
 				goto found;
 			if (was_forced == 0) {
 				/* appropriate proxy is disabled : redistribute on enabled ones */
+				if (rtpproxy_rtt_weighting) {
+					/* favouring the ones answering fast and reliably */
+					node = select_rtpp_healthy(set, hash);
+					if (node == NULL)
+						return NULL;
+					goto found;
+				}
 				sumcut = weight_sum ? sum %  weight_sum : -1;
 				node = set->rn_first;
 				was_forced = 1;
@@ -2616,11 +3323,33 @@ static int rtpp_get_var_svalue(struct sip_msg *msg, gparam_p gp, str *val, int n
 	return 0;
 }
 
-static int
-rtpproxy_offer4_f(struct sip_msg *msg, char *param1, char *param2, char *param3, char *param4)
+/* evaluates the flags and IP parameters of rtpproxy_offer/answer */
+static int rtpp_oa_params(struct sip_msg *msg, char **param1, char **param2)
 {
 	str aux_str;
 
+	if (*param1) {
+		if (rtpp_get_var_svalue(msg, (gparam_p)*param1, &aux_str, 0)<0) {
+			LM_ERR("bogus flags parameter\n");
+			return -1;
+		}
+		*param1 = aux_str.s;
+	}
+
+	if (*param2) {
+		if (rtpp_get_var_svalue(msg, (gparam_p)*param2, &aux_str, 1)<0) {
+			LM_ERR("bogus IP addr parameter\n");
+			return -1;
+		}
+		*param2 = aux_str.s;
+	}
+
+	return 0;
+}
+
+static int rtpp_offer_prepare(struct sip_msg *msg, char **param1,
+		char **param2)
+{
 	if(rtpp_notify_socket.s)
 	{
 		if ( (!msg->to && parse_headers(msg, HDR_TO_F,0)<0) || !msg->to ) {
@@ -2633,21 +3362,24 @@ rtpproxy_offer4_f(struct sip_msg *msg, char *param1, char *param2, char *param3,
 			dlg_api.create_dlg(msg,0);
 	}
 
-	if (param1) {
-		if (rtpp_get_var_svalue(msg, (gparam_p)param1, &aux_str, 0)<0) {
-			LM_ERR("bogus flags parameter\n");
-			return -1;
-		}
-		param1 = aux_str.s;
-	}
+	return rtpp_oa_params(msg, param1, param2);
+}
 
-	if (param2) {
-		if (rtpp_get_var_svalue(msg, (gparam_p)param2, &aux_str, 1)<0) {
-			LM_ERR("bogus IP addr parameter\n");
+static int rtpp_answer_prepare(struct sip_msg *msg, char **param1,
+		char **param2)
+{
+	if (msg->first_line.type == SIP_REQUEST)
+		if (msg->first_line.u.request.method_value != METHOD_ACK)
 			return -1;
-		}
-		param2 = aux_str.s;
-	}
+
+	return rtpp_oa_params(msg, param1, param2);
+}
+
+static int
+rtpproxy_offer4_f(struct sip_msg *msg, char *param1, char *param2, char *param3, char *param4)
+{
+	if (rtpp_offer_prepare(msg, &param1, &param2) < 0)
+		return -1;
 
 	return force_rtp_proxy(msg, param1, param2, param3, param4, 1);
 }
@@ -2655,29 +3387,448 @@ rtpproxy_offer4_f(struct sip_msg *msg, char *param1, char *param2, char *param3,
 static int
 rtpproxy_answer4_f(struct sip_msg *msg, char *param1, char *param2, char *param3, char *param4)
 {
-	str aux_str;
+	if (rtpp_answer_prepare(msg, &param1, &param2) < 0)
+		return -1;
 
-	if (msg->first_line.type == SIP_REQUEST)
-		if (msg->first_line.u.request.method_value != METHOD_ACK)
-			return -1;
+	return force_rtp_proxy(msg, param1, param2, param3, param4, 0);
+}
 
-	if (param1) {
-		if (rtpp_get_var_svalue(msg, (gparam_p)param1, &aux_str, 0)<0) {
-			LM_ERR("bogus flags parameter\n");
+/*
+ * Async rtpproxy_offer / rtpproxy_answer / rtpproxy_unforce
+ */
+static int init_rtpp_async(void)
+{
+	if (rtpproxy_async_slots <= 0) {
+		LM_DBG("no async slots - the async commands will block\n");
+		return 0;
+	}
+#if !defined(HAVE_EPOLL) && !defined(HAVE_KQUEUE)
+	LM_WARN("neither epoll nor kqueue available - the async commands "
+		"will block\n");
+	return 0;
+#endif
+
+	rtpp_async_busy = shm_malloc(sizeof(int));
+	if (rtpp_async_busy == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	*rtpp_async_busy = 0;
+
+	rtpp_async_lock = lock_alloc();
+	if (rtpp_async_lock == NULL || !lock_init(rtpp_async_lock)) {
+		LM_ERR("failed to create the async slots lock\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the reactor watches a single fd for an op, so its socket and its reply
+ * timer are gathered under an epoll (or kqueue) fd */
+static int rtpp_async_mux(struct rtpp_async_op *op)
+{
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+
+	op->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (op->tfd < 0) {
+		LM_ERR("can't create timer: %s\n", strerror(errno));
+		return -1;
+	}
+	op->mfd = epoll_create(2);
+	if (op->mfd < 0) {
+		LM_ERR("can't create epoll fd: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	if (epoll_ctl(op->mfd, EPOLL_CTL_ADD, op->fd, &ev) < 0 ||
+	epoll_ctl(op->mfd, EPOLL_CTL_ADD, op->tfd, &ev) < 0) {
+		LM_ERR("epoll_ctl failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+#elif defined(HAVE_KQUEUE)
+	struct kevent ev;
+
+	op->mfd = kqueue();
+	if (op->mfd < 0) {
+		LM_ERR("can't create kqueue: %s\n", strerror(errno));
+		return -1;
+	}
+	EV_SET(&ev, op->fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(op->mfd, &ev, 1, NULL, 0, NULL) < 0) {
+		LM_ERR("kevent failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/* (re)starts the reply timer of the op */
+static int rtpp_async_arm(struct rtpp_async_op *op)
+{
+#ifdef HAVE_EPOLL
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = rtpproxy_tout / 1000;
+	its.it_value.tv_nsec = (rtpproxy_tout % 1000) * 1000000;
+	if (timerfd_settime(op->tfd, 0, &its, NULL) < 0) {
+		LM_ERR("can't set timer: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+#elif defined(HAVE_KQUEUE)
+	struct kevent ev;
+
+	/* adding it again re-arms it */
+	EV_SET(&ev, 0, EVFILT_TIMER, EV_ADD|EV_ONESHOT, 0, rtpproxy_tout, NULL);
+	if (kevent(op->mfd, &ev, 1, NULL, 0, NULL) < 0) {
+		LM_ERR("can't set timer: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/* did the reply timer fire? - clears it */
+static int rtpp_async_expired(struct rtpp_async_op *op)
+{
+#ifdef HAVE_EPOLL
+	unsigned long long n;
+
+	return read(op->tfd, &n, sizeof(n)) == sizeof(n);
+#elif defined(HAVE_KQUEUE)
+	static struct timespec nowait = {0, 0};
+	struct kevent ev[2];
+	int i, n;
+
+	n = kevent(op->mfd, NULL, 0, ev, 2, &nowait);
+	for (i = 0; i < n; i++)
+		if (ev[i].filter == EVFILT_TIMER)
+			return 1;
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+/* closes the fds of the op, except the one left to the reactor */
+static void rtpp_async_close(struct rtpp_async_op *op, int keep_mfd)
+{
+	if (op->fd >= 0)
+		close(op->fd);
+	if (op->tfd >= 0)
+		close(op->tfd);
+	if (op->mfd >= 0 && !keep_mfd)
+		close(op->mfd);
+	op->fd = op->tfd = op->mfd = -1;
+}
+
+static void rtpp_async_free(struct rtpp_async_op *op)
+{
+	int i;
+
+	for (i = 0; i < op->ncmds; i++) {
+		if (op->cmds[i].cmd.s)
+			pkg_free(op->cmds[i].cmd.s);
+		if (op->cmds[i].reply)
+			pkg_free(op->cmds[i].reply);
+	}
+	if (op->param1)
+		pkg_free(op->param1);
+	if (op->param2)
+		pkg_free(op->param2);
+	pkg_free(op);
+}
+
+/* (re)sends the commands still waiting for a reply */
+static int rtpp_async_xmit(struct rtpp_async_op *op)
+{
+	struct rtpp_async_cmd *c;
+	struct iovec v[2];
+	struct msghdr mh;
+	int i, len;
+
+	for (i = 0; i < op->ncmds; i++) {
+		c = &op->cmds[i];
+		if (c->reply)
+			continue;
+
+		v[0].iov_base = c->cookie;
+		v[0].iov_len = c->cookie_len;
+		v[1].iov_base = c->cmd.s;
+		v[1].iov_len = c->cmd.len;
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = v;
+		mh.msg_iovlen = 2;
+
+		do {
+			len = sendmsg(op->fd, &mh, 0);
+		} while (len == -1 && (errno == EINTR || errno == ENOBUFS));
+		if (len <= 0) {
+			LM_ERR("can't send command to a RTP proxy %s\n",
+					strerror(errno));
 			return -1;
 		}
-		param1 = aux_str.s;
+		if (op->tries == 0)
+			c->sent = rtpp_now();
 	}
 
-	if (param2) {
-		if (rtpp_get_var_svalue(msg, (gparam_p)param2, &aux_str, 1)<0) {
-			LM_ERR("bogus IP addr parameter\n");
-			return -1;
+	return rtpp_async_arm(op);
+}
+
+/* sends the gathered commands over a new socket, connected to the node
+ * (only its replies get in), and books a slot; returns the fd to be
+ * watched or -1 */
+static int rtpp_async_send(struct rtpp_async_op *op)
+{
+	union sockaddr_union *to;
+
+	to = &rtpp_addrs[op->cmds[0].node_idx];
+
+	op->fd = socket(to->s.sa_family, SOCK_DGRAM, 0);
+	if (op->fd < 0) {
+		LM_ERR("can't create socket: %s\n", strerror(errno));
+		return -1;
+	}
+	if (fcntl(op->fd, F_SETFL, fcntl(op->fd, F_GETFL) | O_NONBLOCK) < 0) {
+		LM_ERR("failed to set socket non-blocking: %s\n", strerror(errno));
+		goto error;
+	}
+	if (connect(op->fd, &to->s, sockaddru_len(*to)) < 0) {
+		LM_ERR("can't connect to a RTP proxy: %s\n", strerror(errno));
+		goto error;
+	}
+	if (rtpp_async_mux(op) < 0)
+		goto error;
+
+	lock_get(rtpp_async_lock);
+	if (*rtpp_async_busy == rtpproxy_async_slots) {
+		lock_release(rtpp_async_lock);
+		LM_DBG("no free async slot\n");
+		goto error;
+	}
+	(*rtpp_async_busy)++;
+	lock_release(rtpp_async_lock);
+
+	if (rtpp_async_xmit(op) < 0) {
+		lock_get(rtpp_async_lock);
+		(*rtpp_async_busy)--;
+		lock_release(rtpp_async_lock);
+		goto error;
+	}
+
+	return op->mfd;
+error:
+	rtpp_async_close(op, 0);
+	return -1;
+}
+
+static int rtpp_async_run(struct sip_msg *msg, struct rtpp_async_op *op,
+		int pass)
+{
+	int ret;
+
+	rtpp_pass = pass;
+	rtpp_async_op = op;
+
+	switch (op->type) {
+		case RTPP_ASYNC_OFFER:
+			ret = force_rtp_proxy(msg, op->param1, op->param2,
+				op->setid, op->var, 1);
+			break;
+		case RTPP_ASYNC_ANSWER:
+			ret = force_rtp_proxy(msg, op->param1, op->param2,
+				op->setid, op->var, 0);
+			break;
+		default:
+			ret = unforce_rtp_proxy_f(msg, op->setid, op->var);
+	}
+
+	rtpp_pass = RTPP_PASS_SYNC;
+	rtpp_async_op = NULL;
+	return ret;
+}
+
+static int resume_async_rtpproxy(int fd, struct sip_msg *msg, void *param)
+{
+	struct rtpp_async_op *op = (struct rtpp_async_op *)param;
+	static char buf[RTPPROXY_BUF_SIZE];
+	struct rtpp_async_cmd *c;
+	struct pollfd pfd;
+	int i, len, ret, expired;
+
+	/* out of the reactor (no transaction to suspend) we are called in a
+	 * loop, and have to do the waiting */
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	expired = (poll(&pfd, 1, rtpproxy_tout) == 0);
+
+	for (;;) {
+		len = recv(op->fd, buf, sizeof(buf) - 1, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
 		}
-		param2 = aux_str.s;
+		buf[len] = '\0';
+
+		for (i = 0, c = NULL; i < op->ncmds; i++) {
+			if (op->cmds[i].reply == NULL &&
+			len >= op->cmds[i].cookie_len - 1 &&
+			memcmp(buf, op->cmds[i].cookie, op->cmds[i].cookie_len - 1) == 0 &&
+			(len == op->cmds[i].cookie_len - 1 ||
+			buf[op->cmds[i].cookie_len - 1] == ' ')) {
+				c = &op->cmds[i];
+				break;
+			}
+		}
+		if (c == NULL) {
+			LM_DBG("dropping stale reply: %s\n", buf);
+			continue;
+		}
+
+		c->rtt = rtpp_elapsed(c->sent);
+		len -= c->cookie_len - 1;
+		c->reply = pkg_malloc(len + 1);
+		if (c->reply == NULL) {
+			LM_ERR("no more pkg memory\n");
+			continue;
+		}
+		/* skip the space after the cookie, like send_rtpp_command() */
+		if (len != 0) {
+			memcpy(c->reply, buf + c->cookie_len, len - 1);
+			len--;
+		}
+		c->reply[len] = '\0';
+		op->nreplies++;
 	}
 
-	return force_rtp_proxy(msg, param1, param2, param3, param4, 0);
+	if (rtpp_async_expired(op))
+		expired = 1;
+
+	if (op->nreplies < op->ncmds) {
+		if (!expired) {
+			async_status = ASYNC_CONTINUE;
+			return 1;
+		}
+		if (++op->tries < rtpproxy_retr && rtpp_async_xmit(op) == 0) {
+			async_status = ASYNC_CONTINUE;
+			return 1;
+		}
+	}
+
+	lock_get(rtpp_async_lock);
+	(*rtpp_async_busy)--;
+	lock_release(rtpp_async_lock);
+	/* the watched fd is closed by the reactor */
+	rtpp_async_close(op, 1);
+
+	/* the commands without a reply are reported as timeouts by the
+	 * second pass, disabling the node as usual */
+	ret = rtpp_async_run(msg, op, RTPP_PASS_REPLAY);
+	rtpp_async_free(op);
+
+	async_status = ASYNC_DONE_CLOSE_FD;
+	return ret;
+}
+
+static int rtpp_async_start(struct sip_msg *msg,
+		async_resume_module **resume_f, void **resume_param,
+		int type, char *param1, char *param2, char *setid, char *var)
+{
+	struct rtpp_async_op *op;
+	int ret, fd, i;
+
+	*resume_f = NULL;
+	*resume_param = NULL;
+	async_status = ASYNC_NO_IO;
+
+	op = pkg_malloc(sizeof(*op));
+	if (op == NULL) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	op->setid = setid;
+	op->var = var;
+	op->fd = op->tfd = op->mfd = -1;
+	/* the evaluated parameters are in static buffers */
+	if ((param1 && (op->param1 = pkg_strdup(param1)) == NULL) ||
+	(param2 && (op->param2 = pkg_strdup(param2)) == NULL)) {
+		LM_ERR("no more pkg memory\n");
+		rtpp_async_free(op);
+		return -1;
+	}
+
+	/* the auto-bridging defers the offer to the forwarding time */
+	if (rtpp_async_busy == NULL || (rtpproxy_autobridge &&
+	type != RTPP_ASYNC_UNFORCE))
+		goto sync;
+
+	op->version = *list_version;
+	ret = rtpp_async_run(msg, op, RTPP_PASS_COLLECT);
+	if (ret < 0) {
+		rtpp_async_free(op);
+		return ret;
+	}
+	if (op->sync || op->ncmds == 0 || op->version != *list_version ||
+	(fd = rtpp_async_send(op)) < 0)
+		goto sync;
+
+	*resume_f = resume_async_rtpproxy;
+	*resume_param = op;
+	async_status = fd;
+	return 1;
+
+sync:
+	for (i = 0; i < op->ncmds; i++) {
+		pkg_free(op->cmds[i].cmd.s);
+		op->cmds[i].cmd.s = NULL;
+	}
+	op->ncmds = 0;
+	ret = rtpp_async_run(msg, op, RTPP_PASS_SYNC);
+	rtpp_async_free(op);
+	return ret;
+}
+
+static int w_async_rtpproxy_offer(struct sip_msg *msg,
+		async_resume_module **resume_f, void **resume_param,
+		char *param1, char *param2, char *param3, char *param4)
+{
+	if (rtpp_offer_prepare(msg, &param1, &param2) < 0)
+		return -1;
+
+	return rtpp_async_start(msg, resume_f, resume_param, RTPP_ASYNC_OFFER,
+		param1, param2, param3, param4);
+}
+
+static int w_async_rtpproxy_answer(struct sip_msg *msg,
+		async_resume_module **resume_f, void **resume_param,
+		char *param1, char *param2, char *param3, char *param4)
+{
+	if (rtpp_answer_prepare(msg, &param1, &param2) < 0)
+		return -1;
+
+	return rtpp_async_start(msg, resume_f, resume_param, RTPP_ASYNC_ANSWER,
+		param1, param2, param3, param4);
+}
+
+static int w_async_rtpproxy_unforce(struct sip_msg *msg,
+		async_resume_module **resume_f, void **resume_param,
+		char *pset, char *var)
+{
+	return rtpp_async_start(msg, resume_f, resume_param, RTPP_ASYNC_UNFORCE,
+		NULL, NULL, pset, var);
 }
 
 static void engage_callback(struct dlg_cell *dlg, int type,
@@ -3881,6 +5032,9 @@ force_rtp_proxy_body(struct sip_msg* msg, struct force_rtpp_args *args, pv_spec_
 				locked = 0;
 				lock_stop_read(nh_lock);
 			}
+			/* async mode, gathering the commands only */
+			if (rtpp_pass == RTPP_PASS_COLLECT)
+				continue;
 			LM_DBG("proxy reply: %s\n", cp);
 			/* Parse proxy reply to <argc,argv> */
 			argc = 0;
@@ -4002,7 +5156,8 @@ force_rtp_proxy_body(struct sip_msg* msg, struct force_rtpp_args *args, pv_spec_
 	} /* Iterate sessions */
 	free_opts(&opts, &rep_opts, &pt_opts);
 
-	if (proxied == 0 && nortpproxy_str.len) {
+	if (proxied == 0 && nortpproxy_str.len &&
+	rtpp_pass != RTPP_PASS_COLLECT) {
 		cp = pkg_malloc((nortpproxy_str.len + CRLF_LEN) * sizeof(char));
 		if (cp == NULL) {
 			LM_ERR("out of pkg memory\n");
@@ -30,11 +30,15 @@
 #include "../../pvar.h"
 #include "../dialog/dlg_load.h"
 #include "../../rw_locking.h"
+#include "../../statistics.h"
 
 /* Handy macros */
 #define STR2IOVEC(sx, ix)       do {(ix).iov_base = (sx).s; (ix).iov_len = (sx).len;} while(0)
 #define SZ2IOVEC(sx, ix)        do {(ix).iov_base = (sx); (ix).iov_len = strlen(sx);} while(0)
 
+/* reply time histogram: <1ms, <5ms, <20ms, <100ms, <500ms, above */
+#define RTPP_RTT_BUCKETS        6
+
 struct rtpp_node {
 	unsigned int		idx;			/* overall index */
 	str					rn_url;			/* unparsed, deletable */
@@ -46,6 +50,13 @@ struct rtpp_node {
 	int			rn_rep_supported;
 	int			rn_ptl_supported;
 	int			abr_supported;
+	/* health of the control channel, updated by all the processes */
+	unsigned int		rn_rtt;			/* smoothed reply time (us) */
+	unsigned int		rn_loss;		/* smoothed loss, per mille */
+	stat_var			*rn_replies;
+	stat_var			*rn_timeouts;
+	stat_var			*rn_rtt_hist[RTPP_RTT_BUCKETS];
+	stat_var			*rn_sessions;	/* polled, plus the new calls since */
 	struct rtpp_node	*rn_next;
 };
 
@@ -43,6 +43,15 @@
 /* BPF structure */
 #ifdef __OS_linux
 #include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <poll.h>
+#endif
+
+/* PACKET_MMAP block ring (TPACKET_V3) capture */
+#if defined(__OS_linux) && defined(TPACKET3_HDRLEN) && defined(PACKET_FANOUT)
+#define HAVE_TPACKET_V3
 #endif
 
 #ifndef __USE_BSD
@@ -63,6 +72,7 @@
 #include "../../mi/mi.h"
 #include "../../db/db.h"
 #include "../../db/db_insertq.h"
+#include "../../db/db_bulkq.h"
 #include "../../parser/contact/parse_contact.h"
 #include "../../parser/parse_content.h"
 #include "../../parser/parse_from.h"
@@ -74,6 +84,7 @@
 #include "../../str.h"
 #include "../../resolve.h"
 #include "../../receive.h"
+#include "../../atomic.h"
 #include "sipcapture.h"
 
 #ifdef STATISTICS
@@ -131,12 +142,21 @@ struct _sipcapture_object {
 static int mod_init(void);
 static int child_init(int rank);
 static void raw_socket_process(int rank);
+static void db_writer_process(int rank);
+static int sip_capture_db_insert(str *table, db_val_t *db_vals);
+static void sip_capture_db_flush(void);
 static void destroy(void);
 static int sip_capture(struct sip_msg *msg, char *s1, char *s2);
 int hep_msg_received(int sockfd, struct receive_info *ri, str *msg, void* param);
 int extract_host_port(void);
 int raw_capture_socket(struct ip_addr* ip, str* iface, int port_start, int port_end, int proto);
 int raw_capture_rcv_loop(int rsock, int port1, int port2, int ipip);
+#ifdef HAVE_TPACKET_V3
+struct raw_ring;
+static int raw_rings_init(struct ip_addr *ip);
+static void raw_rings_destroy(void);
+static int raw_capture_ring_loop(struct raw_ring *ring, int port1, int port2);
+#endif
 int sipcapture_db_init(const str* db_url);
 void sipcapture_db_close(void);
 
@@ -196,6 +216,25 @@ int moni_port_end   = 0;
 int *capture_on_flag = NULL;
 int promisc_on = 0;
 int bpf_on = 0;
+int mmap_on = 0;
+/* 4MB per capture child */
+unsigned int mmap_block_size = 1 << 18;
+unsigned int mmap_blocks = 16;
+
+#ifdef HAVE_TPACKET_V3
+/* one PACKET_MMAP ring per RAW receiver; all of them are created and mapped
+ * by the main process (before dropping privileges), so the mappings are
+ * inherited and visible in all the processes */
+struct raw_ring {
+	int sock;
+	char *map;
+	unsigned int block_size;
+	unsigned int blocks;
+};
+
+static struct raw_ring *raw_rings = NULL;
+static unsigned int raw_rings_no = 0;
+#endif
 
 str raw_socket_listen = { 0, 0 };
 str raw_interface = { 0, 0 };
@@ -222,6 +261,11 @@ db_con_t* db_con = 0; 		/*!< database connection */
 static db_ps_t sipcapture_ps = NULL;
 static query_list_t *ins_list = NULL;
 
+/* rows going to the DB writer process (if enabled) */
+static unsigned int bulk_queue_size = 0;
+static int bulk_drop_oldest = 0;
+static db_bulkq_t *bulk_q = NULL;
+
 struct hep_timehdr* heptime;
 
 /*! \brief
@@ -235,6 +279,7 @@ static cmd_export_t cmds[] = {
 
 static proc_export_t procs[] = {
         {"RAW receiver",  0,  0, raw_socket_process, 1, 0},
+        {"SIP capture DB writer",  0,  0, db_writer_process, 1, 0},
         {0,0,0,0,0,0}
 };
 
@@ -293,6 +338,11 @@ static param_export_t params[] = {
 	{"raw_interface",     		STR_PARAM, &raw_interface.s   },
         {"promiscious_on",  		INT_PARAM, &promisc_on   },
         {"raw_moni_bpf_on",  		INT_PARAM, &bpf_on   },
+        {"raw_moni_mmap_on",  		INT_PARAM, &mmap_on   },
+        {"raw_mmap_block_size",  	INT_PARAM, &mmap_block_size   },
+        {"raw_mmap_blocks",  		INT_PARAM, &mmap_blocks   },
+	{"bulk_queue_size",		INT_PARAM, &bulk_queue_size   },
+	{"bulk_drop_oldest",		INT_PARAM, &bulk_drop_oldest  },
 	{0, 0, 0}
 };
 
@@ -308,10 +358,29 @@ static mi_export_t mi_cmds[] = {
 #ifdef STATISTICS
 stat_var* sipcapture_req;
 stat_var* sipcapture_rpl;
+stat_var* raw_captured;
+stat_var* raw_kernel_drops;
+stat_var* raw_ring_freezes;
+
+static unsigned long get_raw_ring_occupancy(void *foo);
+static unsigned long get_bulk_queued(void *foo);
+static unsigned long get_bulk_dropped(void *foo);
+static unsigned long get_bulk_written(void *foo);
+static unsigned long get_bulk_failed(void *foo);
+static unsigned long get_bulk_queue_load(void *foo);
 
 stat_export_t sipcapture_stats[] = {
 	{"captured_requests" ,  0,  &sipcapture_req  },
 	{"captured_replies"  ,  0,  &sipcapture_rpl  },
+	{"raw_captured"      ,  0,  &raw_captured    },
+	{"raw_kernel_drops"  ,  0,  &raw_kernel_drops },
+	{"raw_ring_freezes"  ,  0,  &raw_ring_freezes },
+	{"raw_ring_occupancy",  STAT_IS_FUNC, (stat_var**)get_raw_ring_occupancy },
+	{"bulk_queued"       ,  STAT_IS_FUNC, (stat_var**)get_bulk_queued },
+	{"bulk_dropped"      ,  STAT_IS_FUNC, (stat_var**)get_bulk_dropped },
+	{"bulk_written"      ,  STAT_IS_FUNC, (stat_var**)get_bulk_written },
+	{"bulk_failed"       ,  STAT_IS_FUNC, (stat_var**)get_bulk_failed },
+	{"bulk_queue_load"   ,  STAT_IS_FUNC, (stat_var**)get_bulk_queue_load },
 	{0,0,0}
 };
 #endif
@@ -369,6 +438,7 @@ static int mod_init(void) {
 
 	/* check if we need to start extra process */
 	procs[0].no = (ipip_capture_on || moni_capture_on) ? raw_sock_children:0;
+	procs[1].no = bulk_queue_size ? 1 : 0;
 
 	db_url.len = strlen(db_url.s);
 	table_name.len = strlen(table_name.s);
@@ -443,6 +513,15 @@ static int mod_init(void) {
 
 	*capture_on_flag = capture_on;
 
+	if (bulk_queue_size) {
+		bulk_q = db_bulkq_new(bulk_queue_size, NR_KEYS, bulk_drop_oldest);
+		if (bulk_q == NULL)
+			return -1;
+		if (query_buffer_size <= 1)
+			LM_NOTICE("query_buffer_size is not set, the DB writer will "
+				"insert the captured messages one by one\n");
+	}
+
 	/* register DGRAM event IPv4 */
         if (register_udprecv_cb(&hep_msg_received, 0, 16, 16) != 0) {
                 LM_ERR("failed to install failed to register homer recv callback IPv4\n");
@@ -478,6 +557,24 @@ static int mod_init(void) {
         		return -1;
                 }
 
+		if(mmap_on && !moni_capture_on) {
+			LM_WARN("raw_moni_mmap_on is used only by the monitoring capture\n");
+			mmap_on = 0;
+		}
+
+#ifdef HAVE_TPACKET_V3
+		if(mmap_on) {
+			if(raw_rings_init(raw_socket_listen.len ? ip : 0) < 0)
+				return -1;
+			raw_sock_desc = raw_rings[0].sock;
+		} else
+#else
+		if(mmap_on) {
+			LM_WARN("TPACKET_V3 rings are not supported on this system,"
+				" capturing with recvfrom()\n");
+			mmap_on = 0;
+		}
+#endif
 		raw_sock_desc = raw_capture_socket(raw_socket_listen.len ? ip : 0, raw_interface.len ? &raw_interface : 0,
 		                                moni_port_start, moni_port_end , ipip_capture_on ? IPPROTO_IPIP : htons(0x0800));
 
@@ -520,6 +617,12 @@ static int mod_init(void) {
 	return 0;
 #ifdef __OS_linux
 error:
+#ifdef HAVE_TPACKET_V3
+	if(raw_rings) {
+		raw_rings_destroy();
+		return -1;
+	}
+#endif
 	if(raw_sock_desc) close(raw_sock_desc);
 	return -1;
 #endif
@@ -614,6 +717,11 @@ static void raw_socket_process(int rank)
                 return;
         }
 
+#ifdef HAVE_TPACKET_V3
+	if (raw_rings)
+		raw_capture_ring_loop(&raw_rings[rank], moni_port_start, moni_port_end);
+	else
+#endif
 	raw_capture_rcv_loop(raw_sock_desc, moni_port_start, moni_port_end,
 			moni_capture_on ? 0 : 1);
 
@@ -621,6 +729,19 @@ static void raw_socket_process(int rank)
         sipcapture_db_close();
 }
 
+static void db_writer_process(int rank)
+{
+	if (sipcapture_db_init(&db_url) < 0 ){
+                LM_ERR("unable to open database connection\n");
+                return;
+        }
+
+	db_bulkq_writer(bulk_q, sip_capture_db_insert, sip_capture_db_flush);
+
+	/* Destroy DB socket */
+        sipcapture_db_close();
+}
+
 
 static void destroy(void)
 {
@@ -630,6 +751,8 @@ static void destroy(void)
 	if (capture_on_flag)
 		shm_free(capture_on_flag);
 
+	db_bulkq_destroy(bulk_q);
+
 	if(raw_sock_desc > 0) {
 		 if(promisc_on && raw_interface.len) {
 #ifdef __OS_linux
@@ -641,6 +764,11 @@ static void destroy(void)
                          }
 #endif
                 }
+#ifdef HAVE_TPACKET_V3
+		if (raw_rings)
+			raw_rings_destroy();
+		else
+#endif
 		close(raw_sock_desc);
 	}
 }
@@ -795,9 +923,38 @@ static int sip_capture_prepare(struct sip_msg* msg)
 	return 0;
 }
 
+/* the columns, in the order of the values built by sip_capture_store() */
+static db_key_t db_keys[NR_KEYS] = {
+	&id_column, &date_column, &micro_ts_column, &method_column,
+	&reply_reason_column, &ruri_column, &ruri_user_column, &from_user_column,
+	&from_tag_column, &to_user_column, &to_tag_column, &pid_user_column,
+	&contact_user_column, &auth_user_column, &callid_column,
+	&callid_aleg_column, &via_1_column, &via_1_branch_column, &cseq_column,
+	&reason_column, &content_type_column, &authorization_column,
+	&user_agent_column, &source_ip_column, &source_port_column,
+	&dest_ip_column, &dest_port_column, &contact_ip_column,
+	&contact_port_column, &orig_ip_column, &orig_port_column, &proto_column,
+	&family_column, &rtp_stat_column, &type_column, &node_column, &msg_column
+};
+
+/* all the rows go to table_name, already set on the connection */
+static int sip_capture_db_insert(str *table, db_val_t *db_vals)
+{
+	if (con_set_inslist(&db_funcs,db_con,&ins_list,db_keys,NR_KEYS) < 0 )
+	               CON_RESET_INSLIST(db_con);
+        CON_PS_REFERENCE(db_con) = &sipcapture_ps;
+
+	return db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS);
+}
+
+static void sip_capture_db_flush(void)
+{
+	if (ql_flush_rows(&db_funcs, db_con, ins_list) < 0)
+		LM_ERR("failed to flush the captured messages to DB\n");
+}
+
 static int sip_capture_store(struct _sipcapture_object *sco)
 {
-	db_key_t db_keys[NR_KEYS];
 	db_val_t db_vals[NR_KEYS];
         int i = 0;
 
@@ -807,151 +964,114 @@ static int sip_capture_store(struct _sipcapture_object *sco)
 		return -1;
 	}
 
-	db_keys[0] = &id_column;
         db_vals[0].type = DB_INT;
         db_vals[0].val.int_val = 0;
 
-	db_keys[1] = &date_column;
 	db_vals[1].type = DB_DATETIME;
 	db_vals[1].val.time_val = time(NULL);
 
-	db_keys[2] = &micro_ts_column;
         db_vals[2].type = DB_BIGINT;
         db_vals[2].val.bigint_val = sco->tmstamp;
 
-	db_keys[3] = &method_column;
 	db_vals[3].type = DB_STR;
 	db_vals[3].val.str_val = sco->method;
 
-	db_keys[4] = &reply_reason_column;
 	db_vals[4].type = DB_STR;
 	db_vals[4].val.str_val = sco->reply_reason;
 
-	db_keys[5] = &ruri_column;
 	db_vals[5].type = DB_STR;
 	db_vals[5].val.str_val = sco->ruri;
 
-	db_keys[6] = &ruri_user_column;
 	db_vals[6].type = DB_STR;
 	db_vals[6].val.str_val = sco->ruri_user;
 
-	db_keys[7] = &from_user_column;
 	db_vals[7].type = DB_STR;
 	db_vals[7].val.str_val = sco->from_user;
 
-	db_keys[8] = &from_tag_column;
 	db_vals[8].type = DB_STR;
 	db_vals[8].val.str_val = sco->from_tag;
 
-	db_keys[9] = &to_user_column;
 	db_vals[9].type = DB_STR;
 	db_vals[9].val.str_val = sco->to_user;
 
-	db_keys[10] = &to_tag_column;
 	db_vals[10].type = DB_STR;
 	db_vals[10].val.str_val = sco->to_tag;
 
-	db_keys[11] = &pid_user_column;
 	db_vals[11].type = DB_STR;
 	db_vals[11].val.str_val = sco->pid_user;
 
-	db_keys[12] = &contact_user_column;
 	db_vals[12].type = DB_STR;
 	db_vals[12].val.str_val = sco->contact_user;
 
-	db_keys[13] = &auth_user_column;
 	db_vals[13].type = DB_STR;
 	db_vals[13].val.str_val = sco->auth_user;
 
-	db_keys[14] = &callid_column;
 	db_vals[14].type = DB_STR;
 	db_vals[14].val.str_val = sco->callid;
 
-	db_keys[15] = &callid_aleg_column;
 	db_vals[15].type = DB_STR;
 	db_vals[15].val.str_val = sco->callid_aleg;
 
-	db_keys[16] = &via_1_column;
 	db_vals[16].type = DB_STR;
 	db_vals[16].val.str_val = sco->via_1;
 
-	db_keys[17] = &via_1_branch_column;
 	db_vals[17].type = DB_STR;
 	db_vals[17].val.str_val = sco->via_1_branch;
 
-	db_keys[18] = &cseq_column;
 	db_vals[18].type = DB_STR;
 	db_vals[18].val.str_val = sco->cseq;
 
-	db_keys[19] = &reason_column;
 	db_vals[19].type = DB_STR;
 	db_vals[19].val.str_val = sco->reason;
 
-	db_keys[20] = &content_type_column;
 	db_vals[20].type = DB_STR;
 	db_vals[20].val.str_val = sco->content_type;
 
-	db_keys[21] = &authorization_column;
 	db_vals[21].type = DB_STR;
 	db_vals[21].val.str_val = sco->authorization;
 
-	db_keys[22] = &user_agent_column;
 	db_vals[22].type = DB_STR;
 	db_vals[22].val.str_val = sco->user_agent;
 
-	db_keys[23] = &source_ip_column;
 	db_vals[23].type = DB_STR;
 	db_vals[23].val.str_val = sco->source_ip;
 
-	db_keys[24] = &source_port_column;
         db_vals[24].type = DB_INT;
         db_vals[24].val.int_val = sco->source_port;
 
-	db_keys[25] = &dest_ip_column;
 	db_vals[25].type = DB_STR;
 	db_vals[25].val.str_val = sco->destination_ip;
 
-	db_keys[26] = &dest_port_column;
         db_vals[26].type = DB_INT;
         db_vals[26].val.int_val = sco->destination_port;
 
-	db_keys[27] = &contact_ip_column;
 	db_vals[27].type = DB_STR;
 	db_vals[27].val.str_val = sco->contact_ip;
 
-	db_keys[28] = &contact_port_column;
         db_vals[28].type = DB_INT;
         db_vals[28].val.int_val = sco->contact_port;
 
-	db_keys[29] = &orig_ip_column;
 	db_vals[29].type = DB_STR;
 	db_vals[29].val.str_val = sco->originator_ip;
 
-	db_keys[30] = &orig_port_column;
         db_vals[30].type = DB_INT;
         db_vals[30].val.int_val = sco->originator_port;
 
-        db_keys[31] = &proto_column;
         db_vals[31].type = DB_INT;
         db_vals[31].val.int_val = sco->proto;
 
-        db_keys[32] = &family_column;
         db_vals[32].type = DB_INT;
         db_vals[32].val.int_val = sco->family;
 
-        db_keys[33] = &rtp_stat_column;
         db_vals[33].type = DB_STR;
         db_vals[33].val.str_val = sco->rtp_stat;
 
-        db_keys[34] = &type_column;
         db_vals[34].type = DB_INT;
         db_vals[34].val.int_val = sco->type;
 
-	db_keys[35] = &node_column;
 	db_vals[35].type = DB_STR;
 	db_vals[35].val.str_val = sco->node;
 
-	db_keys[36] = &msg_column;
 	db_vals[36].type = DB_BLOB;
 	db_vals[36].val.blob_val = sco->msg;
 
@@ -961,11 +1081,12 @@ static int sip_capture_store(struct _sipcapture_object *sco)
 
 	LM_DBG("storing info...\n");
 
-	if (con_set_inslist(&db_funcs,db_con,&ins_list,db_keys,NR_KEYS) < 0 )
-	               CON_RESET_INSLIST(db_con);
-        CON_PS_REFERENCE(db_con) = &sipcapture_ps;
-
-	if (db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0) {
+	if (bulk_q) {
+		/* leave it to the DB writer; a row dropped because the queue is
+		 * full is not an error, it is counted in bulk_dropped */
+		if (db_bulkq_push(bulk_q, &table_name, db_vals) < 0)
+			goto error;
+	} else if (sip_capture_db_insert(&table_name, db_vals) < 0) {
 		LM_ERR("failed to insert into database\n");
                 goto error;
 	}
@@ -1399,25 +1520,100 @@ error:
 
 }
 
-/* Local raw receive loop */
-int raw_capture_rcv_loop(int rsock, int port1, int port2, int ipip) {
-
-
-	static char buf [BUF_SIZE+1];
+/* Handles one captured ethernet (or IPIP) frame */
+static inline void raw_capture_packet(char *buf, int len, int port1, int port2,
+		int ipip)
+{
 	union sockaddr_union from;
 	union sockaddr_union to;
-        struct receive_info ri;
-	int len;
+	struct receive_info ri;
 	struct ip *iph;
-        struct udphdr *udph;
-        char* udph_start;
-        unsigned short udp_len;
+	struct udphdr *udph;
+	char* udph_start;
+	unsigned short udp_len;
 	int offset = 0;
 	char* end;
 	unsigned short dst_port;
 	unsigned short src_port;
 	struct ip_addr dst_ip, src_ip;
 
+	end=buf+len;
+
+	offset =  ipip ? sizeof(struct ip) : ETHHDR;
+
+	if (len < (sizeof(struct ip)+sizeof(struct udphdr) + offset)) {
+		LM_DBG("received small packet: %d. Ignore it\n",len);
+		return;
+	}
+
+	iph = (struct ip*) (buf + offset);
+
+	offset+=iph->ip_hl*4;
+
+	udph_start = buf+offset;
+
+	udph = (struct udphdr*) udph_start;
+	offset +=sizeof(struct udphdr);
+
+	if ((buf+offset)>end){
+		return;
+	}
+
+	udp_len=ntohs(udph->uh_ulen);
+	if ((udph_start+udp_len)!=end){
+		if ((udph_start+udp_len)>end){
+			return;
+		}else{
+			LM_DBG("udp length too small: %d/%d\n", (int)udp_len, (int)(end-udph_start));
+			return;
+		}
+	}
+
+	/*FIL IPs*/
+	dst_ip.af=AF_INET;
+	dst_ip.len=4;
+	dst_ip.u.addr32[0]=iph->ip_dst.s_addr;
+	/* fill dst_port */
+	dst_port=ntohs(udph->uh_dport);
+	ip_addr2su(&to, &dst_ip, dst_port);
+	/* fill src_port */
+	src_port=ntohs(udph->uh_sport);
+	src_ip.af=AF_INET;
+	src_ip.len=4;
+	src_ip.u.addr32[0]=iph->ip_src.s_addr;
+	ip_addr2su(&from, &src_ip, src_port);
+	su_setport(&from, src_port);
+
+	ri.src_su=from;
+	su2ip_addr(&ri.src_ip, &from);
+	ri.src_port=src_port;
+	su2ip_addr(&ri.dst_ip, &to);
+	ri.dst_port=dst_port;
+	ri.proto=PROTO_UDP;
+
+	/* cut off the offset */
+	len -= offset;
+
+	if (len<MIN_UDP_PACKET){
+		LM_DBG("probing packet received from\n");
+		return;
+	}
+
+	LM_DBG("PORT: [%d] and [%d]\n", port1, port2);
+
+	if((!port1 && !port2)
+	        || (src_port >= port1 && src_port <= port2) || (dst_port >= port1 && dst_port <= port2)
+	        || (!port2 && (src_port == port1 || dst_port == port1)))
+	                          receive_msg(buf+offset, len, &ri);
+}
+
+/* Local raw receive loop */
+int raw_capture_rcv_loop(int rsock, int port1, int port2, int ipip) {
+
+
+	static char buf [BUF_SIZE+1];
+	int len;
+
 	for(;;) {
 
 		len = recvfrom(rsock, buf, BUF_SIZE, 0, 0, 0);
@@ -1435,80 +1631,291 @@ int raw_capture_rcv_loop(int rsock, int port1, int port2, int ipip) {
                         }
                 }
 
-		end=buf+len;
-
-		offset =  ipip ? sizeof(struct ip) : ETHHDR;
-
-		if (len < (sizeof(struct ip)+sizeof(struct udphdr) + offset)) {
-			LM_DBG("received small packet: %d. Ignore it\n",len);
-                	continue;
-        	}
-
-		iph = (struct ip*) (buf + offset);
-
-		offset+=iph->ip_hl*4;
-
-		udph_start = buf+offset;
-
-		udph = (struct udphdr*) udph_start;
-		offset +=sizeof(struct udphdr);
-
-        	if ((buf+offset)>end){
-                	continue;
-        	}
-
-		udp_len=ntohs(udph->uh_ulen);
-	        if ((udph_start+udp_len)!=end){
-        	        if ((udph_start+udp_len)>end){
-				continue;
-        	        }else{
-                	        LM_DBG("udp length too small: %d/%d\n", (int)udp_len, (int)(end-udph_start));
-	                        continue;
-        	        }
-	        }
-
-		/*FIL IPs*/
-		dst_ip.af=AF_INET;
-	        dst_ip.len=4;
-        	dst_ip.u.addr32[0]=iph->ip_dst.s_addr;
-	        /* fill dst_port */
-        	dst_port=ntohs(udph->uh_dport);
-	        ip_addr2su(&to, &dst_ip, dst_port);
-        	/* fill src_port */
-	        src_port=ntohs(udph->uh_sport);
-                src_ip.af=AF_INET;
- 	        src_ip.len=4;
-                src_ip.u.addr32[0]=iph->ip_src.s_addr;
-                ip_addr2su(&from, &src_ip, src_port);
-	        su_setport(&from, src_port);
-
-		ri.src_su=from;
-                su2ip_addr(&ri.src_ip, &from);
-                ri.src_port=src_port;
-                su2ip_addr(&ri.dst_ip, &to);
-                ri.dst_port=dst_port;
-                ri.proto=PROTO_UDP;
-
-		/* cut off the offset */
-	        len -= offset;
-
-		if (len<MIN_UDP_PACKET){
-                        LM_DBG("probing packet received from\n");
-                        continue;
-                }
+#ifdef STATISTICS
+		update_stat(raw_captured, 1);
+#endif
+		raw_capture_packet(buf, len, port1, port2, ipip);
+	}
+
+	return 0;
 
-                LM_DBG("PORT: [%d] and [%d]\n", port1, port2);
+error:
+	return -1;
 
-		if((!port1 && !port2)
-		        || (src_port >= port1 && src_port <= port2) || (dst_port >= port1 && dst_port <= port2)
-		        || (!port2 && (src_port == port1 || dst_port == port1)))
-		                          receive_msg(buf+offset, len, &ri);
+}
+
+#ifdef HAVE_TPACKET_V3
+/* how long (ms) the kernel keeps a partially filled block before passing
+ * it to the user space */
+#define RAW_RING_BLOCK_TMO   10
+
+static int raw_ring_init(struct raw_ring *ring, int fanout_id)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	int val;
+
+	val = TPACKET_V3;
+	if (setsockopt(ring->sock, SOL_PACKET, PACKET_VERSION,
+	&val, sizeof(val)) < 0) {
+		LM_ERR("failed to switch to TPACKET_V3: %s [%d]\n",
+			strerror(errno), errno);
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = mmap_block_size;
+	req.tp_block_nr = mmap_blocks;
+	req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+	req.tp_frame_nr = (mmap_block_size / req.tp_frame_size) * mmap_blocks;
+	req.tp_retire_blk_tov = RAW_RING_BLOCK_TMO;
+	if (setsockopt(ring->sock, SOL_PACKET, PACKET_RX_RING,
+	&req, sizeof(req)) < 0) {
+		LM_ERR("failed to set up a %u x %u bytes RX ring: %s [%d]\n",
+			mmap_blocks, mmap_block_size, strerror(errno), errno);
+		return -1;
+	}
+
+	ring->map = mmap(NULL, (size_t)mmap_block_size * mmap_blocks,
+		PROT_READ|PROT_WRITE, MAP_SHARED, ring->sock, 0);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		LM_ERR("failed to map the RX ring: %s [%d]\n", strerror(errno), errno);
+		return -1;
+	}
+	ring->block_size = mmap_block_size;
+	ring->blocks = mmap_blocks;
+
+	/* SO_BINDTODEVICE is not honored by packet sockets */
+	if (raw_interface.len) {
+		memset(&sll, 0, sizeof(sll));
+		sll.sll_family = AF_PACKET;
+		sll.sll_protocol = htons(0x0800);
+		sll.sll_ifindex = if_nametoindex(raw_interface.s);
+		if (sll.sll_ifindex == 0 ||
+		bind(ring->sock, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+			LM_ERR("could not bind to %.*s: %s [%d]\n",
+				raw_interface.len, raw_interface.s, strerror(errno), errno);
+			return -1;
+		}
+	}
+
+	/* spread the flows over all the receivers, keeping the fragments
+	 * of the same datagram together */
+	if (fanout_id >= 0) {
+		val = (fanout_id & 0xffff) |
+			((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+		if (setsockopt(ring->sock, SOL_PACKET, PACKET_FANOUT,
+		&val, sizeof(val)) < 0) {
+			LM_ERR("failed to join fanout group %d: %s [%d]\n",
+				fanout_id, strerror(errno), errno);
+			return -1;
+		}
 	}
 
 	return 0;
+}
+
+static int raw_rings_init(struct ip_addr *ip)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned int i;
+
+	if (mmap_block_size == 0 || mmap_block_size % page ||
+	mmap_block_size % (TPACKET_ALIGNMENT << 7)) {
+		LM_ERR("raw_mmap_block_size (%u) must be a multiple of both the "
+			"page size (%ld) and the frame size (%d)\n", mmap_block_size,
+			page, TPACKET_ALIGNMENT << 7);
+		return -1;
+	}
+	if (mmap_blocks == 0) {
+		LM_ERR("raw_mmap_blocks must be a positive number\n");
+		return -1;
+	}
+
+	raw_rings = pkg_malloc(raw_sock_children * sizeof(struct raw_ring));
+	if (raw_rings == NULL) {
+		LM_ERR("no more pkg memory left\n");
+		return -1;
+	}
+	memset(raw_rings, 0, raw_sock_children * sizeof(struct raw_ring));
+
+	/* the ports are always filtered by the kernel in ring mode */
+	bpf_on = 1;
+
+	for (i = 0; i < raw_sock_children; i++) {
+		raw_rings[i].sock = raw_capture_socket(ip,
+			raw_interface.len ? &raw_interface : 0,
+			moni_port_start, moni_port_end, htons(0x0800));
+		if (raw_rings[i].sock < 0) {
+			LM_ERR("could not initialize raw socket: %s (%d)\n",
+				strerror(errno), errno);
+			if (errno == EPERM)
+				LM_ERR("could not initialize raw socket on startup"
+					" due to inadequate permissions, please"
+					" restart as root or with CAP_NET_RAW\n");
+			goto error;
+		}
+		raw_rings_no++;
+
+		if (raw_ring_init(&raw_rings[i],
+		raw_sock_children > 1 ? (getpid() & 0xffff) : -1) < 0)
+			goto error;
+	}
+
+	LM_DBG("%u RX rings of %u x %u bytes set up\n",
+		raw_rings_no, mmap_blocks, mmap_block_size);
+	return 0;
 
 error:
+	raw_rings_destroy();
 	return -1;
+}
+
+static void raw_rings_destroy(void)
+{
+	unsigned int i;
 
+	for (i = 0; i < raw_rings_no; i++) {
+		if (raw_rings[i].map)
+			munmap(raw_rings[i].map,
+				(size_t)raw_rings[i].block_size * raw_rings[i].blocks);
+		close(raw_rings[i].sock);
+	}
+
+	pkg_free(raw_rings);
+	raw_rings = NULL;
+	raw_rings_no = 0;
+	raw_sock_desc = -1;
 }
 
+/* collects the kernel counters of the ring (they are reset on each read) */
+static inline void raw_ring_stats(struct raw_ring *ring)
+{
+#ifdef STATISTICS
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (getsockopt(ring->sock, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) {
+		LM_DBG("failed to read ring statistics: %s [%d]\n",
+			strerror(errno), errno);
+		return;
+	}
+
+	if (st.tp_drops)
+		update_stat(raw_kernel_drops, st.tp_drops);
+	if (st.tp_freeze_q_cnt)
+		update_stat(raw_ring_freezes, st.tp_freeze_q_cnt);
+#endif
+}
+
+/* Local ring receive loop - consumes the blocks filled by the kernel */
+static int raw_capture_ring_loop(struct raw_ring *ring, int port1, int port2)
+{
+	static char buf [BUF_SIZE+1];
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *ph;
+	struct pollfd pfd;
+	unsigned int blk = 0, i, n, len;
+
+	pfd.fd = ring->sock;
+	pfd.events = POLLIN|POLLERR;
+
+	for(;;) {
+		bd = (struct tpacket_block_desc *)(ring->map + blk * ring->block_size);
+
+		if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+			/* all caught up - a good time to look at the drops */
+			raw_ring_stats(ring);
+
+			pfd.revents = 0;
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+				LM_ERR("poll: %s [%d]\n", strerror(errno), errno);
+				return -1;
+			}
+			continue;
+		}
+
+		n = bd->hdr.bh1.num_pkts;
+		ph = (struct tpacket3_hdr *)((char *)bd +
+			bd->hdr.bh1.offset_to_first_pkt);
+
+		for (i = 0; i < n; i++) {
+			len = ph->tp_snaplen;
+			if (len > BUF_SIZE)
+				len = BUF_SIZE;
+			/* receive_msg() works on a private copy, the frame must be
+			 * left untouched until the block goes back to the kernel */
+			memcpy(buf, (char *)ph + ph->tp_mac, len);
+			raw_capture_packet(buf, len, port1, port2, 0);
+
+			ph = (struct tpacket3_hdr *)((char *)ph + ph->tp_next_offset);
+		}
+
+#ifdef STATISTICS
+		update_stat(raw_captured, n);
+#endif
+
+		/* hand the block back to the kernel */
+		membar_full();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+		if (++blk == ring->blocks) {
+			blk = 0;
+			raw_ring_stats(ring);
+		}
+	}
+
+	return 0;
+}
+#endif
+
+#ifdef STATISTICS
+/* percentage of the ring blocks filled and not yet consumed */
+static unsigned long get_raw_ring_occupancy(void *foo)
+{
+#ifdef HAVE_TPACKET_V3
+	struct tpacket_block_desc *bd;
+	unsigned int i, b, used = 0, total = 0;
+
+	for (i = 0; i < raw_rings_no; i++) {
+		for (b = 0; b < raw_rings[i].blocks; b++) {
+			bd = (struct tpacket_block_desc *)(raw_rings[i].map +
+				b * raw_rings[i].block_size);
+			if (bd->hdr.bh1.block_status & TP_STATUS_USER)
+				used++;
+			total++;
+		}
+	}
+
+	return total ? (unsigned long)used * 100 / total : 0;
+#else
+	return 0;
+#endif
+}
+
+static unsigned long get_bulk_queued(void *foo)
+{
+	return bulk_q ? bulk_q->queued : 0;
+}
+
+static unsigned long get_bulk_dropped(void *foo)
+{
+	return bulk_q ? bulk_q->dropped : 0;
+}
+
+static unsigned long get_bulk_written(void *foo)
+{
+	return bulk_q ? bulk_q->written : 0;
+}
+
+static unsigned long get_bulk_failed(void *foo)
+{
+	return bulk_q ? bulk_q->failed : 0;
+}
+
+static unsigned long get_bulk_queue_load(void *foo)
+{
+	return bulk_q ? db_bulkq_load(bulk_q) : 0;
+}
+#endif
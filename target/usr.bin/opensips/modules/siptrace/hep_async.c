@@ -0,0 +1,424 @@
+/*
+ * Asynchronous HEP duplication for siptrace
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Each process encodes its HEP packets directly into its own ring buffer
+ * (see proc_ring.h) and the "HEP sender" process drains all the rings,
+ * sending the packets to the collector in batches - with sendmmsg() over
+ * UDP or over a persistent TCP connection (if the duplicate_uri has
+ * transport=tcp). If its ring is full, a process drops the packet instead
+ * of waiting.
+ *
+ * The rings are allocated right before forking the HEP sender, so the
+ * processes forked earlier (other module processes) keep sending their
+ * packets by themselves.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#include "../../dprint.h"
+#include "../../pt.h"
+#include "../../proc_ring.h"
+#include "../../proxy.h"
+#include "../../resolve.h"
+#include "../../ip_addr.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "hep_async.h"
+
+#if defined(__OS_linux) && defined(MSG_WAITFORONE)
+#define HAVE_SENDMMSG
+#endif
+
+unsigned int hep_async_buf_size = 0;
+int hep_compress = 0;
+
+/* max number of packets sent at once */
+#define HEP_SEND_BATCH   64
+/* how long the HEP sender sleeps when there is nothing to send (us) */
+#define HEP_SENDER_IDLE  10000
+/* how often the HEP sender retries to resolve the collector (s) */
+#define HEP_RESOLVE_RETRY 5
+
+/* errors that do not hit the next packets as well */
+#define HEP_TRANSIENT_ERR(_e) \
+	((_e)==EAGAIN || (_e)==EWOULDBLOCK || (_e)==ENOBUFS)
+
+static struct proc_rings *hep_rings = NULL;
+
+/* set while the HEP sender cannot resolve the collector; meanwhile the
+ * SIP workers send their packets by themselves */
+static int *hep_sender_down = NULL;
+
+/* buffers of the compressed packets */
+struct hep_zbuf {
+	char *s;
+	unsigned int size;
+};
+
+/* the collector, as seen by the HEP sender */
+static union sockaddr_union hep_dst;
+static int hep_dst_proto = PROTO_UDP;
+static int hep_sock = -1;
+
+
+int hep_async_init(void)
+{
+	hep_rings = proc_rings_alloc(hep_async_buf_size, HEP3_MAX_LEN);
+	if (hep_rings==NULL) {
+		LM_ERR("failed to allocate the HEP buffers\n");
+		return -1;
+	}
+
+	hep_sender_down = (int*)shm_malloc(sizeof(int));
+	if (hep_sender_down==NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	*hep_sender_down = 0;
+
+	if (hep_rings->size != hep_async_buf_size) {
+		hep_async_buf_size = hep_rings->size;
+		LM_NOTICE("hep_async_buf_size set to %u\n", hep_async_buf_size);
+	}
+
+	return 0;
+}
+
+
+int hep_async_on(void)
+{
+	return proc_ring_on(hep_rings) && *hep_sender_down==0;
+}
+
+
+char *hep_ring_reserve(unsigned int len)
+{
+	return proc_ring_reserve(hep_rings, len);
+}
+
+
+void hep_ring_commit(unsigned int len, unsigned int payload)
+{
+	proc_ring_commit(hep_rings, len, payload);
+}
+
+
+static int hep3_compress_to(struct hep_zbuf *zb, char *pkt, unsigned int len,
+		unsigned int payload, char **out, unsigned int *out_len)
+{
+	unsigned short u16;
+	uLongf zlen;
+	unsigned int plen, need;
+	char *p;
+
+	plen = len - payload - HEP3_CHUNK_HDR_LEN;
+	need = payload + HEP3_CHUNK_HDR_LEN + compressBound(plen);
+	if (need > zb->size) {
+		p = pkg_realloc(zb->s, need);
+		if (p==NULL) {
+			LM_ERR("no more pkg memory\n");
+			return -1;
+		}
+		zb->s = p;
+		zb->size = need;
+	}
+
+	zlen = zb->size - payload - HEP3_CHUNK_HDR_LEN;
+	if (compress2((Bytef*)zb->s + payload + HEP3_CHUNK_HDR_LEN, &zlen,
+	(Bytef*)pkt + payload + HEP3_CHUNK_HDR_LEN, plen, Z_BEST_SPEED)!=Z_OK) {
+		LM_ERR("failed to compress the HEP payload\n");
+		return -1;
+	}
+
+	if (zlen >= plen)
+		return 1;
+
+	/* all the chunks but the payload are kept as they are */
+	memcpy(zb->s, pkt, payload);
+	p = zb->s + payload;
+	u16 = 0;
+	memcpy(p, &u16, 2);
+	u16 = htons(HEP3_PAYLOAD_Z);
+	memcpy(p + 2, &u16, 2);
+	u16 = htons(HEP3_CHUNK_HDR_LEN + zlen);
+	memcpy(p + 4, &u16, 2);
+
+	*out_len = payload + HEP3_CHUNK_HDR_LEN + zlen;
+	u16 = htons(*out_len);
+	memcpy(zb->s + 4, &u16, 2);
+
+	*out = zb->s;
+	return 0;
+}
+
+
+int hep3_compress(char *pkt, unsigned int len, unsigned int payload,
+		char **out, unsigned int *out_len)
+{
+	static struct hep_zbuf zb = {NULL, 0};
+
+	return hep3_compress_to(&zb, pkt, len, payload, out, out_len);
+}
+
+
+static int hep_connect(void)
+{
+	hep_sock = socket(hep_dst.s.sa_family,
+		hep_dst_proto==PROTO_TCP ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (hep_sock < 0) {
+		LM_ERR("failed to create socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* UDP sockets are connected as well, to send with no address */
+	if (connect(hep_sock, &hep_dst.s, sockaddru_len(hep_dst)) < 0) {
+		LM_ERR("failed to connect to the HEP collector %.*s: %s\n",
+			dup_uri->host.len, dup_uri->host.s, strerror(errno));
+		close(hep_sock);
+		hep_sock = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* writes the whole iovec on the TCP stream; returns 0 or -1 */
+static int hep_tcp_writev(struct iovec *iov, int n)
+{
+	ssize_t ret;
+
+	while (n > 0) {
+		ret = writev(hep_sock, iov, n);
+		if (ret < 0) {
+			if (errno==EINTR)
+				continue;
+			return -1;
+		}
+
+		/* skip what was written */
+		while (n > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char*)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+
+/* returns the number of packets sent; on an error that would hit the
+ * rest of the batch as well, the rest of the batch is dropped */
+static int hep_send_batch(struct iovec *iov, int n)
+{
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[HEP_SEND_BATCH];
+	int ret;
+#endif
+	int i, sent, err;
+
+	if (hep_sock < 0 && hep_connect() < 0)
+		return 0;
+
+	if (hep_dst_proto==PROTO_TCP) {
+		if (hep_tcp_writev(iov, n) < 0) {
+			LM_ERR("failed to send to the HEP collector: %s\n",
+				strerror(errno));
+			/* reconnect with the next batch */
+			close(hep_sock);
+			hep_sock = -1;
+			return 0;
+		}
+		return n;
+	}
+
+	sent = err = 0;
+#ifdef HAVE_SENDMMSG
+	memset(msgs, 0, n * sizeof(struct mmsghdr));
+	for (i=0; i<n; i++) {
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	i = 0;
+	while (i < n) {
+		ret = sendmmsg(hep_sock, msgs + i, n - i, 0);
+		if (ret >= 0) {
+			sent += ret;
+			i += ret;
+			continue;
+		}
+		if (errno==EINTR)
+			continue;
+		err = errno;
+		if (!HEP_TRANSIENT_ERR(err))
+			break;
+		/* drop the packet that failed and go on with the rest */
+		i++;
+	}
+#else
+	for (i=0; i<n; i++) {
+		if (send(hep_sock, iov[i].iov_base, iov[i].iov_len, 0) < 0) {
+			if (errno==EINTR) {
+				i--;
+				continue;
+			}
+			err = errno;
+			if (!HEP_TRANSIENT_ERR(err))
+				break;
+			continue;
+		}
+		sent++;
+	}
+#endif
+
+	/* once per batch, not for each packet */
+	if (err)
+		LM_ERR("failed to send %d of %d packets to the HEP collector: %s\n",
+			n - sent, n, strerror(err));
+
+	return sent;
+}
+
+
+/* sends all the packets of a ring; returns how many there were */
+static int hep_ring_flush(unsigned int idx)
+{
+	static struct hep_zbuf zbufs[HEP_SEND_BATCH];
+	struct proc_ring_rec *recs[HEP_SEND_BATCH];
+	struct iovec iov[HEP_SEND_BATCH];
+	unsigned int zlen;
+	char *zpkt;
+	int i, n, cnt, sent;
+
+	cnt = 0;
+	while ( (n=proc_ring_peek(hep_rings, idx, recs, HEP_SEND_BATCH))>0 ) {
+		for (i=0; i<n; i++) {
+			if (hep_compress && recs[i]->info &&
+			hep3_compress_to(&zbufs[i], proc_ring_data(recs[i]),
+			recs[i]->len, recs[i]->info, &zpkt, &zlen)==0) {
+				iov[i].iov_base = zpkt;
+				iov[i].iov_len = zlen;
+			} else {
+				iov[i].iov_base = proc_ring_data(recs[i]);
+				iov[i].iov_len = recs[i]->len;
+			}
+		}
+
+		sent = hep_send_batch(iov, n);
+		if (sent < n)
+			LM_DBG("%d HEP packets lost\n", n - sent);
+#ifdef STATISTICS
+		update_stat(hep_sent, sent);
+		if (sent < n)
+			update_stat(hep_failed, n - sent);
+#endif
+
+		/* let the process reuse the space */
+		proc_ring_release(hep_rings, idx);
+		cnt += n;
+	}
+
+	return cnt;
+}
+
+
+/* drops what was left in the rings by the time the sender went down */
+static void hep_rings_discard(void)
+{
+	struct proc_ring_rec *recs[HEP_SEND_BATCH];
+	unsigned int i;
+	int n;
+
+	for (i=0; i<hep_rings->no; i++)
+		while ( (n=proc_ring_peek(hep_rings, i, recs, HEP_SEND_BATCH))>0 ) {
+#ifdef STATISTICS
+			update_stat(hep_failed, n);
+#endif
+			proc_ring_release(hep_rings, i);
+		}
+}
+
+
+/* resolves the collector into hep_dst; returns 0 or -1 */
+static int hep_resolve(void)
+{
+	struct proxy_l *p;
+	unsigned short port;
+
+	port = dup_uri->port_no ? dup_uri->port_no : SIP_PORT;
+	hep_dst_proto = dup_uri->proto==PROTO_TCP ? PROTO_TCP : PROTO_UDP;
+
+	p = mk_proxy(&dup_uri->host, port, hep_dst_proto, 0);
+	if (p==NULL)
+		return -1;
+	hostent2su(&hep_dst, &p->host, p->addr_idx, p->port ? p->port : port);
+	free_proxy(p); /* frees only p content, not p itself */
+	pkg_free(p);
+
+	return 0;
+}
+
+
+void hep_sender_process(int rank)
+{
+	unsigned int i;
+	int cnt;
+
+	while (hep_resolve() < 0) {
+		if (*hep_sender_down==0) {
+			LM_ERR("failed to resolve the HEP collector %.*s, the SIP "
+				"workers send the HEP packets by themselves until it "
+				"resolves\n", dup_uri->host.len, dup_uri->host.s);
+			*hep_sender_down = 1;
+		}
+		hep_rings_discard();
+		sleep(HEP_RESOLVE_RETRY);
+	}
+	if (*hep_sender_down) {
+		LM_NOTICE("HEP collector %.*s resolved, sending asynchronously "
+			"again\n", dup_uri->host.len, dup_uri->host.s);
+		*hep_sender_down = 0;
+	}
+
+	for ( ;; ) {
+		cnt = 0;
+		for (i=0; i<hep_rings->no; i++)
+			cnt += hep_ring_flush(i);
+
+		if (cnt==0)
+			usleep(HEP_SENDER_IDLE);
+	}
+}
@@ -0,0 +1,99 @@
+/*
+ * Asynchronous HEP duplication for siptrace
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#ifndef _SIPTRACE_HEP_ASYNC_H
+#define _SIPTRACE_HEP_ASYNC_H
+
+#include "../../str.h"
+#include "../../parser/parse_uri.h"
+
+#ifdef STATISTICS
+#include "../../statistics.h"
+
+extern stat_var *hep_sent;
+extern stat_var *hep_dropped;
+extern stat_var *hep_failed;
+#endif
+
+/* HEPv3 framing: "HEP3" + total length (u16), then chunks made of vendor
+ * id (u16), type (u16), length (u16, header included) and data */
+#define HEP3_HDR_LEN         6
+#define HEP3_CHUNK_HDR_LEN   6
+
+#define HEP3_IP_FAMILY       0x0001
+#define HEP3_IP_PROTO        0x0002
+#define HEP3_IPV4_SRC        0x0003
+#define HEP3_IPV4_DST        0x0004
+#define HEP3_IPV6_SRC        0x0005
+#define HEP3_IPV6_DST        0x0006
+#define HEP3_SRC_PORT        0x0007
+#define HEP3_DST_PORT        0x0008
+#define HEP3_TS_SEC          0x0009
+#define HEP3_TS_USEC         0x000a
+#define HEP3_PROTO_TYPE      0x000b
+#define HEP3_CAPTURE_ID      0x000c
+#define HEP3_PAYLOAD         0x000f
+#define HEP3_PAYLOAD_Z       0x0010
+
+#define HEP3_PROTO_SIP       0x01
+
+/* largest HEPv3 packet (the total length is a 16 bit field) */
+#define HEP3_MAX_LEN         65535
+
+/* size of the per process HEP rings; 0 sends from the SIP workers */
+extern unsigned int hep_async_buf_size;
+/* compress the payload of the HEPv3 packets */
+extern int hep_compress;
+
+extern struct sip_uri *dup_uri;
+
+/* allocates the rings - pre-fork function of the HEP sender */
+int hep_async_init(void);
+
+/* the HEP sender process */
+void hep_sender_process(int rank);
+
+/* is the HEP sender available to the current process ? */
+int hep_async_on(void);
+
+/*
+ * Reserves "len" contiguous bytes in the ring of the current process.
+ * Returns NULL if the ring is full - the packet is to be dropped.
+ */
+char *hep_ring_reserve(unsigned int len);
+
+/*
+ * Hands the last reserved packet to the HEP sender; "payload" is the
+ * offset of the HEPv3 payload chunk (0 for the older versions).
+ */
+void hep_ring_commit(unsigned int len, unsigned int payload);
+
+/*
+ * Replaces the payload chunk (at offset "payload", last in the packet)
+ * of a HEPv3 packet with a compressed payload chunk. The new packet is
+ * built in a per process buffer. Returns 0 if compressed, 1 if it was
+ * not worth it (the packet is unchanged), -1 on error.
+ */
+int hep3_compress(char *pkt, unsigned int len, unsigned int payload,
+		char **out, unsigned int *out_len);
+
+#endif
@@ -35,6 +35,7 @@
 #include "../../mi/mi.h"
 #include "../../db/db.h"
 #include "../../db/db_insertq.h"
+#include "../../db/db_bulkq.h"
 #include "../../parser/parse_content.h"
 #include "../../parser/parse_from.h"
 #include "../../pvar.h"
@@ -43,8 +44,10 @@
 #include "../sl/sl_cb.h"
 #include "../../str.h"
 #include "../../script_cb.h"
+#include "../../hash_func.h"
 
 #include "../sipcapture/sipcapture.h"
+#include "hep_async.h"
 
 #define NR_KEYS 14
 #define SIPTRACE_TABLE_VERSION 4
@@ -65,6 +68,11 @@ db_val_t db_vals[NR_KEYS];
 static db_ps_t siptrace_ps = NULL;
 static query_list_t *ins_list = NULL;
 
+/* rows going to the DB writer process (if enabled) */
+static unsigned int bulk_queue_size = 0;
+static int bulk_drop_oldest = 0;
+static db_bulkq_t *bulk_q = NULL;
+
 struct tm_binds tmb;
 struct dlg_binds dlgb;
 
@@ -72,6 +80,7 @@ struct dlg_binds dlgb;
 static int mod_init(void);
 static int child_init(int rank);
 static void destroy(void);
+static void db_writer_process(int rank);
 
 static int fixup_trace_dialog(void** param, int param_no);
 
@@ -98,7 +107,8 @@ static struct mi_root* sip_trace_mi(struct mi_root* cmd, void* param );
 static struct mi_root* trace_to_database_mi(struct mi_root* cmd, void* param );
 
 static int trace_send_hep_duplicate(str *body, str *fromproto, str *fromip,
-		unsigned short fromport, str *toproto, str *toip, unsigned short toport);
+		unsigned short fromport, str *toproto, str *toip, unsigned short toport,
+		str *callid);
 static int pipport2su (str *sproto, str *ip, unsigned short port,
 			union sockaddr_union *tmp_su, unsigned int *proto);
 
@@ -130,6 +140,8 @@ int trace_to_database = 1;
 int hep_version = 1;
 int hep_capture_id = 1;
 int duplicate_with_hep = 0;
+/* percentage of the calls (by Call-ID) duplicated with HEP */
+int hep_sampling = 100;
 
 str    dup_uri_str      = {0, 0};
 struct sip_uri *dup_uri = 0;
@@ -203,9 +215,20 @@ static param_export_t params[] = {
 	{"duplicate_with_hep", INT_PARAM, &duplicate_with_hep   },
 	{"hep_version",        INT_PARAM, &hep_version          },
 	{"hep_capture_id",     INT_PARAM, &hep_capture_id  	},
+	{"bulk_queue_size",    INT_PARAM, &bulk_queue_size      },
+	{"bulk_drop_oldest",   INT_PARAM, &bulk_drop_oldest     },
+	{"hep_async_buf_size", INT_PARAM, &hep_async_buf_size   },
+	{"hep_compress",       INT_PARAM, &hep_compress         },
+	{"hep_sampling",       INT_PARAM, &hep_sampling         },
 	{0, 0, 0}
 };
 
+static proc_export_t procs[] = {
+	{"SIP trace DB writer",  0,  0, db_writer_process, 1, 0},
+	{"HEP sender",  hep_async_init,  0, hep_sender_process, 1, 0},
+	{0,0,0,0,0,0}
+};
+
 static mi_export_t mi_cmds[] = {
 	{ "sip_trace", 0, sip_trace_mi,   0,  0,  0 },
 	{ "trace_to_database", 0, trace_to_database_mi,   0,  0,  0 },
@@ -218,10 +241,27 @@ static mi_export_t mi_cmds[] = {
 
 stat_var* siptrace_req;
 stat_var* siptrace_rpl;
+stat_var* hep_sent;
+stat_var* hep_dropped;
+stat_var* hep_failed;
+
+static unsigned long get_bulk_queued(void *foo);
+static unsigned long get_bulk_dropped(void *foo);
+static unsigned long get_bulk_written(void *foo);
+static unsigned long get_bulk_failed(void *foo);
+static unsigned long get_bulk_queue_load(void *foo);
 
 static stat_export_t siptrace_stats[] = {
 	{"traced_requests" ,  0,  &siptrace_req  },
 	{"traced_replies"  ,  0,  &siptrace_rpl  },
+	{"bulk_queued"     ,  STAT_IS_FUNC, (stat_var**)get_bulk_queued },
+	{"bulk_dropped"    ,  STAT_IS_FUNC, (stat_var**)get_bulk_dropped },
+	{"bulk_written"    ,  STAT_IS_FUNC, (stat_var**)get_bulk_written },
+	{"bulk_failed"     ,  STAT_IS_FUNC, (stat_var**)get_bulk_failed },
+	{"bulk_queue_load" ,  STAT_IS_FUNC, (stat_var**)get_bulk_queue_load },
+	{"hep_sent"        ,  0,  &hep_sent     },
+	{"hep_dropped"     ,  0,  &hep_dropped  },
+	{"hep_failed"      ,  0,  &hep_failed   },
 	{0,0,0}
 };
 #endif
@@ -255,7 +295,7 @@ struct module_exports exports = {
 #endif
 	mi_cmds,    /* exported MI functions */
 	0,          /* exported pseudo-variables */
-	0,          /* extra processes */
+	procs,      /* extra processes */
 	mod_init,   /* module initialization function */
 	0,          /* response function */
 	destroy,    /* destroy function */
@@ -432,8 +472,20 @@ static int mod_init(void)
 
 		db_funcs.close(db_con);
 		db_con = 0;
+
+		if (bulk_queue_size) {
+			bulk_q = db_bulkq_new(bulk_queue_size, NR_KEYS, bulk_drop_oldest);
+			if (bulk_q == NULL)
+				return -1;
+			if (query_buffer_size <= 1)
+				LM_NOTICE("query_buffer_size is not set, the DB writer will "
+					"insert the traces one by one\n");
+		}
 	}
 
+	/* the DB writer is needed only if the rows are queued */
+	procs[0].no = bulk_q ? 1 : 0;
+
 	trace_on_flag = (int*)shm_malloc(sizeof(int));
 	if(trace_on_flag==NULL)
 	{
@@ -481,12 +533,22 @@ static int mod_init(void)
 		return -1;
 	}
 
-	if(hep_version != 1 && hep_version != 2) {
+	if(hep_version != 1 && hep_version != 2 && hep_version != 3) {
 
                 LM_ERR("unsupported version of HEP");
                 return -1;
 	}
 
+	if(hep_compress && hep_version != 3) {
+		LM_WARN("only HEPv3 payloads can be compressed\n");
+		hep_compress = 0;
+	}
+
+	if(hep_sampling < 1 || hep_sampling > 100) {
+		LM_ERR("hep_sampling must be a percentage, between 1 and 100\n");
+		return -1;
+	}
+
 	if(dup_uri_str.s!=0) {
 		dup_uri_str.len = strlen(dup_uri_str.s);
 		dup_uri = (struct sip_uri *)pkg_malloc(sizeof(struct sip_uri));
@@ -501,6 +563,9 @@ static int mod_init(void)
 		}
 	}
 
+	/* the HEP sender is needed only for asynchronous HEP duplication */
+	procs[1].no = (duplicate_with_hep && dup_uri && hep_async_buf_size) ? 1 : 0;
+
 	if(traced_user_avp_str.s && traced_user_avp_str.len > 0)
 	{
 		if (pv_parse_spec(&traced_user_avp_str, &avp_spec)==0
@@ -580,17 +645,47 @@ static int mod_init(void)
 	return 0;
 }
 
-static inline int insert_siptrace_flag(struct sip_msg *msg,
+static int siptrace_db_insert(str *table, db_val_t *vals)
+{
+	db_funcs.use_table(db_con, table);
+
+	if (con_set_inslist(&db_funcs,db_con,&ins_list,db_keys,NR_KEYS) < 0 )
+		CON_RESET_INSLIST(db_con);
+	CON_PS_REFERENCE(db_con) = &siptrace_ps;
+
+	return db_funcs.insert(db_con, db_keys, vals, NR_KEYS);
+}
+
+static void siptrace_db_flush(void)
+{
+	if (ins_list == NULL)
+		return;
+
+	db_funcs.use_table(db_con, &ins_list->table);
+	if (ql_flush_rows(&db_funcs, db_con, ins_list) < 0)
+		LM_ERR("failed to flush the traces to DB\n");
+}
+
+/* stores a row now or queues it for the DB writer */
+static inline int siptrace_insert(str *table, db_key_t *keys, db_val_t *vals)
+{
+	if (bulk_q)
+		return db_bulkq_push(bulk_q, table, vals) < 0 ? -1 : 0;
+
+	if (con_set_inslist(&db_funcs,db_con,&ins_list,keys,NR_KEYS) < 0 )
+		CON_RESET_INSLIST(db_con);
+	CON_PS_REFERENCE(db_con) = &siptrace_ps;
+	return db_funcs.insert(db_con, keys, vals, NR_KEYS);
+}
+
+static inline int insert_siptrace_flag(struct sip_msg *msg, str *table,
 		db_key_t *keys,db_val_t *vals)
 {
 	db_vals[13].val.str_val.s   = "";
 	db_vals[13].val.str_val.len = 0;
 
 	LM_DBG("storing info 1...\n");
-	if (con_set_inslist(&db_funcs,db_con,&ins_list,keys,NR_KEYS) < 0 )
-		CON_RESET_INSLIST(db_con);
-	CON_PS_REFERENCE(db_con) = &siptrace_ps;
-	if(db_funcs.insert(db_con, keys, vals, NR_KEYS) < 0)
+	if(siptrace_insert(table, keys, vals) < 0)
 	{
 			LM_ERR("error storing trace\n");
 		return -1;
@@ -599,7 +694,7 @@ static inline int insert_siptrace_flag(struct sip_msg *msg,
 	return 0;
 }
 
-static inline int insert_siptrace_avp(struct usr_avp *avp,
+static inline int insert_siptrace_avp(struct usr_avp *avp, str *table,
 		int_str *first_val,db_key_t *keys,db_val_t *vals)
 {
 	int_str        avp_value;
@@ -618,10 +713,7 @@ static inline int insert_siptrace_avp(struct usr_avp *avp,
 	db_vals[13].val.str_val.len = avp_value.s.len;
 
 	LM_DBG("storing info 14...\n");
-	CON_PS_REFERENCE(db_con) = &siptrace_ps;
-	if (con_set_inslist(&db_funcs,db_con,&ins_list,keys,NR_KEYS) < 0 )
-		CON_RESET_INSLIST(db_con);
-	if(db_funcs.insert(db_con, keys, vals, NR_KEYS) < 0) {
+	if(siptrace_insert(table, keys, vals) < 0) {
 		LM_ERR("error storing trace\n");
 		return -1;
 	}
@@ -635,10 +727,7 @@ static inline int insert_siptrace_avp(struct usr_avp *avp,
 		db_vals[13].val.str_val.len = avp_value.s.len;
 
 		LM_DBG("### - storing info 14 \n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if (con_set_inslist(&db_funcs,db_con,&ins_list,keys,NR_KEYS) < 0 )
-			CON_RESET_INSLIST(db_con);
-		if(db_funcs.insert(db_con, keys, vals, NR_KEYS) < 0)
+		if(siptrace_insert(table, keys, vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			return -1;
@@ -669,11 +758,13 @@ static inline str* siptrace_get_table(void)
 static int save_siptrace(struct sip_msg *msg,struct usr_avp *avp,
 		int_str *first_val,db_key_t *keys,db_val_t *vals)
 {
+	str *table;
 
 	if (duplicate_with_hep)
 		trace_send_hep_duplicate(&db_vals[0].val.blob_val, &db_vals[4].val.str_val,
 				&db_vals[5].val.str_val, db_vals[6].val.int_val, &db_vals[7].val.str_val,
-				&db_vals[8].val.str_val, db_vals[9].val.int_val);
+				&db_vals[8].val.str_val, db_vals[9].val.int_val,
+				&db_vals[1].val.str_val);
 	else
 		trace_send_duplicate(db_vals[0].val.blob_val.s,
 			db_vals[0].val.blob_val.len);
@@ -681,15 +772,18 @@ static int save_siptrace(struct sip_msg *msg,struct usr_avp *avp,
 
 	if(trace_to_database_flag!=NULL && *trace_to_database_flag!=0) {
 		LM_DBG("saving siptrace\n");
-		db_funcs.use_table(db_con, siptrace_get_table());
+		table = siptrace_get_table();
+		if (bulk_q == NULL)
+			db_funcs.use_table(db_con, table);
 
-		if (flag_trace_is_set(msg) && insert_siptrace_flag(msg,keys,vals) < 0)
+		if (flag_trace_is_set(msg) &&
+		insert_siptrace_flag(msg,table,keys,vals) < 0)
 			return -1;
 
 		if (avp==NULL)
 			return 0;
 
-		if (insert_siptrace_avp(avp,first_val,keys,vals) < 0)
+		if (insert_siptrace_avp(avp,table,first_val,keys,vals) < 0)
 			return -1;
 	}
 
@@ -713,6 +807,22 @@ static int child_init(int rank)
 }
 
 
+static void db_writer_process(int rank)
+{
+	db_con = db_funcs.init(&db_url);
+	if (!db_con)
+	{
+		LM_ERR("unable to connect database\n");
+		return;
+	}
+
+	db_bulkq_writer(bulk_q, siptrace_db_insert, siptrace_db_flush);
+
+	db_funcs.close(db_con);
+	db_con = NULL;
+}
+
+
 static void destroy(void)
 {
 	if(trace_to_database_flag!=NULL && *trace_to_database_flag!=0) {
@@ -721,7 +831,37 @@ static void destroy(void)
 		if (trace_on_flag)
 			shm_free(trace_on_flag);
 	}
+
+	db_bulkq_destroy(bulk_q);
+}
+
+
+#ifdef STATISTICS
+static unsigned long get_bulk_queued(void *foo)
+{
+	return bulk_q ? bulk_q->queued : 0;
+}
+
+static unsigned long get_bulk_dropped(void *foo)
+{
+	return bulk_q ? bulk_q->dropped : 0;
+}
+
+static unsigned long get_bulk_written(void *foo)
+{
+	return bulk_q ? bulk_q->written : 0;
+}
+
+static unsigned long get_bulk_failed(void *foo)
+{
+	return bulk_q ? bulk_q->failed : 0;
+}
+
+static unsigned long get_bulk_queue_load(void *foo)
+{
+	return bulk_q ? db_bulkq_load(bulk_q) : 0;
 }
+#endif
 
 
 static str* generate_val_name(unsigned char n)
@@ -1774,23 +1914,168 @@ static int trace_send_duplicate(char *buf, int len)
 	return ret;
 }
 
+/* length of the HEP packet carrying "body" */
+static unsigned int hep_pkt_len(int family, str *body)
+{
+	unsigned int len;
+
+	if (hep_version == 3) {
+		len = HEP3_HDR_LEN
+			+ 2 * (HEP3_CHUNK_HDR_LEN + 1)      /* family, proto */
+			+ 2 * HEP3_CHUNK_HDR_LEN            /* src, dst addr */
+			+ 2 * (HEP3_CHUNK_HDR_LEN + 2)      /* src, dst port */
+			+ 2 * (HEP3_CHUNK_HDR_LEN + 4)      /* timestamp */
+			+ HEP3_CHUNK_HDR_LEN + 1            /* proto type */
+			+ HEP3_CHUNK_HDR_LEN + 4            /* capture id */
+			+ HEP3_CHUNK_HDR_LEN + body->len;   /* payload */
+		len += (family == AF_INET) ?
+			2 * sizeof(struct in_addr) : 2 * sizeof(struct in6_addr);
+		return len;
+	}
+
+	len = sizeof(struct hep_hdr) + body->len;
+	len += (family == AF_INET) ?
+		sizeof(struct hep_iphdr) : sizeof(struct hep_ip6hdr);
+	if (hep_version == 2)
+		len += sizeof(struct hep_timehdr);
+	return len;
+}
+
+static inline char *hep3_chunk(char *p, unsigned short type,
+		const void *data, unsigned short len)
+{
+	unsigned short u;
+
+	u = htons(0);   /* generic chunk, no vendor */
+	memcpy(p, &u, 2);
+	u = htons(type);
+	memcpy(p + 2, &u, 2);
+	u = htons(HEP3_CHUNK_HDR_LEN + len);
+	memcpy(p + 4, &u, 2);
+	memcpy(p + HEP3_CHUNK_HDR_LEN, data, len);
+
+	return p + HEP3_CHUNK_HDR_LEN + len;
+}
+
+/*
+ * Encodes the HEP packet in "buf" (of hep_pkt_len() bytes). For HEPv3,
+ * "payload" is set to the offset of the payload chunk.
+ */
+static void hep_pkt_build(char *buf, unsigned int len,
+		union sockaddr_union *from_su, union sockaddr_union *to_su,
+		unsigned int proto, struct timeval *tvb, str *body,
+		unsigned int *payload)
+{
+	struct hep_hdr hdr;
+	struct hep_timehdr hep_time;
+	unsigned int u32;
+	unsigned short u16;
+	unsigned char u8;
+	char *p;
+
+	if (hep_version == 3) {
+		memcpy(buf, "HEP3", 4);
+		u16 = htons(len);
+		memcpy(buf + 4, &u16, 2);
+		p = buf + HEP3_HDR_LEN;
+
+		u8 = from_su->s.sa_family;
+		p = hep3_chunk(p, HEP3_IP_FAMILY, &u8, 1);
+		u8 = proto;
+		p = hep3_chunk(p, HEP3_IP_PROTO, &u8, 1);
+
+		if (from_su->s.sa_family == AF_INET) {
+			p = hep3_chunk(p, HEP3_IPV4_SRC, &from_su->sin.sin_addr,
+				sizeof(struct in_addr));
+			p = hep3_chunk(p, HEP3_IPV4_DST, &to_su->sin.sin_addr,
+				sizeof(struct in_addr));
+			/* already in network byte order */
+			p = hep3_chunk(p, HEP3_SRC_PORT, &from_su->sin.sin_port, 2);
+			p = hep3_chunk(p, HEP3_DST_PORT, &to_su->sin.sin_port, 2);
+		} else {
+			p = hep3_chunk(p, HEP3_IPV6_SRC, &from_su->sin6.sin6_addr,
+				sizeof(struct in6_addr));
+			p = hep3_chunk(p, HEP3_IPV6_DST, &to_su->sin6.sin6_addr,
+				sizeof(struct in6_addr));
+			p = hep3_chunk(p, HEP3_SRC_PORT, &from_su->sin6.sin6_port, 2);
+			p = hep3_chunk(p, HEP3_DST_PORT, &to_su->sin6.sin6_port, 2);
+		}
+
+		u32 = htonl(tvb->tv_sec);
+		p = hep3_chunk(p, HEP3_TS_SEC, &u32, 4);
+		u32 = htonl(tvb->tv_usec);
+		p = hep3_chunk(p, HEP3_TS_USEC, &u32, 4);
+		u8 = HEP3_PROTO_SIP;
+		p = hep3_chunk(p, HEP3_PROTO_TYPE, &u8, 1);
+		u32 = htonl(hep_capture_id);
+		p = hep3_chunk(p, HEP3_CAPTURE_ID, &u32, 4);
+
+		/* the payload goes last, so that it can be compressed in place */
+		*payload = p - buf;
+		hep3_chunk(p, HEP3_PAYLOAD, body->s, body->len);
+		return;
+	}
+
+	*payload = 0;
+
+	/* Version && proto && length */
+	hdr.hp_v = hep_version;
+	/* in hep header we need standard library format IPPROTO_* which is set
+	 * by pipport2su() function */
+	hdr.hp_p = proto;
+	hdr.hp_f = from_su->s.sa_family;
+	p = buf + sizeof(struct hep_hdr);
+
+	if (from_su->s.sa_family == AF_INET) {
+		hdr.hp_l = sizeof(struct hep_hdr) + sizeof(struct hep_iphdr);
+		hdr.hp_sport = htons(from_su->sin.sin_port);
+		hdr.hp_dport = htons(to_su->sin.sin_port);
+
+		memcpy(p, &from_su->sin.sin_addr, sizeof(struct in_addr));
+		memcpy(p + sizeof(struct in_addr), &to_su->sin.sin_addr,
+			sizeof(struct in_addr));
+		p += sizeof(struct hep_iphdr);
+	} else {
+		hdr.hp_l = sizeof(struct hep_hdr) + sizeof(struct hep_ip6hdr);
+		hdr.hp_sport = htons(from_su->sin6.sin6_port);
+		hdr.hp_dport = htons(to_su->sin6.sin6_port);
+
+		memcpy(p, &from_su->sin6.sin6_addr, sizeof(struct in6_addr));
+		memcpy(p + sizeof(struct in6_addr), &to_su->sin6.sin6_addr,
+			sizeof(struct in6_addr));
+		p += sizeof(struct hep_ip6hdr);
+	}
+
+	memcpy(buf, &hdr, sizeof(struct hep_hdr));
+
+	if (hep_version == 2) {
+		memset(&hep_time, 0, sizeof(struct hep_timehdr));
+		hep_time.tv_sec = tvb->tv_sec;
+		hep_time.tv_usec = tvb->tv_usec;
+		hep_time.captid = hep_capture_id;
+
+		memcpy(p, &hep_time, sizeof(struct hep_timehdr));
+		p += sizeof(struct hep_timehdr);
+	}
+
+	/* PAYLOAD */
+	memcpy(p, body->s, body->len);
+}
+
 static int trace_send_hep_duplicate(str *body, str *fromproto, str *fromip,
-		unsigned short fromport, str *toproto, str *toip, unsigned short toport)
+		unsigned short fromport, str *toproto, str *toip, unsigned short toport,
+		str *callid)
 {
 	struct proxy_l * p=NULL /* make gcc happy */;
-	void* buffer = NULL;
+	char* buffer = NULL;
+	char* pkt;
 	int ret;
 	union sockaddr_union from_su;
 	union sockaddr_union to_su;
-	unsigned int len, buflen, proto;
+	unsigned int len, pkt_len, proto, payload;
 	struct socket_info* send_sock;
 	union sockaddr_union* to = NULL;
-	struct hep_hdr hdr;
-	struct hep_iphdr hep_ipheader;
-	struct hep_timehdr hep_time;
 	struct timeval tvb;
-	struct timezone tz;
-	struct hep_ip6hdr hep_ip6header;
 
 	if(body->s==NULL || body->len <= 0)
 		return -1;
@@ -1798,18 +2083,10 @@ static int trace_send_hep_duplicate(str *body, str *fromproto, str *fromip,
 	if(dup_uri_str.s==0 || dup_uri==NULL)
 		return 0;
 
-	gettimeofday( &tvb, &tz );
-
-	/* message length */
-	len = body->len
-		+ sizeof(struct hep_ip6hdr)
-		+ sizeof(struct hep_hdr) + sizeof(struct hep_timehdr);
-
-
-	/* The packet is too big for us */
-	if (len>BUF_SIZE){
-		goto error;
-	}
+	/* sampling is done per call, so that the dialogs are complete */
+	if (hep_sampling < 100 && callid && callid->s &&
+	core_hash(callid, NULL, 0) % 100 >= (unsigned int)hep_sampling)
+		return 0;
 
 	/* Convert proto:ip:port to sockaddress union SRC IP */
 	if (pipport2su(fromproto, fromip, fromport, &from_su, &proto)==-1 ||
@@ -1822,113 +2099,75 @@ static int trace_send_hep_duplicate(str *body, str *fromproto, str *fromip,
 		goto error;
 	}
 
-
-	/* create a temporary proxy*/
-	p=mk_proxy(&dup_uri->host, (dup_uri->port_no)?dup_uri->port_no:SIP_PORT, PROTO_UDP, 0);
-	if (p==0){
-		LM_ERR("bad host name in uri\n");
-		return -1;
-	}
-
-	to=(union sockaddr_union*)pkg_malloc(sizeof(union sockaddr_union));
-	if (to==0){
-		LM_ERR("out of pkg memory\n");
-		return -1;
+	if (from_su.s.sa_family!=AF_INET && from_su.s.sa_family!=AF_INET6) {
+		LM_ERR("ERROR: trace_send_hep_duplicate: Unsupported protocol family\n");
+		goto error;
 	}
 
-	hostent2su(to, &p->host, p->addr_idx, (p->port)?p->port:SIP_PORT);
-
-	/* Version && proto && length */
-	hdr.hp_l = sizeof(struct hep_hdr);
-	hdr.hp_v = hep_version;
-
-	/* set proto to PROTO_UDP after we set the proto in HEP header;
-	 * in hep header we need standard library format IPPROTO_* which is set by
-	 * pipport2su() function */
-	hdr.hp_p = proto;
-	proto = PROTO_UDP;
+	gettimeofday(&tvb, NULL);
 
-	/* AND the last */
-	if (from_su.s.sa_family==AF_INET){
-		/* prepare the hep headers */
-
-		hdr.hp_f = AF_INET;
-		hdr.hp_sport = htons(from_su.sin.sin_port);
-		hdr.hp_dport = htons(to_su.sin.sin_port);
-
-		hep_ipheader.hp_src = from_su.sin.sin_addr;
-		hep_ipheader.hp_dst = to_su.sin.sin_addr;
+	/* message length */
+	len = hep_pkt_len(from_su.s.sa_family, body);
 
-		len = sizeof(struct hep_iphdr);
+	/* The packet is too big for us */
+	if (len>BUF_SIZE || (hep_version==3 && len>HEP3_MAX_LEN)){
+		goto error;
 	}
-	else if (from_su.s.sa_family==AF_INET6){
-		/* prepare the hep6 headers */
 
-		hdr.hp_f = AF_INET6;
-
-		hdr.hp_sport = htons(from_su.sin6.sin6_port);
-		hdr.hp_dport = htons(to_su.sin6.sin6_port);
-
-		hep_ip6header.hp6_src = from_su.sin6.sin6_addr;
-		hep_ip6header.hp6_dst = to_su.sin6.sin6_addr;
-
-		len = sizeof(struct hep_ip6hdr);
-	}
-	else {
-		LM_ERR("ERROR: trace_send_hep_duplicate: Unsupported protocol family\n");
-		goto error;;
+	if (hep_async_on()) {
+		/* encode straight into the ring, the HEP sender does the rest */
+		buffer = hep_ring_reserve(len);
+		if (buffer==NULL) {
+			update_stat(hep_dropped, 1);
+			return -1;
+		}
+		hep_pkt_build(buffer, len, &from_su, &to_su, proto, &tvb, body,
+			&payload);
+		hep_ring_commit(len, payload);
+		return 0;
 	}
 
-	hdr.hp_l +=len;
-	len += (sizeof(struct hep_hdr)+sizeof(struct hep_timehdr)+body->len);
-	buffer = (void *)pkg_malloc(len+1);
+	buffer = pkg_malloc(len);
 	if (buffer==0){
 		LM_ERR("ERROR: trace_send_hep_duplicate: out of memory\n");
 		goto error;
 	}
+	hep_pkt_build(buffer, len, &from_su, &to_su, proto, &tvb, body, &payload);
 
-	/* Copy job */
-	memset(buffer, '\0', len+1);
-
-	/* copy hep_hdr */
-	memcpy((void*)buffer, &hdr, sizeof(struct hep_hdr));
-	buflen = sizeof(struct hep_hdr);
-
-	/* hep_ip_hdr */
-	if(from_su.s.sa_family==AF_INET) {
-		memcpy((void*)buffer + buflen, &hep_ipheader, sizeof(struct hep_iphdr));
-		buflen += sizeof(struct hep_iphdr);
-	}
-	else {
-		memcpy((void*)buffer+buflen, &hep_ip6header, sizeof(struct hep_ip6hdr));
-		buflen += sizeof(struct hep_ip6hdr);
+	pkt = buffer;
+	pkt_len = len;
+	if (hep_compress &&
+	hep3_compress(buffer, len, payload, &pkt, &pkt_len)<0) {
+		pkt = buffer;
+		pkt_len = len;
 	}
 
-	if(hep_version == 2) {
-
-		hep_time.tv_sec = tvb.tv_sec;
-		hep_time.tv_usec = tvb.tv_usec;
-		hep_time.captid = hep_capture_id;
+	/* create a temporary proxy*/
+	p=mk_proxy(&dup_uri->host, (dup_uri->port_no)?dup_uri->port_no:SIP_PORT, PROTO_UDP, 0);
+	if (p==0){
+		LM_ERR("bad host name in uri\n");
+		goto error;
+	}
 
-		memcpy((void*)buffer+buflen, &hep_time, sizeof(struct hep_timehdr));
-		buflen += sizeof(struct hep_timehdr);
+	to=(union sockaddr_union*)pkg_malloc(sizeof(union sockaddr_union));
+	if (to==0){
+		LM_ERR("out of pkg memory\n");
+		goto error;
 	}
 
-	/* PAYLOAD */
-	memcpy((void*)(buffer + buflen) , (void*)body->s, body->len);
-	buflen +=body->len;
+	hostent2su(to, &p->host, p->addr_idx, (p->port)?p->port:SIP_PORT);
 
 	ret = -1;
 
 	do {
-		send_sock=get_send_socket(0, to, proto);
+		send_sock=get_send_socket(0, to, PROTO_UDP);
 		if (send_sock==0){
 			LM_ERR("can't forward to af %d, proto %d no corresponding listening socket\n",
-					to->s.sa_family,proto);
+					to->s.sa_family,PROTO_UDP);
 			continue;
 		}
 
-		if (msg_send(send_sock, proto, to, 0, buffer, buflen, NULL)<0){
+		if (msg_send(send_sock, PROTO_UDP, to, 0, pkt, pkt_len, NULL)<0){
 			LM_ERR("cannot send duplicate message\n");
 			continue;
 		}
@@ -1936,6 +2175,11 @@ static int trace_send_hep_duplicate(str *body, str *fromproto, str *fromip,
 		break;
 	}while( get_next_su( p, to, 0)==0 );
 
+	if (ret==0)
+		update_stat(hep_sent, 1);
+	else
+		update_stat(hep_failed, 1);
+
 	free_proxy(p); /* frees only p content, not p itself */
 	pkg_free(p);
 	pkg_free(buffer);
@@ -34,6 +34,13 @@
 /* always use a power of 2 for hash table size */
 #define tm_hash( s1, s2 )     core_hash( &s1, &s2, TM_TABLE_ENTRIES)
 
+/* default size of the transaction ID (branch based) index - a power of 2;
+ * it may be changed with the "tid_hash_size" module parameter */
+#define TM_TID_ENTRIES       (1<<12)
+
+/* max number of locks protecting the transaction ID index - a power of 2 */
+#define TM_TID_LOCKS         512
+
 /* maximum length of localy generated acknowledgment */
 #define MAX_ACK_LEN   1024
 
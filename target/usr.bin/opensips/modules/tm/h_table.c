@@ -66,6 +66,11 @@ static struct s_table*  tm_table;
 
 int syn_branch = 1;
 
+/* size of each table of the transaction ID index - rounded up to a power
+ * of 2 at startup */
+int tid_hash_size = TM_TID_ENTRIES;
+unsigned int tid_hash_bits;
+
 
 void reset_kr(void)
 {
@@ -95,6 +100,18 @@ void unlock_hash(int i)
 }
 
 
+void lock_tid(unsigned int h)
+{
+	lock_set_get(tm_table->tid_locks, h & (tm_table->tid_locks_no-1));
+}
+
+
+void unlock_tid(unsigned int h)
+{
+	lock_set_release(tm_table->tid_locks, h & (tm_table->tid_locks_no-1));
+}
+
+
 struct s_table* get_tm_table(void)
 {
 	return tm_table;
@@ -381,6 +398,12 @@ void free_hash_table(void)
 				free_cell( p_cell );
 			}
 		}
+		if (tm_table->tid_entrys[0])
+			shm_free(tm_table->tid_entrys[0]);
+		if (tm_table->tid_locks) {
+			lock_set_destroy(tm_table->tid_locks);
+			lock_set_dealloc(tm_table->tid_locks);
+		}
 		shm_free(tm_table);
 	}
 }
@@ -410,6 +433,45 @@ struct s_table* init_hash_table( unsigned int timer_sets )
 		tm_table->entrys[i].next_label = rand();
 	}
 
+	/* the transaction ID index - a power of 2 (of at least 16 entries),
+	 * so that the hashes may be just shifted or masked */
+	for( tid_hash_bits=4 ; tid_hash_bits<31 &&
+	(1U<<tid_hash_bits)<(unsigned int)tid_hash_size ; tid_hash_bits++ );
+	if (tid_hash_size!=(1<<tid_hash_bits)) {
+		LM_INFO("transaction ID index size rounded up from %d to %d\n",
+			tid_hash_size, 1<<tid_hash_bits);
+		tid_hash_size = 1<<tid_hash_bits;
+	}
+	tm_table->tid_entrys[0] = (struct tid_entry*)shm_malloc(
+		TM_TID_TYPES * tid_hash_size * sizeof(struct tid_entry));
+	if (tm_table->tid_entrys[0]==0) {
+		LM_ERR("no more share memory for the transaction ID index\n");
+		goto error;
+	}
+	memset( tm_table->tid_entrys[0], 0,
+		TM_TID_TYPES * tid_hash_size * sizeof(struct tid_entry));
+	for( i=1 ; i<TM_TID_TYPES ; i++ )
+		tm_table->tid_entrys[i] = tm_table->tid_entrys[i-1] + tid_hash_size;
+
+	/* locks for the transaction ID index - as the number of locks may
+	 * be limited (e.g. sysv), get as many as possible */
+	for( i=TM_TID_LOCKS ; i ; i>>=1 ) {
+		if ( (tm_table->tid_locks=lock_set_alloc(i))==0 ) {
+			LM_ERR("no more share memory\n");
+			goto error;
+		}
+		if ( lock_set_init(tm_table->tid_locks)!=0 )
+			break;
+		lock_set_dealloc(tm_table->tid_locks);
+		tm_table->tid_locks = 0;
+	}
+	if (tm_table->tid_locks==0) {
+		LM_ERR("failed to init the transaction ID index locks\n");
+		goto error;
+	}
+	tm_table->tid_locks_no = i;
+	LM_DBG("using %d locks for the transaction ID index\n", i);
+
 	return  tm_table;
 
 error:
@@ -417,6 +479,75 @@ error:
 }
 
 
+/* links the cell into the given table of the transaction ID index */
+static inline void tid_link_cell(struct cell *p_cell,
+								enum tid_index_type type, unsigned int h)
+{
+	struct tid_entry *p_entry = &tm_table->tid_entrys[type][h];
+	struct tid_link *l = &p_cell->tid[type];
+
+	l->hash = h;
+	l->prev = 0;
+
+	lock_tid(h);
+	l->next = p_entry->first_cell;
+	if (p_entry->first_cell)
+		p_entry->first_cell->tid[type].prev = p_cell;
+	p_entry->first_cell = p_cell;
+	p_entry->cur_entries++;
+	l->linked = 1;
+	unlock_tid(h);
+}
+
+
+static inline void tid_unlink_cell(struct cell *p_cell,
+												enum tid_index_type type)
+{
+	struct tid_link *l = &p_cell->tid[type];
+	struct tid_entry *p_entry;
+
+	if (!l->linked)
+		return;
+	p_entry = &tm_table->tid_entrys[type][l->hash];
+
+	lock_tid(l->hash);
+	if (l->prev)
+		l->prev->tid[type].next = l->next;
+	else
+		p_entry->first_cell = l->next;
+	if (l->next)
+		l->next->tid[type].prev = l->prev;
+	p_entry->cur_entries--;
+	l->linked = 0;
+	unlock_tid(l->hash);
+}
+
+
+/* adds the cell to the transaction ID index; must be called after the
+ * cell got its label */
+static inline void tid_index_cell(struct cell *p_cell)
+{
+	struct via_param *branch;
+	str tid;
+
+	/* in-transaction requests are matched on the tid of the request the
+	 * transaction was created for, if RFC 3261 compliant */
+	if (p_cell->uas.request && p_cell->uas.request->via1) {
+		branch = p_cell->uas.request->via1->branch;
+		if (branch && branch->value.s && branch->value.len>MCOOKIE_LEN
+		&& memcmp(branch->value.s, MCOOKIE, MCOOKIE_LEN)==0) {
+			tid.s = branch->value.s + MCOOKIE_LEN;
+			tid.len = branch->value.len - MCOOKIE_LEN;
+			tid_link_cell(p_cell, TM_TID_UAS, tid_uas_hash(&tid));
+		}
+	}
+
+	/* replies are matched on the key we put in the branches */
+	tid_link_cell(p_cell, TM_TID_UAC,
+		tid_uac_hash(p_cell->hash_index, p_cell->label, p_cell->md5));
+}
+
+
 /*  Takes an already created cell and links it into hash table on the
  *  appropriate entry. */
 void insert_into_hash_table_unsafe( struct cell * p_cell, unsigned int _hash )
@@ -437,6 +568,8 @@ void insert_into_hash_table_unsafe( struct cell * p_cell, unsigned int _hash )
 
 	p_entry->last_cell = p_cell;
 
+	tid_index_cell(p_cell);
+
 	/* update stats */
 	p_entry->cur_entries++;
 	p_entry->acc_entries++;
@@ -458,6 +591,9 @@ void remove_from_hash_table_unsafe( struct cell * p_cell)
 		p_cell->next_cell->prev_cell = p_cell->prev_cell;
 	else
 		p_entry->last_cell = p_cell->prev_cell;
+
+	tid_unlink_cell(p_cell, TM_TID_UAS);
+	tid_unlink_cell(p_cell, TM_TID_UAC);
 # ifdef EXTRA_DEBUG
 	if (p_entry->cur_entries==0) {
 		LM_CRIT("bad things happened: cur_entries=0\n");
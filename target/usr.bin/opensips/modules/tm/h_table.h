@@ -64,6 +64,15 @@ void lock_hash(int i);
 void unlock_hash(int i);
 
 
+/* the transaction ID index: besides their hash entry (Call-ID and CSeq
+ * based), transactions are also hashed on the RFC 3261 transaction ID (the
+ * branch value after the magic cookie) of the request they were created
+ * for (TM_TID_UAS) and on the transaction key we put in the branch of the
+ * requests we send out (TM_TID_UAC). The index is used only to speed up
+ * the lookups - a transaction found in it is still checked against the
+ * message and it must live in the hash entry locked by the caller */
+enum tid_index_type { TM_TID_UAS=0, TM_TID_UAC, TM_TID_TYPES };
+
 #define NO_CANCEL       ( (char*) 0 )
 #define EXTERNAL_CANCEL ( (char*) -1)
 
@@ -213,6 +222,13 @@ typedef struct cell
 	/* linking data */
 	struct cell*     next_cell;
 	struct cell*     prev_cell;
+	/* linking data in the transaction ID index */
+	struct tid_link {
+		struct cell*  next;
+		struct cell*  prev;
+		unsigned int  hash;
+		unsigned int  linked;
+	} tid[TM_TID_TYPES];
 	/* tells in which hash table entry the cell lives */
 	unsigned int  hash_index;
 	/* sequence number within hash collision slot */
@@ -315,11 +331,27 @@ typedef struct entry
 
 
 
+/* list of cells with the same transaction ID hash */
+struct tid_entry
+{
+	struct cell*    first_cell;
+	unsigned long   cur_entries;
+};
+
+
+
 /* transaction table */
 struct s_table
 {
 	/* table of hash entries; each of them is a list of synonyms  */
 	struct entry   entrys[ TM_TABLE_ENTRIES ];
+	/* the transaction ID index, one table of tid_hash_size entries per
+	 * index type */
+	struct tid_entry *tid_entrys[ TM_TID_TYPES ];
+	/* locks of the transaction ID index, shared by all its tables; they
+	 * are always taken after the lock of the hash entry */
+	gen_lock_set_t* tid_locks;
+	unsigned int   tid_locks_no;
 	/* we keep it here just as a shortcut, we need it for assigning
 	 * a transaction to a specific timer set */
 	unsigned short timer_sets;
@@ -358,6 +390,8 @@ struct s_table
 
 
 extern int syn_branch;
+extern int tid_hash_size;
+extern unsigned int tid_hash_bits;
 extern int fr_timeout;
 extern int fr_inv_timeout;
 extern int tm_timer_shift;
@@ -380,6 +414,34 @@ void   insert_into_hash_table_unsafe( struct cell * p_cell, unsigned int _hash )
 
 unsigned int transaction_count( void );
 
+void lock_tid(unsigned int h);
+void unlock_tid(unsigned int h);
+
+/* hash of an RFC 3261 transaction ID, in the TM_TID_UAS table */
+static inline unsigned int tid_uas_hash(str *tid)
+{
+	return core_hash( tid, 0, tid_hash_size);
+}
+
+/* hash of the transaction key used in our branches, in the TM_TID_UAC
+ * table - the label if syn_branch is on, the MD5 value otherwise */
+static inline unsigned int tid_uac_hash(unsigned int hash_index,
+										unsigned int label, char *md5)
+{
+	str s;
+	unsigned int h;
+
+	if (syn_branch) {
+		h = label;
+	} else {
+		s.s = md5;
+		s.len = MD5_LEN;
+		h = core_hash( &s, 0, 0);
+	}
+	h = (h ^ (hash_index * 0x9e3779b1)) * 0x85ebca6b;
+	return h >> (32 - tid_hash_bits);
+}
+
 /* Unix socket variant */
 int unixsock_hash(str* msg);
 
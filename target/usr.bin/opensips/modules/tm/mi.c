@@ -634,6 +634,114 @@ error:
 }
 
 
+/* chain length intervals reported by "t_hash_stats" */
+#define MI_CHAIN_SLOTS 6
+static unsigned long chain_slot_max[MI_CHAIN_SLOTS] = {0, 1, 2, 4, 8, 0};
+static char *chain_slot_name[MI_CHAIN_SLOTS] =
+	{"chain_0", "chain_1", "chain_2", "chain_3_4", "chain_5_8", "chain_9_"};
+
+/* chain length histogram of a hash table, filled in one pass */
+struct chain_stats {
+	unsigned long slots[MI_CHAIN_SLOTS];
+	unsigned long buckets;
+	unsigned long total;
+	unsigned long used;
+	unsigned long max;
+};
+
+static inline void chain_stats_add(struct chain_stats *cs, unsigned long len)
+{
+	int j;
+
+	cs->buckets++;
+	cs->total += len;
+	if (len) cs->used++;
+	if (len>cs->max) cs->max = len;
+	for (j=0; j<MI_CHAIN_SLOTS-1 && len>chain_slot_max[j]; j++);
+	cs->slots[j]++;
+}
+
+static int mi_add_chain_stats(struct mi_node *rpl, char *name,
+													struct chain_stats *cs)
+{
+	struct mi_node *node;
+	struct mi_attr *attr;
+	char *p;
+	int j, l;
+
+	node = add_mi_node_child(rpl, 0, name, strlen(name), 0, 0);
+	if (node==NULL)
+		return -1;
+
+	p = int2str(cs->buckets, &l);
+	if (add_mi_attr(node, MI_DUP_VALUE, "buckets", 7, p, l)==NULL)
+		return -1;
+	p = int2str(cs->used, &l);
+	if (add_mi_attr(node, MI_DUP_VALUE, "used", 4, p, l)==NULL)
+		return -1;
+	p = int2str(cs->total, &l);
+	if (add_mi_attr(node, MI_DUP_VALUE, "cells", 5, p, l)==NULL)
+		return -1;
+	p = int2str(cs->max, &l);
+	if (add_mi_attr(node, MI_DUP_VALUE, "max_chain", 9, p, l)==NULL)
+		return -1;
+	/* average length of the non-empty chains, with 2 decimals */
+	attr = addf_mi_attr(node, 0, "avg_chain", 9, "%lu.%02lu",
+		cs->used ? cs->total/cs->used : 0,
+		cs->used ? (cs->total*100/cs->used)%100 : 0);
+	if (attr==NULL)
+		return -1;
+
+	for (j=0; j<MI_CHAIN_SLOTS; j++) {
+		p = int2str(cs->slots[j], &l);
+		if (add_mi_node_child(node, MI_DUP_VALUE, chain_slot_name[j],
+		strlen(chain_slot_name[j]), p, l)==NULL)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+  Syntax of "t_hash_stats" :
+    no nodes
+*/
+struct mi_root* mi_tm_hash_stats(struct mi_root* cmd_tree, void* param)
+{
+	static char *tid_name[TM_TID_TYPES] = {"tid_requests", "tid_replies"};
+	struct mi_root* rpl_tree;
+	struct s_table* tm_t;
+	struct chain_stats cs;
+	int i, t;
+
+	rpl_tree = init_mi_tree( 200, MI_OK_S, MI_OK_LEN);
+	if (rpl_tree==0)
+		return 0;
+	tm_t = get_tm_table();
+
+	/* the counters are read without locking - it is just a snapshot */
+	memset(&cs, 0, sizeof cs);
+	for (i=0; i<TM_TABLE_ENTRIES; i++)
+		chain_stats_add(&cs, tm_t->entrys[i].cur_entries);
+	if (mi_add_chain_stats(&rpl_tree->node, "hash_table", &cs)<0)
+		goto error;
+
+	for (t=0; t<TM_TID_TYPES; t++) {
+		memset(&cs, 0, sizeof cs);
+		for (i=0; i<tid_hash_size; i++)
+			chain_stats_add(&cs, tm_t->tid_entrys[t][i].cur_entries);
+		if (mi_add_chain_stats(&rpl_tree->node, tid_name[t], &cs)<0)
+			goto error;
+	}
+
+	return rpl_tree;
+error:
+	free_mi_tree(rpl_tree);
+	return init_mi_tree( 500, MI_INTERNAL_ERR_S, MI_INTERNAL_ERR_LEN);
+}
+
+
 /*
   Syntax of "t_reply" :
   code
@@ -279,6 +279,37 @@ static inline int via_matching( struct via_body *inv_via,
 }
 
 
+/* looks up in the transaction ID index the transaction of the current
+ * hash entry that the request (with the magic cookie in branch) belongs
+ * to; ACKs are not matched to transactions with 2xx replies */
+static inline struct cell* tid_matching( struct sip_msg *p_msg,
+		struct via_body *via1, enum request_method skip_method, int is_ack)
+{
+	struct cell *p_cell;
+	struct sip_msg *t_msg;
+	unsigned int h;
+
+	h = tid_uas_hash(&via1->tid);
+
+	lock_tid(h);
+	for ( p_cell = get_tm_table()->tid_entrys[TM_TID_UAS][h].first_cell;
+		p_cell; p_cell = p_cell->tid[TM_TID_UAS].next )
+	{
+		/* only the transactions of our (locked) entry are safe to use */
+		if (p_cell->hash_index!=p_msg->hash_index) continue;
+		t_msg=p_cell->uas.request;
+		if (skip_method & t_msg->REQ_METHOD) continue;
+		if (is_ack && p_cell->uas.status>=200 && p_cell->uas.status<300)
+			continue;
+		if (via_matching(t_msg->via1 /* inv via */, via1 /* ack */ ))
+			break;
+	}
+	unlock_tid(h);
+
+	return p_cell;
+}
+
+
 /* transaction matching a-la RFC-3261 using transaction ID in branch
    (the function assumes there is magic cookie in branch)
    It returns:
@@ -306,6 +337,21 @@ static int matching_3261( struct sip_msg *p_msg, struct cell **trans,
 	via1->tid.s=via1->branch->value.s+MCOOKIE_LEN;
 	via1->tid.len=via1->branch->value.len-MCOOKIE_LEN;
 
+	/* first look the transaction up by its tid */
+	p_cell = tid_matching(p_msg, via1, skip_method, is_ack);
+	if (p_cell) {
+		LM_DBG("RFC3261 transaction matched, tid=%.*s\n",
+			via1->tid.len, via1->tid.s);
+		*trans=p_cell;
+		return 1;
+	}
+	/* ACKs for 2xx replies have their own tid, they may be matched
+	 * only dialog-wise, walking the whole entry */
+	if (!is_ack) {
+		LM_DBG("RFC3261 transaction matching failed\n");
+		return 0;
+	}
+
 	for ( p_cell = get_tm_table()->entrys[p_msg->hash_index].first_cell;
 		p_cell; p_cell = p_cell->next_cell )
 	{
@@ -690,6 +736,7 @@ int t_reply_matching( struct sip_msg *p_msg , int *p_branch )
 	int hashl, branchl;
 	int scan_space;
 	struct cseq_body *cseq;
+	unsigned int tid_hash;
 
 	char *loopi;
 	int loopl;
@@ -774,8 +821,16 @@ int t_reply_matching( struct sip_msg *p_msg , int *p_branch )
 	   entry first */
 	LOCK_HASH(hash_index);
 
-	for (p_cell = get_tm_table()->entrys[hash_index].first_cell; p_cell;
-		p_cell=p_cell->next_cell) {
+	/* walk only the transactions with the same key in the tid index */
+	tid_hash = tid_uac_hash(hash_index, entry_label, loopi);
+	lock_tid(tid_hash);
+
+	for (p_cell = get_tm_table()->tid_entrys[TM_TID_UAC][tid_hash].first_cell;
+		p_cell; p_cell=p_cell->tid[TM_TID_UAC].next) {
+
+		/* only the transactions of the locked entry are safe to use */
+		if (p_cell->hash_index != hash_index)
+			continue;
 
 		/* first look if branch matches */
 		if (syn_branch) {
@@ -805,6 +860,7 @@ int t_reply_matching( struct sip_msg *p_msg , int *p_branch )
 		/* we passed all disqualifying factors .... the transaction has been
 		   matched !
 		*/
+		unlock_tid(tid_hash);
 		set_t(p_cell);
 		*p_branch = branch_id;
 		REF_UNSAFE( T );
@@ -836,6 +892,7 @@ int t_reply_matching( struct sip_msg *p_msg , int *p_branch )
 	} /* for cycle */
 
 	/* nothing found */
+	unlock_tid(tid_hash);
 	UNLOCK_HASH(hash_index);
 	LM_DBG("no matching transaction exists\n");
 
@@ -275,6 +275,8 @@ static param_export_t params[]={
 		&timer_partitions },
 	{ "auto_100trying",           INT_PARAM,
 		&auto_100trying },
+	{ "tid_hash_size",            INT_PARAM,
+		&tid_hash_size },
 	{0,0,0}
 };
 
@@ -319,6 +321,7 @@ static mi_export_t mi_cmds [] = {
 	{MI_TM_UAC,     0, mi_tm_uac_dlg,   MI_ASYNC_RPL_FLAG,  0,  0 },
 	{MI_TM_CANCEL,  0, mi_tm_cancel,    0,                  0,  0 },
 	{MI_TM_HASH,    0, mi_tm_hash,      MI_NO_INPUT_FLAG,   0,  0 },
+	{MI_TM_HASH_STATS, 0, mi_tm_hash_stats, MI_NO_INPUT_FLAG, 0,  0 },
 	{MI_TM_REPLY,   0, mi_tm_reply,     0,                  0,  0 },
 	{0,0,0,0,0,0}
 };
@@ -0,0 +1,425 @@
+/**
+ * Topology Hiding Module
+ *
+ * Copyright (C) 2016 OpenSIPS Foundation
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History
+ * -------
+ *  2016-10-19  binary Contact encoding, sealed with AES-256-GCM
+*/
+
+/*
+ * The binary info is:
+ *     version (1 byte) | IV (12 bytes) | sealed payload | tag (12 bytes)
+ * and the payload:
+ *     varint  socket index (0 - none)
+ *     varint  number of routes
+ *             [ flags (1 byte), varint length, route ] ...
+ *     flags (1 byte), varint length, Contact URI
+ * A route of the "<sip:...;lr>" form is kept without the brackets, the
+ * scheme and the lr param, all restored out of the flags.
+*/
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+
+#include "../../dprint.h"
+#include "../../mem/mem.h"
+#include "../../socket_info.h"
+#include "../../parser/parse_rr.h"
+#include "topo_hiding_bin.h"
+
+#define TH_BIN_VERSION  1
+#define TH_BIN_IV_LEN   12
+#define TH_BIN_TAG_LEN  12
+#define TH_BIN_OVERHEAD (1 + TH_BIN_IV_LEN + TH_BIN_TAG_LEN)
+/* max bytes of a varint holding an int */
+#define TH_VARINT_MAX   5
+
+/* route / contact flags */
+#define TH_F_SIP  (1<<0)   /* "sip:" scheme */
+#define TH_F_LR   (1<<1)   /* ";lr" param at the end */
+#define TH_F_NA   (1<<2)   /* "<...>" name-addr */
+
+int th_ct_enc_scheme = TH_CT_ENC_XOR;
+
+static unsigned char th_key[32];
+
+/* per process */
+static EVP_CIPHER_CTX *th_enc_ctx, *th_dec_ctx;
+static unsigned char th_iv_salt[4];
+static unsigned long long th_iv_cnt;
+
+/* scratch buffers, grown on demand */
+static char *th_plain_buf, *th_seal_buf, *th_text_buf;
+static int th_plain_size, th_seal_size, th_text_size;
+
+
+int th_bin_init(str *passwd)
+{
+	if (passwd->len == 0) {
+		LM_ERR("an empty contact encoding password is not allowed\n");
+		return -1;
+	}
+	SHA256((unsigned char *)passwd->s, passwd->len, th_key);
+	return 0;
+}
+
+
+static int th_bin_proc_init(void)
+{
+	unsigned int salt;
+
+	th_enc_ctx = EVP_CIPHER_CTX_new();
+	th_dec_ctx = EVP_CIPHER_CTX_new();
+	if (th_enc_ctx == NULL || th_dec_ctx == NULL) {
+		LM_ERR("failed to allocate the cipher contexts\n");
+		goto error;
+	}
+
+	if (EVP_EncryptInit_ex(th_enc_ctx, EVP_aes_256_gcm(), NULL, th_key,
+	NULL) != 1 || EVP_DecryptInit_ex(th_dec_ctx, EVP_aes_256_gcm(), NULL,
+	th_key, NULL) != 1) {
+		LM_ERR("failed to init AES-256-GCM\n");
+		goto error;
+	}
+
+	/* the IV is unique per process (salt) and per message (counter) */
+	if (RAND_bytes((unsigned char *)&salt, sizeof salt) != 1)
+		salt = time(NULL);
+	salt ^= getpid();
+	memcpy(th_iv_salt, &salt, sizeof th_iv_salt);
+	th_iv_cnt = (unsigned long long)time(NULL) << 24;
+
+	return 0;
+
+error:
+	th_bin_destroy();
+	return -1;
+}
+
+
+void th_bin_destroy(void)
+{
+	if (th_enc_ctx) {
+		EVP_CIPHER_CTX_free(th_enc_ctx);
+		th_enc_ctx = NULL;
+	}
+	if (th_dec_ctx) {
+		EVP_CIPHER_CTX_free(th_dec_ctx);
+		th_dec_ctx = NULL;
+	}
+}
+
+
+static inline char *th_get_buf(char **buf, int *size, int len)
+{
+	char *p;
+
+	if (len > *size) {
+		p = pkg_realloc(*buf, len);
+		if (p == NULL) {
+			LM_ERR("no more pkg mem\n");
+			return NULL;
+		}
+		*buf = p;
+		*size = len;
+	}
+
+	return *buf;
+}
+
+
+static inline char *th_put_varint(char *p, unsigned int v)
+{
+	while (v >= 0x80) {
+		*p++ = (char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (char)v;
+	return p;
+}
+
+
+static inline char *th_get_varint(char *p, char *end, unsigned int *v)
+{
+	int shift;
+
+	*v = 0;
+	for (shift = 0; p < end && shift < 7 * TH_VARINT_MAX; shift += 7) {
+		*v |= (unsigned int)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0)
+			return p;
+	}
+
+	return NULL;
+}
+
+
+/* the socket position in the list of all the listeners, 1 based */
+static unsigned int th_sock_index(struct socket_info *sock)
+{
+	struct socket_info *si;
+	unsigned int idx = 0;
+	int p;
+
+	for (p = PROTO_FIRST; p < PROTO_LAST; p++)
+		for (si = protos[p].listeners; si; si = si->next) {
+			idx++;
+			if (si == sock)
+				return idx;
+		}
+
+	return 0;
+}
+
+
+static struct socket_info *th_sock_by_index(unsigned int idx)
+{
+	struct socket_info *si;
+	int p;
+
+	if (idx == 0)
+		return NULL;
+
+	for (p = PROTO_FIRST; p < PROTO_LAST; p++)
+		for (si = protos[p].listeners; si; si = si->next)
+			if (--idx == 0)
+				return si;
+
+	return NULL;
+}
+
+
+/* strips the "<sip:" / ";lr>" parts of an URI, setting the flags */
+static inline void th_compact_uri(str *uri, unsigned char *flags)
+{
+	if (uri->len > 4 && strncasecmp(uri->s, "sip:", 4) == 0) {
+		*flags |= TH_F_SIP;
+		uri->s += 4;
+		uri->len -= 4;
+	}
+	if ((*flags & TH_F_NA) && uri->len > 3 &&
+	strncasecmp(uri->s + uri->len - 3, ";lr", 3) == 0) {
+		*flags |= TH_F_LR;
+		uri->len -= 3;
+	}
+}
+
+
+static char *th_put_field(char *p, unsigned char flags, str *s)
+{
+	*p++ = (char)flags;
+	p = th_put_varint(p, s->len);
+	memcpy(p, s->s, s->len);
+	return p + s->len;
+}
+
+
+int th_bin_encode(str *rr_set, str *contact, struct socket_info *sock,
+		char **out)
+{
+	rr_t *head = NULL, *rr;
+	unsigned int routes = 0;
+	unsigned char flags;
+	int len, plain_len, tmp;
+	str s;
+	char *p;
+
+	if (th_enc_ctx == NULL && th_bin_proc_init() < 0)
+		return -1;
+
+	if (rr_set->len) {
+		if (parse_rr_body(rr_set->s, rr_set->len, &head) != 0) {
+			LM_ERR("failed to parse the route set\n");
+			return -1;
+		}
+		for (rr = head; rr; rr = rr->next)
+			routes++;
+	}
+
+	/* worst case - nothing to strip */
+	len = 3 * TH_VARINT_MAX + (1 + TH_VARINT_MAX) * (routes + 1) +
+		rr_set->len + contact->len;
+	if (th_get_buf(&th_plain_buf, &th_plain_size, len) == NULL ||
+	th_get_buf(&th_seal_buf, &th_seal_size, len + TH_BIN_OVERHEAD) == NULL)
+		goto error;
+
+	p = th_put_varint(th_plain_buf, th_sock_index(sock));
+	p = th_put_varint(p, routes);
+
+	for (rr = head; rr; rr = rr->next) {
+		flags = 0;
+		if (rr->params == NULL && *rr->nameaddr.name.s == '<' &&
+		rr->len == rr->nameaddr.uri.len + 2) {
+			flags |= TH_F_NA;
+			s = rr->nameaddr.uri;
+			th_compact_uri(&s, &flags);
+		} else {
+			s.s = rr->nameaddr.name.s;
+			s.len = rr->len;
+		}
+		p = th_put_field(p, flags, &s);
+	}
+
+	flags = 0;
+	s = *contact;
+	th_compact_uri(&s, &flags);
+	p = th_put_field(p, flags, &s);
+
+	plain_len = p - th_plain_buf;
+
+	/* seal it */
+	p = th_seal_buf;
+	*p++ = TH_BIN_VERSION;
+	memcpy(p, th_iv_salt, sizeof th_iv_salt);
+	th_iv_cnt++;
+	memcpy(p + sizeof th_iv_salt, &th_iv_cnt, sizeof th_iv_cnt);
+
+	if (EVP_EncryptInit_ex(th_enc_ctx, NULL, NULL, NULL,
+	(unsigned char *)p) != 1 ||
+	EVP_EncryptUpdate(th_enc_ctx, NULL, &tmp,
+	(unsigned char *)th_seal_buf, 1) != 1 ||
+	EVP_EncryptUpdate(th_enc_ctx, (unsigned char *)p + TH_BIN_IV_LEN, &len,
+	(unsigned char *)th_plain_buf, plain_len) != 1 ||
+	EVP_EncryptFinal_ex(th_enc_ctx,
+	(unsigned char *)p + TH_BIN_IV_LEN + len, &tmp) != 1 ||
+	EVP_CIPHER_CTX_ctrl(th_enc_ctx, EVP_CTRL_GCM_GET_TAG, TH_BIN_TAG_LEN,
+	p + TH_BIN_IV_LEN + plain_len) != 1) {
+		LM_ERR("failed to seal the contact info\n");
+		goto error;
+	}
+
+	if (head)
+		free_rr(&head);
+
+	*out = th_seal_buf;
+	return plain_len + TH_BIN_OVERHEAD;
+
+error:
+	if (head)
+		free_rr(&head);
+	return -1;
+}
+
+
+/* appends a field to the text buffer, restoring what was stripped */
+static char *th_get_field(char *p, char *end, str *dst)
+{
+	unsigned int len;
+	unsigned char flags;
+	char *t;
+
+	if (p >= end)
+		return NULL;
+	flags = (unsigned char)*p++;
+	if ((p = th_get_varint(p, end, &len)) == NULL || (long)len > end - p)
+		return NULL;
+
+	t = dst->s + dst->len;
+	if (flags & TH_F_NA)
+		*t++ = '<';
+	if (flags & TH_F_SIP) {
+		memcpy(t, "sip:", 4);
+		t += 4;
+	}
+	memcpy(t, p, len);
+	t += len;
+	if (flags & TH_F_LR) {
+		memcpy(t, ";lr", 3);
+		t += 3;
+	}
+	if (flags & TH_F_NA)
+		*t++ = '>';
+	dst->len = t - dst->s;
+
+	return p + len;
+}
+
+
+int th_bin_decode(char *in, int len, str *rr_set, str *contact,
+		struct socket_info **sock)
+{
+	unsigned int idx, routes;
+	char *p, *end, *iv;
+	int plain_len, tmp;
+
+	if (len <= TH_BIN_OVERHEAD || *in != TH_BIN_VERSION)
+		return -1;
+
+	if (th_dec_ctx == NULL && th_bin_proc_init() < 0)
+		return -1;
+
+	plain_len = len - TH_BIN_OVERHEAD;
+	if (th_get_buf(&th_plain_buf, &th_plain_size, plain_len) == NULL)
+		return -1;
+
+	iv = in + 1;
+	if (EVP_DecryptInit_ex(th_dec_ctx, NULL, NULL, NULL,
+	(unsigned char *)iv) != 1 ||
+	EVP_DecryptUpdate(th_dec_ctx, NULL, &tmp, (unsigned char *)in, 1) != 1 ||
+	EVP_DecryptUpdate(th_dec_ctx, (unsigned char *)th_plain_buf, &tmp,
+	(unsigned char *)iv + TH_BIN_IV_LEN, plain_len) != 1 ||
+	EVP_CIPHER_CTX_ctrl(th_dec_ctx, EVP_CTRL_GCM_SET_TAG, TH_BIN_TAG_LEN,
+	iv + TH_BIN_IV_LEN + plain_len) != 1 ||
+	EVP_DecryptFinal_ex(th_dec_ctx, (unsigned char *)th_plain_buf + tmp,
+	&tmp) != 1) {
+		LM_DBG("contact info failed authentication\n");
+		return -1;
+	}
+
+	/* every stripped byte comes back: at most "<sip:" ";lr>" and ","
+	 * around each (at least 2 bytes long) field */
+	if (th_get_buf(&th_text_buf, &th_text_size, 5 * plain_len + 10) == NULL)
+		return -1;
+
+	p = th_plain_buf;
+	end = th_plain_buf + plain_len;
+	if ((p = th_get_varint(p, end, &idx)) == NULL ||
+	(p = th_get_varint(p, end, &routes)) == NULL)
+		goto bad_info;
+
+	rr_set->s = th_text_buf;
+	rr_set->len = 0;
+	for (; routes; routes--) {
+		if ((p = th_get_field(p, end, rr_set)) == NULL)
+			goto bad_info;
+		if (routes > 1)
+			rr_set->s[rr_set->len++] = ',';
+	}
+
+	contact->s = rr_set->s + rr_set->len;
+	contact->len = 0;
+	if (th_get_field(p, end, contact) == NULL)
+		goto bad_info;
+
+	*sock = th_sock_by_index(idx);
+	if (idx && *sock == NULL)
+		LM_WARN("no listener with index %u...ignoring\n", idx);
+
+	return 0;
+
+bad_info:
+	LM_ERR("malformed contact info\n");
+	return -1;
+}
@@ -0,0 +1,60 @@
+/**
+ * Topology Hiding Module
+ *
+ * Copyright (C) 2016 OpenSIPS Foundation
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History
+ * -------
+ *  2016-10-19  binary Contact encoding, sealed with AES-256-GCM
+*/
+
+#ifndef _TOPOH_BIN_H
+#define _TOPOH_BIN_H
+
+#include "../../str.h"
+#include "../../ip_addr.h"
+
+/* how the Contact info of the no-dialog mode is encoded */
+#define TH_CT_ENC_XOR     0
+#define TH_CT_ENC_BINARY  1
+
+extern int th_ct_enc_scheme;
+
+/* derives the key out of the password */
+int th_bin_init(str *passwd);
+
+void th_bin_destroy(void);
+
+/*
+ * Builds the sealed binary form of the route set, the Contact URI and the
+ * receiving socket; returns its length, the buffer being kept till the next
+ * call, -1 on error
+ */
+int th_bin_encode(str *rr_set, str *contact, struct socket_info *sock,
+		char **out);
+
+/*
+ * Opens a binary info built by th_bin_encode(); the route set and the
+ * Contact are rebuilt in a buffer kept till the next call. Returns -1 if
+ * the info was not built by us (or tampered with)
+ */
+int th_bin_decode(char *in, int len, str *rr_set, str *contact,
+		struct socket_info **sock);
+
+#endif
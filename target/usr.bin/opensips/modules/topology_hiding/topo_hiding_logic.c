@@ -22,9 +22,11 @@
  * History
  * -------
  *  2015-02-17  initial version (Vlad Paiu)
+ *  2016-10-19  the no-dialog Contact info may use the binary encoding
 */
 
 #include "topo_hiding_logic.h"
+#include "topo_hiding_bin.h"
 
 extern int force_dialog;
 extern struct tm_binds tm_api;
@@ -1453,11 +1455,11 @@ error:
 /* Via headers will be restored using the TM module, no need to save anything for them */
 static char* build_encoded_contact_suffix(struct sip_msg* msg,int *suffix_len)
 {
-	short rr_len,ct_len,addr_len,enc_len;
-	char *suffix_plain,*suffix_enc,*p,*s;
+	short rr_len,ct_len,addr_len;
+	char *suffix_plain=NULL,*suffix_enc,*p,*s;
 	str rr_set = {NULL, 0};
 	str contact;
-	int i,total_len;
+	int i,total_len,enc_len;
 	struct sip_uri ctu;
 	struct th_ct_params* el;
 	param_t *it;
@@ -1494,8 +1496,45 @@ static char* build_encoded_contact_suffix(struct sip_msg* msg,int *suffix_len)
 		ct_len = (short)contact.len;
 	}
 
-	addr_len = (short)msg->rcv.bind_address->sock_str.len;
-	local_len += rr_len + ct_len + addr_len; 
+	if (th_ct_enc_scheme == TH_CT_ENC_BINARY) {
+		/* the sealed binary form, kept by the encoder */
+		local_len = th_bin_encode(&rr_set, &contact,
+			msg->rcv.bind_address, &p);
+		if (local_len < 0) {
+			LM_ERR("failed to encode the contact info\n");
+			goto error;
+		}
+	} else {
+		addr_len = (short)msg->rcv.bind_address->sock_str.len;
+		local_len += rr_len + ct_len + addr_len;
+
+		suffix_plain = pkg_malloc(local_len+1);
+		if (!suffix_plain) {
+			LM_ERR("no more pkg\n");
+			goto error;
+		}
+
+		p = suffix_plain;
+		memcpy(p,&rr_len,sizeof(short));
+		p+= sizeof(short);
+		if (rr_len) {
+			memcpy(p,rr_set.s,rr_set.len);
+			p+= rr_set.len;
+		}
+		memcpy(p,&ct_len,sizeof(short));
+		p+= sizeof(short);
+		if (ct_len) {
+			memcpy(p,contact.s,contact.len);
+			p+= contact.len;
+		}
+		memcpy(p,&addr_len,sizeof(short));
+		p+= sizeof(short);
+		memcpy(p,msg->rcv.bind_address->sock_str.s,msg->rcv.bind_address->sock_str.len);
+		p+= msg->rcv.bind_address->sock_str.len;
+		for (i=0;i<(int)(p-suffix_plain);i++)
+			suffix_plain[i] ^= topo_hiding_ct_encode_pw.s[i%topo_hiding_ct_encode_pw.len];
+		p = suffix_plain;
+	}
 	enc_len = calc_base64_encode_len(local_len);
 	total_len = enc_len +  
 		1 /* ; */ + 
@@ -1560,39 +1599,13 @@ static char* build_encoded_contact_suffix(struct sip_msg* msg,int *suffix_len)
 		LM_ERR("no more pkg\n");
 		goto error;
 	}
-	suffix_plain = pkg_malloc(local_len+1);
-	if (!suffix_plain) {
-		LM_ERR("no more pkg\n");
-		goto error;
-	}
-
-	p = suffix_plain;
-	memcpy(p,&rr_len,sizeof(short));
-	p+= sizeof(short);
-	if (rr_len) {
-		memcpy(p,rr_set.s,rr_set.len);
-		p+= rr_set.len;
-	}
-	memcpy(p,&ct_len,sizeof(short));
-	p+= sizeof(short);
-	if (ct_len) {
-		memcpy(p,contact.s,contact.len);
-		p+= contact.len;
-	}
-	memcpy(p,&addr_len,sizeof(short));
-	p+= sizeof(short);
-	memcpy(p,msg->rcv.bind_address->sock_str.s,msg->rcv.bind_address->sock_str.len);
-	p+= msg->rcv.bind_address->sock_str.len;
-	for (i=0;i<(int)(p-suffix_plain);i++)
-		suffix_plain[i] ^= topo_hiding_ct_encode_pw.s[i%topo_hiding_ct_encode_pw.len];
-
 	s = suffix_enc;
 	*s++ = ';';
 	memcpy(s,th_contact_encode_param.s,th_contact_encode_param.len);
 	s+= th_contact_encode_param.len;
 	*s++ = '=';
 	*s++ = '"';	
-	base64encode((unsigned char*)s,(unsigned char *)suffix_plain,p-suffix_plain);
+	base64encode((unsigned char*)s,(unsigned char *)p,local_len);
 	s = s+enc_len;
 	*s++ = '"';
 	
@@ -1642,12 +1655,15 @@ static char* build_encoded_contact_suffix(struct sip_msg* msg,int *suffix_len)
 
 	if (rr_set.s)
 		pkg_free(rr_set.s);
-	pkg_free(suffix_plain);
+	if (suffix_plain)
+		pkg_free(suffix_plain);
 	*suffix_len = total_len;
 	return suffix_enc;
 error:
 	if (rr_set.s)
 		pkg_free(rr_set.s);
+	if (suffix_plain)
+		pkg_free(suffix_plain);
 	return NULL;
 }
 
@@ -1756,7 +1772,8 @@ static int topo_no_dlg_seq_handling(struct sip_msg *msg,str *info)
 	struct lump* lmp = NULL;
 	str host;
 	int port,proto;
-	struct socket_info *sock;
+	struct socket_info *sock = NULL;
+	int is_bin = 0;
 
 	/* parse all headers to be sure that all RR and Contact hdrs are found */
 	if (parse_headers(msg, HDR_EOH_F, 0)< 0) {
@@ -1786,17 +1803,27 @@ static int topo_no_dlg_seq_handling(struct sip_msg *msg,str *info)
 	}
 
 	dec_len = base64decode((unsigned char *)dec_buf,(unsigned char *)info->s,info->len);
-	for (i=0;i<dec_len;i++)
-		dec_buf[i] ^= topo_hiding_ct_encode_pw.s[i%topo_hiding_ct_encode_pw.len]; 
-
-	rr_buf.len=*(short *)dec_buf;
-	rr_buf.s = dec_buf + sizeof(short);
-	p = rr_buf.s + rr_buf.len;
-	ct_buf.len = *(short *)p;
-	ct_buf.s = p + sizeof(short);
-	p = ct_buf.s + ct_buf.len;
-	bind_buf.len = *(short *)p;
-	bind_buf.s = p + sizeof(short);
+
+	/* infos built before switching to the binary encoding fail the
+	 * authentication and are read the old way */
+	if (th_ct_enc_scheme == TH_CT_ENC_BINARY &&
+	th_bin_decode(dec_buf,dec_len,&rr_buf,&ct_buf,&sock) == 0) {
+		is_bin = 1;
+		bind_buf.s = NULL;
+		bind_buf.len = 0;
+	} else {
+		for (i=0;i<dec_len;i++)
+			dec_buf[i] ^= topo_hiding_ct_encode_pw.s[i%topo_hiding_ct_encode_pw.len];
+
+		rr_buf.len=*(short *)dec_buf;
+		rr_buf.s = dec_buf + sizeof(short);
+		p = rr_buf.s + rr_buf.len;
+		ct_buf.len = *(short *)p;
+		ct_buf.s = p + sizeof(short);
+		p = ct_buf.s + ct_buf.len;
+		bind_buf.len = *(short *)p;
+		bind_buf.s = p + sizeof(short);
+	}
 
 	LM_DBG("extracted routes [%.*s] , ct [%.*s] and bind [%.*s]\n",
 		rr_buf.len,rr_buf.s,ct_buf.len,ct_buf.s,bind_buf.len,bind_buf.s);
@@ -1978,7 +2005,14 @@ static int topo_no_dlg_seq_handling(struct sip_msg *msg,str *info)
 		LM_ERR("failed to register TMCB\n");
 	}
 
-	if (bind_buf.len && bind_buf.s) {
+	if (is_bin) {
+		/* the socket came already resolved */
+		if (sock) {
+			LM_DBG("forcing send socket for req to [%.*s]\n",
+				sock->sock_str.len,sock->sock_str.s);
+			msg->force_send_socket = sock;
+		}
+	} else if (bind_buf.len && bind_buf.s) {
 		LM_DBG("forcing send socket for req to [%.*s]\n",bind_buf.len,bind_buf.s);
 		if (parse_phostport( bind_buf.s, bind_buf.len, &host.s, &host.len,
 		&port, &proto)!=0) {
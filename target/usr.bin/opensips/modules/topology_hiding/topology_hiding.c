@@ -22,6 +22,7 @@
  * History
  * -------
  *  2015-02-17  initial version (Vlad Paiu)
+ *  2016-10-19  added th_contact_encode_scheme param
 */
 #include <stdio.h>
 #include <string.h>
@@ -29,6 +30,7 @@
 
 
 #include "topo_hiding_logic.h"
+#include "topo_hiding_bin.h"
 
 struct tm_binds tm_api;
 struct dlg_binds dlg_api;
@@ -40,6 +42,7 @@ str topo_hiding_prefix = str_init("DLGCH_");
 str topo_hiding_seed = str_init("OpenSIPS");
 str topo_hiding_ct_encode_pw = str_init("ToPoCtPaSS");
 str th_contact_encode_param = str_init("thinfo");
+static char *th_ct_enc_scheme_s = "xor";
 
 static int mod_init(void);
 static void mod_destroy(void);
@@ -69,6 +72,7 @@ static param_export_t params[] = {
 	{ "th_callid_prefix",            STR_PARAM, &topo_hiding_prefix.s        },
 	{ "th_contact_encode_passwd",    STR_PARAM, &topo_hiding_ct_encode_pw.s  },
 	{ "th_contact_encode_param",     STR_PARAM, &th_contact_encode_param.s   },
+	{ "th_contact_encode_scheme",    STR_PARAM, &th_ct_enc_scheme_s          },
 	{0, 0, 0}
 };
 
@@ -126,6 +130,15 @@ static int mod_init(void)
 	topo_hiding_prefix.len = strlen(topo_hiding_prefix.s);
 	topo_hiding_seed.len = strlen(topo_hiding_seed.s);
 	th_contact_encode_param.len = strlen(th_contact_encode_param.s);
+	topo_hiding_ct_encode_pw.len = strlen(topo_hiding_ct_encode_pw.s);
+	if (strcasecmp(th_ct_enc_scheme_s, "binary") == 0) {
+		th_ct_enc_scheme = TH_CT_ENC_BINARY;
+		if (th_bin_init(&topo_hiding_ct_encode_pw) < 0)
+			goto error;
+	} else if (strcasecmp(th_ct_enc_scheme_s, "xor") != 0) {
+		LM_ERR("unknown contact encoding scheme <%s>\n", th_ct_enc_scheme_s);
+		goto error;
+	}
 	if (topo_hiding_ct_params.s) {
 		topo_hiding_ct_params.len = strlen(topo_hiding_ct_params.s);
 		topo_parse_passed_ct_params(&topo_hiding_ct_params);
@@ -175,7 +188,7 @@ error:
 
 static void mod_destroy(void)
 {
-	return;
+	th_bin_destroy();
 }
 
 static int fixup_topo_hiding(void **param, int param_no)
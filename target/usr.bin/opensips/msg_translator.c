@@ -729,19 +729,109 @@ skip_after:
 
 
 
+void msg_iov_add(struct msg_iov *iov, char *s, unsigned int len)
+{
+	struct iovec *v;
+
+	if (len==0 || iov->error)
+		return;
+
+	/* extend the last chunk if contiguous */
+	if (iov->cnt && (char*)iov->v[iov->cnt-1].iov_base +
+	iov->v[iov->cnt-1].iov_len == s) {
+		iov->v[iov->cnt-1].iov_len += len;
+		iov->len += len;
+		return;
+	}
+
+	if (iov->cnt==iov->size) {
+		v = pkg_malloc(2 * iov->size * sizeof(struct iovec));
+		if (v==NULL) {
+			LM_ERR("no more pkg mem (%d chunks)\n", 2 * iov->size);
+			iov->error = 1;
+			return;
+		}
+		memcpy(v, iov->v, iov->cnt * sizeof(struct iovec));
+		if (iov->v!=iov->pre)
+			pkg_free(iov->v);
+		iov->v = v;
+		iov->size *= 2;
+	}
+
+	iov->v[iov->cnt].iov_base = s;
+	iov->v[iov->cnt].iov_len = len;
+	iov->cnt++;
+	iov->len += len;
+}
+
+
+void msg_iov_destroy(struct msg_iov *iov)
+{
+	if (iov->v!=iov->pre)
+		pkg_free(iov->v);
+	msg_iov_init(iov);
+}
+
+
+char *msg_iov_flatten(struct msg_iov *iov, unsigned int *len, int flags)
+{
+	char *buf, *p;
+	unsigned int i;
+
+	if (flags&MSG_TRANS_SHM_FLAG)
+		buf=(char*)shm_malloc(iov->len+1);
+	else
+		buf=(char*)pkg_malloc(iov->len+1);
+	if (buf==0){
+		ser_error=E_OUT_OF_MEM;
+		LM_ERR("out of %s memory\n", (flags&MSG_TRANS_SHM_FLAG)?"shm":"pkg");
+		*len=0;
+		return 0;
+	}
+
+	for (i=0, p=buf; i<iov->cnt; i++) {
+		memcpy(p, iov->v[i].iov_base, iov->v[i].iov_len);
+		p += iov->v[i].iov_len;
+	}
+	buf[iov->len]=0;
+
+	*len=iov->len;
+	return buf;
+}
+
+
+/*! \brief where the lumps are processed to: either everything is copied
+ * into a flat buffer or only the chunks (of the original buffer and of the
+ * lumps) are recorded into an iovec list */
+struct lump_out {
+	char *buf;
+	unsigned int offset;
+	struct msg_iov *iov;
+};
+
+static inline void lump_out_copy(struct lump_out *out, char *s,
+														unsigned int len)
+{
+	if (out->iov==NULL)
+		memcpy(out->buf+out->offset, s, len);
+	else
+		msg_iov_add(out->iov, s, len);
+	out->offset+=len;
+}
+
+
 /*! \brief another helper functions, adds/Removes the lump,
 	code moved from build_req_from_req  */
 
-void process_lumps(	struct sip_msg* msg,
+static void _process_lumps(	struct sip_msg* msg,
 					struct lump* lumps,
-					char* new_buf,
-					unsigned int* new_buf_offs,
+					struct lump_out* out,
 					unsigned int* orig_offs,
 					struct socket_info* send_sock)
 {
 	struct lump *t, *r;
 	char* orig;
-	unsigned int size, offset, s_offset;
+	unsigned int size, s_offset;
 	unsigned int last_del;
 	str *send_address_str, *send_port_str;
 	str *rcv_address_str=NULL;
@@ -751,9 +841,8 @@ void process_lumps(	struct sip_msg* msg,
 	switch((subst_l)->u.subst){ \
 		case SUBST_RCV_IP: \
 			if (msg->rcv.bind_address){  \
-				memcpy(new_buf+offset, rcv_address_str->s, \
+				lump_out_copy(out, rcv_address_str->s, \
 					rcv_address_str->len); \
-				offset+=rcv_address_str->len; \
 			}else{  \
 				/*FIXME*/ \
 				LM_CRIT("null bind_address\n"); \
@@ -761,9 +850,8 @@ void process_lumps(	struct sip_msg* msg,
 			break; \
 		case SUBST_RCV_PORT: \
 			if (msg->rcv.bind_address){  \
-				memcpy(new_buf+offset, rcv_port_str->s, \
+				lump_out_copy(out, rcv_port_str->s, \
 						rcv_port_str->len); \
-				offset+=rcv_port_str->len; \
 			}else{  \
 				/*FIXME*/ \
 				LM_CRIT("null bind_address\n"); \
@@ -772,16 +860,13 @@ void process_lumps(	struct sip_msg* msg,
 		case SUBST_RCV_ALL: \
 			if (msg->rcv.bind_address){  \
 				/* address */ \
-				memcpy(new_buf+offset, rcv_address_str->s, \
+				lump_out_copy(out, rcv_address_str->s, \
 						rcv_address_str->len); \
-				offset+=rcv_address_str->len; \
 				/* :port */ \
 				if (msg->rcv.bind_address->port_no!=SIP_PORT || (rcv_port_str!=&(msg->rcv.bind_address->port_no_str))){ \
-					new_buf[offset]=':'; offset++; \
-					memcpy(new_buf+offset, \
-							rcv_port_str->s, \
+					lump_out_copy(out, ":", 1); \
+					lump_out_copy(out, rcv_port_str->s, \
 							rcv_port_str->len); \
-					offset+=rcv_port_str->len; \
 				}\
 				switch(msg->rcv.bind_address->proto){ \
 					/* TODO: change this to look into protos ! */ \
@@ -789,32 +874,24 @@ void process_lumps(	struct sip_msg* msg,
 					case PROTO_UDP: \
 						break; /* nothing to do, udp is default*/ \
 					case PROTO_TCP: \
-						memcpy(new_buf+offset, TRANSPORT_PARAM, \
+						lump_out_copy(out, TRANSPORT_PARAM, \
 								TRANSPORT_PARAM_LEN); \
-						offset+=TRANSPORT_PARAM_LEN; \
-						memcpy(new_buf+offset, "tcp", 3); \
-						offset+=3; \
+						lump_out_copy(out, "tcp", 3); \
 						break; \
 					case PROTO_TLS: \
-						memcpy(new_buf+offset, TRANSPORT_PARAM, \
+						lump_out_copy(out, TRANSPORT_PARAM, \
 								TRANSPORT_PARAM_LEN); \
-						offset+=TRANSPORT_PARAM_LEN; \
-						memcpy(new_buf+offset, "tls", 3); \
-						offset+=3; \
+						lump_out_copy(out, "tls", 3); \
 						break; \
 					case PROTO_SCTP: \
-						memcpy(new_buf+offset, TRANSPORT_PARAM, \
+						lump_out_copy(out, TRANSPORT_PARAM, \
 								TRANSPORT_PARAM_LEN); \
-						offset+=TRANSPORT_PARAM_LEN; \
-						memcpy(new_buf+offset, "sctp", 4); \
-						offset+=4; \
+						lump_out_copy(out, "sctp", 4); \
 						break; \
 					case PROTO_WS: \
-						memcpy(new_buf+offset, TRANSPORT_PARAM, \
+						lump_out_copy(out, TRANSPORT_PARAM, \
 								TRANSPORT_PARAM_LEN); \
-						offset+=TRANSPORT_PARAM_LEN; \
-						memcpy(new_buf+offset, "ws", 2); \
-						offset+=2; \
+						lump_out_copy(out, "ws", 2); \
 						break; \
 					default: \
 						LM_CRIT("unknown proto %d\n", \
@@ -827,9 +904,8 @@ void process_lumps(	struct sip_msg* msg,
 			break; \
 		case SUBST_SND_IP: \
 			if (send_sock){  \
-				memcpy(new_buf+offset, send_address_str->s, \
+				lump_out_copy(out, send_address_str->s, \
 									send_address_str->len); \
-				offset+=send_address_str->len; \
 			}else{  \
 				/*FIXME*/ \
 				LM_CRIT("called with null send_sock\n"); \
@@ -837,9 +913,8 @@ void process_lumps(	struct sip_msg* msg,
 			break; \
 		case SUBST_SND_PORT: \
 			if (send_sock){  \
-				memcpy(new_buf+offset, send_port_str->s, \
+				lump_out_copy(out, send_port_str->s, \
 									send_port_str->len); \
-				offset+=send_port_str->len; \
 			}else{  \
 				/*FIXME*/ \
 				LM_CRIT("called with null send_sock\n"); \
@@ -848,48 +923,38 @@ void process_lumps(	struct sip_msg* msg,
 		case SUBST_SND_ALL: \
 			if (send_sock){  \
 				/* address */ \
-				memcpy(new_buf+offset, send_address_str->s, \
+				lump_out_copy(out, send_address_str->s, \
 						send_address_str->len); \
-				offset+=send_address_str->len; \
 				/* :port */ \
 				if ((send_sock->port_no!=SIP_PORT) || \
 					(send_port_str!=&(send_sock->port_no_str))){ \
-					new_buf[offset]=':'; offset++; \
-					memcpy(new_buf+offset, send_port_str->s, \
+					lump_out_copy(out, ":", 1); \
+					lump_out_copy(out, send_port_str->s, \
 							send_port_str->len); \
-					offset+=send_port_str->len; \
 				}\
 				switch(send_sock->proto){ \
 					case PROTO_NONE: \
 					case PROTO_UDP: \
 						break; /* nothing to do, udp is default*/ \
 					case PROTO_TCP: \
-						memcpy(new_buf+offset, TRANSPORT_PARAM, \
+						lump_out_copy(out, TRANSPORT_PARAM, \
 								TRANSPORT_PARAM_LEN); \
-						offset+=TRANSPORT_PARAM_LEN; \
-						memcpy(new_buf+offset, "tcp", 3); \
-						offset+=3; \
+						lump_out_copy(out, "tcp", 3); \
 						break; \
 					case PROTO_TLS: \
-						memcpy(new_buf+offset, TRANSPORT_PARAM, \
+						lump_out_copy(out, TRANSPORT_PARAM, \
 								TRANSPORT_PARAM_LEN); \
-						offset+=TRANSPORT_PARAM_LEN; \
-						memcpy(new_buf+offset, "tls", 3); \
-						offset+=3; \
+						lump_out_copy(out, "tls", 3); \
 						break; \
 					case PROTO_SCTP: \
-						memcpy(new_buf+offset, TRANSPORT_PARAM, \
+						lump_out_copy(out, TRANSPORT_PARAM, \
 								TRANSPORT_PARAM_LEN); \
-						offset+=TRANSPORT_PARAM_LEN; \
-						memcpy(new_buf+offset, "sctp", 4); \
-						offset+=4; \
+						lump_out_copy(out, "sctp", 4); \
 						break; \
 					case PROTO_WS: \
-						memcpy(new_buf+offset, TRANSPORT_PARAM, \
+						lump_out_copy(out, TRANSPORT_PARAM, \
 								TRANSPORT_PARAM_LEN); \
-						offset+=TRANSPORT_PARAM_LEN; \
-						memcpy(new_buf+offset, "ws", 2); \
-						offset+=2; \
+						lump_out_copy(out, "ws", 2); \
 						break; \
 					default: \
 						LM_CRIT("unknown proto %d\n", \
@@ -905,24 +970,19 @@ void process_lumps(	struct sip_msg* msg,
 				switch(msg->rcv.bind_address->proto){ \
 					case PROTO_NONE: \
 					case PROTO_UDP: \
-						memcpy(new_buf+offset, "udp", 3); \
-						offset+=3; \
+						lump_out_copy(out, "udp", 3); \
 						break; \
 					case PROTO_TCP: \
-						memcpy(new_buf+offset, "tcp", 3); \
-						offset+=3; \
+						lump_out_copy(out, "tcp", 3); \
 						break; \
 					case PROTO_TLS: \
-						memcpy(new_buf+offset, "tls", 3); \
-						offset+=3; \
+						lump_out_copy(out, "tls", 3); \
 						break; \
 					case PROTO_SCTP: \
-						memcpy(new_buf+offset, "sctp", 4); \
-						offset+=4; \
+						lump_out_copy(out, "sctp", 4); \
 						break; \
 					case PROTO_WS: \
-						memcpy(new_buf+offset, "ws", 2); \
-						offset+=2; \
+						lump_out_copy(out, "ws", 2); \
 						break; \
 					default: \
 						LM_CRIT("unknown proto %d\n", \
@@ -938,24 +998,19 @@ void process_lumps(	struct sip_msg* msg,
 				switch(send_sock->proto){ \
 					case PROTO_NONE: \
 					case PROTO_UDP: \
-						memcpy(new_buf+offset, "udp", 3); \
-						offset+=3; \
+						lump_out_copy(out, "udp", 3); \
 						break; \
 					case PROTO_TCP: \
-						memcpy(new_buf+offset, "tcp", 3); \
-						offset+=3; \
+						lump_out_copy(out, "tcp", 3); \
 						break; \
 					case PROTO_TLS: \
-						memcpy(new_buf+offset, "tls", 3); \
-						offset+=3; \
+						lump_out_copy(out, "tls", 3); \
 						break; \
 					case PROTO_SCTP: \
-						memcpy(new_buf+offset, "sctp", 4); \
-						offset+=4; \
+						lump_out_copy(out, "sctp", 4); \
 						break; \
 					case PROTO_WS: \
-						memcpy(new_buf+offset, "ws", 2); \
-						offset+=2; \
+						lump_out_copy(out, "ws", 2); \
 						break; \
 					default: \
 						LM_CRIT("unknown proto %d\n", \
@@ -1003,7 +1058,6 @@ void process_lumps(	struct sip_msg* msg,
 	}
 
 	orig=msg->buf;
-	offset=*new_buf_offs;
 	s_offset=*orig_offs;
 	last_del=0;
 
@@ -1021,8 +1075,7 @@ void process_lumps(	struct sip_msg* msg,
 				/* copy till offset (if any) */
 				if (s_offset < t->u.offset) {
 					size = t->u.offset-s_offset;
-					memcpy(new_buf+offset, orig+s_offset, size);
-					offset += size;
+					lump_out_copy(out, orig+s_offset, size);
 					s_offset += size;
 				}
 
@@ -1034,8 +1087,7 @@ void process_lumps(	struct sip_msg* msg,
 					switch (r->op) {
 						case LUMP_ADD:
 							/*just add it here*/
-							memcpy(new_buf+offset, r->u.value, r->len);
-							offset += r->len;
+							lump_out_copy(out, r->u.value, r->len);
 							break;
 						case LUMP_ADD_SUBST:
 							SUBST_LUMP(r);
@@ -1073,8 +1125,7 @@ skip_nop_before:
 					switch (r->op) {
 						case LUMP_ADD:
 							/*just add it here*/
-							memcpy(new_buf+offset, r->u.value, r->len);
-							offset += r->len;
+							lump_out_copy(out, r->u.value, r->len);
 							break;
 						case LUMP_ADD_SUBST:
 							SUBST_LUMP(r);
@@ -1114,8 +1165,7 @@ skip_nop_after:
 					switch (r->op){
 						case LUMP_ADD:
 							/*just add it here*/
-							memcpy(new_buf+offset, r->u.value, r->len);
-							offset+=r->len;
+							lump_out_copy(out, r->u.value, r->len);
 							break;
 						case LUMP_ADD_SUBST:
 							SUBST_LUMP(r);
@@ -1140,8 +1190,7 @@ skip_before:
 				/* copy "main" part */
 				switch(t->op){
 					case LUMP_ADD:
-						memcpy(new_buf+offset, t->u.value, t->len);
-						offset+=t->len;
+						lump_out_copy(out, t->u.value, t->len);
 						break;
 					case LUMP_ADD_SUBST:
 						SUBST_LUMP(t);
@@ -1158,8 +1207,7 @@ skip_before:
 					switch (r->op){
 						case LUMP_ADD:
 							/*just add it here*/
-							memcpy(new_buf+offset, r->u.value, r->len);
-							offset+=r->len;
+							lump_out_copy(out, r->u.value, r->len);
 							break;
 						case LUMP_ADD_SUBST:
 							SUBST_LUMP(r);
@@ -1195,11 +1243,29 @@ skip_after:
 		}
 	}
 
-	*new_buf_offs = offset;
 	*orig_offs = s_offset;
 }
 
 
+void process_lumps(	struct sip_msg* msg,
+					struct lump* lumps,
+					char* new_buf,
+					unsigned int* new_buf_offs,
+					unsigned int* orig_offs,
+					struct socket_info* send_sock)
+{
+	struct lump_out out;
+
+	out.buf = new_buf;
+	out.offset = *new_buf_offs;
+	out.iov = NULL;
+
+	_process_lumps(msg, lumps, &out, orig_offs, send_sock);
+
+	*new_buf_offs = out.offset;
+}
+
+
 /*! \brief
  * Adjust/insert Content-Length if necessary
  */
@@ -1372,14 +1438,16 @@ int is_del_via1_lump(struct sip_msg* msg)
 	return 0;
 }
 
-char * build_req_buf_from_sip_req( struct sip_msg* msg,
-								unsigned int *returned_len,
+/*! \brief adds to the request all the lumps required for forwarding it
+ * (new Via, received, rport, Content-Length update) - the lumps are
+ * the same no matter how the request is printed afterwards */
+static int prepare_req_lumps( struct sip_msg* msg,
 								struct socket_info* send_sock, int proto,
-								unsigned int flags)
+								unsigned int flags, unsigned int *body_delta)
 {
-	unsigned int len, new_len, received_len, rport_len, uri_len, via_len, body_delta;
-	char *line_buf, *received_buf, *rport_buf, *new_buf, *buf, *id_buf;
-	unsigned int offset, s_offset, size, id_len;
+	unsigned int received_len, rport_len, via_len;
+	char *line_buf, *received_buf, *rport_buf, *buf, *id_buf;
+	unsigned int size, id_len;
 	struct lump *anchor, *via_insert_param;
 	str branch, extra_params;
 	struct hostport hp;
@@ -1389,12 +1457,9 @@ char * build_req_buf_from_sip_req( struct sip_msg* msg,
 	via_insert_param=0;
 	extra_params.len=0;
 	extra_params.s=0;
-	uri_len=0;
 	buf=msg->buf;
-	len=msg->len;
 	received_len=0;
 	rport_len=0;
-	new_buf=0;
 	received_buf=0;
 	rport_buf=0;
 	line_buf=0;
@@ -1410,14 +1475,14 @@ char * build_req_buf_from_sip_req( struct sip_msg* msg,
 	/* Calculate message body difference and adjust
 	 * Content-Length
 	 */
-	body_delta = lumps_len(msg, msg->body_lumps, send_sock);
-	if (adjust_clen(msg, body_delta, proto) < 0) {
+	*body_delta = lumps_len(msg, msg->body_lumps, send_sock);
+	if (adjust_clen(msg, *body_delta, proto) < 0) {
 		LM_ERR("failed to adjust Content-Length\n");
 		goto error;
 	}
 
 	if (flags&MSG_TRANS_NOVIA_FLAG)
-		goto build_msg;
+		return 0;
 
 	/* add id if tcp-based protocol  */
 	if (is_tcp_based_proto(msg->rcv.proto)) {
@@ -1543,7 +1608,40 @@ char * build_req_buf_from_sip_req( struct sip_msg* msg,
 			goto error03; /* free rport_buf */
 	}
 
-build_msg:
+	/* cleanup */
+	if (extra_params.s) pkg_free(extra_params.s);
+	return 0;
+
+error01:
+	if (line_buf) pkg_free(line_buf);
+error02:
+	if (received_buf) pkg_free(received_buf);
+error03:
+	if (rport_buf) pkg_free(rport_buf);
+error00:
+	if (extra_params.s) pkg_free(extra_params.s);
+error:
+	return -1;
+}
+
+
+char * build_req_buf_from_sip_req( struct sip_msg* msg,
+								unsigned int *returned_len,
+								struct socket_info* send_sock, int proto,
+								unsigned int flags)
+{
+	unsigned int len, new_len, uri_len, body_delta;
+	char *new_buf, *buf;
+	unsigned int offset, s_offset, size;
+
+	uri_len=0;
+	buf=msg->buf;
+	len=msg->len;
+	new_buf=0;
+
+	if (prepare_req_lumps(msg, send_sock, proto, flags, &body_delta) < 0)
+		goto error;
+
 	/* compute new msg len and fix overlapping zones*/
 	new_len=len+body_delta+lumps_len(msg, msg->add_rm, send_sock);
 #ifdef XL_DEBUG
@@ -1561,7 +1659,7 @@ build_msg:
 	if (new_buf==0){
 		ser_error=E_OUT_OF_MEM;
 		LM_ERR("out of pkg memory\n");
-		goto error00;
+		goto error;
 	}
 
 	offset=s_offset=0;
@@ -1585,44 +1683,66 @@ build_msg:
 	new_buf[new_len]=0;
 
 	*returned_len=new_len;
-	/* cleanup */
-	if (extra_params.s) pkg_free(extra_params.s);
 	return new_buf;
 
-error01:
-	if (line_buf) pkg_free(line_buf);
-error02:
-	if (received_buf) pkg_free(received_buf);
-error03:
-	if (rport_buf) pkg_free(rport_buf);
-error00:
-	if (extra_params.s) pkg_free(extra_params.s);
 error:
 	*returned_len=0;
 	return 0;
 }
 
 
-
-char * build_res_buf_from_sip_res( struct sip_msg* msg,
-	unsigned int *returned_len, struct socket_info *sock,int flags)
+int build_req_iov_from_sip_req( struct sip_msg* msg, struct msg_iov *iov,
+								struct socket_info* send_sock, int proto,
+								unsigned int flags)
 {
-	unsigned int new_len, body_delta, len;
-	char *new_buf, *buf;
-	unsigned int offset, s_offset;
+	struct lump_out out;
+	unsigned int body_delta, s_offset, size;
 
-	buf=msg->buf;
-	len=msg->len;
-	new_buf=0;
+	if (prepare_req_lumps(msg, send_sock, proto, flags, &body_delta) < 0)
+		return -1;
+
+	out.buf=0;
+	out.offset=0;
+	out.iov=iov;
 
+	s_offset=0;
+	if (msg->new_uri.s){
+		/* the original message up to uri, followed by our uri */
+		size=msg->first_line.u.request.uri.s-msg->buf;
+		lump_out_copy(&out, msg->buf, size);
+		lump_out_copy(&out, msg->new_uri.s, msg->new_uri.len);
+		s_offset=size+msg->first_line.u.request.uri.len;
+	}
+	/* add the chunks between and from the lumps */
+	_process_lumps(msg, msg->add_rm, &out, &s_offset, send_sock);
+	_process_lumps(msg, msg->body_lumps, &out, &s_offset, send_sock);
+	/* the rest of the message */
+	lump_out_copy(&out, msg->buf+s_offset, msg->len-s_offset);
+
+	if (iov->error) {
+		ser_error=E_OUT_OF_MEM;
+		LM_ERR("failed to build the iovec list\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+/*! \brief adds to the reply all the lumps required for relaying it
+ * (Content-Length update, first Via removal) */
+static int prepare_res_lumps( struct sip_msg* msg, int flags,
+												unsigned int *body_delta)
+{
 	/* Calculate message body difference and adjust
 	 * Content-Length
 	 */
-	body_delta = lumps_len(msg, msg->body_lumps, 0);
-	if (adjust_clen(msg, body_delta, (msg->via2? msg->via2->proto:PROTO_UDP))
+	*body_delta = lumps_len(msg, msg->body_lumps, 0);
+	if (adjust_clen(msg, *body_delta, (msg->via2? msg->via2->proto:PROTO_UDP))
 			< 0) {
 		LM_ERR("failed to adjust Content-Length\n");
-		goto error;
+		return -1;
 	}
 
 	/* remove the first via */
@@ -1631,18 +1751,36 @@ char * build_res_buf_from_sip_res( struct sip_msg* msg,
 
 		if (msg->via1->next) {
 			via_len = msg->via1->bsize;
-			via_offset = msg->h_via1->body.s-buf;
+			via_offset = msg->h_via1->body.s-msg->buf;
 		} else {
 			via_len = msg->h_via1->len;
-			via_offset = msg->h_via1->name.s-buf;
+			via_offset = msg->h_via1->name.s-msg->buf;
 		}
 
 		if (del_lump(msg, via_offset, via_len, HDR_VIA_T) == 0) {
 			LM_ERR("failed to remove first via\n");
-			goto error;
+			return -1;
 		}
 	}
 
+	return 0;
+}
+
+
+char * build_res_buf_from_sip_res( struct sip_msg* msg,
+	unsigned int *returned_len, struct socket_info *sock,int flags)
+{
+	unsigned int new_len, body_delta, len;
+	char *new_buf, *buf;
+	unsigned int offset, s_offset;
+
+	buf=msg->buf;
+	len=msg->len;
+	new_buf=0;
+
+	if (prepare_res_lumps(msg, flags, &body_delta) < 0)
+		goto error;
+
 	new_len=len+body_delta+lumps_len(msg, msg->add_rm, sock);
 
 	LM_DBG(" old size: %d, new size: %d\n", len, new_len);
@@ -1676,6 +1814,42 @@ error:
 }
 
 
+int build_res_iov_from_sip_res( struct sip_msg* msg, struct msg_iov *iov,
+										struct socket_info *sock, int flags)
+{
+	struct lump_out out;
+	unsigned int body_delta, s_offset;
+
+	if (prepare_res_lumps(msg, flags, &body_delta) < 0)
+		return -1;
+
+	out.buf=0;
+	out.offset=0;
+	out.iov=iov;
+
+	s_offset=0;
+	/* as it is a relaied reply, if 503, make it 500 (just reply code) */
+	if ( !disable_503_translation && msg->first_line.u.reply.statuscode==503 ){
+		s_offset=msg->first_line.u.reply.status.s-msg->buf+2;
+		lump_out_copy(&out, msg->buf, s_offset);
+		lump_out_copy(&out, "0", 1);
+		s_offset++;
+	}
+
+	_process_lumps(msg, msg->add_rm, &out, &s_offset, sock);
+	_process_lumps(msg, msg->body_lumps, &out, &s_offset, sock);
+	/* the rest of the message */
+	lump_out_copy(&out, msg->buf+s_offset, msg->len-s_offset);
+
+	if (iov->error) {
+		LM_ERR("failed to build the iovec list\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
 char * build_res_buf_from_sip_req( unsigned int code, str *text ,str *new_tag,
 		struct sip_msg* msg, unsigned int *returned_len, struct bookmark *bmark)
 {
@@ -49,6 +49,8 @@
 
 //#define MAX_CONTENT_LEN_BUF INT2STR_MAX_LEN /* see ut.h/int2str() */
 
+#include <sys/uio.h>
+
 #include "parser/msg_parser.h"
 #include "ip_addr.h"
 #include "context.h"
@@ -58,6 +60,39 @@ struct bookmark {
 	str to_tag_val;
 };
 
+/*! \brief an outgoing message kept as a list of chunks, pointing into
+ * the original message buffer and into the lumps, instead of being copied
+ * into a new buffer; the chunks are valid as long as the message and its
+ * lumps are */
+#define MSG_IOV_PREALLOC  32
+
+struct msg_iov {
+	struct iovec *v;   /* the chunks */
+	unsigned int cnt;  /* used chunks */
+	unsigned int size; /* available chunks */
+	unsigned int len;  /* total length of the message */
+	int error;
+	struct iovec pre[MSG_IOV_PREALLOC]; /* avoids any allocation for the
+	                                       usual messages */
+};
+
+static inline void msg_iov_init(struct msg_iov *iov)
+{
+	iov->v = iov->pre;
+	iov->cnt = 0;
+	iov->size = MSG_IOV_PREALLOC;
+	iov->len = 0;
+	iov->error = 0;
+}
+
+void msg_iov_add(struct msg_iov *iov, char *s, unsigned int len);
+
+void msg_iov_destroy(struct msg_iov *iov);
+
+/*! \brief copies the chunks into a new buffer (in shm if
+ * MSG_TRANS_SHM_FLAG is set, in pkg otherwise) */
+char *msg_iov_flatten(struct msg_iov *iov, unsigned int *len, int flags);
+
 /*! \brief used by via_builder() */
 struct hostport {
 	str* host;
@@ -92,6 +127,14 @@ char * build_req_buf_from_sip_req (	struct sip_msg* msg,
 char * build_res_buf_from_sip_res(	struct sip_msg* msg,
 				unsigned int *returned_len, struct socket_info *sock,int flags);
 
+/*! \brief same as the above two, but the result is an iovec list,
+ * (see struct msg_iov) so nothing gets copied; return 0 on success */
+int build_req_iov_from_sip_req( struct sip_msg* msg, struct msg_iov *iov,
+				struct socket_info* send_sock, int proto, unsigned int flags);
+
+int build_res_iov_from_sip_res( struct sip_msg* msg, struct msg_iov *iov,
+				struct socket_info *sock, int flags);
+
 
 char * build_res_buf_from_sip_req( unsigned int code,
 				str *text,
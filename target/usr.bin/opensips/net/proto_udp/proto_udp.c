@@ -45,6 +45,9 @@ static int proto_udp_init(struct proto_info *pi);
 static int proto_udp_init_listener(struct socket_info *si);
 static int proto_udp_send(struct socket_info* send_sock,
 		char* buf, unsigned int len, union sockaddr_union* to, int id);
+static int proto_udp_sendv(struct socket_info* send_sock,
+		const struct iovec *v, int cnt, unsigned int len,
+		union sockaddr_union* to, int id);
 
 static int udp_read_req(struct socket_info *src, int* bytes_read);
 
@@ -98,6 +101,7 @@ static int proto_udp_init(struct proto_info *pi)
 
 	pi->tran.init_listener	= proto_udp_init_listener;
 	pi->tran.send			= proto_udp_send;
+	pi->tran.sendv			= proto_udp_sendv;
 
 	pi->net.flags			= PROTO_NET_USE_UDP;
 	pi->net.read			= (proto_net_read_f)udp_read_req;
@@ -224,6 +228,35 @@ again:
 }
 
 
+static int proto_udp_sendv(struct socket_info* source,
+		const struct iovec *v, int cnt, unsigned int len,
+		union sockaddr_union* to, int id)
+{
+	struct msghdr mh;
+	int n;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_name = &to->s;
+	mh.msg_namelen = sockaddru_len(*to);
+	mh.msg_iov = (struct iovec *)v;
+	mh.msg_iovlen = cnt;
+
+again:
+	n=sendmsg(source->socket, &mh, 0);
+	if (n==-1){
+		LM_ERR("sendmsg(sock,%p,%d chunks,%u bytes,0,%p,%d): %s(%d)\n",
+				v, cnt, len, to, (int)mh.msg_namelen, strerror(errno), errno);
+		if (errno==EINTR || errno==EAGAIN) goto again;
+		if (errno==EINVAL) {
+			LM_CRIT("invalid sendmsg parameters\n"
+			"one possible reason is the server is bound to localhost and\n"
+			"attempts to send to the net\n");
+		}
+	}
+	return n;
+}
+
+
 int register_udprecv_cb(udp_rcv_cb_f* func, void* param, char a, char b)
 {
 	callback_list* new;
@@ -0,0 +1,261 @@
+/*
+ * Header field offset index - one pass, vectorized scanning of the
+ * SIP header section
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * The whole header section of a message is scanned only once, 16 (SSE2) or
+ * 32 (AVX2) bytes at a time, or one machine word at a time on the platforms
+ * without vector units (see the SWAR fallback). For each header field we
+ * keep the offsets of its start, of the end of its name and of its end
+ * (folded lines included), so that get_hdr_field() does not have to look
+ * for them again byte by byte. The Vias parsed by parse_msg() are not
+ * indexed - the index is built by the first parse_headers() call asking
+ * for other HFs, starting with the first unparsed one.
+ *
+ * The index lives in the process memory and it describes only the last
+ * message parsed by the process - it is identified by the message buffer,
+ * length and id, so it is silently rebuilt whenever one of them changes.
+ * As a buffer may be reused for another message with the same length and
+ * id (e.g. messages built in pkg memory, all with id 0), the index is also
+ * dropped by parse_msg() and free_sip_msg(), and each hint is checked
+ * against the buffer before it is returned.
+ */
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hdr_index.h"
+#include "../dprint.h"
+
+#ifndef NO_HDR_INDEX
+
+struct hdr_idx_entry {
+	unsigned int start;
+	unsigned int name_end;   /* 0 if unknown */
+	unsigned int end;
+};
+
+static struct hdr_index {
+	char *buf;
+	unsigned int len;
+	unsigned int msg_id;
+	unsigned int first;      /* offset where the indexing started */
+	unsigned int no;         /* number of indexed HFs */
+	unsigned int cur;        /* where the next lookup is expected */
+	struct hdr_idx_entry hdrs[HDR_IDX_MAX_HDRS];
+} hdr_idx = {NULL, 0, 0, 0, 0, 0, {{0, 0, 0}}};
+
+
+#if !defined(__AVX2__) && !defined(__SSE2__)
+/* word-at-a-time helpers: HAS_ZERO() is not null only if at least one of
+ * the bytes of the word is 0 */
+#define HIDX_ONES        ((unsigned long)-1 / 0xff)
+#define HIDX_HIGHS       (HIDX_ONES * 0x80)
+#define HIDX_HAS_ZERO(_w) (((_w) - HIDX_ONES) & ~(_w) & HIDX_HIGHS)
+#define HIDX_HAS_BYTE(_w, _c) HIDX_HAS_ZERO((_w) ^ (HIDX_ONES * (_c)))
+#endif
+
+char *hdr_idx_next_event(char *p, char *end, int want_name)
+{
+#if defined(__AVX2__)
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i colon = _mm256_set1_epi8(':');
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i ht = _mm256_set1_epi8('\t');
+	__m256i v, m;
+	unsigned int mask;
+
+	for ( ; p + 32 <= end; p += 32) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		m = _mm256_cmpeq_epi8(v, lf);
+		if (want_name)
+			m = _mm256_or_si256(m, _mm256_or_si256(
+				_mm256_cmpeq_epi8(v, colon),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+					_mm256_cmpeq_epi8(v, ht))));
+		mask = (unsigned int)_mm256_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#elif defined(__SSE2__)
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i ht = _mm_set1_epi8('\t');
+	__m128i v, m;
+	unsigned int mask;
+
+	for ( ; p + 16 <= end; p += 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		m = _mm_cmpeq_epi8(v, lf);
+		if (want_name)
+			m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, colon),
+				_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, ht))));
+		mask = (unsigned int)_mm_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#else
+	unsigned long w, hit;
+
+	for ( ; p + sizeof(w) <= end; p += sizeof(w)) {
+		/* memcpy() keeps the unaligned loads safe on strict platforms */
+		memcpy(&w, p, sizeof(w));
+		hit = HIDX_HAS_BYTE(w, '\n');
+		if (want_name)
+			hit |= HIDX_HAS_BYTE(w, ':') | HIDX_HAS_BYTE(w, ' ') |
+				HIDX_HAS_BYTE(w, '\t');
+		/* the exact position is found by the byte loop below */
+		if (hit)
+			break;
+	}
+#endif
+
+	for ( ; p < end; p++) {
+		if (*p == '\n' ||
+		(want_name && (*p == ':' || *p == ' ' || *p == '\t')))
+			return p;
+	}
+
+	return NULL;
+}
+
+
+static void hdr_idx_build(struct sip_msg *msg, char *start)
+{
+	char *end = msg->buf + msg->len;
+	char *line, *name_end, *p, *q;
+	struct hdr_idx_entry *e;
+
+	hdr_idx.buf = msg->buf;
+	hdr_idx.len = msg->len;
+	hdr_idx.msg_id = msg->id;
+	hdr_idx.first = start - msg->buf;
+	hdr_idx.no = 0;
+	hdr_idx.cur = 0;
+
+	line = p = start;
+	name_end = NULL;
+
+	while (p < end && hdr_idx.no < HDR_IDX_MAX_HDRS) {
+		/* empty line - end of headers */
+		if (p == line && (*p == '\n' || *p == '\r'))
+			break;
+
+		q = hdr_idx_next_event(p, end, name_end == NULL);
+		if (q == NULL)
+			/* last HF is not terminated - leave it to get_hdr_field() */
+			break;
+
+		if (*q != '\n') {
+			name_end = q;
+			p = q + 1;
+			continue;
+		}
+
+		p = q + 1;
+		/* folded line ? */
+		if (p < end && (*p == ' ' || *p == '\t'))
+			continue;
+
+		e = &hdr_idx.hdrs[hdr_idx.no++];
+		e->start = line - msg->buf;
+		e->name_end = name_end ? name_end - msg->buf : 0;
+		e->end = p - msg->buf;
+
+		line = p;
+		name_end = NULL;
+	}
+
+	LM_DBG("indexed %u header fields of msg %u\n", hdr_idx.no, msg->id);
+}
+
+
+void hdr_idx_reset(void)
+{
+	hdr_idx.buf = NULL;
+	hdr_idx.no = 0;
+}
+
+
+int hdr_idx_lookup(struct sip_msg *msg, char *hdr_start,
+		struct hdr_idx_hint *hint)
+{
+	unsigned int off, l, r, m;
+	struct hdr_idx_entry *e;
+
+	if (msg->buf == NULL || hdr_start < msg->buf ||
+	hdr_start >= msg->buf + msg->len)
+		return -1;
+
+	off = hdr_start - msg->buf;
+
+	if (hdr_idx.buf != msg->buf || hdr_idx.len != msg->len ||
+	hdr_idx.msg_id != msg->id || off < hdr_idx.first)
+		hdr_idx_build(msg, hdr_start);
+
+	/* parse_headers() walks the HFs in order, so try the cursor first */
+	if (hdr_idx.cur < hdr_idx.no && hdr_idx.hdrs[hdr_idx.cur].start == off) {
+		e = &hdr_idx.hdrs[hdr_idx.cur];
+	} else {
+		l = 0;
+		r = hdr_idx.no;
+		e = NULL;
+		while (l < r) {
+			m = (l + r) / 2;
+			if (hdr_idx.hdrs[m].start == off) {
+				e = &hdr_idx.hdrs[m];
+				break;
+			}
+			if (hdr_idx.hdrs[m].start < off)
+				l = m + 1;
+			else
+				r = m;
+		}
+		if (e == NULL)
+			return -1;
+	}
+
+	/* a stale index (same buffer, length and id, different content)
+	 * must not send get_hdr_field() astray */
+	if (e->end > msg->len || msg->buf[e->end - 1] != '\n' ||
+	(e->name_end && msg->buf[e->name_end] != ':' &&
+	msg->buf[e->name_end] != ' ' && msg->buf[e->name_end] != '\t') ||
+	(off > hdr_idx.first && msg->buf[off - 1] != '\n')) {
+		LM_DBG("stale header index for msg %u, dropping it\n", msg->id);
+		hdr_idx_reset();
+		return -1;
+	}
+
+	hdr_idx.cur = e - hdr_idx.hdrs + 1;
+
+	hint->name_end = e->name_end ? msg->buf + e->name_end : NULL;
+	hint->end = msg->buf + e->end;
+	return 0;
+}
+
+#endif /* NO_HDR_INDEX */
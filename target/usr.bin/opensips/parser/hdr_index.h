@@ -0,0 +1,73 @@
+/*
+ * Header field offset index - one pass, vectorized scanning of the
+ * SIP header section
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+#ifndef HDR_INDEX_H
+#define HDR_INDEX_H
+
+#include "msg_parser.h"
+
+/* max number of header fields kept in the (per process) index; the header
+ * fields following this limit are parsed the classic, byte-by-byte way */
+#define HDR_IDX_MAX_HDRS  256
+
+/* what the index knows about a header field */
+struct hdr_idx_hint {
+	char *name_end;   /* first ':', SP or HT after the name; NULL if the
+	                     header name is not terminated on its own line */
+	char *end;        /* first char after the LF ending the (folded) HF */
+};
+
+#ifdef NO_HDR_INDEX
+
+/* headers parsed the classic way only (as a baseline for benchmarks) */
+#define hdr_idx_lookup(_msg, _hdr_start, _hint) (-1)
+#define hdr_idx_reset() do {} while (0)
+
+#else
+
+/*
+ * Looks up the header field starting at "hdr_start" in the header index of
+ * "msg". The index is built (in a single pass over the whole header section)
+ * the first time it is needed for a message and it is reused by all the
+ * following parse_headers() calls on the same message.
+ * Returns 0 and fills in "hint" if the HF is indexed, -1 otherwise.
+ */
+int hdr_idx_lookup(struct sip_msg *msg, char *hdr_start,
+		struct hdr_idx_hint *hint);
+
+/*
+ * Drops the index - called when a message is parsed from scratch or freed,
+ * as its buffer (and id) may be reused for a different message.
+ */
+void hdr_idx_reset(void);
+
+/*
+ * Finds the first LF, ':', SP or HT (if "want_name" is set) or the first
+ * LF (otherwise) in the [p, end) range. Returns NULL if nothing was found.
+ */
+char *hdr_idx_next_event(char *p, char *end, int want_name);
+
+#endif
+
+#endif /* HDR_INDEX_H */
@@ -52,6 +52,7 @@
 #include "../errinfo.h"
 #include "../dset.h"
 #include "parse_hname2.h"
+#include "hdr_index.h"
 #include "parse_uri.h"
 #include "parse_content.h"
 #include "../msg_callbacks.h"
@@ -61,14 +62,17 @@
 #endif
 
 
-#define parse_hname(_b,_e,_h) parse_hname2((_b),(_e),(_h))
+#define parse_hname(_b,_e,_h,_ne) parse_hname2_hint((_b),(_e),(_h),(_ne))
 
 /* number of via's encountered */
 int via_cnt;
 
 /* returns pointer to next header line, and fill hdr_f ;
- * if at end of header returns pointer to the last crlf  (always buf)*/
-char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
+ * if at end of header returns pointer to the last crlf  (always buf);
+ * "hint", if not NULL, holds the name end and the HF end, as already found
+ * by the header index */
+static char* _get_hdr_field(char* buf, char* end, struct hdr_field* hdr,
+													struct hdr_idx_hint *hint)
 {
 
 	char* tmp;
@@ -85,7 +89,7 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 		return buf;
 	}
 
-	tmp=parse_hname(buf, end, hdr);
+	tmp=parse_hname(buf, end, hdr, hint?hint->name_end:NULL);
 	if (hdr->type==HDR_ERROR_T){
 		LM_ERR("bad header\n");
 		goto error_bad_hdr;
@@ -230,6 +234,12 @@ char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
 		case HDR_OTHER_T:
 			/* just skip over it */
 			hdr->body.s=tmp;
+			/* end of header already known from the index ? */
+			if (hint && hint->end>tmp && hint->end<=end) {
+				tmp=hint->end;
+				hdr->body.len=tmp-hdr->body.s;
+				break;
+			}
 			/* find end of header */
 			/* find lf */
 			do{
@@ -268,6 +278,12 @@ error:
 }
 
 
+char* get_hdr_field(char* buf, char* end, struct hdr_field* hdr)
+{
+	return _get_hdr_field(buf, end, hdr, NULL);
+}
+
+
 
 /* parse the headers and adds them to msg->headers and msg->to, from etc.
  * It stops when all the headers requested in flags were parsed, on error
@@ -285,10 +301,12 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 {
 	struct hdr_field *hf;
 	struct hdr_field *itr;
+	struct hdr_idx_hint hint;
 	char* tmp;
 	char* rest;
 	char* end;
 	hdr_flags_t orig_flag;
+	int use_idx;
 
 #define link_sibling_hdr(_hook, _hdr) \
 	do{ \
@@ -308,6 +326,10 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 	}else
 		orig_flag=0;
 
+	/* the Vias (all parse_msg() asks for) are usually the first HFs - the
+	 * header section is indexed only when more than that is needed */
+	use_idx = (flags & ~(HDR_VIA1_F|HDR_VIA2_F)) != 0;
+
 	LM_DBG("flags=%llx\n", (unsigned long long)flags);
 	while( tmp<end && (flags & msg->parsed_flag) != flags){
 		hf=pkg_malloc(sizeof(struct hdr_field));
@@ -318,7 +340,8 @@ int parse_headers(struct sip_msg* msg, hdr_flags_t flags, int next)
 		}
 		memset(hf,0, sizeof(struct hdr_field));
 		hf->type=HDR_ERROR_T;
-		rest=get_hdr_field(tmp, msg->buf+msg->len, hf);
+		rest=_get_hdr_field(tmp, msg->buf+msg->len, hf,
+			(use_idx && hdr_idx_lookup(msg, tmp, &hint)==0) ? &hint : NULL);
 		switch (hf->type){
 			case HDR_ERROR_T:
 				LM_INFO("bad header field\n");
@@ -549,6 +572,9 @@ int parse_msg(char* buf, unsigned int len, struct sip_msg* msg)
 	int offset;
 	hdr_flags_t flags;
 
+	/* a new message may come in the buffer of the last indexed one */
+	hdr_idx_reset();
+
 	/* eat crlf from the beginning */
 	for (tmp=buf; (*tmp=='\n' || *tmp=='\r')&&
 			(unsigned int)(tmp-buf) < len ; tmp++);
@@ -669,6 +695,7 @@ void free_reply_lump( struct lump_rpl *lump)
 /*only the content*/
 void free_sip_msg(struct sip_msg* msg)
 {
+	hdr_idx_reset();
 	if (msg->msg_cb) { msg_callback_process(msg, MSG_DESTROY, NULL); }
 	if (msg->new_uri.s) { pkg_free(msg->new_uri.s); msg->new_uri.len=0; }
 	if (msg->set_global_address.s) {
@@ -141,7 +141,13 @@ static inline char* skip_ws(char* p, char *end)
 	}
 
 
-char* parse_hname2(char* begin, char* end, struct hdr_field* hdr)
+/*
+ * "name_end", if known (see hdr_index.h), points to the first ':', SP or HT
+ * following the header name, so an unknown header name does not have to be
+ * scanned again byte by byte
+ */
+static inline char* _parse_hname2(char* begin, char* end,
+									struct hdr_field* hdr, char* name_end)
 {
 	register char* p;
 	register unsigned int val;
@@ -232,6 +238,16 @@ char* parse_hname2(char* begin, char* end, struct hdr_field* hdr)
  other:
 	/* Unknown header type */
 	hdr->type = HDR_OTHER_T;
+	if (name_end && name_end >= p && name_end < end) {
+		p = name_end;
+		hdr->name.len = p - hdr->name.s;
+		if (*p == ':')
+			return (p + 1);
+		p = skip_ws(p+1, end);
+		if (*p != ':')
+			goto error;
+		return (p+1);
+	}
 	/* if overflow during the "switch-case" parsing, the "while" will
 	 * exit and we will fall in the "error" section */
 	while ( p < end ) {
@@ -257,3 +273,16 @@ char* parse_hname2(char* begin, char* end, struct hdr_field* hdr)
 	hdr->name.len = 0;
 	return 0;
 }
+
+
+char* parse_hname2(char* begin, char* end, struct hdr_field* hdr)
+{
+	return _parse_hname2(begin, end, hdr, NULL);
+}
+
+
+char* parse_hname2_hint(char* begin, char* end, struct hdr_field* hdr,
+															char* name_end)
+{
+	return _parse_hname2(begin, end, hdr, name_end);
+}
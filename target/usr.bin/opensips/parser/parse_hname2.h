@@ -32,4 +32,11 @@
  */
 char* parse_hname2(char* begin, char* end, struct hdr_field* hdr);
 
+/*
+ * Same as above, but takes advantage of the already known end of the
+ * header name (first ':', SP or HT after it - see hdr_index.h)
+ */
+char* parse_hname2_hint(char* begin, char* end, struct hdr_field* hdr,
+															char* name_end);
+
 #endif /* PARSE_HNAME2_H */
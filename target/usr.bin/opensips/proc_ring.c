@@ -0,0 +1,175 @@
+/*
+ * Per process ring buffers in shared memory
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  shared by the async xlog writer and the siptrace HEP sender
+ */
+
+#include <string.h>
+
+#include "dprint.h"
+#include "pt.h"
+#include "mem/shm_mem.h"
+#include "proc_ring.h"
+
+#define PROC_REC_ALIGN(_l) \
+	(((_l) + sizeof(int) - 1) & ~(sizeof(int) - 1))
+
+
+struct proc_rings *proc_rings_alloc(unsigned int size, unsigned int max_len)
+{
+	struct proc_rings *rs;
+	unsigned int i, min;
+	char *p;
+
+	/* a ring must keep at least a few records of max size */
+	min = 4 * (max_len + 2*sizeof(struct proc_ring_rec));
+	if (size < min)
+		size = min;
+	size = PROC_REC_ALIGN(size);
+
+	p = shm_malloc(sizeof(struct proc_rings) +
+		counted_processes * (sizeof(struct proc_ring) + size));
+	if (p==NULL) {
+		LM_ERR("no more shm memory\n");
+		return NULL;
+	}
+	rs = (struct proc_rings*)p;
+	p += sizeof(struct proc_rings);
+
+	rs->no = counted_processes;
+	rs->size = size;
+	rs->r = (struct proc_ring*)p;
+	p += rs->no * sizeof(struct proc_ring);
+
+	for (i=0; i<rs->no; i++) {
+		memset(&rs->r[i], 0, sizeof(struct proc_ring));
+		lock_init(&rs->r[i].lock);
+		rs->r[i].buf = p + i*size;
+	}
+
+	return rs;
+}
+
+
+char *proc_ring_reserve(struct proc_rings *rs, unsigned int len)
+{
+	struct proc_ring *r = &rs->r[process_no];
+	unsigned int head, tail, size, need;
+
+	lock_get(&r->lock);
+	head = r->head;
+	tail = r->tail;
+	lock_release(&r->lock);
+
+	size = rs->size;
+	need = sizeof(struct proc_ring_rec) + PROC_REC_ALIGN(len);
+
+	/* the head never reaches the tail - an empty ring has head==tail */
+	if (head >= tail) {
+		if (size - head > need) {
+			r->res = head;
+		} else if (tail > need) {
+			/* wrap to the beginning */
+			if (size - head >= sizeof(struct proc_ring_rec))
+				((struct proc_ring_rec*)(r->buf + head))->len = -1;
+			r->res = 0;
+		} else {
+			goto full;
+		}
+	} else if (tail - head > need) {
+		r->res = head;
+	} else {
+		goto full;
+	}
+
+	return proc_ring_data((struct proc_ring_rec*)(r->buf + r->res));
+full:
+	r->dropped++;
+	return NULL;
+}
+
+
+void proc_ring_commit(struct proc_rings *rs, unsigned int len,
+		unsigned int info)
+{
+	struct proc_ring *r = &rs->r[process_no];
+	struct proc_ring_rec *rec = (struct proc_ring_rec*)(r->buf + r->res);
+
+	rec->len = len;
+	rec->pid = my_pid();
+	rec->info = info;
+
+	lock_get(&r->lock);
+	r->head = r->res + sizeof(struct proc_ring_rec) + PROC_REC_ALIGN(len);
+	lock_release(&r->lock);
+}
+
+
+int proc_ring_peek(struct proc_rings *rs, unsigned int idx,
+		struct proc_ring_rec **recs, int max)
+{
+	struct proc_ring *r = &rs->r[idx];
+	struct proc_ring_rec *rec;
+	unsigned int head, tail;
+	int n;
+
+	lock_get(&r->lock);
+	head = r->head;
+	tail = r->tail;
+	lock_release(&r->lock);
+
+	for (n=0; tail != head && n < max; ) {
+		rec = (struct proc_ring_rec*)(r->buf + tail);
+		if (rs->size - tail < sizeof(struct proc_ring_rec) || rec->len < 0) {
+			tail = 0;
+			continue;
+		}
+		recs[n++] = rec;
+		tail += sizeof(struct proc_ring_rec) + PROC_REC_ALIGN(rec->len);
+	}
+
+	r->next = tail;
+	return n;
+}
+
+
+void proc_ring_release(struct proc_rings *rs, unsigned int idx)
+{
+	struct proc_ring *r = &rs->r[idx];
+
+	lock_get(&r->lock);
+	r->tail = r->next;
+	lock_release(&r->lock);
+}
+
+
+unsigned long proc_rings_dropped(struct proc_rings *rs)
+{
+	unsigned long dropped = 0;
+	unsigned int i;
+
+	for (i=0; i<rs->no; i++)
+		dropped += rs->r[i].dropped;
+
+	return dropped;
+}
@@ -0,0 +1,103 @@
+/*
+ * Per process ring buffers in shared memory
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ *
+ * History:
+ * --------
+ *  2016-10-19  shared by the async xlog writer and the siptrace HEP sender
+ */
+
+/*
+ * A set of rings, one for each process, with a single consumer process.
+ * Each process writes its records directly into its own ring (no locking
+ * against the other processes) and the consumer drains all the rings, in
+ * batches. If its ring is full, a process drops the record instead of
+ * waiting for the consumer.
+ */
+
+#ifndef _PROC_RING_H
+#define _PROC_RING_H
+
+#include "locking.h"
+#include "pt.h"
+
+/* a record in a ring; a negative len marks the wrapping point */
+struct proc_ring_rec {
+	int len;                /* of the data, following the header */
+	int pid;                /* of the process that wrote the record */
+	unsigned int info;      /* free for the user of the ring */
+};
+
+#define proc_ring_data(_rec)  ((char*)((_rec) + 1))
+
+struct proc_ring {
+	gen_lock_t lock;        /* protects head and tail only */
+	unsigned int head;      /* changed only by the owning process */
+	unsigned int tail;      /* changed only by the consumer */
+	unsigned int res;       /* last reservation of the owning process */
+	unsigned int next;      /* tail after the last peek of the consumer */
+	unsigned long dropped;  /* records dropped on a full ring */
+	char *buf;
+};
+
+struct proc_rings {
+	unsigned int no;        /* one ring for each of the first "no" procs */
+	unsigned int size;      /* of each ring */
+	struct proc_ring *r;
+};
+
+/*
+ * Allocates (in shm) a ring of "size" bytes for each of the processes
+ * counted so far. The size is raised, if needed, to keep at least a few
+ * records of "max_len" bytes. Returns NULL on error.
+ */
+struct proc_rings *proc_rings_alloc(unsigned int size, unsigned int max_len);
+
+/* does the current process have a ring ? */
+static inline int proc_ring_on(struct proc_rings *rs)
+{
+	return rs != NULL && process_no < rs->no;
+}
+
+/*
+ * Reserves "len" contiguous bytes in the ring of the current process.
+ * Returns NULL if the ring is full - the record is to be dropped.
+ */
+char *proc_ring_reserve(struct proc_rings *rs, unsigned int len);
+
+/* hands the last reserved record, of "len" bytes, to the consumer */
+void proc_ring_commit(struct proc_rings *rs, unsigned int len,
+		unsigned int info);
+
+/*
+ * Consumer only: returns in "recs" up to "max" of the oldest records of
+ * ring "idx", without removing them, and their number (0 if none). The
+ * records stay valid until proc_ring_release() is called.
+ */
+int proc_ring_peek(struct proc_rings *rs, unsigned int idx,
+		struct proc_ring_rec **recs, int max);
+
+/* consumer only: frees the records returned by the last peek of "idx" */
+void proc_ring_release(struct proc_rings *rs, unsigned int idx);
+
+/* number of records dropped so far on full rings */
+unsigned long proc_rings_dropped(struct proc_rings *rs);
+
+#endif
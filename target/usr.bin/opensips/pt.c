@@ -33,6 +33,7 @@
 #include "dprint.h"
 #include "pt.h"
 #include "bin_interface.h"
+#include "xlog.h"
 
 
 /* array with children pids, 0= main proc,
@@ -69,6 +70,10 @@ int init_multi_proc_support(void)
 	/* timer processes */
 	proc_no += 2 /* timer keeper + timer trigger */;
 
+	/* asynchronous log writer */
+	if (xlog_async_buf_size)
+		proc_no++;
+
 	/* count the processes requested by modules */
 	proc_no += count_module_procs();
 
@@ -258,6 +258,7 @@ static int fix_actions(struct action* a)
 	pv_elem_t *model=NULL;
 	pv_elem_t *models[5];
 	xl_level_p xlp;
+	xl_fmt_p xlf;
 	event_id_t ev_id;
 
 	if (a==0){
@@ -754,14 +755,14 @@ static int fix_actions(struct action* a)
 						return E_CFG;
 					}
 
-					if(pv_parse_format(&s ,&model) || model==NULL)
+					if(xl_parse_format(&s, &xlf)<0)
 					{
 						LM_ERR("wrong format [%s] for value param!\n", s.s);
 						ret=E_BUG;
 						goto error;
 					}
 
-					t->elem[0].u.data = (void*)model;
+					t->elem[0].u.data = (void*)xlf;
 					t->elem[0].type = SCRIPTVAR_ELEM_ST;
 				}
 				else
@@ -812,14 +813,14 @@ static int fix_actions(struct action* a)
 
 					s.s = t->elem[1].u.data;
 					s.len = strlen(s.s);
-					if (pv_parse_format(&s, &model) || model == NULL)
+					if (xl_parse_format(&s, &xlf)<0)
 					{
 						LM_ERR("wrong format [%s] for value param\n",s.s);
 						ret=E_BUG;
 						goto error;
 					}
 
-					t->elem[1].u.data = model;
+					t->elem[1].u.data = xlf;
 					t->elem[1].type = SCRIPTVAR_ELEM_ST;
 				}
 				break;
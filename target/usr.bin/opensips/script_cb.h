@@ -99,5 +99,9 @@ int run_post_raw_processing_cb(int type, str* data, struct sip_msg* msg);
 
 int run_raw_processing_cb(int type,str *data, struct sip_msg* msg, struct raw_processing_cb_list* list);
 
+/* returns true if any post raw processing callback is registered - the
+ * outgoing message must be available as a single buffer for them */
+int has_post_raw_processing_cb(void);
+
 #endif
 
@@ -531,7 +531,7 @@ int register_stat2( char *module, char *name, stat_var **pvar,
 		lock_start_write((rw_lock_t *)collector->rwl);
 		shash = collector->dy_hstats;
 		/* double check for duplicates (due race conditions) */
-		for( it=shash[hash] ; it ; it=stat->hnext ) {
+		for( it=shash[hash] ; it ; it=it->hnext ) {
 			if ( (it->name.len==stat->name.len) &&
 			(strncasecmp( it->name.s, stat->name.s, stat->name.len)==0) ) {
 				/* duplicate found -> drop current stat and return the
@@ -0,0 +1,55 @@
+#!/usr/local/bin/bash
+# check the asynchronous xlog writer (xlog_async_buf_size)
+
+# Copyright (C) 2016 OpenSIPS Project
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+source include/require
+
+CFG=37.cfg
+LOOPS=1000
+
+if ! check_opensips; then
+	exit 0
+fi ;
+
+TMPFILE=`mktemp -t opensips-test.XXXXXXXXXX`
+
+../opensips -w . -f $CFG -E 2> $TMPFILE
+ret=$?
+
+sleep 1
+
+if [ "$ret" -eq 0 ] ; then
+	for ((i = 0; i < $LOOPS; i++)) ; do
+		cat invite.sip > /dev/udp/127.0.0.1/5060
+	done
+
+	# let the log writer drain the buffers
+	sleep 2
+
+	# some messages may be dropped if the buffer is full, but not all
+	grep "xlog async test" $TMPFILE > /dev/null
+	ret=$?
+fi ;
+
+killall -9 opensips
+
+rm -f $TMPFILE
+
+exit $ret
@@ -0,0 +1,68 @@
+#!/usr/local/bin/bash
+# benchmark the stateless forwarding of requests with typical proxy rewrites
+
+# Copyright (C) 2016 OpenSIPS Project
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# run it as "./39.sh -v" to get the benchmark results printed; for the
+# baseline figures (messages copied in a flat buffer instead of being sent
+# from iovecs), run it again with opensips built with -DNO_SEND_IOV (see
+# Makefile.conf)
+
+source include/require
+
+CFG=39.cfg
+LOOPS=10000
+
+if ! (check_opensips && check_module "benchmark" && check_module "maxfwd" \
+		&& check_module "rr" && check_module "sipmsgops" \
+		&& check_module "mi_fifo"); then
+	exit 0
+fi ;
+
+../opensips -w . -f $CFG > /dev/null
+ret=$?
+
+sleep 1
+
+if [ "$ret" -eq 0 ] ; then
+	for ((i = 0; i < $LOOPS; i++)) ; do
+		cat invite.sip > /dev/udp/127.0.0.1/5060
+	done
+
+	sleep 1
+
+	TMPFILE=`mktemp -t opensips-test.XXXXXXXXXX`
+	../scripts/opensipsctl fifo bm_poll_results > $TMPFILE
+	ret=$?
+
+	if [ "$ret" -eq 0 ] ; then
+		grep "fwd_rewrites" $TMPFILE > /dev/null
+		ret=$?
+	fi ;
+
+	if [ "$1" = "-v" ] ; then
+		cat $TMPFILE
+	fi ;
+
+	rm -f $TMPFILE
+fi ;
+
+killall -9 opensips
+
+exit $ret
@@ -0,0 +1,69 @@
+#!/usr/local/bin/bash
+# benchmark the db_text equality lookups on a 100k rows table
+
+# Copyright (C) 2016 OpenSIPS Project
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# the db_text sources are built into a small harness (dbt_bench.c), so no
+# opensips binary is needed; run it as "./40.sh -v" to get the lookup times
+# printed, with the full table scan (auto_index off) and with the index
+
+ROWS=100000
+LOOKUPS=1000
+
+if ! ( which gcc > /dev/null ); then
+	echo "gcc not found, not run"
+	exit 0
+fi ;
+
+TMPDIR=`mktemp -d -t opensips-test.XXXXXXXXXX`
+DBT=../modules/db_text
+# the same OS define as Makefile.defs
+OS=`uname -s | sed -e s/SunOS/solaris/ | tr "[A-Z/]" "[a-z_]"`
+
+# the harness gets libc allocations instead of the opensips pkg/shm memory
+gcc -O2 -w -fcommon -I.. -D__OS_$OS -DUSE_PTHREAD_MUTEX \
+	-DNAME='"opensips"' -DMOD_NAME='"db_text"' \
+	-Dmem_h -Dshm_mem_h -include stdlib.h \
+	-Dpkg_malloc=malloc -Dpkg_realloc=realloc -Dpkg_free=free \
+	-Dshm_malloc=malloc -Dshm_realloc=realloc -Dshm_free=free \
+	-o $TMPDIR/dbt_bench dbt_bench.c $DBT/dbt_file.c $DBT/dbt_tb.c \
+	$DBT/dbt_idx.c $DBT/dbt_res.c
+ret=$?
+
+if [ "$ret" -eq 0 ] ; then
+	echo "username(string) password(string) id(int)" > $TMPDIR/subscriber
+	awk -v rows=$ROWS 'BEGIN { for (i = 0; i < rows; i++)
+		printf("user%d:pass%d:%d\n", i, i, i) }' >> $TMPDIR/subscriber
+
+	$TMPDIR/dbt_bench $TMPDIR subscriber $LOOKUPS scan > $TMPDIR/out
+	ret=$?
+fi ;
+
+if [ "$ret" -eq 0 ] ; then
+	$TMPDIR/dbt_bench $TMPDIR subscriber $LOOKUPS >> $TMPDIR/out
+	ret=$?
+fi ;
+
+if [ "$1" = "-v" -a -f $TMPDIR/out ] ; then
+	cat $TMPDIR/out
+fi ;
+
+rm -rf $TMPDIR
+
+exit $ret
@@ -0,0 +1,82 @@
+#!/usr/local/bin/bash
+# benchmark the fraud detection with 500k users calling at 2k CPS
+
+# Copyright (C) 2016 OpenSIPS Project
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# each user places one call, so the run takes USERS/CPS seconds (about 4
+# minutes); run it as "./41.sh -v" to get the check_fraud() times, the
+# tracked entries and the shm memory usage printed
+
+source include/require
+
+CFG=41.cfg
+DBDIR=/tmp/opensips_frd_db
+USERS=500000
+CPS=2000
+
+if ! (check_sipp && check_opensips && check_module "db_text" \
+		&& check_module "sl" && check_module "tm" && check_module "dialog" \
+		&& check_module "drouting" && check_module "fraud_detection" \
+		&& check_module "benchmark" && check_module "mi_fifo"); then
+	exit 0
+fi ;
+
+# one rule matching all the calls, with thresholds never reached
+rm -rf $DBDIR
+cp -r ../scripts/dbtext/opensips $DBDIR
+echo "1:1:00:00\:00:23\:59:Mon-Sun:100000:200000:100000:200000:100000:200000:100000:200000:100000:200000" >> $DBDIR/fraud_detection
+
+CSV=`mktemp -t opensips-test.XXXXXXXXXX`
+awk -v users=$USERS 'BEGIN { print "SEQUENTIAL"; for (i = 0; i < users; i++)
+	printf("user%d;00%d\n", i, 4900000000 + i) }' > $CSV
+
+../opensips -w . -f $CFG > /dev/null
+ret=$?
+
+sleep 1
+
+if [ "$ret" -eq 0 ] ; then
+	sipp -sf 41.xml -inf $CSV -r $CPS -m $USERS -recv_timeout 5000 \
+		-i 127.0.0.1 -p 5061 127.0.0.1:5060 &> /dev/null
+	ret=$?
+
+	TMPFILE=`mktemp -t opensips-test.XXXXXXXXXX`
+	../scripts/opensipsctl fifo bm_poll_results > $TMPFILE
+	../scripts/opensipsctl fifo get_statistics fraud_detection: shmem: \
+		>> $TMPFILE
+
+	if [ "$ret" -eq 0 ] ; then
+		grep "frd_check" $TMPFILE > /dev/null
+		ret=$?
+	fi ;
+
+	if [ "$1" = "-v" ] ; then
+		cat $TMPFILE
+	fi ;
+
+	rm -f $TMPFILE
+fi ;
+
+killall -9 sipp > /dev/null 2>&1
+killall -9 opensips
+
+rm -f $CSV
+rm -rf $DBDIR
+
+exit $ret
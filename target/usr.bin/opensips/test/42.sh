@@ -0,0 +1,83 @@
+#!/usr/local/bin/bash
+# benchmark the topology hiding Contact encoding and decoding (no dialog)
+
+# Copyright (C) 2016 OpenSIPS Project
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# run it as "./42.sh -v" to get the benchmark results printed ("binary"
+# scheme); for the baseline figures ("xor" scheme), run it with "-b" as well
+
+source include/require
+
+CFG=42.cfg
+CALLS=10000
+CPS=500
+
+if ! (check_sipp && check_opensips && check_module "sl" && check_module "tm" \
+		&& check_module "uri" && check_module "topology_hiding" \
+		&& check_module "benchmark" && check_module "mi_fifo"); then
+	exit 0
+fi ;
+
+for arg in "$@" ; do
+	case $arg in
+		-v) VERBOSE=1 ;;
+		-b) BASELINE=1 ;;
+	esac
+done
+
+RUNCFG=`mktemp -t opensips-test.XXXXXXXXXX`
+if [ "$BASELINE" = "1" ] ; then
+	sed -e 's/"th_contact_encode_scheme", "binary"/"th_contact_encode_scheme", "xor"/' \
+		$CFG > $RUNCFG
+else
+	cp $CFG $RUNCFG
+fi ;
+
+../opensips -w . -f $RUNCFG > /dev/null
+ret=$?
+
+sleep 1
+
+if [ "$ret" -eq 0 ] ; then
+	sipp -sn uas -bg -i 127.0.0.1 -p 5070 &> /dev/null
+	sipp -sf 42.xml -s bench -r $CPS -m $CALLS -recv_timeout 5000 \
+		-i 127.0.0.1 -p 5061 127.0.0.1:5060 &> /dev/null
+	ret=$?
+
+	TMPFILE=`mktemp -t opensips-test.XXXXXXXXXX`
+	../scripts/opensipsctl fifo bm_poll_results > $TMPFILE
+
+	if [ "$ret" -eq 0 ] ; then
+		grep "th_decode" $TMPFILE > /dev/null
+		ret=$?
+	fi ;
+
+	if [ "$VERBOSE" = "1" ] ; then
+		cat $TMPFILE
+	fi ;
+
+	rm -f $TMPFILE
+fi ;
+
+killall -9 sipp > /dev/null 2>&1
+killall -9 opensips
+
+rm -f $RUNCFG
+
+exit $ret
@@ -0,0 +1,99 @@
+#!/usr/local/bin/bash
+# benchmark the mmgeoip lookups in a MaxMind DB (GeoIP2 City)
+
+# Copyright (C) 2016 OpenSIPS Project
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# the database is not shipped: point MMDB to a GeoIP2/GeoLite2 City file;
+# run it as "MMDB=/path/to/GeoLite2-City.mmdb ./43.sh -v" to get the results
+# printed (lookup cache on); for the baseline figures (lookup cache off),
+# run it with "-b" as well. The requests carry ADDRS distinct addresses,
+# so with the cache on most of the lookups are hits.
+
+source include/require
+
+CFG=43.cfg
+MMDB=${MMDB:-/usr/share/GeoIP/GeoLite2-City.mmdb}
+LOOPS=10000
+ADDRS=1000
+
+if ! (check_opensips && check_module "mmgeoip" && check_module "benchmark" \
+		&& check_module "mi_fifo"); then
+	exit 0
+fi ;
+
+if ! (test -e $MMDB) ; then
+	echo "$MMDB not found, not run"
+	exit 0
+fi ;
+
+for arg in "$@" ; do
+	case $arg in
+		-v) VERBOSE=1 ;;
+		-b) BASELINE=1 ;;
+	esac
+done
+
+RUNCFG=`mktemp -t opensips-test.XXXXXXXXXX`
+if [ "$BASELINE" = "1" ] ; then
+	CACHE=0
+else
+	CACHE=4096
+fi ;
+sed -e "s|\"mmgeoip_city_db_path\", \"[^\"]*\"|\"mmgeoip_city_db_path\", \"$MMDB\"|" \
+	-e "s|\"lookup_cache_size\", [0-9]*|\"lookup_cache_size\", $CACHE|" \
+	$CFG > $RUNCFG
+
+../opensips -w . -f $RUNCFG > /dev/null
+ret=$?
+
+sleep 1
+
+if [ "$ret" -eq 0 ] ; then
+	for ((i = 0; i < $LOOPS; i++)) ; do
+		# ADDRS distinct addresses, spread over the IPv4 unicast space
+		a=$(( (i % $ADDRS) * 7919 ))
+		ip="$(( 1 + a % 223 )).$(( a / 223 % 256 )).$(( a / 7 % 256 )).1"
+		printf "OPTIONS sip:bench@127.0.0.1 SIP/2.0\r\nVia: SIP/2.0/UDP 127.0.0.1:5061;branch=z9hG4bK-$i\r\nFrom: <sip:bench@127.0.0.1>;tag=$i\r\nTo: <sip:bench@127.0.0.1>\r\nCall-ID: mmg-$i\r\nCSeq: 1 OPTIONS\r\nX-Lookup-IP: $ip\r\nContent-Length: 0\r\n\r\n" \
+			> /dev/udp/127.0.0.1/5060
+	done
+
+	sleep 1
+
+	TMPFILE=`mktemp -t opensips-test.XXXXXXXXXX`
+	../scripts/opensipsctl fifo bm_poll_results > $TMPFILE
+	ret=$?
+	../scripts/opensipsctl fifo get_statistics mmgeoip: >> $TMPFILE
+
+	if [ "$ret" -eq 0 ] ; then
+		grep "mmg_lookup" $TMPFILE > /dev/null
+		ret=$?
+	fi ;
+
+	if [ "$VERBOSE" = "1" ] ; then
+		cat $TMPFILE
+	fi ;
+
+	rm -f $TMPFILE
+fi ;
+
+killall -9 opensips
+
+rm -f $RUNCFG
+
+exit $ret
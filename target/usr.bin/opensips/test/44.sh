@@ -0,0 +1,57 @@
+#!/usr/local/bin/bash
+# spread of the calls over the rtpproxy hashing ring
+
+# Copyright (C) 2016 OpenSIPS Project
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# the ring hashing of the rtpproxy module is built into a small harness
+# (rtpp_spread.c), so no opensips binary is needed; run it as "./44.sh -v"
+# to get the share of the busiest and of the idlest node printed
+
+CALLS=100000
+# the busiest node may get up to this much of the average share
+MAX=1.3
+
+if ! ( which gcc > /dev/null ); then
+	echo "gcc not found, not run"
+	exit 0
+fi ;
+
+TMPDIR=`mktemp -d -t opensips-test.XXXXXXXXXX`
+
+gcc -O2 -w -I.. -o $TMPDIR/rtpp_spread rtpp_spread.c
+ret=$?
+
+# the suggested 64 points per node, for a small and a larger set
+if [ "$ret" -eq 0 ] ; then
+	$TMPDIR/rtpp_spread 4 64 $CALLS $MAX > $TMPDIR/out
+	ret=$?
+fi ;
+
+if [ "$ret" -eq 0 ] ; then
+	$TMPDIR/rtpp_spread 16 64 $CALLS $MAX >> $TMPDIR/out
+	ret=$?
+fi ;
+
+if [ "$1" = "-v" -a -f $TMPDIR/out ] ; then
+	cat $TMPDIR/out
+fi ;
+
+rm -rf $TMPDIR
+
+exit $ret
@@ -0,0 +1,132 @@
+/*
+ * db_text lookup latency harness, built and run by 40.sh
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Loads a table with the db_text sources linked in (no core needed) and
+ * times the equality lookups of "user0" ... "user<N-1>" on its first
+ * column, the way the module runs them for a query.
+ *
+ * usage: dbt_bench <db dir> <table> <lookups> [scan]
+ * With "scan", auto_index is off and each lookup walks the whole table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dprint.h"
+#include "../modules/db_text/dbt_lib.h"
+
+/* what the db_text sources need from dbtext.c and from the core */
+int db_mode = 0;
+int auto_index = 1;
+int journal = 0;
+int journal_compact = 10;
+
+static int dbg_level = L_ERR;
+int *debug = &dbg_level;
+int log_stderr = 1;
+int log_facility = 0;
+char *log_prefix = "";
+char ctime_buf[256];
+int process_no = 0;
+
+int dp_my_pid(void)
+{
+	return 0;
+}
+
+void dprint(char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+int dbt_is_neq_type(db_type_t _t0, db_type_t _t1)
+{
+	return _t0 != _t1;
+}
+
+
+int main(int argc, char **argv)
+{
+	str db, tb;
+	dbt_table_p t;
+	dbt_row_p *rows;
+	db_val_t v;
+	struct timespec start, end;
+	char name[32];
+	int i, n, lookups, misses, lkey[1] = {0};
+	double secs;
+
+	if (argc < 4) {
+		fprintf(stderr, "usage: %s <db dir> <table> <lookups> [scan]\n",
+			argv[0]);
+		return 2;
+	}
+
+	db.s = argv[1];
+	db.len = strlen(argv[1]);
+	tb.s = argv[2];
+	tb.len = strlen(argv[2]);
+	lookups = atoi(argv[3]);
+	if (argc > 4 && strcmp(argv[4], "scan")==0)
+		auto_index = 0;
+
+	t = dbt_load_file(&tb, &db);
+	if (t==NULL) {
+		fprintf(stderr, "failed to load table %s from %s\n", argv[2], argv[1]);
+		return 1;
+	}
+
+	v.type = DB_STR;
+	v.nul = 0;
+	misses = 0;
+
+	/* the index, if any, is built by the first lookup - timed as well */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i=0; i<lookups; i++) {
+		v.val.str_val.s = name;
+		v.val.str_val.len = sprintf(name, "user%d", i);
+		n = dbt_table_match(t, lkey, NULL, &v, 1, &rows);
+		if (n != 1)
+			misses++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+	printf("%s: %d rows, %d lookups in %.3f s (%.1f us/lookup)\n",
+		auto_index ? "index" : "scan", t->nrrows, lookups, secs,
+		secs*1e6/lookups);
+
+	if (misses) {
+		fprintf(stderr, "%d lookups did not find exactly one row\n", misses);
+		return 1;
+	}
+
+	return 0;
+}
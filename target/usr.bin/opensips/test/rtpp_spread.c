@@ -0,0 +1,166 @@
+/*
+ * rtpproxy hashing ring spread harness, built and run by 44.sh
+ *
+ * Copyright (C) 2016 OpenSIPS Project
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Builds the ring of <nodes> RTPProxies (udp:10.0.0.<i>:22222, weight 1)
+ * with <vnodes> points each, the way the module does, and places <calls>
+ * Call-IDs on it. Prints the share of the busiest and of the idlest node
+ * (1.00 being the average) and fails if the busiest one gets more than
+ * <max> times the average. Then the first node is taken out and no call
+ * of the other nodes may move.
+ *
+ * usage: rtpp_spread <nodes> <vnodes> <calls> <max>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../modules/rtpproxy/rtpp_ring.h"
+
+/* all the ring needs to know of a node */
+struct rtpp_node {
+	unsigned int idx;
+	int disabled;
+};
+
+static int point_cmp(const void *a, const void *b)
+{
+	const struct rtpp_ring_point *p1 = a, *p2 = b;
+
+	if (p1->hash != p2->hash)
+		return p1->hash < p2->hash ? -1 : 1;
+	return (int)p1->node->idx - (int)p2->node->idx;
+}
+
+static unsigned int build_ring(struct rtpp_ring_point *points,
+		struct rtpp_node *nodes, int n, int vnodes)
+{
+	char url[32], idx[16];
+	str s_url, s_idx;
+	unsigned int npoints;
+	int i, j;
+
+	npoints = 0;
+	for (i = 0; i < n; i++) {
+		if (nodes[i].disabled)
+			continue;
+		s_url.s = url;
+		s_url.len = sprintf(url, "udp:10.0.0.%d:22222", i + 1);
+		for (j = 0; j < vnodes; j++) {
+			s_idx.s = idx;
+			s_idx.len = sprintf(idx, "%d", j);
+			points[npoints].hash = rtpp_ring_hash(&s_url, &s_idx);
+			points[npoints].node = &nodes[i];
+			npoints++;
+		}
+	}
+	qsort(points, npoints, sizeof(*points), point_cmp);
+	return npoints;
+}
+
+static struct rtpp_node *place(struct rtpp_ring_point *points,
+		unsigned int npoints, int call)
+{
+	char buf[64];
+	str callid;
+
+	/* alike the Call-IDs of the usual user agents */
+	callid.s = buf;
+	callid.len = sprintf(buf, "%08x-%04x@192.168.1.%d",
+		(unsigned int)call * 2654435761u, call & 0xffff, call % 250 + 1);
+	return points[rtpp_ring_find(points, npoints,
+		rtpp_ring_hash(&callid, NULL)) % npoints].node;
+}
+
+
+int main(int argc, char **argv)
+{
+	struct rtpp_ring_point *points;
+	struct rtpp_node *nodes, **placed;
+	unsigned int npoints, *count, most, least;
+	int n, vnodes, calls, i, moved;
+	double max, avg;
+
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s <nodes> <vnodes> <calls> <max>\n",
+			argv[0]);
+		return 2;
+	}
+
+	n = atoi(argv[1]);
+	vnodes = atoi(argv[2]);
+	calls = atoi(argv[3]);
+	max = atof(argv[4]);
+	if (n < 2 || vnodes < 1 || calls < 1) {
+		fprintf(stderr, "at least 2 nodes, 1 vnode and 1 call needed\n");
+		return 2;
+	}
+
+	nodes = calloc(n, sizeof(*nodes));
+	points = malloc(n * vnodes * sizeof(*points));
+	placed = malloc(calls * sizeof(*placed));
+	count = calloc(n, sizeof(*count));
+	if (!nodes || !points || !placed || !count) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+		nodes[i].idx = i;
+
+	npoints = build_ring(points, nodes, n, vnodes);
+	for (i = 0; i < calls; i++) {
+		placed[i] = place(points, npoints, i);
+		count[placed[i]->idx]++;
+	}
+
+	most = 0;
+	least = calls;
+	for (i = 0; i < n; i++) {
+		if (count[i] > most)
+			most = count[i];
+		if (count[i] < least)
+			least = count[i];
+	}
+	avg = (double)calls / n;
+	printf("%d nodes, %d vnodes, %d calls: busiest %.2f, idlest %.2f\n",
+		n, vnodes, calls, most / avg, least / avg);
+
+	/* only the calls of the node taken out may move */
+	nodes[0].disabled = 1;
+	npoints = build_ring(points, nodes, n, vnodes);
+	for (i = 0, moved = 0; i < calls; i++)
+		if (placed[i] != &nodes[0] && place(points, npoints, i) != placed[i])
+			moved++;
+	printf("node 1 out: %d calls of the other nodes moved\n", moved);
+
+	if (most / avg > max) {
+		fprintf(stderr, "busiest node above %.2f of the average\n", max);
+		return 1;
+	}
+	if (moved) {
+		fprintf(stderr, "calls moved between the remaining nodes\n");
+		return 1;
+	}
+
+	return 0;
+}
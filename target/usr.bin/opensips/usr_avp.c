@@ -41,6 +41,7 @@
 #include "locking.h"
 
 #include "map.h"
+#include "hash_func.h"
 
 
 static gen_lock_t *extra_lock;
@@ -57,6 +58,31 @@ static int *last_avp_index_shm = 0;
 #define p2int(_p) (int)(unsigned long)(_p)
 #define int2p(_i) (void *)(unsigned long)(_i)
 
+/* index of the global AVP list, by AVP id: for each id, the first AVP
+ * with that id in the list. The global list is private to the process,
+ * so the index is kept up to date by all the functions changing the list
+ * and it is dropped (and lazily rebuilt) whenever the list may have been
+ * changed from outside (get_avp_list(), set_avp_list()). The lists of the
+ * other contexts (transactions, dialogs) may be shared between processes
+ * and they are always searched linearly */
+static struct usr_avp **gavp_idx = 0;
+static int gavp_idx_size = 0;
+static int gavp_idx_valid = 0;
+
+#define gavp_idx_active() (crt_avps==&global_avps)
+
+/* per process cache of the AVP names resolved at runtime - the name to
+ * id mapping never changes, so the entries never get stale */
+#define AVP_NAME_CACHE_SIZE   256     /* power of 2 */
+#define AVP_NAME_CACHE_MAXLEN 32
+
+static struct avp_name_cache {
+	unsigned int hash;
+	int id;
+	int len;
+	char name[AVP_NAME_CACHE_MAXLEN];
+} avp_name_cache[AVP_NAME_CACHE_SIZE];
+
 int init_global_avps(void)
 {
 	/* initialize map for static avps */
@@ -96,6 +122,87 @@ int init_extra_avps(void)
 }
 
 
+static int gavp_idx_grow(int id)
+{
+	struct usr_avp **idx;
+	int size;
+
+	for (size = gavp_idx_size ? gavp_idx_size : 64; size <= id; size <<= 1);
+
+	idx = pkg_realloc(gavp_idx, size * sizeof(struct usr_avp*));
+	if (idx==NULL) {
+		LM_ERR("no more pkg mem\n");
+		return -1;
+	}
+	memset(idx + gavp_idx_size, 0,
+		(size - gavp_idx_size) * sizeof(struct usr_avp*));
+	gavp_idx = idx;
+	gavp_idx_size = size;
+	return 0;
+}
+
+
+static int gavp_idx_build(void)
+{
+	struct usr_avp *avp;
+
+	if (gavp_idx_size)
+		memset(gavp_idx, 0, gavp_idx_size * sizeof(struct usr_avp*));
+
+	for (avp = global_avps; avp; avp = avp->next) {
+		if (avp->id >= gavp_idx_size && gavp_idx_grow(avp->id)<0)
+			return -1;
+		if (gavp_idx[avp->id]==0)
+			gavp_idx[avp->id] = avp;
+	}
+
+	gavp_idx_valid = 1;
+	return 0;
+}
+
+
+/* the new AVP was linked in front of all the AVPs with the same id */
+static inline void gavp_idx_add_first(struct usr_avp *avp)
+{
+	if (!gavp_idx_active() || !gavp_idx_valid)
+		return;
+	if (avp->id >= gavp_idx_size && gavp_idx_grow(avp->id)<0) {
+		gavp_idx_valid = 0;
+		return;
+	}
+	gavp_idx[avp->id] = avp;
+}
+
+
+/* the new AVP was linked after all the AVPs with the same id */
+static inline void gavp_idx_add_last(struct usr_avp *avp)
+{
+	if (!gavp_idx_active() || !gavp_idx_valid)
+		return;
+	if (avp->id >= gavp_idx_size && gavp_idx_grow(avp->id)<0) {
+		gavp_idx_valid = 0;
+		return;
+	}
+	if (gavp_idx[avp->id]==0)
+		gavp_idx[avp->id] = avp;
+}
+
+
+inline static struct usr_avp *internal_search_ID_avp( struct usr_avp *avp,
+								int id, unsigned short flags);
+
+/* "old" is to be removed from the list, replaced by "new" or, if NULL,
+ * by the next AVP with the same id */
+static inline void gavp_idx_del(struct usr_avp *old, struct usr_avp *new)
+{
+	if (!gavp_idx_active() || !gavp_idx_valid)
+		return;
+	if (gavp_idx[old->id]==old)
+		gavp_idx[old->id] = new ? new :
+			internal_search_ID_avp(old->next, old->id, 0);
+}
+
+
 struct usr_avp* new_avp(unsigned short flags, int id, int_str val)
 {
 	struct usr_avp *avp;
@@ -151,6 +258,7 @@ int add_avp(unsigned short flags, int name, int_str val)
 
 	avp->next = *crt_avps;
 	*crt_avps = avp;
+	gavp_idx_add_first(avp);
 	return 0;
 }
 
@@ -176,6 +284,7 @@ int add_avp_last(unsigned short flags, int name, int_str val)
 		avp->next = NULL;
 		last_avp = avp;
 	}
+	gavp_idx_add_last(avp);
 	return 0;
 }
 
@@ -222,6 +331,7 @@ int replace_avp(unsigned short flags, int name, int_str val, int index)
 			else
 				*crt_avps = avp_new;
 			avp_new->next = avp_del->next;
+			gavp_idx_del(avp_del, avp_new);
 			shm_free(avp_del);
 			return 0;
 		}
@@ -301,6 +411,9 @@ inline void get_avp_val(struct usr_avp *avp, int_str *val)
 struct usr_avp** get_avp_list(void)
 {
 	assert( crt_avps!=0 );
+	/* the list may be changed by the caller */
+	if (gavp_idx_active())
+		gavp_idx_valid = 0;
 	return crt_avps;
 }
 
@@ -344,6 +457,12 @@ struct usr_avp *search_first_avp( unsigned short flags,
 		if (*crt_avps==0)
 			return 0;
 		head = *crt_avps;
+
+		/* jump straight to the first AVP with this id */
+		if (gavp_idx_active() && (gavp_idx_valid || gavp_idx_build()==0)) {
+			if (id >= gavp_idx_size || (head=gavp_idx[id])==0)
+				return 0;
+		}
 	} else {
 		if(start->next==0)
 			return 0;
@@ -391,6 +510,7 @@ void destroy_avp( struct usr_avp *avp_del)
 				avp_prev->next=avp->next;
 			else
 				*crt_avps = avp->next;
+			gavp_idx_del(avp, NULL);
 			shm_free(avp);
 			return;
 		}
@@ -437,6 +557,8 @@ void destroy_avp_list_unsafe( struct usr_avp **list )
 		shm_free_unsafe( foo );
 	}
 	*list = 0;
+	if (list==&global_avps)
+		gavp_idx_valid = 0;
 }
 
 
@@ -452,6 +574,8 @@ inline void destroy_avp_list( struct usr_avp **list )
 		shm_free( foo );
 	}
 	*list = 0;
+	if (list==&global_avps)
+		gavp_idx_valid = 0;
 }
 
 
@@ -474,6 +598,8 @@ struct usr_avp** set_avp_list( struct usr_avp **list )
 
 	foo = crt_avps;
 	crt_avps = list;
+	/* the caller gets access to the global list */
+	gavp_idx_valid = 0;
 	return foo;
 }
 
@@ -573,11 +699,28 @@ int parse_avp_spec( str *name, int *avp_name)
 
 int get_avp_id(str *name)
 {
+	struct avp_name_cache *c;
+	unsigned int h;
 	int id;
+
+	/* names resolved at runtime (dynamic AVP names) are cached */
+	h = core_hash(name, 0, 0);
+	c = &avp_name_cache[h & (AVP_NAME_CACHE_SIZE-1)];
+	if (c->len && c->hash==h && c->len==name->len &&
+	memcmp(c->name, name->s, name->len)==0)
+		return c->id;
+
 	if (parse_avp_spec(name, &id)) {
 		LM_ERR("unable to get id\n");
 		return -1;
 	}
+
+	if (name->len <= AVP_NAME_CACHE_MAXLEN) {
+		c->hash = h;
+		c->id = id;
+		c->len = name->len;
+		memcpy(c->name, name->s, name->len);
+	}
 	return id;
 }
 
@@ -27,11 +27,21 @@
 #include <fcntl.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/uio.h>
 
 #include "sr_module.h"
 #include "dprint.h"
 #include "error.h"
 #include "mem/mem.h"
+#include "mem/shm_mem.h"
+#include "locking.h"
+#include "pt.h"
+#include "globals.h"
+#include "proc_ring.h"
+#include "daemonize.h"
 #include "xlog.h"
 
 #include "pvar.h"
@@ -42,6 +52,30 @@ char *log_buf = NULL;
 int xlog_buf_size = 4096;
 int xlog_force_color = 0;
 
+/* size of the per process buffers of the asynchronous logging;
+ * 0 disables it */
+int xlog_async_buf_size = 0;
+
+
+/* asynchronous logging: each process renders its xlog messages into its
+ * own ring buffer (in shm) and the "log writer" process drains all the
+ * rings, in batches, to syslog or stderr. If its ring is full, a process
+ * drops the message instead of waiting. */
+
+/* max number of messages written at once to stderr */
+#define XL_WRITER_BATCH  64
+/* how long the log writer sleeps when there is nothing to write (us) */
+#define XL_WRITER_IDLE   10000
+
+static struct proc_rings *xl_rings = NULL;
+
+/* max length of a color escape sequence */
+#define COL_BUF 10
+
+/* set by SIGTERM/SIGINT in the log writer */
+static volatile int xl_writer_stop = 0;
+
+
 static int buf_init(void)
 {
 	LM_DBG("initializing...\n");
@@ -54,7 +88,140 @@ static int buf_init(void)
 	return 0;
 }
 
-int xl_print_log(struct sip_msg* msg, pv_elem_p list, int *len)
+
+/*
+ * Folds the color specifiers, whose value is fixed once the config is
+ * loaded, into the text around them and merges each literal run into a
+ * single text, printed in front of the next specifier left. A format with
+ * no other specifiers ends up as a single text.
+ */
+static int xl_fold_format(xl_fmt_p f)
+{
+	pv_elem_p it, next, kept, spare;
+	pv_elem_p *last;
+	pv_value_t val;
+	char *buf, *p, *start;
+	int n;
+
+	n = 0;
+	for (it=f->elems; it; it=it->next) {
+		n += it->text.len;
+		if (it->spec.type==PVT_COLOR)
+			n += COL_BUF;
+	}
+	buf = p = start = (char*)pkg_malloc(n + 1);
+	if (buf==NULL) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+
+	kept = spare = NULL;
+	last = &kept;
+	for (it=f->elems; it; it=next) {
+		next = it->next;
+
+		memcpy(p, it->text.s, it->text.len);
+		p += it->text.len;
+
+		if (it->spec.type==PVT_COLOR) {
+			if (it->spec.getf(NULL, &it->spec.pvp, &val)<0) {
+				LM_ERR("failed to get the color\n");
+				goto error;
+			}
+			memcpy(p, val.rs.s, val.rs.len);
+			p += val.rs.len;
+		} else if (it->spec.type!=PVT_NONE) {
+			/* a real specifier - it gets the text so far */
+			it->text.s = start;
+			it->text.len = p - start;
+			it->next = NULL;
+			*last = it;
+			last = &it->next;
+			start = p;
+			continue;
+		}
+
+		if (spare)
+			pkg_free(spare);
+		spare = it;
+	}
+
+	/* the text after the last specifier, if any; it always comes from a
+	 * dropped element, whose place it takes */
+	if (spare) {
+		if (p!=start || kept==NULL) {
+			memset(spare, 0, sizeof *spare);
+			spare->text.s = start;
+			spare->text.len = p - start;
+			*last = spare;
+		} else {
+			pkg_free(spare);
+		}
+	}
+	f->elems = kept;
+
+	return 0;
+error:
+	f->elems = kept;
+	*last = it;
+	if (spare)
+		pkg_free(spare);
+	pkg_free(buf);
+	return -1;
+}
+
+
+int xl_parse_format(str *s, xl_fmt_p *fmt)
+{
+	xl_fmt_p f;
+
+	f = (xl_fmt_p)pkg_malloc(sizeof(xl_fmt_t));
+	if (f==NULL) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+	memset(f, 0, sizeof(xl_fmt_t));
+
+	if (pv_parse_format(s, &f->elems)<0 || f->elems==NULL) {
+		pkg_free(f);
+		return -1;
+	}
+
+	if (xl_fold_format(f)<0) {
+		pv_elem_free_all(f->elems);
+		pkg_free(f);
+		return -1;
+	}
+
+	/* pure text formats are printed with no further processing */
+	if (f->elems->next==NULL && f->elems->spec.type==PVT_NONE)
+		f->text = f->elems->text;
+
+	*fmt = f;
+	return 0;
+}
+
+
+static inline int xl_print(struct sip_msg* msg, xl_fmt_p fmt, char *buf,
+																int *len)
+{
+	if (fmt->text.s) {
+		if (fmt->text.len >= *len) {
+			LM_ERR("buffer overflow -- increase the buffer size "
+				"from [%d]...\n", *len);
+			return -1;
+		}
+		memcpy(buf, fmt->text.s, fmt->text.len);
+		buf[fmt->text.len] = 0;
+		*len = fmt->text.len;
+		return 0;
+	}
+
+	return pv_printf(msg, fmt->elems, buf, len);
+}
+
+
+int xl_print_log(struct sip_msg* msg, xl_fmt_p fmt, int *len)
 {
 	if (log_buf == NULL)
 		if (buf_init())
@@ -62,13 +229,208 @@ int xl_print_log(struct sip_msg* msg, pv_elem_p list, int *len)
 			LM_ERR("Cannot print message\n");
 			return -1;
 		}
-	return pv_printf(msg, list, log_buf, len);
+	return xl_print(msg, fmt, log_buf, len);
 }
 
 
-int xlog_2(struct sip_msg* msg, char* lev, char* frm)
+int init_xlog_async(void)
+{
+	if (xlog_async_buf_size==0)
+		return 0;
+
+	xl_rings = proc_rings_alloc(xlog_async_buf_size, xlog_buf_size + 1);
+	if (xl_rings==NULL) {
+		LM_ERR("failed to allocate the xlog buffers\n");
+		return -1;
+	}
+
+	if (xl_rings->size != xlog_async_buf_size) {
+		xlog_async_buf_size = xl_rings->size;
+		LM_NOTICE("xlog_async_buf_size set to %d\n", xlog_async_buf_size);
+	}
+
+	return 0;
+}
+
+
+/* renders the message in the ring of the current process
+ * returns 0 if done, 1 if the ring is full, -1 on error */
+static int xl_ring_print(struct sip_msg* msg, int level, xl_fmt_p fmt)
+{
+	char *buf;
+	int len;
+
+	buf = proc_ring_reserve(xl_rings, xlog_buf_size + 1);
+	if (buf==NULL)
+		return 1;
+
+	len = xlog_buf_size;
+	if (xl_print(msg, fmt, buf, &len)<0)
+		return -1;
+
+	proc_ring_commit(xl_rings, len, level);
+	return 0;
+}
+
+
+static inline int xl_syslog_level(int level)
+{
+	switch (level) {
+		case L_ALERT:  return LOG_ALERT;
+		case L_CRIT:   return LOG_CRIT;
+		case L_ERR:    return LOG_ERR;
+		case L_WARN:   return LOG_WARNING;
+		case L_NOTICE: return LOG_NOTICE;
+		case L_INFO:   return LOG_INFO;
+		default:       return LOG_DEBUG;
+	}
+}
+
+
+/* syslog() stamps the lines with the pid of the caller, the log writer;
+ * use a "name[pid]" ident instead, with the pid of the process that logged
+ * the message. A 0 pid restores the ident of the log writer itself. */
+static void xl_syslog_ident(int pid)
+{
+	static char ident[64];
+	static int ident_pid = 0;
+	char *name;
+
+	if (pid == ident_pid)
+		return;
+
+	name = log_name ? log_name : my_argv[0];
+	if (pid) {
+		snprintf(ident, sizeof(ident), "%s[%d]", name, pid);
+		openlog(ident, LOG_CONS, log_facility);
+	} else {
+		openlog(name, LOG_PID|LOG_CONS, log_facility);
+	}
+	ident_pid = pid;
+}
+
+
+/* writes out all the messages of a ring; returns how many there were */
+static int xl_ring_flush(unsigned int idx)
+{
+	struct proc_ring_rec *recs[XL_WRITER_BATCH];
+	struct iovec iov[XL_WRITER_BATCH];
+	int i, n, cnt;
+
+	cnt = 0;
+	while ( (n=proc_ring_peek(xl_rings, idx, recs, XL_WRITER_BATCH))>0 ) {
+		if (log_stderr) {
+			for (i=0; i<n; i++) {
+				iov[i].iov_base = proc_ring_data(recs[i]);
+				iov[i].iov_len = recs[i]->len;
+			}
+			if (writev(STDERR_FILENO, iov, n) < 0)
+				LM_ERR("failed to write to stderr: %s\n", strerror(errno));
+		} else {
+			for (i=0; i<n; i++) {
+				xl_syslog_ident(recs[i]->pid);
+				syslog(xl_syslog_level(recs[i]->info)|log_facility, "%.*s",
+					recs[i]->len, proc_ring_data(recs[i]));
+			}
+			xl_syslog_ident(0);
+		}
+
+		/* let the process reuse the space as soon as possible */
+		proc_ring_release(xl_rings, idx);
+		cnt += n;
+	}
+
+	return cnt;
+}
+
+
+static void xl_writer_sig(int signo)
+{
+	xl_writer_stop = 1;
+}
+
+
+static void xl_writer_loop(void)
+{
+	unsigned long dropped, reported = 0;
+	unsigned int i;
+	int cnt;
+
+	while (!xl_writer_stop) {
+		cnt = 0;
+		for (i=0; i<xl_rings->no; i++)
+			cnt += xl_ring_flush(i);
+
+		dropped = proc_rings_dropped(xl_rings);
+
+		if (dropped != reported) {
+			LM_WARN("%lu xlog messages dropped so far (buffers full), "
+				"consider increasing xlog_async_buf_size\n", dropped);
+			reported = dropped;
+		}
+
+		if (cnt==0 && !xl_writer_stop)
+			usleep(XL_WRITER_IDLE);
+	}
+
+	/* shutting down - write out whatever the other processes logged
+	 * since the last pass, so the last messages are not lost */
+	for (i=0; i<xl_rings->no; i++)
+		xl_ring_flush(i);
+}
+
+
+int start_xlog_writer(void)
+{
+	pid_t pid;
+
+	if (xl_rings==NULL)
+		return 0;
+
+	if ( (pid=internal_fork("log writer"))<0 ) {
+		LM_CRIT("cannot fork log writer process\n");
+		return -1;
+	} else if (pid==0) {
+		/* new process */
+		clean_write_pipeend();
+
+		if (signal(SIGTERM, xl_writer_sig)==SIG_ERR ||
+		signal(SIGINT, xl_writer_sig)==SIG_ERR) {
+			LM_ERR("cannot install the log writer signal handlers\n");
+			exit(-1);
+		}
+
+		xl_writer_loop();
+		exit(0);
+	}
+
+	return 0;
+}
+
+
+static inline int xl_log(struct sip_msg* msg, int level, xl_fmt_p fmt)
 {
 	int log_len;
+
+	if (proc_ring_on(xl_rings)) {
+		/* on a full ring, the message is dropped */
+		return xl_ring_print(msg, level, fmt)<0 ? -1 : 1;
+	}
+
+	log_len = xlog_buf_size;
+
+	if(xl_print_log(msg, fmt, &log_len)<0)
+		return -1;
+
+	/* log_buf[log_len] = '\0'; */
+	LM_GEN1(level, "%.*s", log_len, log_buf);
+
+	return 1;
+}
+
+
+int xlog_2(struct sip_msg* msg, char* lev, char* frm)
+{
 	long level;
 	xl_level_p xlp;
 	pv_value_t value;
@@ -90,54 +452,26 @@ int xlog_2(struct sip_msg* msg, char* lev, char* frm)
 	if(!is_printable((int)level))
 		return 1;
 
-	log_len = xlog_buf_size;
-
-	if(xl_print_log(msg, (pv_elem_t*)frm, &log_len)<0)
-		return -1;
-
-	/* log_buf[log_len] = '\0'; */
-	LM_GEN1((int)level, "%.*s", log_len, log_buf);
-
-	return 1;
+	return xl_log(msg, (int)level, (xl_fmt_p)frm);
 }
 
 
 int xlog_1(struct sip_msg* msg, char* frm, char* str2)
 {
-	int log_len;
-
 	if(!is_printable(L_ERR))
 		return 1;
 
-	log_len = xlog_buf_size;
-
-	if(xl_print_log(msg, (pv_elem_t*)frm, &log_len)<0)
-		return -1;
-
-	/* log_buf[log_len] = '\0'; */
-	LM_GEN1(L_ERR, "%.*s", log_len, log_buf);
-
-	return 1;
+	return xl_log(msg, L_ERR, (xl_fmt_p)frm);
 }
 
 /**
  */
 int xdbg(struct sip_msg* msg, char* frm, char* str2)
 {
-	int log_len;
-
 	if(!is_printable(L_DBG))
 		return 1;
 
-	log_len = xlog_buf_size;
-
-	if(xl_print_log(msg, (pv_elem_t*)frm, &log_len)<0)
-		return -1;
-
-	/* log_buf[log_len] = '\0'; */
-	LM_GEN1(L_DBG, "%.*s", log_len, log_buf);
-
-	return 1;
+	return xl_log(msg, L_DBG, (xl_fmt_p)frm);
 }
 
 int pv_parse_color_name(pv_spec_p sp, str *in)
@@ -193,8 +527,6 @@ error:
 	return -1;
 }
 
-#define COL_BUF 10
-
 #define append_sstring(p, end, s) \
         do{\
                 if ((p)+(sizeof(s)-1)<=(end)){\
@@ -32,8 +32,25 @@ typedef struct _xl_level
 	} v;
 } xl_level_t, *xl_level_p;
 
+/* xlog format, compiled at startup */
+typedef struct _xl_fmt
+{
+	/* the specifiers left after folding the literal runs and the colors,
+	 * each with all the text in front of it */
+	pv_elem_p elems;
+	/* the whole text, if the format has no variables other than colors -
+	 * it is copied as it is, without evaluating anything */
+	str text;
+} xl_fmt_t, *xl_fmt_p;
+
 extern int xlog_buf_size;
 extern int xlog_force_color;
+extern int xlog_async_buf_size;
+
+int xl_parse_format(str *s, xl_fmt_p *fmt);
+
+int init_xlog_async(void);
+int start_xlog_writer(void);
 
 int xlog_1(struct sip_msg*, char*, char*);
 int xlog_2(struct sip_msg*, char*, char*);